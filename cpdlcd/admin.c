@@ -0,0 +1,303 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Local administrative interface. We listen on a UNIX domain socket and
+ * accept one command line per connection, reply with plain text and
+ * close the connection, so any of the usual tools can talk to us, e.g.:
+ *
+ *	echo "top -n 10 -s bytes_out" | nc -U /var/run/cpdlcd.sock
+ *
+ * The interface is served by its own thread, so command handlers must
+ * do their own locking. Access control is left to the filesystem
+ * permissions of the socket.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <acfutils/assert.h>
+#include <acfutils/helpers.h>
+#include <acfutils/log.h>
+#include <acfutils/safe_alloc.h>
+#include <acfutils/thread.h>
+
+#include "admin.h"
+
+#define	MAX_CMDS	16
+#define	MAX_CMD_LEN	1024
+#define	POLL_TIMEOUT	500	/* ms */
+#define	READ_TIMEOUT	2000	/* ms */
+#define	WRITE_TIMEOUT	2000	/* ms */
+#define	SUN_PATH_LEN	sizeof (((struct sockaddr_un *)0)->sun_path)
+
+/* Don't let a client which hung up kill us with SIGPIPE */
+#ifdef	MSG_NOSIGNAL
+#define	SEND_FLAGS	MSG_NOSIGNAL
+#else
+#define	SEND_FLAGS	0
+#endif
+
+typedef struct {
+	const char	*name;
+	const char	*help;
+	admin_cmd_cb_t	cb;
+} admin_cmd_t;
+
+static admin_cmd_t	cmds[MAX_CMDS];
+static unsigned		num_cmds = 0;
+
+static bool		inited = false;
+/* Set by admin_fini, accessed with __atomic builtins */
+static bool		shutdown_req = false;
+static int		listen_fd = -1;
+static char		sock_path[SUN_PATH_LEN];
+static thread_t		worker;
+
+static void
+help_cmd(char **argv, size_t argc, char **out, size_t *out_cap)
+{
+	UNUSED(argv);
+	UNUSED(argc);
+	for (unsigned i = 0; i < num_cmds; i++) {
+		append_format(out, out_cap, "%-10s %s\n", cmds[i].name,
+		    cmds[i].help);
+	}
+}
+
+/*
+ * Registers a new admin command. Must be called before admin_init.
+ */
+void
+admin_register(const char *name, const char *help, admin_cmd_cb_t cb)
+{
+	ASSERT(!inited);
+	ASSERT(name != NULL);
+	ASSERT(help != NULL);
+	ASSERT(cb != NULL);
+	VERIFY3U(num_cmds, <, MAX_CMDS);
+
+	cmds[num_cmds].name = name;
+	cmds[num_cmds].help = help;
+	cmds[num_cmds].cb = cb;
+	num_cmds++;
+}
+
+/*
+ * Reads a single command line from the admin connection. Returns false
+ * if the client didn't send a complete line in time.
+ */
+static bool
+read_cmd(int fd, char buf[MAX_CMD_LEN])
+{
+	size_t len = 0;
+
+	for (;;) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		ssize_t n;
+
+		if (poll(&pfd, 1, READ_TIMEOUT) <= 0)
+			return (false);
+		n = read(fd, &buf[len], MAX_CMD_LEN - len - 1);
+		if (n < 0 && (errno == EINTR || errno == EAGAIN ||
+		    errno == EWOULDBLOCK))
+			continue;
+		if (n <= 0) {
+			/* Accept a final line without a newline on EOF */
+			buf[len] = '\0';
+			return (n == 0 && len != 0);
+		}
+		len += n;
+		buf[len] = '\0';
+		if (strchr(buf, '\n') != NULL) {
+			*strchr(buf, '\n') = '\0';
+			return (true);
+		}
+		if (len + 1 >= MAX_CMD_LEN)
+			return (false);
+	}
+}
+
+/*
+ * Sends the reply to the admin connection. The socket is non-blocking,
+ * so a client which stops reading only holds up the admin thread until
+ * WRITE_TIMEOUT expires, after which the rest of the reply is dropped.
+ */
+static void
+write_all(int fd, const char *buf, size_t len)
+{
+	while (len != 0) {
+		struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+		ssize_t n;
+
+		if (poll(&pfd, 1, WRITE_TIMEOUT) <= 0)
+			return;
+		n = send(fd, buf, len, SEND_FLAGS);
+		if (n < 0 && (errno == EINTR || errno == EAGAIN ||
+		    errno == EWOULDBLOCK))
+			continue;
+		if (n <= 0)
+			return;
+		buf += n;
+		len -= n;
+	}
+}
+
+static void
+handle_conn(int fd)
+{
+	char buf[MAX_CMD_LEN];
+	char *out = NULL;
+	size_t out_cap = 0;
+	char **argv;
+	size_t argc;
+	bool found = false;
+
+	if (!read_cmd(fd, buf))
+		return;
+	/* Tolerate CRLF line endings */
+	if (strchr(buf, '\r') != NULL)
+		*strchr(buf, '\r') = '\0';
+	argv = strsplit(buf, " ", true, &argc);
+	if (argc == 0) {
+		free_strlist(argv, argc);
+		return;
+	}
+	for (unsigned i = 0; i < num_cmds; i++) {
+		if (strcmp(argv[0], cmds[i].name) == 0) {
+			cmds[i].cb(argv, argc, &out, &out_cap);
+			found = true;
+			break;
+		}
+	}
+	if (!found) {
+		append_format(&out, &out_cap, "unknown command \"%s\", "
+		    "try \"help\"\n", argv[0]);
+	}
+	if (out != NULL)
+		write_all(fd, out, strlen(out));
+	free(out);
+	free_strlist(argv, argc);
+}
+
+static void
+admin_worker(void *userinfo)
+{
+	UNUSED(userinfo);
+	thread_set_name("admin_worker");
+
+	while (!__atomic_load_n(&shutdown_req, __ATOMIC_ACQUIRE)) {
+		struct pollfd pfd = { .fd = listen_fd, .events = POLLIN };
+		int fd, flags;
+
+		if (poll(&pfd, 1, POLL_TIMEOUT) <= 0)
+			continue;
+		fd = accept(listen_fd, NULL, NULL);
+		if (fd == -1)
+			continue;
+		/* All I/O on the connection is bounded by poll timeouts */
+		if ((flags = fcntl(fd, F_GETFL)) >= 0 &&
+		    fcntl(fd, F_SETFL, flags | O_NONBLOCK) >= 0)
+			handle_conn(fd);
+		close(fd);
+	}
+}
+
+/*
+ * Starts the admin interface on a UNIX domain socket at `path'. Any
+ * stale socket left at the path by a previous instance is removed, but
+ * we refuse to remove anything else, so a mistyped config option can't
+ * make us delete an unrelated file.
+ */
+bool
+admin_init(const char *path)
+{
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	struct stat st;
+
+	ASSERT(!inited);
+	ASSERT(path != NULL);
+
+	if (strlen(path) >= sizeof (sa.sun_path)) {
+		logMsg("Admin socket path %s is too long", path);
+		return (false);
+	}
+	lacf_strlcpy(sa.sun_path, path, sizeof (sa.sun_path));
+	lacf_strlcpy(sock_path, path, sizeof (sock_path));
+	if (lstat(path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			logMsg("Can't create admin socket %s: path exists "
+			    "and isn't a socket", path);
+			return (false);
+		}
+		(void) unlink(path);
+	} else if (errno != ENOENT) {
+		logMsg("Can't create admin socket %s: %s", path,
+		    strerror(errno));
+		return (false);
+	}
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd == -1 ||
+	    bind(listen_fd, (struct sockaddr *)&sa, sizeof (sa)) < 0 ||
+	    listen(listen_fd, 8) < 0) {
+		logMsg("Can't create admin socket %s: %s", path,
+		    strerror(errno));
+		if (listen_fd != -1)
+			close(listen_fd);
+		listen_fd = -1;
+		return (false);
+	}
+	admin_register("help", "list available commands", help_cmd);
+	inited = true;
+	__atomic_store_n(&shutdown_req, false, __ATOMIC_RELEASE);
+	VERIFY(thread_create(&worker, admin_worker, NULL));
+
+	return (true);
+}
+
+void
+admin_fini(void)
+{
+	if (inited) {
+		__atomic_store_n(&shutdown_req, true, __ATOMIC_RELEASE);
+		thread_join(&worker);
+		close(listen_fd);
+		listen_fd = -1;
+		(void) unlink(sock_path);
+		inited = false;
+	}
+	num_cmds = 0;
+}
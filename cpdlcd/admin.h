@@ -0,0 +1,52 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef	_CPDLCD_ADMIN_H_
+#define	_CPDLCD_ADMIN_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Admin command handler. `argv' holds the whitespace-separated words of
+ * the command line, argv[0] being the command name. The response text
+ * is appended to `*out' using append_format.
+ */
+typedef void (*admin_cmd_cb_t)(char **argv, size_t argc, char **out,
+    size_t *out_cap);
+
+void admin_register(const char *name, const char *help, admin_cmd_cb_t cb);
+bool admin_init(const char *sock_path);
+void admin_fini(void);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _CPDLCD_ADMIN_H_ */
@@ -37,6 +37,9 @@
 #include <acfutils/safe_alloc.h>
 #include <acfutils/thread.h>
 
+#include "../src/cpdlc_memtag.h"
+#include "../src/cpdlc_probe.h"
+
 #include "auth.h"
 
 #define	REALLOC_STEP	(16 << 10)	/* 16 KiB */
@@ -81,6 +84,8 @@ static avl_tree_t	sessions;
  * for all authentication session to shut down before returning.
  */
 static condvar_t	sess_shutdown_cv;
+/* Session structures and authenticator response buffers */
+static cpdlc_memtag_t	auth_tag = CPDLC_MEMTAG_INIT("auth");
 
 /*
  * cURL data download write callback (CURLOPT_WRITEFUNCTION).
@@ -119,7 +124,8 @@ dl_write(char *ptr, size_t size, size_t nmemb, void *userdata)
 	 */
 	if (dl_info->bufcap < dl_info->bufsz + bytes) {
 		dl_info->bufcap += REALLOC_STEP;
-		dl_info->buf = safe_realloc(dl_info->buf, dl_info->bufcap + 1);
+		dl_info->buf = safe_realloc_tag(&auth_tag, dl_info->buf,
+		    dl_info->bufcap + 1);
 	}
 	memcpy(&dl_info->buf[dl_info->bufsz], ptr, bytes);
 	dl_info->bufsz += bytes;
@@ -265,6 +271,8 @@ auth_worker(void *userinfo)
 				    "HTTP error %ld", auth_url, code);
 			}
 		}
+		CPDLC_PROBE3(cpdlcd, auth__done, sess->key, auth_result,
+		    auth_atc);
 		ASSERT(sess->done_cb != NULL);
 		sess->done_cb(auth_result, auth_atc, sess->userinfo);
 	}
@@ -275,14 +283,14 @@ auth_worker(void *userinfo)
 	/*
 	 * All of the remaining state is held by us and not visible globally.
 	 */
-	free(dl_info.buf);
+	safe_free_tag(dl_info.buf);
 	curl_easy_cleanup(curl);
 	curl_slist_free_all(hdrs);
 	/* This is kinda sensitive, so zero out before freeing */
 	memset(sess->postdata, 0, strlen(sess->postdata));
 	free(sess->postdata);
 	memset(sess, 0, sizeof (*sess));
-	free(sess);
+	safe_free_tag(sess);
 }
 
 /*
@@ -398,6 +406,9 @@ auth_sess_open(const cpdlc_msg_t *logon_msg, const void *sockaddr,
 	ASSERT(done_cb != NULL);
 
 	if (auth_url[0] == '\0') {
+		CPDLC_PROBE2(cpdlcd, auth__start, 0,
+		    cpdlc_msg_get_from(logon_msg));
+		CPDLC_PROBE3(cpdlcd, auth__done, 0, true, true);
 		done_cb(true, true, userinfo);
 		return (0);
 	}
@@ -405,7 +416,7 @@ auth_sess_open(const cpdlc_msg_t *logon_msg, const void *sockaddr,
 	curl = curl_easy_init();
 	VERIFY(curl != NULL);
 
-	sess = safe_calloc(1, sizeof (*sess));
+	sess = safe_calloc_tag(&auth_tag, 1, sizeof (*sess));
 	sess->done_cb = done_cb;
 	sess->userinfo = userinfo;
 
@@ -468,6 +479,7 @@ auth_sess_open(const cpdlc_msg_t *logon_msg, const void *sockaddr,
 
 	mutex_enter(&lock);
 	key = sess->key = next_sess_key++;
+	CPDLC_PROBE2(cpdlcd, auth__start, key, cpdlc_msg_get_from(logon_msg));
 	avl_add(&sessions, sess);
 	VERIFY(thread_create(&sess->thread, auth_worker, sess));
 	mutex_exit(&lock);
@@ -38,6 +38,8 @@
 #include <acfutils/safe_alloc.h>
 #include <acfutils/thread.h>
 
+#include "../src/cpdlc_memtag.h"
+
 #include "common.h"
 #include "blocklist.h"
 
@@ -53,6 +55,21 @@ static char	filename[PATH_MAX] = { 0 };
 static mutex_t	lock;
 static htbl_t	table;
 static bool	blocklist_entry = true;
+/*
+ * The table's memory is allocated by htbl, so we can only charge the
+ * entries' key payload to our tag, not the table's own overhead.
+ */
+static cpdlc_memtag_t	blocklist_tag = CPDLC_MEMTAG_INIT("blocklist");
+static size_t	num_charged = 0;
+
+static void
+blocklist_charge(size_t num_ents)
+{
+	cpdlc_memtag_adjust(&blocklist_tag,
+	    ((int64_t)num_ents - (int64_t)num_charged) * sizeof (block_addr_t),
+	    (int64_t)num_ents - (int64_t)num_charged);
+	num_charged = num_ents;
+}
 
 void
 blocklist_init(void)
@@ -66,6 +83,7 @@ blocklist_fini(void)
 {
 	htbl_empty(&table, NULL, NULL);
 	htbl_destroy(&table);
+	blocklist_charge(0);
 	mutex_destroy(&lock);
 }
 
@@ -104,6 +122,7 @@ blocklist_refresh_impl(void)
 	htbl_empty(&table, NULL, NULL);
 	htbl_destroy(&table);
 	htbl_create(&table, num_lines, sizeof (block_addr_t), 0);
+	blocklist_charge(0);
 
 	while (!feof(fp)) {
 		char buf[128];
@@ -172,6 +191,7 @@ blocklist_refresh_impl(void)
 		freeaddrinfo(ai_full);
 	}
 	fclose(fp);
+	blocklist_charge(htbl_count(&table));
 
 	mutex_exit(&lock);
 
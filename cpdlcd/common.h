@@ -31,6 +31,7 @@ extern "C" {
 #endif
 
 #define	CALLSIGN_LEN	16
+#define	SOCKADDR_STRLEN	64
 
 #ifdef	__cplusplus
 }
@@ -0,0 +1,341 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <acfutils/assert.h>
+#include <acfutils/helpers.h>
+#include <acfutils/safe_alloc.h>
+
+#include "../src/cpdlc_clock.h"
+
+#include "connstats.h"
+#include "report.h"
+
+#define	DFL_TOP_N	20
+
+typedef enum {
+	GROUP_CONN,
+	GROUP_CALLSIGN,
+	GROUP_ADDR
+} group_t;
+
+typedef enum {
+	SORT_BYTES_IN,
+	SORT_BYTES_OUT,
+	SORT_MSGS_IN,
+	SORT_MSGS_OUT,
+	SORT_QUEUED,
+	SORT_HWM,
+	SORT_WAIT,
+	SORT_ERRORS,
+	SORT_IDLE,
+	NUM_SORT_KEYS
+} sort_key_t;
+
+static const char *sort_key_names[NUM_SORT_KEYS] = {
+	"bytes_in", "bytes_out", "msgs_in", "msgs_out", "queued", "hwm",
+	"wait", "errors", "idle"
+};
+
+/*
+ * One line of the `top' report: either a single connection, or the sum
+ * of all connections sharing a callsign or remote address.
+ */
+typedef struct {
+	char		key[CALLSIGN_LEN + SOCKADDR_STRLEN + 2];
+	unsigned	num_conns;
+	uint64_t	bytes_in;
+	uint64_t	bytes_out;
+	uint64_t	msgs_in;
+	uint64_t	msgs_out;
+	uint64_t	queued;
+	uint64_t	hwm;
+	uint64_t	wait_us;
+	uint64_t	errors;
+	time_t		last_activity;
+} top_ent_t;
+
+typedef struct {
+	sort_key_t	sort_key;
+	time_t		now;
+} sort_ctx_t;
+
+void
+conn_stats_init(conn_stats_t *st)
+{
+	ASSERT(st != NULL);
+	memset(st, 0, sizeof (*st));
+	st->connected = st->last_activity = cpdlc_clock_time();
+}
+
+void
+conn_stats_rx(conn_stats_t *st, size_t bytes)
+{
+	ASSERT(st != NULL);
+	st->bytes_in += bytes;
+	st->last_activity = cpdlc_clock_time();
+}
+
+/*
+ * Accounts for a message having been appended to the connection's output
+ * buffer. `outbuf_sz' is the size of the output buffer afterwards.
+ */
+void
+conn_stats_tx_queued(conn_stats_t *st, size_t outbuf_sz)
+{
+	ASSERT(st != NULL);
+	st->msgs_out++;
+	st->outbuf_hwm = MAX(st->outbuf_hwm, outbuf_sz);
+	if (st->write_wait_start == 0)
+		st->write_wait_start = cpdlc_clock_us();
+}
+
+/*
+ * Accounts for `bytes' having been written out to the client, leaving
+ * `outbuf_sz' bytes still pending.
+ */
+void
+conn_stats_tx_sent(conn_stats_t *st, size_t bytes, size_t outbuf_sz)
+{
+	ASSERT(st != NULL);
+	st->bytes_out += bytes;
+	if (outbuf_sz == 0 && st->write_wait_start != 0) {
+		st->write_wait_us += cpdlc_clock_us() - st->write_wait_start;
+		st->write_wait_start = 0;
+	}
+}
+
+/*
+ * Strips the port number from a remote address string.
+ */
+static void
+addr_host(const char *addr, char host[SOCKADDR_STRLEN])
+{
+	const char *end;
+
+	lacf_strlcpy(host, addr, SOCKADDR_STRLEN);
+	if (addr[0] == '[')
+		end = strchr(addr, ']');
+	else
+		end = strrchr(addr, ':');
+	if (end != NULL) {
+		if (*end == ']')
+			end++;
+		host[end - addr] = '\0';
+	}
+}
+
+static void
+snap_key(const conn_stats_snap_t *snap, group_t group,
+    char key[CALLSIGN_LEN + SOCKADDR_STRLEN + 2])
+{
+	const char *callsign = (snap->callsign[0] != '\0' ?
+	    snap->callsign : "-");
+	char host[SOCKADDR_STRLEN];
+
+	switch (group) {
+	case GROUP_CONN:
+		snprintf(key, CALLSIGN_LEN + SOCKADDR_STRLEN + 2, "%s %s",
+		    callsign, snap->addr);
+		break;
+	case GROUP_CALLSIGN:
+		lacf_strlcpy(key, callsign, CALLSIGN_LEN + SOCKADDR_STRLEN + 2);
+		break;
+	case GROUP_ADDR:
+		addr_host(snap->addr, host);
+		lacf_strlcpy(key, host, CALLSIGN_LEN + SOCKADDR_STRLEN + 2);
+		break;
+	}
+}
+
+static int
+ent_key_compar(const void *a, const void *b)
+{
+	const top_ent_t *ea = a, *eb = b;
+	return (strcmp(ea->key, eb->key));
+}
+
+static uint64_t
+ent_sort_val(const void *ent_p, void *userinfo)
+{
+	const top_ent_t *ent = ent_p;
+	const sort_ctx_t *ctx = userinfo;
+
+	switch (ctx->sort_key) {
+	case SORT_BYTES_IN:
+		return (ent->bytes_in);
+	case SORT_BYTES_OUT:
+		return (ent->bytes_out);
+	case SORT_MSGS_IN:
+		return (ent->msgs_in);
+	case SORT_MSGS_OUT:
+		return (ent->msgs_out);
+	case SORT_QUEUED:
+		return (ent->queued);
+	case SORT_HWM:
+		return (ent->hwm);
+	case SORT_WAIT:
+		return (ent->wait_us);
+	case SORT_ERRORS:
+		return (ent->errors);
+	case SORT_IDLE:
+	default:
+		return (ctx->now - ent->last_activity);
+	}
+}
+
+static void
+ent_add(top_ent_t *ent, const conn_stats_snap_t *snap, uint64_t now_us)
+{
+	const conn_stats_t *st = &snap->stats;
+
+	ent->num_conns++;
+	ent->bytes_in += st->bytes_in;
+	ent->bytes_out += st->bytes_out;
+	ent->msgs_in += st->msgs_in;
+	ent->msgs_out += st->msgs_out;
+	ent->queued += snap->outbuf_sz;
+	ent->hwm = MAX(ent->hwm, st->outbuf_hwm);
+	ent->wait_us += st->write_wait_us;
+	/* Include the current wait, so stuck clients show up right away */
+	if (st->write_wait_start != 0 && now_us > st->write_wait_start)
+		ent->wait_us += now_us - st->write_wait_start;
+	ent->errors += st->errors;
+	ent->last_activity = MAX(ent->last_activity, st->last_activity);
+}
+
+static bool
+top_opt(const char *opt, const char *val, void *userinfo)
+{
+	group_t *group = userinfo;
+
+	if (strcmp(opt, "-g") != 0)
+		return (false);
+	if (strcmp(val, "conn") == 0)
+		*group = GROUP_CONN;
+	else if (strcmp(val, "callsign") == 0)
+		*group = GROUP_CALLSIGN;
+	else if (strcmp(val, "addr") == 0)
+		*group = GROUP_ADDR;
+	else
+		return (false);
+	return (true);
+}
+
+/*
+ * Implements the `top' admin command: sorts the connections (or groups
+ * of connections sharing a callsign or remote address) by the selected
+ * counter and prints the first N of them.
+ */
+void
+conn_stats_top(conn_stats_snap_t *snaps, size_t num_snaps, char **argv,
+    size_t argc, char **out, size_t *out_cap)
+{
+	unsigned top_n = DFL_TOP_N;
+	group_t group = GROUP_CONN;
+	int sort_key = SORT_BYTES_IN;
+	top_ent_t *ents;
+	size_t num_ents = 0;
+	uint64_t now_us = cpdlc_clock_us();
+	sort_ctx_t ctx;
+	const report_args_t args = {
+	    .cmd = "top",
+	    .opts_usage = "[-g conn|callsign|addr]",
+	    .sort_key_names = sort_key_names,
+	    .num_sort_keys = NUM_SORT_KEYS,
+	    .opt_cb = top_opt,
+	    .userinfo = &group
+	};
+
+	ASSERT(snaps != NULL || num_snaps == 0);
+
+	if (!report_parse_args(&args, argv, argc, &top_n, &sort_key, out,
+	    out_cap))
+		return;
+
+	/*
+	 * Build one entry per connection, then sort them by their group
+	 * key and merge runs of identical keys into a single entry.
+	 */
+	ents = safe_calloc(MAX(num_snaps, 1), sizeof (*ents));
+	for (size_t i = 0; i < num_snaps; i++) {
+		snap_key(&snaps[i], group, ents[i].key);
+		ent_add(&ents[i], &snaps[i], now_us);
+	}
+	qsort(ents, num_snaps, sizeof (*ents), ent_key_compar);
+	for (size_t i = 0; i < num_snaps; i++) {
+		top_ent_t *ent;
+
+		if (num_ents == 0 || group == GROUP_CONN ||
+		    strcmp(ents[num_ents - 1].key, ents[i].key) != 0) {
+			if (num_ents != i)
+				ents[num_ents] = ents[i];
+			num_ents++;
+			continue;
+		}
+		ent = &ents[num_ents - 1];
+		ent->num_conns += ents[i].num_conns;
+		ent->bytes_in += ents[i].bytes_in;
+		ent->bytes_out += ents[i].bytes_out;
+		ent->msgs_in += ents[i].msgs_in;
+		ent->msgs_out += ents[i].msgs_out;
+		ent->queued += ents[i].queued;
+		ent->hwm = MAX(ent->hwm, ents[i].hwm);
+		ent->wait_us += ents[i].wait_us;
+		ent->errors += ents[i].errors;
+		ent->last_activity = MAX(ent->last_activity,
+		    ents[i].last_activity);
+	}
+	/* Entries are in key order here, so ties are broken by the key */
+	ctx.sort_key = sort_key;
+	ctx.now = cpdlc_clock_time();
+	report_sort(ents, num_ents, sizeof (*ents), ent_sort_val, &ctx);
+
+	append_format(out, out_cap, "%-28s %5s %10s %10s %8s %8s %8s %8s "
+	    "%9s %6s %6s\n", group == GROUP_CONN ? "CALLSIGN ADDRESS" :
+	    group == GROUP_CALLSIGN ? "CALLSIGN" : "ADDRESS", "CONNS",
+	    "BYTES_IN", "BYTES_OUT", "MSGS_IN", "MSGS_OUT", "QUEUED", "HWM",
+	    "WAIT_MS", "ERRORS", "IDLE");
+	for (size_t i = 0; i < num_ents && i < top_n; i++) {
+		const top_ent_t *ent = &ents[i];
+
+		append_format(out, out_cap, "%-28s %5u %10llu %10llu %8llu "
+		    "%8llu %8llu %8llu %9llu %6llu %6lld\n", ent->key,
+		    ent->num_conns, (unsigned long long)ent->bytes_in,
+		    (unsigned long long)ent->bytes_out,
+		    (unsigned long long)ent->msgs_in,
+		    (unsigned long long)ent->msgs_out,
+		    (unsigned long long)ent->queued,
+		    (unsigned long long)ent->hwm,
+		    (unsigned long long)(ent->wait_us / 1000),
+		    (unsigned long long)ent->errors,
+		    (long long)(ctx.now - ent->last_activity));
+	}
+	free(ents);
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef	_CPDLCD_CONNSTATS_H_
+#define	_CPDLCD_CONNSTATS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "common.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Per-connection traffic accounting. Protected by the connection's lock.
+ */
+typedef struct {
+	time_t		connected;
+	/* last time we received data */
+	time_t		last_activity;
+	uint64_t	bytes_in;
+	uint64_t	bytes_out;
+	uint64_t	msgs_in;
+	uint64_t	msgs_out;
+	uint64_t	outbuf_hwm;	/* highest amount of queued output */
+	/* Total time output was pending, waiting for the client to drain */
+	uint64_t	write_wait_us;
+	/* cpdlc_clock_us() when output became pending, 0 if not waiting */
+	uint64_t	write_wait_start;
+	uint64_t	errors;
+} conn_stats_t;
+
+/*
+ * A copy of a connection's stats, plus what we need to identify it.
+ */
+typedef struct {
+	/* empty if not logged on */
+	char		callsign[CALLSIGN_LEN];
+	char		addr[SOCKADDR_STRLEN];
+	bool		is_atc;
+	bool		is_lws;
+	uint64_t	outbuf_sz;
+	conn_stats_t	stats;
+} conn_stats_snap_t;
+
+void conn_stats_init(conn_stats_t *st);
+void conn_stats_rx(conn_stats_t *st, size_t bytes);
+void conn_stats_tx_queued(conn_stats_t *st, size_t outbuf_sz);
+void conn_stats_tx_sent(conn_stats_t *st, size_t bytes, size_t outbuf_sz);
+
+void conn_stats_top(conn_stats_snap_t *snaps, size_t num_snaps,
+    char **argv, size_t argc, char **out, size_t *out_cap);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _CPDLCD_CONNSTATS_H_ */
@@ -28,6 +28,7 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <poll.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -38,6 +39,10 @@
 #include <time.h>
 #include <unistd.h>
 
+#ifdef	__GLIBC__
+#include <malloc.h>
+#endif
+
 #include <netdb.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -60,38 +65,33 @@
 #include <acfutils/safe_alloc.h>
 #include <acfutils/thread.h>
 
+#include "../src/cpdlc_clock.h"
+#include "../src/cpdlc_memtag.h"
 #include "../src/cpdlc_msg.h"
+#include "../src/cpdlc_probe.h"
 #include "../src/cpdlc_string.h"
 
+#include "admin.h"
 #include "auth.h"
 #include "blocklist.h"
 #include "common.h"
+#include "connstats.h"
+#include "framing.h"
 #include "msgquota.h"
+#include "msgstats.h"
+#include "timeouts.h"
 
 #define	CONN_BACKLOG		UINT16_MAX
 #define	READ_BUF_SZ		4096	/* bytes */
 /*
- * Buffer size limits for logged on and non-logged-on connections. If a
- * message is not completed within this amount of bytes, the associated
- * connection is terminated with an error.
+ * Limit on output waiting to be sent to a client. A client which stops
+ * reading would otherwise make us buffer everything sent to it for as
+ * long as it stays connected. Once the limit is hit, the connection
+ * refuses all further output and is closed from the main loop. Routed
+ * messages it refused are stored for later delivery instead.
  */
-#define	MAX_BUF_SZ		8192	/* bytes */
-#define	MAX_BUF_SZ_NO_LOGON	128	/* bytes */
+#define	MAX_OUTBUF_SZ		(256 << 10)	/* bytes */
 #define	POLL_TIMEOUT		500	/* ms */
-/*
- * This value is tuned to be greater + a sufficient margin above the longest
- * possible message validity timeout (LONG_TIMEOUT in cpdlc_infos.c). This is
- * ATM 300 seconds (for low-priority instructions), so a 600 second timeout is
- * enough margin to definitely get those through within the validity period.
- */
-#define	QUEUED_MSG_TIMEOUT	600	/* seconds */
-/*
- * If no logon is completed within this time period from the connection
- * having been established, the connection is terminated.
- */
-#define	LOGON_GRACE_TIME	30	/* seconds */
-
-#define	SOCKADDR_STRLEN		64
 
 #define	AF2ADDRLEN(sa_family) \
 	((sa_family) == AF_INET ? sizeof (struct sockaddr_in) : \
@@ -175,6 +175,8 @@ typedef struct {
 	/* Data about to be sent to the client over the TLS/WS connection */
 	uint8_t			*outbuf;
 	size_t			outbuf_sz;
+	bool			outbuf_overflow;
+	conn_stats_t		stats;
 
 	list_node_t		conns_node;
 } conn_t;
@@ -187,6 +189,8 @@ typedef struct {
 	char		to[CALLSIGN_LEN];
 	bool		is_atc;
 	time_t		created;	/* when the msg entered the queue */
+	uint64_t	rx_us;		/* when we received the msg */
+	unsigned	stats_key;	/* msgstats key of the msg */
 	char		*msg;		/* message contents */
 	list_node_t	queued_msgs_node;
 } queued_msg_t;
@@ -286,6 +290,18 @@ static list_t		queued_msgs;
 static uint64_t		queued_msg_bytes = 0;
 /* Maximum size that `queued_msgs' can grow to. */
 static uint64_t		queued_msg_max_bytes = 128 << 20;	/* 128 MiB */
+/* How long a message can remain queued before being dropped. */
+static time_t		queued_msg_timeout = QUEUED_MSG_TIMEOUT;
+
+/*
+ * Memory accounting tags (see cpdlc_memtag.h). LWS connection structures
+ * are allocated by libwebsockets, so we charge them to `conn_tag' by hand.
+ */
+static cpdlc_memtag_t	conn_tag = CPDLC_MEMTAG_INIT("conn");
+static cpdlc_memtag_t	conn_buf_tag = CPDLC_MEMTAG_INIT("conn_buf");
+static cpdlc_memtag_t	msgqueue_tag = CPDLC_MEMTAG_INIT("msgqueue");
+/* Set from the SIGUSR1 handler to request a memory usage dump */
+static volatile sig_atomic_t	memtag_dump_req = 0;
 /*
  * Global server config parameters. Can be overridden from config file.
  */
@@ -323,7 +339,7 @@ static void send_error_msg(conn_t *conn, const cpdlc_msg_t *orig_msg,
     const char *fmt, ...);
 static void send_svc_unavail_msg(conn_t *conn, unsigned orig_min);
 static void close_conn(conn_t *conn);
-static void conn_send_msg(conn_t *conn, const cpdlc_msg_t *msg);
+static bool conn_send_msg(conn_t *conn, const cpdlc_msg_t *msg);
 
 /*
  * Writes a single byte into the main thread wakeup pipe. This forces
@@ -404,6 +420,7 @@ init_structs(void)
 	list_create(&listen_lws, sizeof (listen_lws_t),
 	    offsetof(listen_lws_t, listen_lws_node));
 	blocklist_init();
+	msgstats_init();
 	VERIFY_MSG(pipe(poll_wakeup_pipe) != -1, "pipe() failed: %s",
 	    strerror(errno));
 	set_fd_nonblock(poll_wakeup_pipe[0]);
@@ -441,8 +458,8 @@ fini_structs(void)
 	mutex_destroy(&conns_lws_lock);
 
 	while ((msg = list_remove_head(&queued_msgs)) != NULL) {
-		free(msg->msg);
-		free(msg);
+		safe_free_tag(msg->msg);
+		safe_free_tag(msg);
 	}
 	list_destroy(&queued_msgs);
 	queued_msg_bytes = 0;
@@ -469,6 +486,7 @@ fini_structs(void)
 	list_destroy(&listen_lws);
 
 	blocklist_fini();
+	msgstats_fini();
 
 	close(poll_wakeup_pipe[0]);
 	close(poll_wakeup_pipe[1]);
@@ -723,6 +741,7 @@ parse_config(const char *conf_path)
 	void *cookie;
 	const char *auth_url = NULL, *auth_cainfo = NULL;
 	const char *auth_username = NULL, *auth_password = NULL;
+	const char *admin_sock = NULL;
 
 	if (conf == NULL) {
 		if (errline == -1)
@@ -770,6 +789,16 @@ parse_config(const char *conf_path)
 		msgquota_max = parse_bytes(value);
 	if (conf_get_str(conf, "msgqueue/max", &value))
 		queued_msg_max_bytes = parse_bytes(value);
+	if (conf_get_str(conf, "msgqueue/timeout", &value)) {
+		queued_msg_timeout = atoi(value);
+		if (queued_msg_timeout <= 0) {
+			logMsg("Invalid msgqueue/timeout value %s, must be "
+			    "a positive number of seconds", value);
+			goto errout;
+		}
+	}
+	if (conf_get_str(conf, "admin/socket", &value))
+		admin_sock = value;
 
 	/*
 	 * Must go after all TLS parameters have been parsed, because
@@ -791,6 +820,8 @@ parse_config(const char *conf_path)
 	    !add_listen_sock("loopback", true))) {
 		goto errout;
 	}
+	if (admin_sock != NULL && !admin_init(admin_sock))
+		goto errout;
 	auth_init(auth_url, auth_cainfo, auth_username, auth_password);
 	msgquota_init(msgquota_max);
 
@@ -865,13 +896,13 @@ static void
 handle_accepts(listen_sock_t *ls)
 {
 	for (;;) {
-		conn_t *conn = safe_calloc(1, sizeof (*conn));
+		conn_t *conn = safe_calloc_tag(&conn_tag, 1, sizeof (*conn));
 		socklen_t addr_len = sizeof (conn->sockaddr);
 
 		conn->fd = accept(ls->fd, (struct sockaddr *)&conn->sockaddr,
 		    &addr_len);
 		if (conn->fd == -1) {
-			free(conn);
+			safe_free_tag(conn);
 			if (errno == EAGAIN || errno == EWOULDBLOCK) {
 				/* No more pending connections, we're done. */
 				break;
@@ -892,7 +923,7 @@ handle_accepts(listen_sock_t *ls)
 			logMsg("Incoming connection blocked: "
 			    "address %s on blocklist.", conn->addr_str);
 			close(conn->fd);
-			free(conn);
+			safe_free_tag(conn);
 			continue;
 		}
 		/*
@@ -900,7 +931,7 @@ handle_accepts(listen_sock_t *ls)
 		 * connections (this would indicate a kernel bug, really).
 		 */
 		set_fd_nonblock(conn->fd);
-		conn->logoff_time = time(NULL);
+		conn->logoff_time = cpdlc_clock_time();
 		/*
 		 * Start the TLS handshake process.
 		 */
@@ -919,11 +950,15 @@ handle_accepts(listen_sock_t *ls)
 		mutex_init(&conn->lock);
 		list_create(&conn->from_list, sizeof (ident_list_t),
 		    offsetof(ident_list_t, node));
+		conn_stats_init(&conn->stats);
 
 		mutex_enter(&conns_tcp_lock);
 		list_insert_tail(&conns_tcp, conn);
 		conns_tcp_dirty = true;
 		mutex_exit(&conns_tcp_lock);
+
+		CPDLC_PROBE3(cpdlcd, conn__accept, conn, conn->fd,
+		    conn->addr_str);
 	}
 }
 
@@ -977,7 +1012,7 @@ conn_reset_logon(conn_t *conn)
 	 */
 	while ((idl = list_remove_head(&conn->from_list)) != NULL) {
 		conns_by_from_remove(conn, idl->ident);
-		free(idl);
+		safe_free_tag(idl);
 	}
 	conn->is_atc = false;
 	memset(conn->to, 0, sizeof (conn->to));
@@ -999,6 +1034,7 @@ close_conn(conn_t *conn)
 	ASSERT(conn != NULL);
 	ASSERT(CONNS_MUTEX_HELD(conn));
 
+	CPDLC_PROBE2(cpdlcd, conn__close, conn, conn->addr_str);
 	/*
 	 * Must be done before unlinking the connection from any list,
 	 * because we can be called in the background to complete a logon.
@@ -1014,10 +1050,12 @@ close_conn(conn_t *conn)
 
 	mutex_destroy(&conn->lock);
 	list_destroy(&conn->from_list);
-	free(conn->inbuf);
-	free(conn->outbuf);
+	safe_free_tag(conn->inbuf);
+	safe_free_tag(conn->outbuf);
 
-	if (!conn->is_lws) {
+	if (conn->is_lws) {
+		cpdlc_memtag_adjust(&conn_tag, -(int64_t)sizeof (*conn), -1);
+	} else {
 		if (conn->tls_handshake_complete)
 			gnutls_bye(conn->session, GNUTLS_SHUT_WR);
 		ASSERT(conn->fd != -1);
@@ -1025,7 +1063,7 @@ close_conn(conn_t *conn)
 		gnutls_deinit(conn->session);
 
 		memset(conn, 0, sizeof (*conn));
-		free(conn);
+		safe_free_tag(conn);
 	}
 }
 
@@ -1082,7 +1120,8 @@ complete_logon(conn_t *conn)
 		cpdlc_msg_seg_set_arg(msg, 0, 0, "LOGON REQUIRES TO= HEADER",
 		    NULL);
 	} else if (conn->logon_success) {
-		ident_list_t *idl = safe_calloc(1, sizeof (*idl));
+		ident_list_t *idl = safe_calloc_tag(&conn_tag, 1,
+		    sizeof (*idl));
 
 		conn->logon_status = LOGON_COMPLETE;
 
@@ -1106,6 +1145,8 @@ complete_logon(conn_t *conn)
 	memset(conn->logon_to, 0, sizeof (conn->logon_to));
 	memset(conn->logon_from, 0, sizeof (conn->logon_from));
 
+	CPDLC_PROBE3(cpdlcd, logon__done, conn,
+	    conn->logon_status == LOGON_COMPLETE, conn->is_atc);
 	conn_send_msg(conn, msg);
 	cpdlc_msg_free(msg);
 
@@ -1142,7 +1183,7 @@ conn_remove_ident(conn_t *conn, const char *ident)
 		if (strcmp(idl->ident, ident) == 0) {
 			conns_by_from_remove(conn, idl->ident);
 			list_remove(&conn->from_list, idl);
-			free(idl);
+			safe_free_tag(idl);
 			break;
 		}
 	}
@@ -1184,7 +1225,7 @@ process_logon_msg(conn_t *conn, const cpdlc_msg_t *msg)
 		conn_remove_ident(conn, cpdlc_msg_get_from(msg));
 	}
 	if (list_count(&conn->from_list) == 0) {
-		conn->logoff_time = time(NULL);
+		conn->logoff_time = cpdlc_clock_time();
 		conn->logon_status = LOGON_NONE;
 		conn->logon_success = false;
 		conn->is_atc = false;
@@ -1201,6 +1242,7 @@ process_logon_msg(conn_t *conn, const cpdlc_msg_t *msg)
 	    sizeof (conn->logon_from));
 	conn->logon_status = LOGON_STARTED;
 	conn->logon_min = cpdlc_msg_get_min(msg);
+	CPDLC_PROBE2(cpdlcd, logon__start, conn, conn->logon_from);
 
 	/* This is async */
 	conn->auth_key = auth_sess_open(msg, &conn->sockaddr, logon_done_cb,
@@ -1217,9 +1259,12 @@ process_logon_msg(conn_t *conn, const cpdlc_msg_t *msg)
 /*
  * Prepares a new buffer for transmission to a particular connection.
  * The buffer is queued on the connections `outbuf'. This is later
- * processed by the master output functions.
+ * processed by the master output functions. Returns false if the
+ * buffer was refused, because the connection's output has overflowed
+ * (see MAX_OUTBUF_SZ). Once that happens, the connection refuses all
+ * further output, so that the client never sees a gap in its stream.
  */
-static void
+static bool
 conn_send_buf(conn_t *conn, const char *buf, size_t buflen)
 {
 	ASSERT(conn != NULL);
@@ -1228,29 +1273,46 @@ conn_send_buf(conn_t *conn, const char *buf, size_t buflen)
 
 	mutex_enter(&conn->lock);
 
-	conn->outbuf = safe_realloc(conn->outbuf, conn->outbuf_pre_pad +
-	    conn->outbuf_sz + buflen + 1);
+	if (conn->outbuf_overflow ||
+	    conn->outbuf_sz + buflen > MAX_OUTBUF_SZ) {
+		if (!conn->outbuf_overflow) {
+			logMsg("Output buffer overflow on connection from %s: "
+			    "client isn't reading, closing connection",
+			    conn->addr_str);
+			conn->outbuf_overflow = true;
+			conn->stats.errors++;
+		}
+		mutex_exit(&conn->lock);
+		return (false);
+	}
+	conn->outbuf = safe_realloc_tag(&conn_buf_tag, conn->outbuf,
+	    conn->outbuf_pre_pad + conn->outbuf_sz + buflen + 1);
 	lacf_strlcpy((char *)&conn->outbuf[conn->outbuf_pre_pad +
 	    conn->outbuf_sz], buf, buflen + 1);
 	/* Exclude training NUL char */
 	conn->outbuf_sz += buflen;
+	conn_stats_tx_queued(&conn->stats, conn->outbuf_sz);
 	if (conn->is_lws) {
 		ASSERT(conn->wsi != NULL);
 		lws_callback_on_writable(conn->wsi);
 	}
 
 	mutex_exit(&conn->lock);
+
+	return (true);
 }
 
 /*
  * Takes a message, encodes it into a sendable format and schedules it for
  * sending to a client. The caller retains ownership of the `msg' object.
+ * Returns false if the connection refused the message (see conn_send_buf).
  */
-static void
+static bool
 conn_send_msg(conn_t *conn, const cpdlc_msg_t *msg)
 {
 	unsigned l;
 	char *buf;
+	bool sent;
 
 	ASSERT(conn != NULL);
 	ASSERT(msg != NULL);
@@ -1258,8 +1320,10 @@ conn_send_msg(conn_t *conn, const cpdlc_msg_t *msg)
 	l = cpdlc_msg_encode(msg, NULL, 0);
 	buf = safe_malloc(l + 1);
 	cpdlc_msg_encode(msg, buf, l + 1);
-	conn_send_buf(conn, buf, l);
+	sent = conn_send_buf(conn, buf, l);
 	free(buf);
+	if (!sent)
+		return (false);
 
 	/*
 	 * Check if the message being sent is a service termination.
@@ -1270,9 +1334,11 @@ conn_send_msg(conn_t *conn, const cpdlc_msg_t *msg)
 		if (!msg->segs[i].info->is_dl &&
 		    msg->segs[i].info->msg_type == CPDLC_UM161_END_SVC) {
 			conn_reset_logon(conn);
-			conn->logoff_time = time(NULL);
+			conn->logoff_time = cpdlc_clock_time();
 		}
 	}
+
+	return (true);
 }
 
 /*
@@ -1306,6 +1372,11 @@ send_error_msg(conn_t *conn, const cpdlc_msg_t *orig_msg, const char *fmt, ...)
 	va_start(ap, fmt);
 	vsnprintf(buf, l + 1, fmt, ap);
 	va_end(ap);
+	CPDLC_PROBE3(cpdlcd, msg__reject, conn, orig_msg, buf);
+
+	mutex_enter(&conn->lock);
+	conn->stats.errors++;
+	mutex_exit(&conn->lock);
 
 	if (orig_msg != NULL) {
 		msg = cpdlc_msg_alloc(CPDLC_PKT_CPDLC);
@@ -1340,6 +1411,10 @@ send_svc_unavail_msg(conn_t *conn, unsigned orig_min)
 {
 	cpdlc_msg_t *msg = cpdlc_msg_alloc(CPDLC_PKT_CPDLC);
 	ASSERT(conn != NULL);
+	CPDLC_PROBE3(cpdlcd, msg__reject, conn, NULL, "SERVICE UNAVAILABLE");
+	mutex_enter(&conn->lock);
+	conn->stats.errors++;
+	mutex_exit(&conn->lock);
 	cpdlc_msg_set_mrn(msg, orig_min);
 	cpdlc_msg_add_seg(msg, false, CPDLC_UM162_SVC_UNAVAIL, 0);
 	conn_send_msg(conn, msg);
@@ -1363,7 +1438,8 @@ send_svc_unavail_msg(conn_t *conn, unsigned orig_min)
  *	space, or if the sender's quota has been exhausted.
  */
 static bool
-store_msg(const cpdlc_msg_t *msg, const char *to, bool is_atc)
+store_msg(const cpdlc_msg_t *msg, const char *to, bool is_atc,
+    unsigned stats_key, uint64_t rx_us)
 {
 	uint64_t bytes = cpdlc_msg_encode(msg, NULL, 0);
 	queued_msg_t *qmsg;
@@ -1383,19 +1459,22 @@ store_msg(const cpdlc_msg_t *msg, const char *to, bool is_atc)
 	if (!is_atc && !msgquota_incr(cpdlc_msg_get_from(msg), bytes))
 		return (false);
 
-	qmsg = safe_calloc(1, sizeof (*qmsg));
-	buf = safe_malloc(bytes + 1);
+	qmsg = safe_calloc_tag(&msgqueue_tag, 1, sizeof (*qmsg));
+	buf = safe_malloc_tag(&msgqueue_tag, bytes + 1);
 
 	cpdlc_msg_encode(msg, buf, bytes + 1);
 
 	qmsg->msg = buf;
-	qmsg->created = time(NULL);
+	qmsg->created = cpdlc_clock_time();
+	qmsg->rx_us = rx_us;
+	qmsg->stats_key = stats_key;
 	qmsg->is_atc = is_atc;
 	lacf_strlcpy(qmsg->from, cpdlc_msg_get_from(msg), sizeof (qmsg->from));
 	lacf_strlcpy(qmsg->to, to, sizeof (qmsg->to));
 
 	list_insert_tail(&queued_msgs, qmsg);
 	queued_msg_bytes += bytes;
+	CPDLC_PROBE3(cpdlcd, msg__store, qmsg, qmsg->to, bytes);
 
 	return (true);
 }
@@ -1424,17 +1503,23 @@ msg_is_not_cda(const cpdlc_msg_t *msg)
  * @param msg The message to process. As any forwarding of the message
  *	is done in encoded form, the caller retains ownership of the
  *	message object.
+ * @param bytes Size of the message as received on the wire.
  */
 static void
-conn_process_msg(conn_t *conn, cpdlc_msg_t *msg)
+conn_process_msg(conn_t *conn, cpdlc_msg_t *msg, size_t bytes)
 {
 	char to[CALLSIGN_LEN] = { 0 };
 	const list_t *l;
+	uint64_t rx_us = cpdlc_clock_us();
+	unsigned stats_key;
+	bool delivered = false;
 
 	ASSERT(conn != NULL);
 	ASSERT(msg != NULL);
 	ASSERT(CONNS_MUTEX_HELD(conn));
 
+	CPDLC_PROBE2(cpdlcd, msg__recv, conn, msg);
+	stats_key = msgstats_rx(msg, bytes);
 	/*
 	 * If the user isn't logged on, don't allow anything other than
 	 * LOGON through.
@@ -1518,27 +1603,46 @@ conn_process_msg(conn_t *conn, cpdlc_msg_t *msg)
 	/*
 	 * If there is at least one connection matching the identity of
 	 * the intended recipient, forward the message without storing it.
-	 * Otherwise, we store it for later delivery as soon as the
+	 * Otherwise, or if all of the recipient's connections refused the
+	 * message (because they stopped reading and are about to be
+	 * closed), we store it for later delivery as soon as the
 	 * recipient becomes available, or until the message expires.
 	 */
 	mutex_enter(&conns_by_from_lock);
 	l = htbl_lookup_multi(&conns_by_from, to);
-	if (l != NULL && list_count(l) != 0) {
+	CPDLC_PROBE4(cpdlcd, msg__route, conn, msg, to,
+	    l != NULL ? list_count(l) : 0);
+	if (l != NULL) {
 		for (void *mv = list_head(l), *mv_next = NULL; mv != NULL;
 		    mv = mv_next) {
 			conn_t *tgt_conn = HTBL_VALUE_MULTI(mv);
 
 			mv_next = list_next(l, mv);
 			ASSERT(tgt_conn != NULL);
-			conn_send_msg(tgt_conn, msg);
+			if (conn_send_msg(tgt_conn, msg))
+				delivered = true;
 		}
+	}
+	if (delivered) {
+		msgstats_delivered(stats_key, rx_us);
+	} else if (store_msg(msg, to, conn->is_atc, stats_key, rx_us)) {
+		msgstats_queued(stats_key);
 	} else {
-		if (!store_msg(msg, to, conn->is_atc))
-			send_error_msg(conn, msg, "TOO MANY QUEUED MESSAGES");
+		msgstats_dropped(stats_key);
+		send_error_msg(conn, msg, "TOO MANY QUEUED MESSAGES");
 	}
 	mutex_exit(&conns_by_from_lock);
 }
 
+static void
+conn_process_input_cb(cpdlc_msg_t *msg, int bytes, void *userinfo)
+{
+	conn_t *conn = userinfo;
+
+	conn->stats.msgs_in++;
+	conn_process_msg(conn, msg, bytes);
+}
+
 /*
  * Drains a connection's `inbuf', attempts to construct messages from it
  * and processes them. Any input that isn't a full message yet, will be
@@ -1551,38 +1655,21 @@ conn_process_msg(conn_t *conn, cpdlc_msg_t *msg)
 static bool
 conn_process_input(conn_t *conn)
 {
-	int consumed_total = 0;
+	int consumed_total;
+	char error[128] = { 0 };
 
 	ASSERT(conn != NULL);
 	ASSERT(conn->inbuf_sz != 0);
 	ASSERT(CONNS_MUTEX_HELD(conn));
 	ASSERT(MUTEX_HELD(&conn->lock));
 
-	while (consumed_total < (int)conn->inbuf_sz) {
-		int consumed;
-		cpdlc_msg_t *msg;
-		char error[128] = { 0 };
-
-		if (!cpdlc_msg_decode(
-		    (const char *)&conn->inbuf[consumed_total], &msg,
-		    &consumed, error, sizeof (error))) {
-			logMsg("Error decoding message from client %s: %s",
-			    conn->addr_str, error);
-			return (false);
-		}
-		/* No more complete messages pending? */
-		if (msg == NULL)
-			break;
-		ASSERT(consumed != 0);
-		conn_process_msg(conn, msg);
-		/*
-		 * If the message was queued for later delivery, it will
-		 * have been encoded into a textual form. So we can get
-		 * rid of the in-memory representation now.
-		 */
-		cpdlc_msg_free(msg);
-		consumed_total += consumed;
-		ASSERT3S(consumed_total, <=, conn->inbuf_sz);
+	consumed_total = framing_drain((const char *)conn->inbuf,
+	    conn->inbuf_sz, conn_process_input_cb, conn, error,
+	    sizeof (error));
+	if (consumed_total < 0) {
+		logMsg("Error decoding message from client %s: %s",
+		    conn->addr_str, error);
+		return (false);
 	}
 	if (consumed_total != 0) {
 		/* Adjust `inbuf' to get rid of the consumed message data */
@@ -1590,7 +1677,8 @@ conn_process_input(conn_t *conn)
 		conn->inbuf_sz -= consumed_total;
 		memmove(conn->inbuf, &conn->inbuf[consumed_total],
 		    conn->inbuf_sz + 1);
-		conn->inbuf = realloc(conn->inbuf, conn->inbuf_sz);
+		conn->inbuf = safe_realloc_tag(&conn_buf_tag, conn->inbuf,
+		    conn->inbuf_sz + 1);
 	}
 
 	return (true);
@@ -1630,21 +1718,6 @@ tls_verify_peer(conn_t *conn)
 	return (true);
 }
 
-/*
- * Data input validator. All incoming connection data must be plaintext.
- */
-static bool
-sanitize_input(const uint8_t *buf, size_t len)
-{
-	for (size_t i = 0; i < len; i++) {
-		uint8_t c = buf[i];
-		/* Input sanitization, don't allow control chars */
-		if ((c < 32 || c > 127) && c != '\n' && c != '\r' && c != '\t')
-			return (false);
-	}
-	return (true);
-}
-
 /*
  * Drains a connection of any pending input bytes and stores them in the
  * `inbuf' cache. This function then calls conn_process_input to turn any
@@ -1683,6 +1756,7 @@ conn_read_input(conn_t *conn)
 				return (false);
 			/* TLS handshake succeeded */
 			conn->tls_handshake_complete = true;
+			CPDLC_PROBE1(cpdlcd, tls__handshake__done, conn);
 		}
 
 		bytes = gnutls_record_recv(conn->session, buf, sizeof (buf));
@@ -1694,6 +1768,9 @@ conn_read_input(conn_t *conn)
 				logMsg("Soft read error on connection from %s, "
 				    "can retry: %s", conn->addr_str,
 				    gnutls_strerror(bytes));
+				mutex_enter(&conn->lock);
+				conn->stats.errors++;
+				mutex_exit(&conn->lock);
 				continue;
 			}
 			logMsg("Fatal read error on connection from %s: %s",
@@ -1704,7 +1781,7 @@ conn_read_input(conn_t *conn)
 			/* Connection closed */
 			return (false);
 		}
-		if (!sanitize_input(buf, bytes)) {
+		if (!framing_sanitize(buf, bytes)) {
 			logMsg("Invalid input character on connection from "
 			    "%s: data MUST be plain text", conn->addr_str);
 			return (false);
@@ -1722,11 +1799,12 @@ conn_read_input(conn_t *conn)
 		 */
 		mutex_enter(&conn->lock);
 
-		conn->inbuf = safe_realloc(conn->inbuf,
+		conn->inbuf = safe_realloc_tag(&conn_buf_tag, conn->inbuf,
 		    conn->inbuf_sz + bytes + 1);
 		memcpy(&conn->inbuf[conn->inbuf_sz], buf, bytes);
 		conn->inbuf_sz += bytes;
 		conn->inbuf[conn->inbuf_sz] = '\0';
+		conn_stats_rx(&conn->stats, bytes);
 
 		if (!conn_process_input(conn)) {
 			mutex_exit(&conn->lock);
@@ -1772,6 +1850,7 @@ conn_write_output(conn_t *conn)
 			}
 			logMsg("Soft send error on connection from %s: %s",
 			    conn->addr_str, gnutls_strerror(bytes));
+			conn->stats.errors++;
 		}
 	} else if (bytes > 0) {
 		if ((ssize_t)conn->outbuf_sz > bytes) {
@@ -1779,13 +1858,15 @@ conn_write_output(conn_t *conn)
 			    &conn->outbuf[conn->outbuf_pre_pad + bytes],
 			    (conn->outbuf_sz - bytes) + 1);
 			conn->outbuf_sz -= bytes;
-			conn->outbuf = safe_realloc(conn->outbuf,
-			    conn->outbuf_pre_pad + conn->outbuf_sz + 1);
+			conn->outbuf = safe_realloc_tag(&conn_buf_tag,
+			    conn->outbuf, conn->outbuf_pre_pad +
+			    conn->outbuf_sz + 1);
 		} else {
-			free(conn->outbuf);
+			safe_free_tag(conn->outbuf);
 			conn->outbuf = NULL;
 			conn->outbuf_sz = 0;
 		}
+		conn_stats_tx_sent(&conn->stats, bytes, conn->outbuf_sz);
 	}
 
 	mutex_exit(&conn->lock);
@@ -1958,14 +2039,16 @@ dequeue_msg(queued_msg_t *qmsg)
 	uint64_t bytes;
 
 	ASSERT(qmsg != NULL);
+	CPDLC_PROBE3(cpdlcd, msg__dequeue, qmsg, qmsg->to,
+	    cpdlc_clock_time() - qmsg->created);
 	bytes = strlen(qmsg->msg);
 	ASSERT3U(queued_msg_bytes, >=, bytes);
 	queued_msg_bytes -= bytes;
 	if (!qmsg->is_atc)
 		msgquota_decr(qmsg->from, bytes);
 	list_remove(&queued_msgs, qmsg);
-	free(qmsg->msg);
-	free(qmsg);
+	safe_free_tag(qmsg->msg);
+	safe_free_tag(qmsg);
 	if (list_count(&queued_msgs) == 0)
 		ASSERT0(queued_msg_bytes);
 }
@@ -1978,11 +2061,12 @@ dequeue_msg(queued_msg_t *qmsg)
 static void
 handle_queued_msgs(void)
 {
-	time_t now = time(NULL);
+	time_t now = cpdlc_clock_time();
 
 	for (queued_msg_t *qmsg = list_head(&queued_msgs), *next_qmsg = NULL;
 	    qmsg != NULL; qmsg = next_qmsg) {
 		const list_t *l;
+		bool delivered = false;
 		/*
 		 * Messages might be removed from the list below, so we need
 		 * to grab the next message pointer ahead of time.
@@ -1991,24 +2075,32 @@ handle_queued_msgs(void)
 
 		mutex_enter(&conns_by_from_lock);
 		l = htbl_lookup_multi(&conns_by_from, qmsg->to);
-		if (l != NULL && list_count(l) != 0) {
+		if (l != NULL) {
 			/*
-			 * One or more connections with the identity of the
-			 * message's intended recipient have been found, so
-			 * deliver the message to them and remove it from
-			 * the queue.
+			 * Try to deliver the message to all connections with
+			 * the identity of its intended recipient. If any of
+			 * them took it, it can be removed from the queue.
+			 * Otherwise it stays queued, until the recipient
+			 * reconnects or the message expires.
 			 */
 			for (void *mv = list_head(l); mv != NULL;
 			    mv = list_next(l, mv)) {
 				conn_t *conn = HTBL_VALUE_MULTI(mv);
-				conn_send_buf(conn, qmsg->msg,
-				strlen(qmsg->msg));
+
+				if (conn_send_buf(conn, qmsg->msg,
+				    strlen(qmsg->msg)))
+					delivered = true;
 			}
+		}
+		if (delivered) {
+			msgstats_delivered(qmsg->stats_key, qmsg->rx_us);
 			dequeue_msg(qmsg);
-		} else if (now - qmsg->created > QUEUED_MSG_TIMEOUT) {
+		} else if (queued_msg_expired(qmsg->created,
+		    queued_msg_timeout, now)) {
 			/*
 			 * Message has timed out, remove it from the queue.
 			 */
+			msgstats_expired(qmsg->stats_key);
 			dequeue_msg(qmsg);
 		}
 		mutex_exit(&conns_by_from_lock);
@@ -2042,21 +2134,37 @@ close_blocked_conns(void)
 	mutex_exit(&conns_lws_lock);
 }
 
+/*
+ * Checks whether a connection's output buffer has overflowed. See
+ * MAX_OUTBUF_SZ.
+ */
+static bool
+conn_outbuf_overflowed(conn_t *conn)
+{
+	bool overflow;
+
+	mutex_enter(&conn->lock);
+	overflow = conn->outbuf_overflow;
+	mutex_exit(&conn->lock);
+
+	return (overflow);
+}
+
 /*
  * Runs through existing connections and close ones which haven't logged on
- * yet and have timed out.
+ * yet and have timed out, or which have stopped reading their output.
  */
 static void
 close_timedout_conns(void)
 {
-	time_t now = time(NULL);
+	time_t now = cpdlc_clock_time();
 
 	mutex_enter(&conns_tcp_lock);
 	for (conn_t *conn = list_head(&conns_tcp), *conn_next = NULL;
 	    conn != NULL; conn = conn_next) {
 		conn_next = list_next(&conns_tcp, conn);
-		if (!conn->logon_success &&
-		    now - conn->logoff_time > LOGON_GRACE_TIME) {
+		if (conn_logon_timedout(conn->logon_success,
+		    conn->logoff_time, now) || conn_outbuf_overflowed(conn)) {
 			close_conn(conn);
 		}
 	}
@@ -2067,8 +2175,8 @@ close_timedout_conns(void)
 	    conn != NULL; conn = conn_next) {
 		conn_next = list_next(&conns_lws, conn);
 		ASSERT(conn->wsi != NULL);
-		if (!conn->logon_success &&
-		    now - conn->logoff_time > LOGON_GRACE_TIME) {
+		if (conn_logon_timedout(conn->logon_success,
+		    conn->logoff_time, now) || conn_outbuf_overflowed(conn)) {
 			conn->kill_wsi = true;
 		}
 	}
@@ -2141,6 +2249,170 @@ tls_fini(void)
 	gnutls_global_deinit();
 }
 
+/*
+ * Appends copies of the traffic counters of all connections on `conns'
+ * to `*snaps'. Caller must hold the list's lock.
+ */
+static void
+snap_conns(list_t *conns, conn_stats_snap_t **snaps, size_t *num_snaps)
+{
+	*snaps = safe_realloc(*snaps, (*num_snaps + list_count(conns) + 1) *
+	    sizeof (**snaps));
+	for (conn_t *conn = list_head(conns); conn != NULL;
+	    conn = list_next(conns, conn)) {
+		conn_stats_snap_t *snap = &(*snaps)[(*num_snaps)++];
+		const ident_list_t *ident;
+
+		memset(snap, 0, sizeof (*snap));
+		mutex_enter(&conn->lock);
+		ident = list_head(&conn->from_list);
+		if (ident != NULL) {
+			lacf_strlcpy(snap->callsign, ident->ident,
+			    sizeof (snap->callsign));
+		}
+		lacf_strlcpy(snap->addr, conn->addr_str, sizeof (snap->addr));
+		snap->is_atc = conn->is_atc;
+		snap->is_lws = conn->is_lws;
+		snap->outbuf_sz = conn->outbuf_sz;
+		snap->stats = conn->stats;
+		mutex_exit(&conn->lock);
+	}
+}
+
+/*
+ * Admin `top' command. We only hold the connection list locks for as
+ * long as it takes to copy the counters, the sorting and formatting
+ * is done on the copy.
+ */
+static void
+admin_top_cmd(char **argv, size_t argc, char **out, size_t *out_cap)
+{
+	conn_stats_snap_t *snaps = NULL;
+	size_t num_snaps = 0;
+
+	mutex_enter(&conns_tcp_lock);
+	snap_conns(&conns_tcp, &snaps, &num_snaps);
+	mutex_exit(&conns_tcp_lock);
+
+	mutex_enter(&conns_lws_lock);
+	snap_conns(&conns_lws, &snaps, &num_snaps);
+	mutex_exit(&conns_lws_lock);
+
+	conn_stats_top(snaps, num_snaps, argv, argc, out, out_cap);
+	free(snaps);
+}
+
+static int
+memtag_compar(const void *a, const void *b)
+{
+	const cpdlc_memtag_stats_t *sa = a, *sb = b;
+
+	if (sa->live_bytes > sb->live_bytes)
+		return (-1);
+	if (sa->live_bytes < sb->live_bytes)
+		return (1);
+	return (strcmp(sa->name, sb->name));
+}
+
+/*
+ * Formats the live memory usage of all allocation tags, largest first.
+ */
+static void
+memtag_report(char **out, size_t *out_cap)
+{
+	size_t n = cpdlc_memtag_get_stats(NULL, 0);
+	cpdlc_memtag_stats_t *stats = safe_calloc(MAX(n, 1), sizeof (*stats));
+
+	n = MIN(cpdlc_memtag_get_stats(stats, n), n);
+	if (n == 0) {
+		append_format(out, out_cap, "memory accounting not available, "
+		    "rebuild with MEMTAG=1\n");
+		free(stats);
+		return;
+	}
+	qsort(stats, n, sizeof (*stats), memtag_compar);
+	append_format(out, out_cap, "%-12s %12s %10s %12s %12s\n", "TAG",
+	    "LIVE_BYTES", "LIVE_OBJS", "PEAK_BYTES", "TOTAL_ALLOCS");
+	for (size_t i = 0; i < n; i++) {
+		append_format(out, out_cap, "%-12s %12llu %10llu %12llu "
+		    "%12llu\n", stats[i].name,
+		    (unsigned long long)stats[i].live_bytes,
+		    (unsigned long long)stats[i].live_objs,
+		    (unsigned long long)stats[i].peak_bytes,
+		    (unsigned long long)stats[i].total_allocs);
+	}
+	free(stats);
+}
+
+static void
+admin_mem_cmd(char **argv, size_t argc, char **out, size_t *out_cap)
+{
+	UNUSED(argv);
+	UNUSED(argc);
+	memtag_report(out, out_cap);
+}
+
+/*
+ * Admin `heap' command. Reports the state of the C library's heap as
+ * "key value" lines. "fragmentation" is the fraction of the main heap
+ * arena which is free, but can't be returned to the OS. Watching this
+ * over time tells leaks (in_use grows) apart from fragmentation (in_use
+ * stays flat while the arena grows).
+ */
+static void
+admin_heap_cmd(char **argv, size_t argc, char **out, size_t *out_cap)
+{
+#if	defined(__GLIBC__) && \
+	(__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	struct mallinfo2 mi = mallinfo2();
+#elif	defined(__GLIBC__)
+	struct mallinfo mi = mallinfo();
+#endif
+
+	UNUSED(argv);
+	UNUSED(argc);
+#ifdef	__GLIBC__
+	append_format(out, out_cap, "arena_bytes %llu\n"
+	    "mmap_bytes %llu\n"
+	    "in_use_bytes %llu\n"
+	    "free_bytes %llu\n"
+	    "releasable_bytes %llu\n"
+	    "fragmentation %.4f\n",
+	    (unsigned long long)mi.arena, (unsigned long long)mi.hblkhd,
+	    (unsigned long long)mi.uordblks, (unsigned long long)mi.fordblks,
+	    (unsigned long long)mi.keepcost, mi.arena != 0 ?
+	    (double)(mi.fordblks - mi.keepcost) / mi.arena : 0.0);
+#else	/* !__GLIBC__ */
+	append_format(out, out_cap, "heap statistics not available on "
+	    "this platform\n");
+#endif	/* !__GLIBC__ */
+}
+
+/*
+ * Dumps the memory usage report to the log in response to SIGUSR1.
+ */
+static void
+memtag_dump(void)
+{
+	char *out = NULL;
+	size_t out_cap = 0, n_lines;
+	char **lines;
+
+	memtag_report(&out, &out_cap);
+	lines = strsplit(out, "\n", true, &n_lines);
+	for (size_t i = 0; i < n_lines; i++)
+		logMsg("%s", lines[i]);
+	free_strlist(lines, n_lines);
+	free(out);
+}
+
+static void
+sigusr1_handler(int sig)
+{
+	UNUSED(sig);
+	memtag_dump_req = 1;
+}
+
 static void
 log_dbg_string(const char *str)
 {
@@ -2189,6 +2461,16 @@ main(int argc, char *argv[])
 	}
 
 	init_structs();
+	admin_register("top", "Show the busiest connections. Usage: "
+	    "top [-n <count>] [-g conn|callsign|addr] [-s <sort_key>]",
+	    admin_top_cmd);
+	admin_register("mem", "Show live memory usage by subsystem",
+	    admin_mem_cmd);
+	admin_register("heap", "Show C library heap usage",
+	    admin_heap_cmd);
+	admin_register("msgs", "Show traffic by message type. Usage: "
+	    "msgs [-n <count>] [-t ul|dl|all] [-s <sort_key>] [-r]",
+	    msgstats_report);
 	if (background && !daemonize(true, true))
 		return (1);
 	if ((conf_path != NULL && !parse_config(conf_path)) ||
@@ -2198,8 +2480,13 @@ main(int argc, char *argv[])
 	if (!tls_init())
 		return (1);
 	(void) blocklist_refresh();
+	signal(SIGUSR1, sigusr1_handler);
 
 	while (!do_shutdown) {
+		if (memtag_dump_req) {
+			memtag_dump_req = 0;
+			memtag_dump();
+		}
 		poll_sockets();
 		handle_lws_input();
 		complete_logons();
@@ -2209,6 +2496,7 @@ main(int argc, char *argv[])
 		close_timedout_conns();
 	}
 
+	admin_fini();
 	msgquota_fini();
 	auth_fini();
 	tls_fini();
@@ -2267,7 +2555,7 @@ conn_established_lws(conn_t *conn, struct lws *wsi)
 	conn->is_lws = true;
 	conn->wsi = wsi;
 	conn->outbuf_pre_pad = P2ROUNDUP(LWS_PRE);
-	conn->logoff_time = time(NULL);
+	conn->logoff_time = cpdlc_clock_time();
 	/*
 	 * We must have validated the address before already, so we can't
 	 * be having trouble grabbing it again here.
@@ -2280,10 +2568,14 @@ conn_established_lws(conn_t *conn, struct lws *wsi)
 	mutex_init(&conn->lock);
 	list_create(&conn->from_list, sizeof (ident_list_t),
 	    offsetof(ident_list_t, node));
+	conn_stats_init(&conn->stats);
+	cpdlc_memtag_adjust(&conn_tag, sizeof (*conn), 1);
 
 	mutex_enter(&conns_lws_lock);
 	list_insert_tail(&conns_lws, conn);
 	mutex_exit(&conns_lws_lock);
+
+	CPDLC_PROBE3(cpdlcd, conn__accept, conn, fd, conn->addr_str);
 }
 
 static bool
@@ -2307,7 +2599,8 @@ do_lws_output(conn_t *conn, struct lws *wsi)
 		lws_callback_on_writable(wsi);
 		return (true);
 	}
-	free(conn->outbuf);
+	conn_stats_tx_sent(&conn->stats, conn->outbuf_sz, 0);
+	safe_free_tag(conn->outbuf);
 	conn->outbuf = NULL;
 	conn->outbuf_sz = 0;
 
@@ -2339,6 +2632,7 @@ cpdlc_lws_cb(struct lws *wsi, enum lws_callback_reasons reason, void *user,
     void *in, size_t len)
 {
 	conn_t *conn = user;
+	size_t max_inbuf_sz;
 
 	ASSERT(wsi != NULL);
 	UNUSED(reason);
@@ -2361,17 +2655,28 @@ cpdlc_lws_cb(struct lws *wsi, enum lws_callback_reasons reason, void *user,
 		ASSERT(conn != NULL);
 		if (conn->kill_wsi)
 			return (-1);
-		if (!sanitize_input(in, len)) {
+		if (!framing_sanitize(in, len)) {
 			logMsg("Invalid input character on connection from "
 			    "%s: data MUST be plain text", conn->addr_str);
 			return (-1);
 		}
 		mutex_enter(&conn->lock);
-		conn->inbuf = safe_realloc(conn->inbuf,
+		max_inbuf_sz = (list_count(&conn->from_list) != 0 ?
+		    MAX_BUF_SZ : MAX_BUF_SZ_NO_LOGON);
+		if (conn->inbuf_sz + len > max_inbuf_sz) {
+			logMsg("Input buffer overflow on connection from %s: "
+			    "received %d bytes, maximum allowable is %d bytes",
+			    conn->addr_str, (int)(conn->inbuf_sz + len),
+			    (int)max_inbuf_sz);
+			mutex_exit(&conn->lock);
+			return (-1);
+		}
+		conn->inbuf = safe_realloc_tag(&conn_buf_tag, conn->inbuf,
 		    conn->inbuf_sz + len + 1);
 		memcpy(&conn->inbuf[conn->inbuf_sz], in, len);
 		conn->inbuf_sz += len;
 		conn->inbuf[conn->inbuf_sz] = '\0';
+		conn_stats_rx(&conn->stats, len);
 		mutex_exit(&conn->lock);
 		wake_up_main_thread();
 		break;
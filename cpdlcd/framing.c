@@ -0,0 +1,99 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Turns the raw byte stream received from a client into messages. This
+ * is kept separate from the connection handling, so that the fuzz tests
+ * in test/fuzz.c can exercise exactly the same code as the server.
+ */
+
+#include <stddef.h>
+
+#include "../src/cpdlc_assert.h"
+
+#include "framing.h"
+
+/*
+ * Input sanitization, we don't allow control chars. Input must be plain
+ * text, anything else means the client is broken or malicious.
+ */
+bool
+framing_sanitize(const uint8_t *buf, size_t len)
+{
+	ASSERT(buf != NULL || len == 0);
+
+	for (size_t i = 0; i < len; i++) {
+		uint8_t c = buf[i];
+		if ((c < 32 || c > 127) && c != '\n' && c != '\r' && c != '\t')
+			return (false);
+	}
+	return (true);
+}
+
+/*
+ * Decodes all complete messages in `buf' and passes them to `cb' one by
+ * one. `buf' must be NUL-terminated at `len'. Any trailing input which
+ * doesn't form a complete message yet is left alone.
+ *
+ * @return The number of bytes consumed from the start of `buf', which
+ *	the caller should discard. If a malformed message is encountered,
+ *	returns -1 and fills `error' with the reason. Messages decoded
+ *	before the malformed one will have been passed to `cb' already.
+ */
+int
+framing_drain(const char *buf, size_t len, framing_msg_cb_t cb,
+    void *userinfo, char *error, size_t error_cap)
+{
+	int consumed_total = 0;
+
+	ASSERT(buf != NULL);
+	ASSERT0(buf[len]);
+	ASSERT(cb != NULL);
+	ASSERT(error != NULL);
+
+	while (consumed_total < (int)len) {
+		int consumed;
+		cpdlc_msg_t *msg;
+
+		if (!cpdlc_msg_decode(&buf[consumed_total], &msg, &consumed,
+		    error, error_cap))
+			return (-1);
+		/* No more complete messages pending? */
+		if (msg == NULL)
+			break;
+		ASSERT(consumed != 0);
+		cb(msg, consumed, userinfo);
+		/*
+		 * If the message was queued for later delivery, it will
+		 * have been encoded into a textual form. So we can get
+		 * rid of the in-memory representation now.
+		 */
+		cpdlc_msg_free(msg);
+		consumed_total += consumed;
+		ASSERT3S(consumed_total, <=, (int)len);
+	}
+
+	return (consumed_total);
+}
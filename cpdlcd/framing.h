@@ -0,0 +1,63 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef	_CPDLCD_FRAMING_H_
+#define	_CPDLCD_FRAMING_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../src/cpdlc_msg.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Buffer size limits for logged on and non-logged-on connections. If a
+ * message is not completed within this amount of bytes, the associated
+ * connection is terminated with an error.
+ */
+#define	MAX_BUF_SZ		8192	/* bytes */
+#define	MAX_BUF_SZ_NO_LOGON	128	/* bytes */
+
+/*
+ * Called for every message extracted from an input buffer. `bytes' is the
+ * size of the message on the wire. The callee does NOT take ownership of
+ * the message.
+ */
+typedef void (*framing_msg_cb_t)(cpdlc_msg_t *msg, int bytes,
+    void *userinfo);
+
+bool framing_sanitize(const uint8_t *buf, size_t len);
+int framing_drain(const char *buf, size_t len, framing_msg_cb_t cb,
+    void *userinfo, char *error, size_t error_cap);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _CPDLCD_FRAMING_H_ */
@@ -31,6 +31,8 @@
 #include <acfutils/helpers.h>
 #include <acfutils/safe_alloc.h>
 
+#include "../src/cpdlc_memtag.h"
+
 #include "common.h"
 #include "msgquota.h"
 
@@ -43,6 +45,7 @@ typedef struct {
 static bool		inited = false;
 static avl_tree_t	tree;
 static uint64_t		msgquota_max = 16 << 10;	/* 16 KiB */
+static cpdlc_memtag_t	msgquota_tag = CPDLC_MEMTAG_INIT("msgquota");
 
 static int
 msgquota_compar(const void *a, const void *b)
@@ -79,7 +82,7 @@ msgquota_fini(void)
 	inited = false;
 
 	while ((mq = avl_destroy_nodes(&tree, &cookie)) != NULL)
-		free(mq);
+		safe_free_tag(mq);
 	avl_destroy(&tree);
 }
 
@@ -95,7 +98,7 @@ mq_get(const char *callsign)
 	lacf_strlcpy(srch.callsign, callsign, sizeof (srch.callsign));
 	mq = avl_find(&tree, &srch, &where);
 	if (mq == NULL) {
-		mq = safe_calloc(1, sizeof (*mq));
+		mq = safe_calloc_tag(&msgquota_tag, 1, sizeof (*mq));
 		lacf_strlcpy(mq->callsign, callsign, sizeof (mq->callsign));
 		avl_insert(&tree, mq, where);
 	}
@@ -131,6 +134,6 @@ msgquota_decr(const char *callsign, uint64_t bytes)
 	mq->bytes -= bytes;
 	if (mq->bytes == 0) {
 		avl_remove(&tree, mq);
-		free(mq);
+		safe_free_tag(mq);
 	}
 }
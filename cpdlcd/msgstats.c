@@ -0,0 +1,425 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Traffic accounting by message type. Every message a client sends us is
+ * attributed to the type of its first segment (e.g. UM20 or DM67b), or to
+ * one of the pseudo-types for logons, logoffs and pings. For each type we
+ * count the messages, their size on the wire and how they were routed.
+ * Segments are also counted individually, so that types which mostly
+ * travel as secondary segments (such as the UM169 free text appended to
+ * clearances) show up too.
+ *
+ * The delivery delay is measured from when we received a message, until
+ * it was handed to the recipient's connection. For directly forwarded
+ * messages this is just our own routing cost, for messages which had to
+ * be stored, it includes the time spent waiting for the recipient.
+ * A message only counts as delivered once a connection has accepted it
+ * for sending. Messages which could neither be delivered nor stored
+ * (because the queue or the sender's quota was full) count as dropped.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <acfutils/assert.h>
+#include <acfutils/helpers.h>
+#include <acfutils/safe_alloc.h>
+#include <acfutils/thread.h>
+
+#include "../src/cpdlc_clock.h"
+
+#include "msgstats.h"
+#include "report.h"
+
+#define	DFL_TOP_N	30
+
+enum {
+	KEY_LOGON,
+	KEY_LOGOFF,
+	KEY_PING,
+	KEY_PONG,
+	NUM_PKT_KEYS
+};
+
+static const char *pkt_key_names[NUM_PKT_KEYS] = {
+	"LOGON", "LOGOFF", "PING", "PONG"
+};
+
+typedef struct {
+	/* messages with this as their 1st seg */
+	uint64_t	msgs;
+	/* segments of this type in any message */
+	uint64_t	segs;
+	uint64_t	bytes;		/* wire size of `msgs' */
+	uint64_t	delivered;
+	/* messages stored for later delivery */
+	uint64_t	queued;
+	uint64_t	expired;	/* stored messages never delivered */
+	uint64_t	dropped;	/* neither delivered nor stored */
+	uint64_t	delay_us;	/* sum of the delays of `delivered' */
+	uint64_t	delay_max_us;
+} msgstats_ent_t;
+
+typedef struct {
+	unsigned	key;
+	msgstats_ent_t	ent;
+} report_ent_t;
+
+typedef struct {
+	bool		want_ul;
+	bool		want_dl;
+	bool		reset;
+} report_opts_t;
+
+typedef enum {
+	SORT_MSGS,
+	SORT_SEGS,
+	SORT_BYTES,
+	SORT_SIZE,
+	SORT_DELAY,
+	NUM_SORT_KEYS
+} sort_key_t;
+
+static const char *sort_key_names[NUM_SORT_KEYS] = {
+	"msgs", "segs", "bytes", "size", "delay"
+};
+
+static mutex_t		lock;
+static msgstats_ent_t	*ents = NULL;	/* protected by `lock' */
+static unsigned		num_ents = 0;
+static unsigned		num_ul = 0;
+static time_t		reset_time;	/* protected by `lock' */
+
+static unsigned
+count_infos(const cpdlc_msg_info_t *infos)
+{
+	unsigned n = 0;
+
+	while (infos[n].msg_type != -1)
+		n++;
+	return (n);
+}
+
+void
+msgstats_init(void)
+{
+	ASSERT3P(ents, ==, NULL);
+
+	mutex_init(&lock);
+	num_ul = count_infos(cpdlc_ul_infos);
+	num_ents = NUM_PKT_KEYS + num_ul + count_infos(cpdlc_dl_infos);
+	ents = safe_calloc(num_ents, sizeof (*ents));
+	reset_time = cpdlc_clock_time();
+}
+
+void
+msgstats_fini(void)
+{
+	if (ents == NULL)
+		return;
+	free(ents);
+	ents = NULL;
+	num_ents = num_ul = 0;
+	mutex_destroy(&lock);
+}
+
+/*
+ * Message info structures come from the cpdlc_ul_infos and cpdlc_dl_infos
+ * tables, so an info's position in the table is all we need to find its
+ * counters.
+ */
+static unsigned
+info2key(const cpdlc_msg_info_t *info)
+{
+	unsigned key;
+
+	ASSERT(info != NULL);
+	if (info->is_dl)
+		key = NUM_PKT_KEYS + num_ul + (info - cpdlc_dl_infos);
+	else
+		key = NUM_PKT_KEYS + (info - cpdlc_ul_infos);
+	ASSERT3U(key, <, num_ents);
+
+	return (key);
+}
+
+static void
+key2name(unsigned key, char name[16])
+{
+	const cpdlc_msg_info_t *info;
+
+	ASSERT3U(key, <, num_ents);
+	if (key < NUM_PKT_KEYS) {
+		lacf_strlcpy(name, pkt_key_names[key], 16);
+		return;
+	}
+	key -= NUM_PKT_KEYS;
+	if (key < num_ul)
+		info = &cpdlc_ul_infos[key];
+	else
+		info = &cpdlc_dl_infos[key - num_ul];
+	if (info->msg_subtype != 0) {
+		snprintf(name, 16, "%s%d%c", info->is_dl ? "DM" : "UM",
+		    info->msg_type, info->msg_subtype);
+	} else {
+		snprintf(name, 16, "%s%d", info->is_dl ? "DM" : "UM",
+		    info->msg_type);
+	}
+}
+
+/*
+ * Accounts for a message received from a client, `bytes' being its size
+ * on the wire. Returns the key under which the message's delivery is to
+ * be reported later on.
+ */
+unsigned
+msgstats_rx(const cpdlc_msg_t *msg, size_t bytes)
+{
+	unsigned key;
+
+	ASSERT(msg != NULL);
+	ASSERT(ents != NULL);
+
+	if (msg->is_logon)
+		key = KEY_LOGON;
+	else if (msg->is_logoff)
+		key = KEY_LOGOFF;
+	else if (msg->pkt_type == CPDLC_PKT_PING)
+		key = KEY_PING;
+	else if (msg->pkt_type == CPDLC_PKT_PONG || msg->num_segs == 0)
+		key = KEY_PONG;
+	else
+		key = info2key(msg->segs[0].info);
+
+	mutex_enter(&lock);
+	ents[key].msgs++;
+	ents[key].bytes += bytes;
+	for (unsigned i = 0; i < msg->num_segs; i++) {
+		if (msg->segs[i].info != NULL)
+			ents[info2key(msg->segs[i].info)].segs++;
+	}
+	mutex_exit(&lock);
+
+	return (key);
+}
+
+/*
+ * Accounts for a message having been handed to its recipient's
+ * connection(s). `rx_us' is the cpdlc_clock_us() time of its reception.
+ */
+void
+msgstats_delivered(unsigned key, uint64_t rx_us)
+{
+	uint64_t now = cpdlc_clock_us();
+	uint64_t delay = (now > rx_us ? now - rx_us : 0);
+
+	ASSERT3U(key, <, num_ents);
+	mutex_enter(&lock);
+	ents[key].delivered++;
+	ents[key].delay_us += delay;
+	ents[key].delay_max_us = MAX(ents[key].delay_max_us, delay);
+	mutex_exit(&lock);
+}
+
+void
+msgstats_queued(unsigned key)
+{
+	ASSERT3U(key, <, num_ents);
+	mutex_enter(&lock);
+	ents[key].queued++;
+	mutex_exit(&lock);
+}
+
+void
+msgstats_expired(unsigned key)
+{
+	ASSERT3U(key, <, num_ents);
+	mutex_enter(&lock);
+	ents[key].expired++;
+	mutex_exit(&lock);
+}
+
+void
+msgstats_dropped(unsigned key)
+{
+	ASSERT3U(key, <, num_ents);
+	mutex_enter(&lock);
+	ents[key].dropped++;
+	mutex_exit(&lock);
+}
+
+static uint64_t
+ent_sort_val(const void *rent_p, void *userinfo)
+{
+	const msgstats_ent_t *ent = &((const report_ent_t *)rent_p)->ent;
+	sort_key_t sort_key = *(const int *)userinfo;
+
+	switch (sort_key) {
+	case SORT_MSGS:
+		return (ent->msgs);
+	case SORT_SEGS:
+		return (ent->segs);
+	case SORT_BYTES:
+		return (ent->bytes);
+	case SORT_SIZE:
+		return (ent->msgs != 0 ? ent->bytes / ent->msgs : 0);
+	case SORT_DELAY:
+	default:
+		return (ent->delivered != 0 ?
+		    ent->delay_us / ent->delivered : 0);
+	}
+}
+
+static bool
+report_opt(const char *opt, const char *val, void *userinfo)
+{
+	report_opts_t *opts = userinfo;
+
+	if (strcmp(opt, "-r") == 0) {
+		opts->reset = true;
+	} else if (strcmp(opt, "-t") == 0) {
+		opts->want_ul = (strcmp(val, "ul") == 0 ||
+		    strcmp(val, "all") == 0);
+		opts->want_dl = (strcmp(val, "dl") == 0 ||
+		    strcmp(val, "all") == 0);
+		if (!opts->want_ul && !opts->want_dl)
+			return (false);
+	} else {
+		return (false);
+	}
+	return (true);
+}
+
+static void
+print_ent(const char *name, const msgstats_ent_t *ent, time_t elapsed,
+    char **out, size_t *out_cap)
+{
+	append_format(out, out_cap, "%-7s %9llu %9llu %9llu %10llu %7llu "
+	    "%9llu %7llu %7llu %7llu %9llu %9llu\n", name,
+	    (unsigned long long)ent->msgs,
+	    (unsigned long long)(ent->msgs * 3600 / elapsed),
+	    (unsigned long long)ent->segs,
+	    (unsigned long long)ent->bytes,
+	    (unsigned long long)(ent->msgs != 0 ? ent->bytes / ent->msgs : 0),
+	    (unsigned long long)ent->delivered,
+	    (unsigned long long)ent->queued,
+	    (unsigned long long)ent->expired,
+	    (unsigned long long)ent->dropped,
+	    (unsigned long long)(ent->delivered != 0 ?
+	    ent->delay_us / ent->delivered / 1000 : 0),
+	    (unsigned long long)(ent->delay_max_us / 1000));
+}
+
+/*
+ * Implements the `msgs' admin command: prints the counters of the first
+ * N message types with any traffic, sorted by the selected counter. With
+ * "-r" the counters are reset after printing, so that successive calls
+ * show the traffic since the previous one.
+ */
+void
+msgstats_report(char **argv, size_t argc, char **out, size_t *out_cap)
+{
+	static const char *const flags[] = { "-r", NULL };
+	unsigned top_n = DFL_TOP_N;
+	int sort_key = SORT_MSGS;
+	report_opts_t opts = { .want_ul = true, .want_dl = true };
+	const report_args_t args = {
+	    .cmd = "msgs",
+	    .opts_usage = "[-t ul|dl|all] [-r]",
+	    .flags = flags,
+	    .sort_key_names = sort_key_names,
+	    .num_sort_keys = NUM_SORT_KEYS,
+	    .opt_cb = report_opt,
+	    .userinfo = &opts
+	};
+	report_ent_t *rents;
+	unsigned num_rents = 0;
+	msgstats_ent_t total = { 0 };
+	time_t elapsed;
+	char name[16];
+
+	ASSERT(ents != NULL);
+
+	if (!report_parse_args(&args, argv, argc, &top_n, &sort_key, out,
+	    out_cap))
+		return;
+
+	/* Only hold the lock while copying, sorting is done on the copy */
+	rents = safe_calloc(num_ents, sizeof (*rents));
+	mutex_enter(&lock);
+	elapsed = MAX(cpdlc_clock_time() - reset_time, 1);
+	for (unsigned key = 0; key < num_ents; key++) {
+		bool is_dl = (key >= NUM_PKT_KEYS + num_ul);
+
+		if (ents[key].msgs == 0 && ents[key].segs == 0)
+			continue;
+		if (key >= NUM_PKT_KEYS &&
+		    !(is_dl ? opts.want_dl : opts.want_ul))
+			continue;
+		rents[num_rents].key = key;
+		rents[num_rents].ent = ents[key];
+		num_rents++;
+	}
+	if (opts.reset) {
+		memset(ents, 0, num_ents * sizeof (*ents));
+		reset_time = cpdlc_clock_time();
+	}
+	mutex_exit(&lock);
+
+	/* `rents' is in key order, so ties are broken by the key */
+	report_sort(rents, num_rents, sizeof (*rents), ent_sort_val,
+	    &sort_key);
+
+	append_format(out, out_cap, "Interval: %lld seconds\n",
+	    (long long)elapsed);
+	append_format(out, out_cap, "%-7s %9s %9s %9s %10s %7s %9s %7s %7s "
+	    "%7s %9s %9s\n", "TYPE", "MSGS", "MSGS/H", "SEGS", "BYTES",
+	    "AVG_SZ", "DELIVERED", "QUEUED", "EXPIRED", "DROPPED", "AVG_DL_MS",
+	    "MAX_DL_MS");
+	for (unsigned i = 0; i < num_rents; i++) {
+		const msgstats_ent_t *ent = &rents[i].ent;
+
+		if (i < top_n) {
+			key2name(rents[i].key, name);
+			print_ent(name, ent, elapsed, out, out_cap);
+		}
+		total.msgs += ent->msgs;
+		total.segs += ent->segs;
+		total.bytes += ent->bytes;
+		total.delivered += ent->delivered;
+		total.queued += ent->queued;
+		total.expired += ent->expired;
+		total.dropped += ent->dropped;
+		total.delay_us += ent->delay_us;
+		total.delay_max_us = MAX(total.delay_max_us,
+		    ent->delay_max_us);
+	}
+	print_ent("TOTAL", &total, elapsed, out, out_cap);
+	free(rents);
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef	_CPDLCD_MSGSTATS_H_
+#define	_CPDLCD_MSGSTATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../src/cpdlc_msg.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+void msgstats_init(void);
+void msgstats_fini(void);
+
+unsigned msgstats_rx(const cpdlc_msg_t *msg, size_t bytes);
+void msgstats_delivered(unsigned key, uint64_t rx_us);
+void msgstats_queued(unsigned key);
+void msgstats_expired(unsigned key);
+void msgstats_dropped(unsigned key);
+
+void msgstats_report(char **argv, size_t argc, char **out, size_t *out_cap);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _CPDLCD_MSGSTATS_H_ */
@@ -0,0 +1,160 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Common parts of the tabular admin reports (`top' and `msgs'): parsing
+ * of the "-n <count>" and "-s <sort_key>" options shared by all of them
+ * and sorting of the report entries by the selected counter.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <acfutils/assert.h>
+#include <acfutils/helpers.h>
+#include <acfutils/safe_alloc.h>
+
+#include "report.h"
+
+typedef struct {
+	uint64_t	val;
+	size_t		idx;
+} sort_ent_t;
+
+static void
+print_usage(const report_args_t *args, char **out, size_t *out_cap)
+{
+	append_format(out, out_cap, "Usage: %s [-n <count>] %s "
+	    "[-s <sort_key>]\nSort keys:", args->cmd, args->opts_usage);
+	for (int i = 0; i < args->num_sort_keys; i++)
+		append_format(out, out_cap, " %s", args->sort_key_names[i]);
+	append_format(out, out_cap, "\n");
+}
+
+static bool
+is_flag(const report_args_t *args, const char *opt)
+{
+	for (int i = 0; args->flags != NULL && args->flags[i] != NULL; i++) {
+		if (strcmp(opt, args->flags[i]) == 0)
+			return (true);
+	}
+	return (false);
+}
+
+/*
+ * Parses the arguments of a report command. "-n" and "-s" are handled
+ * here, everything else is passed to `args->opt_cb'. On a bad argument,
+ * the usage message is printed to `out' and false is returned.
+ */
+bool
+report_parse_args(const report_args_t *args, char **argv, size_t argc,
+    unsigned *top_n, int *sort_key, char **out, size_t *out_cap)
+{
+	ASSERT(args != NULL);
+	ASSERT(args->flags == NULL || args->opt_cb != NULL);
+	ASSERT(top_n != NULL);
+	ASSERT(sort_key != NULL);
+
+	for (size_t i = 1; i < argc; i++) {
+		const char *opt = argv[i], *val = (i + 1 < argc ?
+		    argv[i + 1] : NULL);
+
+		if (is_flag(args, opt)) {
+			if (!args->opt_cb(opt, NULL, args->userinfo))
+				goto errout;
+			continue;
+		}
+		if (val == NULL)
+			goto errout;
+		i++;
+		if (strcmp(opt, "-n") == 0) {
+			*top_n = atoi(val);
+		} else if (strcmp(opt, "-s") == 0) {
+			*sort_key = -1;
+			for (int j = 0; j < args->num_sort_keys; j++) {
+				if (strcmp(val, args->sort_key_names[j]) == 0)
+					*sort_key = j;
+			}
+			if (*sort_key == -1)
+				goto errout;
+		} else if (args->opt_cb == NULL ||
+		    !args->opt_cb(opt, val, args->userinfo)) {
+			goto errout;
+		}
+	}
+	return (true);
+errout:
+	print_usage(args, out, out_cap);
+	return (false);
+}
+
+static int
+sort_ent_compar(const void *a, const void *b)
+{
+	const sort_ent_t *ea = a, *eb = b;
+
+	if (ea->val > eb->val)
+		return (-1);
+	if (ea->val < eb->val)
+		return (1);
+	if (ea->idx < eb->idx)
+		return (-1);
+	if (ea->idx > eb->idx)
+		return (1);
+	return (0);
+}
+
+/*
+ * Sorts an array of report entries in descending order of the values
+ * returned by `val_cb'. The sort is stable, so entries with equal values
+ * keep their order, which callers use to break ties by the entry key.
+ */
+void
+report_sort(void *ents, size_t num_ents, size_t ent_sz,
+    report_val_cb_t val_cb, void *userinfo)
+{
+	sort_ent_t *sents;
+	uint8_t *copy;
+
+	ASSERT(ents != NULL || num_ents == 0);
+	ASSERT(val_cb != NULL);
+
+	if (num_ents < 2)
+		return;
+	sents = safe_malloc(num_ents * sizeof (*sents));
+	copy = safe_malloc(num_ents * ent_sz);
+	memcpy(copy, ents, num_ents * ent_sz);
+	for (size_t i = 0; i < num_ents; i++) {
+		sents[i].val = val_cb(&copy[i * ent_sz], userinfo);
+		sents[i].idx = i;
+	}
+	qsort(sents, num_ents, sizeof (*sents), sort_ent_compar);
+	for (size_t i = 0; i < num_ents; i++) {
+		memcpy((uint8_t *)ents + i * ent_sz,
+		    &copy[sents[i].idx * ent_sz], ent_sz);
+	}
+	free(copy);
+	free(sents);
+}
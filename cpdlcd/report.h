@@ -0,0 +1,70 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef	_CPDLCD_REPORT_H_
+#define	_CPDLCD_REPORT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Called for every report-specific option. `val' is NULL for the options
+ * listed in `flags'. Returning false prints the usage message.
+ */
+typedef bool (*report_opt_cb_t)(const char *opt, const char *val,
+    void *userinfo);
+/*
+ * Returns the value of `ent' to sort by. `userinfo' is passed through
+ * from report_sort.
+ */
+typedef uint64_t (*report_val_cb_t)(const void *ent, void *userinfo);
+
+typedef struct {
+	/* command name and report-specific options for the usage line */
+	const char		*cmd;
+	const char		*opts_usage;
+	/* options which take no value, e.g. { "-r", NULL } */
+	const char *const	*flags;
+	const char *const	*sort_key_names;
+	int			num_sort_keys;
+	report_opt_cb_t		opt_cb;
+	void			*userinfo;
+} report_args_t;
+
+bool report_parse_args(const report_args_t *args, char **argv, size_t argc,
+    unsigned *top_n, int *sort_key, char **out, size_t *out_cap);
+void report_sort(void *ents, size_t num_ents, size_t ent_sz,
+    report_val_cb_t val_cb, void *userinfo);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _CPDLCD_REPORT_H_ */
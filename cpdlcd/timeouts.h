@@ -0,0 +1,81 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef	_CPDLCD_TIMEOUTS_H_
+#define	_CPDLCD_TIMEOUTS_H_
+
+#include <stdbool.h>
+#include <time.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * This value is tuned to be greater + a sufficient margin above the longest
+ * possible message validity timeout (LONG_TIMEOUT in cpdlc_infos.c). This is
+ * ATM 300 seconds (for low-priority instructions), so a 600 second timeout is
+ * enough margin to definitely get those through within the validity period.
+ * Can be overridden with the "msgqueue/timeout" config option.
+ */
+#define	QUEUED_MSG_TIMEOUT	600	/* seconds */
+/*
+ * If no logon is completed within this time period from the connection
+ * having been established, the connection is terminated.
+ */
+#define	LOGON_GRACE_TIME	30	/* seconds */
+
+/*
+ * The timeout rules are kept here, rather than in cpdlcd.c, so that the
+ * network simulation in test/sim.c applies exactly the same ones. All
+ * times are cpdlc_clock_time() values.
+ */
+
+/*
+ * Returns true if a connection which isn't logged on has been so for
+ * longer than LOGON_GRACE_TIME. `logoff_time' is when the connection was
+ * established, or when it last logged off.
+ */
+static inline bool
+conn_logon_timedout(bool logon_success, time_t logoff_time, time_t now)
+{
+	return (!logon_success && now - logoff_time > LOGON_GRACE_TIME);
+}
+
+/*
+ * Returns true if a message stored for later delivery at `created' has
+ * been waiting for its recipient for longer than `timeout' seconds.
+ */
+static inline bool
+queued_msg_expired(time_t created, time_t timeout, time_t now)
+{
+	return (now - created > timeout);
+}
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _CPDLCD_TIMEOUTS_H_ */
@@ -32,6 +32,7 @@
 #include "../src/cpdlc_alloc.h"
 #include "../src/cpdlc_assert.h"
 #include "../src/cpdlc_client.h"
+#include "../src/cpdlc_clock.h"
 #include "../src/cpdlc_core.h"
 #include "../src/cpdlc_msglist.h"
 #include "../src/cpdlc_string.h"
@@ -59,15 +60,18 @@
 #include "fans_rej.h"
 #include "fans_vrfy.h"
 
-#define	ADD_LINE(__lines, __n_lines, __start, __len) \
-	do { \
-		(__lines) = safe_realloc((__lines), \
-		    ((__n_lines) + 1) * sizeof (*(__lines))); \
-		(__lines)[(__n_lines)] = safe_malloc((__len) + 1); \
-		cpdlc_strlcpy((__lines)[(__n_lines)], (__start), \
-		    (__len) + 1); \
-		(__n_lines)++; \
-	} while (0)
+#define	SCR_REFRESH_INTVAL	1000000	/* microseconds */
+
+/*
+ * Accumulates wrapped lines as consecutive NUL-terminated strings, so
+ * the result can be packed into a single allocation by lines_finish.
+ */
+typedef struct {
+	char		*text;
+	size_t		len;
+	size_t		cap;
+	unsigned	n_lines;
+} lines_bld_t;
 
 static fms_page_t fms_pages[FMS_NUM_PAGES] = {
 	{	/* FMS_PAGE_MAIN_MENU */
@@ -169,6 +173,7 @@ static fms_page_t fms_pages[FMS_NUM_PAGES] = {
 static void draw_atc_msg_lsk(fans_t *box);
 static void handle_atc_msg_lsk(fans_t *box);
 static void put_cur_time(fans_t *box);
+static void scr_regen(fans_t *box);
 
 void
 fans_set_thr_id(fans_t *box, cpdlc_msg_thr_id_t thr_id)
@@ -584,26 +589,62 @@ update_error_msg(fans_t *box)
 	    FMS_FONT_LARGE, "%s", box->error_msg);
 }
 
-fans_t *
-fans_alloc(const fans_funcs_t *funcs, void *userinfo)
+static fans_t *
+fans_alloc_impl(const fans_funcs_t *funcs, void *userinfo,
+    cpdlc_msglist_t *msglist, bool shared)
 {
 	fans_t *box = safe_calloc(1, sizeof (*box));
 
+	ASSERT(msglist != NULL);
+
 	if (funcs != NULL)
 		memcpy(&box->funcs, funcs, sizeof (*funcs));
 	box->userinfo = userinfo;
-	box->cl = cpdlc_client_alloc(false);
+	box->msglist = msglist;
+	box->cl = cpdlc_msglist_get_client(msglist);
 	ASSERT(box->cl != NULL);
-	cpdlc_client_set_host(box->cl, "localhost");
-	box->msglist = cpdlc_msglist_alloc(box->cl);
+	box->shared = shared;
 	fans_set_page(box, FMS_PAGE_MAIN_MENU, true);
 	box->thr_id = CPDLC_NO_MSG_THR_ID;
 
+	box->scr_inval = true;
 	fans_update(box);
 
 	return (box);
 }
 
+fans_t *
+fans_alloc(const fans_funcs_t *funcs, void *userinfo)
+{
+	cpdlc_client_t *cl = cpdlc_client_alloc(false);
+
+	ASSERT(cl != NULL);
+	cpdlc_client_set_host(cl, "localhost");
+
+	return (fans_alloc_impl(funcs, userinfo, cpdlc_msglist_alloc(cl),
+	    false));
+}
+
+/*
+ * Allocates a FANS box on top of an existing message list and the
+ * client it was created on. Several boxes (e.g. the left and right
+ * MCDU of one aircraft) can share a single data link session and its
+ * worker thread this way, each adding only its own screen and page
+ * state. The caller retains ownership of `msglist' and its client and
+ * must only free them after all boxes using them have been freed.
+ *
+ * To run many aircraft without a worker thread for each one, create
+ * their clients with cpdlc_client_set_polled and drive all of them from
+ * a single loop using cpdlc_client_poll_multi, calling fans_update on
+ * every box after each poll.
+ */
+fans_t *
+fans_alloc_shared(const fans_funcs_t *funcs, void *userinfo,
+    cpdlc_msglist_t *msglist)
+{
+	return (fans_alloc_impl(funcs, userinfo, msglist, true));
+}
+
 void
 fans_free(fans_t *box)
 {
@@ -613,11 +654,27 @@ fans_free(fans_t *box)
 
 	if (box->verify.msg != NULL)
 		cpdlc_msg_free(box->verify.msg);
-	cpdlc_msglist_free(box->msglist);
-	cpdlc_client_free(box->cl);
+	fans_free_lines(box->thr_lines.lines);
+	if (!box->shared) {
+		cpdlc_msglist_free(box->msglist);
+		cpdlc_client_free(box->cl);
+	}
 	free(box);
 }
 
+/*
+ * Sets an optional navigation database used to validate and resolve
+ * fix, navaid and airport entries. The database isn't copied and must
+ * remain open while it's set. Pass NULL to go back to accepting any
+ * well-formed identifier.
+ */
+void
+fans_set_navdb(fans_t *box, const fans_navdb_t *navdb)
+{
+	ASSERT(box != NULL);
+	box->navdb = navdb;
+}
+
 cpdlc_client_t *
 fans_get_client(const fans_t *box)
 {
@@ -625,6 +682,13 @@ fans_get_client(const fans_t *box)
 	return (box->cl);
 }
 
+cpdlc_msglist_t *
+fans_get_msglist(const fans_t *box)
+{
+	ASSERT(box != NULL);
+	return (box->msglist);
+}
+
 const fms_char_t *
 fans_get_screen_row(const fans_t *box, unsigned row)
 {
@@ -668,6 +732,17 @@ fans_push_key(fans_t *box, fms_key_t key)
 	ASSERT(box->page != NULL);
 	ASSERT(box->page->key_cb != NULL);
 
+	/*
+	 * Page draw callbacks set up state that key handling relies on
+	 * (such as the number of subpages), so inside of an input batch
+	 * we still need to redraw before handling a key. We can skip the
+	 * msglist update though, that's done once at the end of the batch.
+	 */
+	if (box->input_depth != 0 && box->scr_inval) {
+		box->scr_inval = false;
+		scr_regen(box);
+		box->scr_inval = true;
+	}
 	/* Clear any errors on a new LSK entry */
 	if (key >= FMS_KEY_LSK_L1 && key <= FMS_KEY_LSK_R6 &&
 	    strlen(box->scratchpad) != 0)
@@ -694,7 +769,9 @@ fans_push_key(fans_t *box, fms_key_t key)
 			fans_set_page(box, FMS_PAGE_MAIN_MENU, true);
 		}
 	}
-	fans_update(box);
+	box->scr_inval = true;
+	if (box->input_depth == 0)
+		fans_update(box);
 }
 
 void
@@ -712,7 +789,47 @@ fans_push_char(fans_t *box, char c)
 	if (len + 1 < sizeof (box->scratchpad))
 		box->scratchpad[len] = toupper(c);
 
-	fans_update(box);
+	box->scr_inval = true;
+	if (box->input_depth == 0)
+		fans_update(box);
+}
+
+/*
+ * Pushes up to `len' characters from `str' into the scratchpad, as if
+ * typed one by one, but only updates the screen once at the end.
+ */
+void
+fans_push_chars(fans_t *box, const char *str, size_t len)
+{
+	ASSERT(box != NULL);
+	ASSERT(str != NULL || len == 0);
+
+	fans_input_begin(box);
+	for (size_t i = 0; i < len && str[i] != '\0'; i++)
+		fans_push_char(box, str[i]);
+	fans_input_end(box);
+}
+
+/*
+ * Starts an input batch. Until the matching fans_input_end call, calls
+ * to fans_push_key and fans_push_char don't update the screen, so a
+ * long scripted input sequence is only drawn once. Batches can nest.
+ */
+void
+fans_input_begin(fans_t *box)
+{
+	ASSERT(box != NULL);
+	box->input_depth++;
+}
+
+void
+fans_input_end(fans_t *box)
+{
+	ASSERT(box != NULL);
+	ASSERT(box->input_depth != 0);
+	box->input_depth--;
+	if (box->input_depth == 0)
+		fans_update(box);
 }
 
 static void
@@ -729,13 +846,62 @@ update_cda(fans_t *box)
 	}
 }
 
-void
-fans_update(fans_t *box)
+static inline bool
+fms_char_eq(const fms_char_t *a, const fms_char_t *b)
 {
-	ASSERT(box != NULL);
-	ASSERT(box->page != NULL);
+	return (a->c == b->c && a->color == b->color && a->size == b->size);
+}
 
-	cpdlc_msglist_update(box->msglist);
+static bool
+scr_needs_regen(fans_t *box)
+{
+	uint64_t now = cpdlc_clock_us();
+	uint64_t msglist_gen = cpdlc_msglist_get_gen(box->msglist);
+	cpdlc_logon_status_t logon_status =
+	    cpdlc_client_get_logon_status(box->cl, NULL);
+
+	if (!box->scr_inval && msglist_gen == box->msglist_gen &&
+	    logon_status == box->logon_status &&
+	    now - box->scr_regen_t < SCR_REFRESH_INTVAL)
+		return (false);
+	box->scr_inval = false;
+	box->msglist_gen = msglist_gen;
+	box->logon_status = logon_status;
+	box->scr_regen_t = now;
+
+	return (true);
+}
+
+/*
+ * Compares the regenerated screen against its previous contents and
+ * bumps the generation of every cell which has changed.
+ */
+static void
+scr_track_changes(fans_t *box, const fms_char_t old_scr[FMS_ROWS][FMS_COLS])
+{
+	bool changed = false;
+
+	for (unsigned row = 0; row < FMS_ROWS; row++) {
+		for (unsigned col = 0; col < FMS_COLS; col++) {
+			if (fms_char_eq(&box->scr[row][col],
+			    &old_scr[row][col]))
+				continue;
+			if (!changed) {
+				box->gen++;
+				changed = true;
+			}
+			box->scr_gen[row][col] = box->gen;
+			box->row_gen[row] = box->gen;
+		}
+	}
+}
+
+static void
+scr_regen(fans_t *box)
+{
+	fms_char_t old_scr[FMS_ROWS][FMS_COLS];
+
+	memcpy(old_scr, box->scr, sizeof (old_scr));
 	clear_screen(box);
 	ASSERT(box->page->draw_cb != NULL);
 	box->page->draw_cb(box);
@@ -749,6 +915,69 @@ fans_update(fans_t *box)
 	fans_update_scratchpad(box);
 	update_error_msg(box);
 	update_cda(box);
+
+	scr_track_changes(box, old_scr);
+}
+
+void
+fans_update(fans_t *box)
+{
+	ASSERT(box != NULL);
+	ASSERT(box->page != NULL);
+
+	cpdlc_msglist_update(box->msglist);
+	if (scr_needs_regen(box))
+		scr_regen(box);
+}
+
+/*
+ * Forces the screen to be regenerated on the next call to fans_update.
+ * Call this when any of the data returned by the `funcs' callbacks has
+ * changed and the change should be reflected immediately.
+ */
+void
+fans_invalidate(fans_t *box)
+{
+	ASSERT(box != NULL);
+	box->scr_inval = true;
+}
+
+/*
+ * Returns the screen generation number. This is incremented every time
+ * the screen contents change, so renderers can skip redrawing if the
+ * generation hasn't changed since their last draw.
+ */
+uint64_t
+fans_get_gen(const fans_t *box)
+{
+	ASSERT(box != NULL);
+	return (box->gen);
+}
+
+/*
+ * Returns a bitmask of screen rows (bit 0 being the top row) containing
+ * cells which have changed after generation `since_gen'.
+ */
+unsigned
+fans_get_dirty_rows(const fans_t *box, uint64_t since_gen)
+{
+	unsigned rows = 0;
+
+	ASSERT(box != NULL);
+	for (unsigned row = 0; row < FMS_ROWS; row++) {
+		if (box->row_gen[row] > since_gen)
+			rows |= (1u << row);
+	}
+	return (rows);
+}
+
+uint64_t
+fans_get_cell_gen(const fans_t *box, unsigned row, unsigned col)
+{
+	ASSERT(box != NULL);
+	ASSERT3U(row, <, FMS_ROWS);
+	ASSERT3U(col, <, FMS_COLS);
+	return (box->scr_gen[row][col]);
 }
 
 void
@@ -781,30 +1010,12 @@ put_cur_time(fans_t *box)
 
 	ASSERT(box != NULL);
 
-	now = time(NULL);
+	now = cpdlc_clock_time();
 	tm = localtime(&now);
 	fans_put_str(box, LSK6_ROW, 8, false, FMS_COLOR_GREEN, FMS_FONT_SMALL,
 	    "%02d%02dZ", tm->tm_hour, tm->tm_min);
 }
 
-cpdlc_msg_thr_id_t *
-fans_get_thr_ids(fans_t *box, unsigned *num_thr_ids, bool ignore_closed)
-{
-	cpdlc_msg_thr_id_t *thr_ids;
-
-	ASSERT(box != NULL);
-	ASSERT(num_thr_ids != NULL);
-
-	*num_thr_ids = 0;
-	cpdlc_msglist_get_thr_ids(box->msglist, ignore_closed, NULL,
-	    num_thr_ids);
-	thr_ids = safe_calloc(*num_thr_ids, sizeof (*thr_ids));
-	cpdlc_msglist_get_thr_ids(box->msglist, ignore_closed, thr_ids,
-	    num_thr_ids);
-
-	return (thr_ids);
-}
-
 const char *
 fans_thr_status2str(cpdlc_msg_thr_status_t st, bool dirty)
 {
@@ -842,25 +1053,17 @@ fans_thr_status2str(cpdlc_msg_thr_status_t st, bool dirty)
 static cpdlc_msg_thr_id_t
 get_new_thr_id(fans_t *box)
 {
-	unsigned num_thr_ids;
-	cpdlc_msg_thr_id_t *thr_ids;
-	cpdlc_msg_thr_id_t thr_id = CPDLC_NO_MSG_THR_ID;
+	const cpdlc_msglist_query_t query = {
+	    .dirty = CPDLC_MSGLIST_DIRTY_ONLY
+	};
+	cpdlc_msglist_thr_info_t info;
 
 	ASSERT(box != NULL);
 
-	thr_ids = fans_get_thr_ids(box, &num_thr_ids, true);
-	for (unsigned i = 0; i < num_thr_ids; i++) {
-		bool dirty;
-
-		cpdlc_msglist_get_thr_status(box->msglist, thr_ids[i], &dirty);
-		if (dirty) {
-			thr_id = thr_ids[i];
-			break;
-		}
-	}
-	free(thr_ids);
-
-	return (thr_id);
+	if (cpdlc_msglist_query(box->msglist, &query, NULL, &info, 1,
+	    NULL) == 0)
+		return (CPDLC_NO_MSG_THR_ID);
+	return (info.thr_id);
 }
 
 static void
@@ -893,27 +1096,61 @@ handle_atc_msg_lsk(fans_t *box)
 	}
 }
 
-void
-fans_msg2lines(const cpdlc_msg_t *msg, char ***lines_p, unsigned *n_lines_p)
+static void
+lines_add(lines_bld_t *bld, const char *start, size_t len)
+{
+	if (bld->len + len + 1 > bld->cap) {
+		bld->cap = MAX(2 * bld->cap, bld->len + len + 1);
+		bld->text = safe_realloc(bld->text, bld->cap);
+	}
+	memcpy(&bld->text[bld->len], start, len);
+	bld->text[bld->len + len] = '\0';
+	bld->len += len + 1;
+	bld->n_lines++;
+}
+
+/*
+ * Packs the accumulated lines into a single allocation: an array of
+ * line pointers immediately followed by the line text. The whole thing
+ * is released with a single call to fans_free_lines.
+ */
+static void
+lines_finish(lines_bld_t *bld, char ***lines_p, unsigned *n_lines_p)
+{
+	char **lines;
+	char *text;
+
+	lines = safe_malloc(bld->n_lines * sizeof (*lines) + bld->len);
+	text = (char *)&lines[bld->n_lines];
+	if (bld->len != 0)
+		memcpy(text, bld->text, bld->len);
+	for (unsigned i = 0; i < bld->n_lines; i++) {
+		lines[i] = text;
+		text += strlen(text) + 1;
+	}
+	*lines_p = lines;
+	*n_lines_p = bld->n_lines;
+	free(bld->text);
+	memset(bld, 0, sizeof (*bld));
+}
+
+static void
+msg2lines_impl(const cpdlc_msg_t *msg, unsigned width, lines_bld_t *bld)
 {
 	char buf[1024];
 	const char *start, *cur, *end, *last_sp;
 
-	ASSERT(msg != NULL);
-	ASSERT(lines_p != NULL);
-	ASSERT(n_lines_p != NULL);
-
 	cpdlc_msg_readable(msg, buf, sizeof (buf));
 	last_sp = strchr(buf, ' ');
 	for (start = buf, cur = buf, end = buf + strlen(buf);; cur++) {
 		if (last_sp == NULL)
 			last_sp = end;
 		if (cur == end) {
-			ADD_LINE(*lines_p, *n_lines_p, start, cur - start);
+			lines_add(bld, start, cur - start);
 			break;
 		}
-		if (cur - start >= FMS_COLS) {
-			ADD_LINE(*lines_p, *n_lines_p, start, last_sp - start);
+		if (cur - start >= width) {
+			lines_add(bld, start, last_sp - start);
 			if (last_sp == end)
 				break;
 			start = last_sp + 1;
@@ -924,6 +1161,21 @@ fans_msg2lines(const cpdlc_msg_t *msg, char ***lines_p, unsigned *n_lines_p)
 	}
 }
 
+void
+fans_msg2lines(const cpdlc_msg_t *msg, unsigned width, char ***lines_p,
+    unsigned *n_lines_p)
+{
+	lines_bld_t bld = { .text = NULL };
+
+	ASSERT(msg != NULL);
+	ASSERT(width != 0);
+	ASSERT(lines_p != NULL);
+	ASSERT(n_lines_p != NULL);
+
+	msg2lines_impl(msg, width, &bld);
+	lines_finish(&bld, lines_p, n_lines_p);
+}
+
 static bool
 is_short_response(const cpdlc_msg_t *msg)
 {
@@ -933,10 +1185,14 @@ is_short_response(const cpdlc_msg_t *msg)
 
 void
 fans_thr2lines(cpdlc_msglist_t *msglist, cpdlc_msg_thr_id_t thr_id,
-    char ***lines_p, unsigned *n_lines_p)
+    unsigned width, char ***lines_p, unsigned *n_lines_p)
 {
+	static const char sep[] = "------------------------";
+	lines_bld_t bld = { .text = NULL };
+
 	ASSERT(msglist != NULL);
 	ASSERT(thr_id != CPDLC_NO_MSG_THR_ID);
+	ASSERT(width != 0);
 	ASSERT(lines_p != NULL);
 	ASSERT(n_lines_p != NULL);
 
@@ -953,22 +1209,54 @@ fans_thr2lines(cpdlc_msglist_t *msglist, cpdlc_msg_thr_id_t thr_id,
 		 */
 		if (sent && is_short_response(msg))
 			continue;
-		if (i > 0) {
-			ADD_LINE(*lines_p, *n_lines_p,
-			    "------------------------", 24);
-		}
-		fans_msg2lines(msg, lines_p, n_lines_p);
+		if (i > 0)
+			lines_add(&bld, sep, MIN(width, sizeof (sep) - 1));
+		msg2lines_impl(msg, width, &bld);
 	}
+	lines_finish(&bld, lines_p, n_lines_p);
 }
 
 void
-fans_free_lines(char **lines, unsigned n_lines)
+fans_free_lines(char **lines)
 {
-	for (unsigned i = 0; i < n_lines; i++)
-		free(lines[i]);
 	free(lines);
 }
 
+/*
+ * Returns the wrapped lines of a message thread, as produced by
+ * fans_thr2lines. The layout is cached in the box and only rebuilt
+ * when a different thread or width is requested, or when a message has
+ * been added to the thread (messages themselves are immutable once in
+ * the msglist and thread IDs are never reused). The returned array is
+ * owned by the box and is valid until the next call.
+ */
+char **
+fans_thr_lines(fans_t *box, cpdlc_msg_thr_id_t thr_id, unsigned width,
+    unsigned *n_lines_p)
+{
+	unsigned num_msgs;
+
+	ASSERT(box != NULL);
+	ASSERT(thr_id != CPDLC_NO_MSG_THR_ID);
+	ASSERT(n_lines_p != NULL);
+
+	num_msgs = cpdlc_msglist_get_thr_msg_count(box->msglist, thr_id);
+	if (box->thr_lines.lines == NULL ||
+	    box->thr_lines.thr_id != thr_id ||
+	    box->thr_lines.width != width ||
+	    box->thr_lines.num_msgs != num_msgs) {
+		fans_free_lines(box->thr_lines.lines);
+		fans_thr2lines(box->msglist, thr_id, width,
+		    &box->thr_lines.lines, &box->thr_lines.n_lines);
+		box->thr_lines.thr_id = thr_id;
+		box->thr_lines.width = width;
+		box->thr_lines.num_msgs = num_msgs;
+	}
+	*n_lines_p = box->thr_lines.n_lines;
+
+	return (box->thr_lines.lines);
+}
+
 void
 fans_put_step_at(fans_t *box, const fms_step_at_t *step_at)
 {
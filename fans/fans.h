@@ -27,6 +27,7 @@
 #define	_LIBCPDLC_FANS_H_
 
 #include "cpdlc_msglist.h"
+#include "fans_navdb.h"
 
 #ifdef	__cplusplus
 extern "C" {
@@ -111,6 +112,7 @@ typedef bool (*fans_get_fuel_t)(void *userinfo, unsigned *hrs, unsigned *mins);
 typedef bool (*fans_get_temp_t)(void *userinfo, int *temp);
 typedef bool (*fans_get_wind_t)(void *userinfo, unsigned *deg_true,
     unsigned *knots);
+typedef bool (*fans_get_pos_t)(void *userinfo, double *lat, double *lon);
 
 typedef struct {
 	fans_get_flt_id_t	get_flt_id;
@@ -126,18 +128,32 @@ typedef struct {
 	fans_get_fuel_t		get_fuel;
 	fans_get_temp_t		get_sat;
 	fans_get_wind_t		get_wind;
+	fans_get_pos_t		get_cur_pos;
 } fans_funcs_t;
 
 fans_t *fans_alloc(const fans_funcs_t *funcs, void *userinfo);
+fans_t *fans_alloc_shared(const fans_funcs_t *funcs, void *userinfo,
+    cpdlc_msglist_t *msglist);
 void fans_free(fans_t *box);
 
+void fans_set_navdb(fans_t *box, const fans_navdb_t *navdb);
+
 cpdlc_client_t *fans_get_client(const fans_t *fans);
+cpdlc_msglist_t *fans_get_msglist(const fans_t *fans);
 
 const fms_char_t *fans_get_screen_row(const fans_t *box, unsigned row);
 
 void fans_push_key(fans_t *box, fms_key_t key);
 void fans_push_char(fans_t *box, char c);
+void fans_push_chars(fans_t *box, const char *str, size_t len);
+void fans_input_begin(fans_t *box);
+void fans_input_end(fans_t *box);
 void fans_update(fans_t *box);
+void fans_invalidate(fans_t *box);
+
+uint64_t fans_get_gen(const fans_t *box);
+unsigned fans_get_dirty_rows(const fans_t *box, uint64_t since_gen);
+uint64_t fans_get_cell_gen(const fans_t *box, unsigned row, unsigned col);
 
 #ifdef	__cplusplus
 }
@@ -168,6 +168,22 @@ typedef void (*pos_pick_done_cb_t)(fans_t *box, const fms_pos_t *pos);
 
 struct fans_s {
 	fms_char_t		scr[FMS_ROWS][FMS_COLS];
+	/*
+	 * Screen change tracking. `gen' is incremented every time a screen
+	 * regeneration changes at least one cell. `scr_gen' and `row_gen'
+	 * hold the generation at which each cell and row last changed.
+	 * The screen is only regenerated if `scr_inval' is set, any of the
+	 * msglist or logon state changed, or SCR_REFRESH_INTVAL elapsed
+	 * (for inputs we can't track, such as the clock and `funcs').
+	 */
+	uint64_t		gen;
+	uint64_t		scr_gen[FMS_ROWS][FMS_COLS];
+	uint64_t		row_gen[FMS_ROWS];
+	bool			scr_inval;
+	unsigned		input_depth;
+	uint64_t		scr_regen_t;
+	uint64_t		msglist_gen;
+	cpdlc_logon_status_t	logon_status;
 	fans_funcs_t		funcs;
 	void			*userinfo;
 	fms_page_t		*page;
@@ -289,6 +305,18 @@ struct fans_s {
 
 	cpdlc_client_t	*cl;
 	cpdlc_msglist_t	*msglist;
+	/* cl & msglist belong to the caller of fans_alloc_shared */
+	bool		shared;
+	const fans_navdb_t *navdb;
+
+	/* Layout cache for fans_thr_lines */
+	struct {
+		char			**lines;
+		unsigned		n_lines;
+		cpdlc_msg_thr_id_t	thr_id;
+		unsigned		width;
+		unsigned		num_msgs;
+	} thr_lines;
 };
 
 enum {
@@ -356,14 +384,13 @@ void fans_put_wind(fans_t *box, int row, int col, bool align_right,
     const fms_wind_t *userwind, const fms_wind_t *autowind, bool req);
 
 const char *fans_thr_status2str(cpdlc_msg_thr_status_t st, bool dirty);
-void fans_msg2lines(const cpdlc_msg_t *msg, char ***lines_p,
+void fans_msg2lines(const cpdlc_msg_t *msg, unsigned width, char ***lines_p,
     unsigned *n_lines_p);
 void fans_thr2lines(cpdlc_msglist_t *msglist, cpdlc_msg_thr_id_t thr_id,
-    char ***lines_p, unsigned *n_lines_p);
-void fans_free_lines(char **lines, unsigned n_lines);
-
-cpdlc_msg_thr_id_t *fans_get_thr_ids(fans_t *box, unsigned *num_thr_ids,
-    bool ignore_closed);
+    unsigned width, char ***lines_p, unsigned *n_lines_p);
+void fans_free_lines(char **lines);
+char **fans_thr_lines(fans_t *box, cpdlc_msg_thr_id_t thr_id,
+    unsigned width, unsigned *n_lines_p);
 
 void fans_put_step_at(fans_t *box, const fms_step_at_t *step_at);
 void fans_key_step_at(fans_t *box, fms_key_t key, fms_step_at_t *step_at);
@@ -86,12 +86,17 @@ void
 fans_msg_log_draw_cb(fans_t *box)
 {
 	enum { MSG_LOG_LINES = 4 };
-	cpdlc_msg_thr_id_t *thr_ids;
-	unsigned num_thr_ids;
+	cpdlc_msglist_query_t query = {
+	    .ignore_closed = box->msg_log_open,
+	    .offset = box->subpage * MSG_LOG_LINES
+	};
+	cpdlc_msglist_thr_info_t infos[MSG_LOG_LINES];
+	unsigned num_infos, num_thr_ids;
 
 	ASSERT(box != NULL);
 
-	thr_ids = fans_get_thr_ids(box, &num_thr_ids, box->msg_log_open);
+	num_infos = cpdlc_msglist_query(box->msglist, &query, NULL, infos,
+	    MSG_LOG_LINES, &num_thr_ids);
 	if (num_thr_ids == 0) {
 		fans_set_num_subpages(box, 1);
 	} else {
@@ -101,19 +106,13 @@ fans_msg_log_draw_cb(fans_t *box)
 
 	fans_put_page_title(box, "CPDLC MESSAGE LOG");
 	fans_put_page_ind(box, FMS_COLOR_WHITE);
-	for (unsigned i = 0; i < MSG_LOG_LINES; i++) {
-		unsigned thr_i = i + box->subpage * MSG_LOG_LINES;
-		if (thr_i >= num_thr_ids)
-			break;
-		msg_log_draw_thr(box, thr_ids[thr_i], i);
-	}
+	for (unsigned i = 0; i < num_infos; i++)
+		msg_log_draw_thr(box, infos[i].thr_id, i);
 
 	fans_put_str(box, LSK_HEADER_ROW(LSK5_ROW), 0, true, FMS_COLOR_CYAN,
 	    FMS_FONT_SMALL, "FILTER");
 	fans_put_altn_selector(box, LSK5_ROW, true, !box->msg_log_open,
 	    "OPEN", "ALL", NULL);
-
-	free(thr_ids);
 }
 
 bool
@@ -124,17 +123,18 @@ fans_msg_log_key_cb(fans_t *box, fms_key_t key)
 	ASSERT(box != NULL);
 
 	if (key >= FMS_KEY_LSK_L1 && key <= FMS_KEY_LSK_L4) {
-		unsigned num_thr_ids;
-		cpdlc_msg_thr_id_t *thr_ids = fans_get_thr_ids(box,
-		    &num_thr_ids, box->msg_log_open);
-		unsigned thr_nr = (key - FMS_KEY_LSK_L1) +
-		    (box->subpage * MSG_LOG_LINES);
-
-		if (thr_nr < num_thr_ids) {
-			fans_set_thr_id(box, thr_ids[thr_nr]);
+		cpdlc_msglist_query_t query = {
+		    .ignore_closed = box->msg_log_open,
+		    .offset = (key - FMS_KEY_LSK_L1) +
+		    (box->subpage * MSG_LOG_LINES)
+		};
+		cpdlc_msglist_thr_info_t info;
+
+		if (cpdlc_msglist_query(box->msglist, &query, NULL, &info, 1,
+		    NULL) != 0) {
+			fans_set_thr_id(box, info.thr_id);
 			fans_set_page(box, FMS_PAGE_MSG_THR, true);
 		}
-		free(thr_ids);
 	} else if (key == FMS_KEY_LSK_R5) {
 		box->msg_log_open = !box->msg_log_open;
 	} else {
@@ -287,15 +287,15 @@ void
 fans_msg_thr_draw_cb(fans_t *box)
 {
 	enum { MAX_LINES = 5 };
-	char **lines = NULL;
-	unsigned n_lines = 0;
+	char **lines;
+	unsigned n_lines;
 
 	ASSERT(box != NULL);
 	ASSERT(box->thr_id != CPDLC_NO_MSG_THR_ID);
 
 	cpdlc_msglist_thr_mark_seen(box->msglist, box->thr_id);
 
-	fans_thr2lines(box->msglist, box->thr_id, &lines, &n_lines);
+	lines = fans_thr_lines(box, box->thr_id, FMS_COLS, &n_lines);
 	fans_set_num_subpages(box, ceil(n_lines / (double)MAX_LINES));
 
 	fans_put_page_title(box, "CPDLC MESSAGE");
@@ -309,8 +309,6 @@ fans_msg_thr_draw_cb(fans_t *box)
 		    FMS_FONT_LARGE, "%s", lines[line]);
 	}
 	draw_response_section(box);
-
-	fans_free_lines(lines, n_lines);
 }
 
 bool
@@ -0,0 +1,544 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Prebuilt navigation database index. The index file is a fixed header
+ * followed by an array of fixed-size records sorted by identifier and
+ * type, so it can be memory-mapped as-is and searched with a binary
+ * search, without any parsing or allocation at load time.
+ *
+ * The index is built by fans_navdb_build (see the `mknavdb' tool) from
+ * a plain-text source file with one entry per line:
+ *
+ *	<FIX|NAVAID|ARPT> <ident> <latitude> <longitude>
+ *
+ * Latitude and longitude are in decimal degrees, negative south and
+ * west. Blank lines and anything following a '#' are ignored.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef	_WIN32
+#define	strtok_r	strtok_s
+#define	strcasecmp	_stricmp
+#else	/* !_WIN32 */
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif	/* !_WIN32 */
+
+#include "../src/cpdlc_alloc.h"
+#include "../src/cpdlc_assert.h"
+#include "../src/cpdlc_string.h"
+
+#include "fans_navdb.h"
+
+/* Also serves as a byte order check, as the file is in host order */
+#define	NAVDB_MAGIC	0x46534e44u	/* "FSND" */
+#define	NAVDB_VERSION	1
+#define	COORD_SCALE	1e7
+#define	MAX_LINE_LEN	256
+
+typedef struct {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	num_recs;
+	uint32_t	rsvd;
+} navdb_hdr_t;
+
+typedef struct {
+	char		ident[FANS_NAVDB_IDENT_LEN];	/* NUL-padded */
+	uint8_t		type;				/* fans_navdb_type_t */
+	uint8_t		pad[3];
+	int32_t		lat;				/* 1e-7 degrees */
+	int32_t		lon;				/* 1e-7 degrees */
+} navdb_rec_t;
+
+CTASSERT(sizeof (navdb_hdr_t) == 16);
+CTASSERT(sizeof (navdb_rec_t) == 20);
+
+struct fans_navdb_s {
+	void			*base;
+	size_t			size;
+	const navdb_rec_t	*recs;
+	unsigned		num_recs;
+};
+
+static const char *type_names[FANS_NAVDB_NUM_TYPES] = {
+	"FIX", "NAVAID", "ARPT"
+};
+
+static int
+rec_key_compar(const char *ident, fans_navdb_type_t type,
+    const navdb_rec_t *rec)
+{
+	int res = strncmp(ident, rec->ident, FANS_NAVDB_IDENT_LEN);
+
+	if (res != 0)
+		return (res);
+	if ((unsigned)type < rec->type)
+		return (-1);
+	if ((unsigned)type > rec->type)
+		return (1);
+	return (0);
+}
+
+static int
+rec_compar(const void *a, const void *b)
+{
+	const navdb_rec_t *ra = a, *rb = b;
+	char ident[FANS_NAVDB_IDENT_LEN + 1] = { 0 };
+	int res;
+
+	memcpy(ident, ra->ident, FANS_NAVDB_IDENT_LEN);
+	res = rec_key_compar(ident, ra->type, rb);
+	if (res != 0)
+		return (res);
+	if (ra->lat != rb->lat)
+		return (ra->lat < rb->lat ? -1 : 1);
+	if (ra->lon != rb->lon)
+		return (ra->lon < rb->lon ? -1 : 1);
+	return (0);
+}
+
+static void
+rec2ent(const navdb_rec_t *rec, fans_navdb_ent_t *ent)
+{
+	memset(ent, 0, sizeof (*ent));
+	memcpy(ent->ident, rec->ident, FANS_NAVDB_IDENT_LEN - 1);
+	ent->type = rec->type;
+	ent->lat = rec->lat / COORD_SCALE;
+	ent->lon = rec->lon / COORD_SCALE;
+}
+
+/*
+ * Opens a navdb index built by fans_navdb_build. On POSIX systems, the
+ * file is memory-mapped, so its pages are shared between all processes
+ * using it. The records are checked once at open time for valid types
+ * and sort order, so that a corrupt index is rejected rather than
+ * producing bogus lookups.
+ */
+fans_navdb_t *
+fans_navdb_open(const char *path)
+{
+	fans_navdb_t *db;
+	const navdb_hdr_t *hdr;
+	void *base;
+	size_t size;
+#ifdef	_WIN32
+	FILE *fp = fopen(path, "rb");
+	long len;
+
+	ASSERT(path != NULL);
+	if (fp == NULL) {
+		fprintf(stderr, "Can't open navdb %s: %s\n", path,
+		    strerror(errno));
+		return (NULL);
+	}
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if (len < (long)sizeof (navdb_hdr_t)) {
+		fprintf(stderr, "Can't open navdb %s: file too short\n", path);
+		fclose(fp);
+		return (NULL);
+	}
+	size = len;
+	base = safe_malloc(size);
+	if (fread(base, 1, size, fp) != size) {
+		fprintf(stderr, "Can't read navdb %s\n", path);
+		free(base);
+		fclose(fp);
+		return (NULL);
+	}
+	fclose(fp);
+#else	/* !_WIN32 */
+	struct stat st;
+	int fd;
+
+	ASSERT(path != NULL);
+	fd = open(path, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		fprintf(stderr, "Can't open navdb %s: %s\n", path,
+		    strerror(errno));
+		if (fd != -1)
+			close(fd);
+		return (NULL);
+	}
+	if (st.st_size < (off_t)sizeof (navdb_hdr_t)) {
+		fprintf(stderr, "Can't open navdb %s: file too short\n", path);
+		close(fd);
+		return (NULL);
+	}
+	size = st.st_size;
+	base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		fprintf(stderr, "Can't map navdb %s: %s\n", path,
+		    strerror(errno));
+		return (NULL);
+	}
+#endif	/* !_WIN32 */
+
+	db = safe_calloc(1, sizeof (*db));
+	db->base = base;
+	db->size = size;
+
+	hdr = base;
+	if (hdr->magic != NAVDB_MAGIC || hdr->version != NAVDB_VERSION ||
+	    size != sizeof (*hdr) + (size_t)hdr->num_recs *
+	    sizeof (navdb_rec_t)) {
+		fprintf(stderr, "Can't open navdb %s: bad header or "
+		    "unsupported version\n", path);
+		fans_navdb_close(db);
+		return (NULL);
+	}
+	db->recs = (const navdb_rec_t *)&hdr[1];
+	db->num_recs = hdr->num_recs;
+	/*
+	 * Callers use the entry type as a table index and lookups rely on
+	 * the binary search order, so a damaged file mustn't get past here.
+	 */
+	for (unsigned i = 0; i < db->num_recs; i++) {
+		if (db->recs[i].type >= FANS_NAVDB_NUM_TYPES ||
+		    (i != 0 && rec_compar(&db->recs[i - 1],
+		    &db->recs[i]) > 0)) {
+			fprintf(stderr, "Can't open navdb %s: record %u is "
+			    "invalid or out of order\n", path, i);
+			fans_navdb_close(db);
+			return (NULL);
+		}
+	}
+
+	return (db);
+}
+
+void
+fans_navdb_close(fans_navdb_t *db)
+{
+	if (db == NULL)
+		return;
+#ifdef	_WIN32
+	free(db->base);
+#else
+	munmap(db->base, db->size);
+#endif
+	free(db);
+}
+
+unsigned
+fans_navdb_get_num_ents(const fans_navdb_t *db)
+{
+	ASSERT(db != NULL);
+	return (db->num_recs);
+}
+
+/*
+ * Returns the index of the first record matching `ident' and `type',
+ * or the index where such a record would be inserted.
+ */
+static unsigned
+lower_bound(const fans_navdb_t *db, const char *ident, fans_navdb_type_t type)
+{
+	unsigned lo = 0, hi = db->num_recs;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+
+		if (rec_key_compar(ident, type, &db->recs[mid]) > 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo);
+}
+
+/*
+ * Looks up all entries with a given identifier and type. Up to
+ * `max_ents' of them are returned in `ents' (which may be NULL if
+ * `max_ents' is 0). Returns the total number of matching entries.
+ */
+unsigned
+fans_navdb_lookup(const fans_navdb_t *db, const char *ident,
+    fans_navdb_type_t type, fans_navdb_ent_t *ents, unsigned max_ents)
+{
+	unsigned n = 0;
+
+	ASSERT(db != NULL);
+	ASSERT(ident != NULL);
+	ASSERT3U(type, <, FANS_NAVDB_NUM_TYPES);
+	ASSERT(ents != NULL || max_ents == 0);
+
+	if (strlen(ident) >= FANS_NAVDB_IDENT_LEN)
+		return (0);
+	for (unsigned i = lower_bound(db, ident, type); i < db->num_recs &&
+	    rec_key_compar(ident, type, &db->recs[i]) == 0; i++, n++) {
+		if (n < max_ents)
+			rec2ent(&db->recs[i], &ents[n]);
+	}
+	return (n);
+}
+
+/*
+ * Equirectangular approximation of the squared angular distance. This
+ * is only used to rank same-named entries, which tend to be hundreds of
+ * miles apart, so we don't need the precision of a great circle.
+ */
+static double
+dist2(double lat1, double lon1, double lat2, double lon2)
+{
+	double dlon = fmod(lon2 - lon1 + 540, 360) - 180;
+	double x = dlon * cos(((lat1 + lat2) / 2) * (M_PI / 180));
+	double y = lat2 - lat1;
+
+	return (x * x + y * y);
+}
+
+/*
+ * Looks up the entry with a given identifier and type, picking the one
+ * closest to `lat' and `lon' if the identifier isn't unique. Returns
+ * false if there is no such entry.
+ */
+bool
+fans_navdb_lookup_nearest(const fans_navdb_t *db, const char *ident,
+    fans_navdb_type_t type, double lat, double lon, fans_navdb_ent_t *ent)
+{
+	const navdb_rec_t *best = NULL;
+	double best_d = 0;
+
+	ASSERT(db != NULL);
+	ASSERT(ident != NULL);
+	ASSERT3U(type, <, FANS_NAVDB_NUM_TYPES);
+	ASSERT(ent != NULL);
+
+	if (strlen(ident) >= FANS_NAVDB_IDENT_LEN)
+		return (false);
+	for (unsigned i = lower_bound(db, ident, type); i < db->num_recs &&
+	    rec_key_compar(ident, type, &db->recs[i]) == 0; i++) {
+		const navdb_rec_t *rec = &db->recs[i];
+		double d = dist2(lat, lon, rec->lat / COORD_SCALE,
+		    rec->lon / COORD_SCALE);
+
+		if (best == NULL || d < best_d) {
+			best = rec;
+			best_d = d;
+		}
+	}
+	if (best == NULL)
+		return (false);
+	rec2ent(best, ent);
+
+	return (true);
+}
+
+static bool
+parse_line(char *line, navdb_rec_t *rec, const char *src_path,
+    unsigned line_nr)
+{
+	char *type_str, *ident, *lat_str, *lon_str, *end, *saveptr = NULL;
+	double lat, lon;
+	int type = -1;
+
+	type_str = strtok_r(line, " \t", &saveptr);
+	ident = strtok_r(NULL, " \t", &saveptr);
+	lat_str = strtok_r(NULL, " \t", &saveptr);
+	lon_str = strtok_r(NULL, " \t", &saveptr);
+	if (lon_str == NULL || strtok_r(NULL, " \t", &saveptr) != NULL) {
+		fprintf(stderr, "%s:%u: expected 4 fields\n", src_path,
+		    line_nr);
+		return (false);
+	}
+	for (int i = 0; i < FANS_NAVDB_NUM_TYPES; i++) {
+		if (strcasecmp(type_str, type_names[i]) == 0)
+			type = i;
+	}
+	if (type == -1) {
+		fprintf(stderr, "%s:%u: unknown entry type \"%s\"\n",
+		    src_path, line_nr, type_str);
+		return (false);
+	}
+	if (strlen(ident) >= FANS_NAVDB_IDENT_LEN) {
+		fprintf(stderr, "%s:%u: identifier \"%s\" too long\n",
+		    src_path, line_nr, ident);
+		return (false);
+	}
+	lat = strtod(lat_str, &end);
+	if (*end != '\0' || !isfinite(lat) || lat < -90 || lat > 90) {
+		fprintf(stderr, "%s:%u: invalid latitude \"%s\"\n",
+		    src_path, line_nr, lat_str);
+		return (false);
+	}
+	lon = strtod(lon_str, &end);
+	if (*end != '\0' || !isfinite(lon) || lon < -180 || lon > 180) {
+		fprintf(stderr, "%s:%u: invalid longitude \"%s\"\n",
+		    src_path, line_nr, lon_str);
+		return (false);
+	}
+
+	memset(rec, 0, sizeof (*rec));
+	for (int i = 0; ident[i] != '\0'; i++)
+		rec->ident[i] = toupper(ident[i]);
+	rec->type = type;
+	rec->lat = lrint(lat * COORD_SCALE);
+	rec->lon = lrint(lon * COORD_SCALE);
+
+	return (true);
+}
+
+static bool
+write_index(const char *dst_path, const navdb_rec_t *recs, unsigned n)
+{
+	navdb_hdr_t hdr = {
+	    .magic = NAVDB_MAGIC,
+	    .version = NAVDB_VERSION,
+	    .num_recs = n
+	};
+	size_t tmp_len = strlen(dst_path) + 5;
+	char *tmp_path = safe_malloc(tmp_len);
+	FILE *fp;
+	bool result = true;
+
+	/*
+	 * Write to a temporary file and rename it into place, so that
+	 * processes which have the old index mapped aren't disturbed.
+	 */
+	snprintf(tmp_path, tmp_len, "%s.tmp", dst_path);
+	fp = fopen(tmp_path, "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "Can't create %s: %s\n", tmp_path,
+		    strerror(errno));
+		free(tmp_path);
+		return (false);
+	}
+	if (fwrite(&hdr, sizeof (hdr), 1, fp) != 1 ||
+	    (n != 0 && fwrite(recs, sizeof (*recs), n, fp) != n)) {
+		fprintf(stderr, "Error writing %s: %s\n", tmp_path,
+		    strerror(errno));
+		result = false;
+	}
+	if (fclose(fp) != 0)
+		result = false;
+#ifdef	_WIN32
+	if (result)
+		remove(dst_path);
+#endif
+	if (result && rename(tmp_path, dst_path) != 0) {
+		fprintf(stderr, "Can't rename %s to %s: %s\n", tmp_path,
+		    dst_path, strerror(errno));
+		result = false;
+	}
+	if (!result)
+		remove(tmp_path);
+	free(tmp_path);
+
+	return (result);
+}
+
+/*
+ * Builds a navdb index at `dst_path' from the text source file at
+ * `src_path'. Exact duplicate entries are dropped. On success, the
+ * number of entries written is returned in `num_ents' (optional).
+ */
+bool
+fans_navdb_build(const char *src_path, const char *dst_path,
+    unsigned *num_ents)
+{
+	FILE *fp;
+	char line[MAX_LINE_LEN];
+	navdb_rec_t *recs = NULL;
+	unsigned num_recs = 0, cap = 0, line_nr = 0, n_uniq = 0;
+	bool result = true;
+
+	ASSERT(src_path != NULL);
+	ASSERT(dst_path != NULL);
+
+	fp = fopen(src_path, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "Can't open %s: %s\n", src_path,
+		    strerror(errno));
+		return (false);
+	}
+	while (fgets(line, sizeof (line), fp) != NULL) {
+		char *comment;
+
+		line_nr++;
+		/*
+		 * fgets splits longer lines, so only the last line in the
+		 * file may lack its newline.
+		 */
+		if (strchr(line, '\n') == NULL && getc(fp) != EOF) {
+			fprintf(stderr, "%s:%u: line too long (max %d "
+			    "characters)\n", src_path, line_nr,
+			    MAX_LINE_LEN - 2);
+			result = false;
+			break;
+		}
+		comment = strchr(line, '#');
+		if (comment != NULL)
+			*comment = '\0';
+		line[strcspn(line, "\r\n")] = '\0';
+		if (strspn(line, " \t") == strlen(line))
+			continue;
+		if (num_recs == cap) {
+			cap = (cap != 0 ? cap * 2 : 1024);
+			recs = safe_realloc(recs, cap * sizeof (*recs));
+		}
+		if (!parse_line(line, &recs[num_recs], src_path, line_nr)) {
+			result = false;
+			break;
+		}
+		num_recs++;
+	}
+	if (result && ferror(fp)) {
+		fprintf(stderr, "Error reading %s: %s\n", src_path,
+		    strerror(errno));
+		result = false;
+	}
+	fclose(fp);
+
+	if (result) {
+		qsort(recs, num_recs, sizeof (*recs), rec_compar);
+		for (unsigned i = 0; i < num_recs; i++) {
+			if (n_uniq == 0 ||
+			    rec_compar(&recs[n_uniq - 1], &recs[i]) != 0)
+				recs[n_uniq++] = recs[i];
+		}
+		result = write_index(dst_path, recs, n_uniq);
+	}
+	if (result && num_ents != NULL)
+		*num_ents = n_uniq;
+	free(recs);
+
+	return (result);
+}
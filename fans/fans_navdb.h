@@ -0,0 +1,69 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef	_LIBCPDLC_FANS_NAVDB_H_
+#define	_LIBCPDLC_FANS_NAVDB_H_
+
+#include <stdbool.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define	FANS_NAVDB_IDENT_LEN	8
+
+typedef struct fans_navdb_s fans_navdb_t;
+
+typedef enum {
+	FANS_NAVDB_FIX,
+	FANS_NAVDB_NAVAID,
+	FANS_NAVDB_ARPT,
+	FANS_NAVDB_NUM_TYPES
+} fans_navdb_type_t;
+
+typedef struct {
+	char			ident[FANS_NAVDB_IDENT_LEN];
+	fans_navdb_type_t	type;
+	double			lat;
+	double			lon;
+} fans_navdb_ent_t;
+
+fans_navdb_t *fans_navdb_open(const char *path);
+void fans_navdb_close(fans_navdb_t *db);
+unsigned fans_navdb_get_num_ents(const fans_navdb_t *db);
+
+unsigned fans_navdb_lookup(const fans_navdb_t *db, const char *ident,
+    fans_navdb_type_t type, fans_navdb_ent_t *ents, unsigned max_ents);
+bool fans_navdb_lookup_nearest(const fans_navdb_t *db, const char *ident,
+    fans_navdb_type_t type, double lat, double lon, fans_navdb_ent_t *ent);
+
+bool fans_navdb_build(const char *src_path, const char *dst_path,
+    unsigned *num_ents);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _LIBCPDLC_FANS_NAVDB_H_ */
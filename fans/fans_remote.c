@@ -0,0 +1,573 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef	_WIN32
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif	/* !_WIN32 */
+
+#include "../src/cpdlc_alloc.h"
+#include "../src/cpdlc_assert.h"
+#include "../src/cpdlc_string.h"
+#include "../src/minilist.h"
+
+#include "fans_remote.h"
+
+#define	CELL_SZ		2
+#define	RUN_HDR_SZ	3
+
+static void
+put_le16(uint8_t *p, uint16_t x)
+{
+	p[0] = x & 0xff;
+	p[1] = x >> 8;
+}
+
+static void
+put_le64(uint8_t *p, uint64_t x)
+{
+	for (int i = 0; i < 8; i++)
+		p[i] = (x >> (8 * i)) & 0xff;
+}
+
+static uint16_t
+get_le16(const uint8_t *p)
+{
+	return (p[0] | (p[1] << 8));
+}
+
+static uint64_t
+get_le64(const uint8_t *p)
+{
+	uint64_t x = 0;
+
+	for (int i = 0; i < 8; i++)
+		x |= (uint64_t)p[i] << (8 * i);
+	return (x);
+}
+
+static uint8_t *
+put_run(uint8_t *p, const fms_char_t *row_chars, unsigned row,
+    unsigned col, unsigned n)
+{
+	*p++ = row;
+	*p++ = col;
+	*p++ = n;
+	for (unsigned i = col; i < col + n; i++) {
+		*p++ = row_chars[i].c;
+		*p++ = row_chars[i].color | (row_chars[i].size << 3);
+	}
+	return (p);
+}
+
+static bool
+cell_changed(const fans_t *box, unsigned row, unsigned col,
+    uint64_t since_gen)
+{
+	return (fans_get_cell_gen(box, row, col) > since_gen);
+}
+
+/*
+ * Encodes a frame into `buf'. For diffs, consecutive changed cells are
+ * grouped into runs. A single unchanged cell between two changed ones
+ * is cheaper to resend than to start a new run for, so it's included.
+ */
+static size_t
+export_frame(const fans_t *box, bool keyframe, uint64_t since_gen,
+    uint8_t *buf, size_t cap)
+{
+	unsigned dirty_rows;
+	uint8_t *p;
+
+	ASSERT(box != NULL);
+	ASSERT(buf != NULL);
+	ASSERT3U(cap, >=, FANS_FRAME_MAX_SZ);
+
+	dirty_rows = (keyframe ? (1u << FMS_ROWS) - 1 :
+	    fans_get_dirty_rows(box, since_gen));
+	if (dirty_rows == 0)
+		return (0);
+
+	p = &buf[FANS_FRAME_HDR_SZ];
+	for (unsigned row = 0; row < FMS_ROWS; row++) {
+		const fms_char_t *row_chars;
+
+		if ((dirty_rows & (1u << row)) == 0)
+			continue;
+		row_chars = fans_get_screen_row(box, row);
+		if (keyframe) {
+			p = put_run(p, row_chars, row, 0, FMS_COLS);
+			continue;
+		}
+		for (unsigned col = 0; col < FMS_COLS;) {
+			unsigned end;
+
+			if (!cell_changed(box, row, col, since_gen)) {
+				col++;
+				continue;
+			}
+			end = col + 1;
+			while (end < FMS_COLS) {
+				if (cell_changed(box, row, end, since_gen)) {
+					end++;
+				} else if (end + 1 < FMS_COLS &&
+				    cell_changed(box, row, end + 1,
+				    since_gen)) {
+					end += 2;
+				} else {
+					break;
+				}
+			}
+			p = put_run(p, row_chars, row, col, end - col);
+			col = end;
+		}
+	}
+
+	buf[0] = FANS_FRAME_MAGIC;
+	buf[1] = (keyframe ? FANS_FRAME_KEYFRAME : FANS_FRAME_DIFF);
+	put_le16(&buf[2], (p - buf) - FANS_FRAME_HDR_SZ);
+	put_le64(&buf[4], keyframe ? 0 : since_gen);
+	put_le64(&buf[12], fans_get_gen(box));
+	ASSERT3U((size_t)(p - buf), <=, cap);
+
+	return (p - buf);
+}
+
+/*
+ * Encodes the entire screen into `buf', which must be at least
+ * FANS_FRAME_MAX_SZ bytes long. Returns the number of bytes written.
+ */
+size_t
+fans_export_keyframe(const fans_t *box, uint8_t *buf, size_t cap)
+{
+	return (export_frame(box, true, 0, buf, cap));
+}
+
+/*
+ * Encodes the cells which have changed after generation `since_gen'
+ * into `buf', which must be at least FANS_FRAME_MAX_SZ bytes long.
+ * Returns the number of bytes written, or 0 if nothing has changed.
+ */
+size_t
+fans_export_diff(const fans_t *box, uint64_t since_gen, uint8_t *buf,
+    size_t cap)
+{
+	return (export_frame(box, false, since_gen, buf, cap));
+}
+
+/*
+ * Applies a single frame from `buf' to the screen `scr'. `gen' holds
+ * the generation of `scr' and is updated on success. A diff whose base
+ * generation doesn't match `gen' is rejected, since applying it would
+ * leave the screen inconsistent.
+ *
+ * @return The number of bytes consumed from `buf', 0 if `buf' doesn't
+ *	contain a complete frame yet, or -1 if the frame is malformed or
+ *	can't be applied. The receiver should resynchronize to a new
+ *	keyframe in that case.
+ */
+int
+fans_import_frame(fms_char_t scr[FMS_ROWS][FMS_COLS], uint64_t *gen,
+    const uint8_t *buf, size_t len)
+{
+	unsigned payload_len;
+	const uint8_t *p, *end;
+	bool keyframe;
+
+	ASSERT(scr != NULL);
+	ASSERT(gen != NULL);
+	ASSERT(buf != NULL || len == 0);
+
+	if (len < FANS_FRAME_HDR_SZ)
+		return (0);
+	if (buf[0] != FANS_FRAME_MAGIC || (buf[1] != FANS_FRAME_KEYFRAME &&
+	    buf[1] != FANS_FRAME_DIFF))
+		return (-1);
+	keyframe = (buf[1] == FANS_FRAME_KEYFRAME);
+	payload_len = get_le16(&buf[2]);
+	if (payload_len > FANS_FRAME_MAX_SZ - FANS_FRAME_HDR_SZ)
+		return (-1);
+	if (len < FANS_FRAME_HDR_SZ + payload_len)
+		return (0);
+	if (!keyframe && get_le64(&buf[4]) != *gen)
+		return (-1);
+	end = &buf[FANS_FRAME_HDR_SZ + payload_len];
+
+	/* Validate everything first, so we never apply half a frame */
+	for (p = &buf[FANS_FRAME_HDR_SZ]; p < end;) {
+		unsigned row, col, n;
+
+		if (end - p < RUN_HDR_SZ)
+			return (-1);
+		row = p[0];
+		col = p[1];
+		n = p[2];
+		p += RUN_HDR_SZ;
+		if (row >= FMS_ROWS || n == 0 || col + n > FMS_COLS ||
+		    (unsigned)(end - p) < n * CELL_SZ)
+			return (-1);
+		for (unsigned i = 0; i < n; i++, p += CELL_SZ) {
+			if ((p[1] & 7) > FMS_COLOR_MAGENTA ||
+			    (p[1] >> 3) > FMS_FONT_LARGE)
+				return (-1);
+		}
+	}
+	for (p = &buf[FANS_FRAME_HDR_SZ]; p < end;) {
+		unsigned row = p[0], col = p[1], n = p[2];
+
+		p += RUN_HDR_SZ;
+		for (unsigned i = col; i < col + n; i++, p += CELL_SZ) {
+			scr[row][i].c = p[0];
+			scr[row][i].color = p[1] & 7;
+			scr[row][i].size = p[1] >> 3;
+		}
+	}
+	*gen = get_le64(&buf[12]);
+
+	return (FANS_FRAME_HDR_SZ + payload_len);
+}
+
+#ifndef	_WIN32
+
+#define	MAX_LISTENERS	4
+#define	MAX_SUBS	64
+#define	LISTEN_BACKLOG	8
+
+#ifndef	MSG_NOSIGNAL
+#define	MSG_NOSIGNAL	0
+#endif
+
+/*
+ * A subscriber only ever has a single frame outstanding. New frames are
+ * only encoded once the previous one has been fully written out, and
+ * since a diff covers everything since the last frame we sent, a slow
+ * subscriber simply receives fewer, larger diffs rather than growing an
+ * unbounded backlog.
+ */
+typedef struct {
+	int		fd;
+	uint8_t		buf[FANS_FRAME_MAX_SZ];
+	size_t		len;
+	size_t		off;
+	bool		keyframe_sent;
+	uint64_t	sent_gen;
+	list_node_t	node;
+} sub_t;
+
+struct fans_remote_srv_s {
+	const fans_t	*box;
+	int		listen_fds[MAX_LISTENERS];
+	unsigned	num_listeners;
+	char		*unix_paths[MAX_LISTENERS];
+	list_t		subs;
+};
+
+static bool
+set_nonblock(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+
+	return (flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1);
+}
+
+fans_remote_srv_t *
+fans_remote_srv_alloc(const fans_t *box)
+{
+	fans_remote_srv_t *srv = safe_calloc(1, sizeof (*srv));
+
+	ASSERT(box != NULL);
+	srv->box = box;
+	list_create(&srv->subs, sizeof (sub_t), offsetof(sub_t, node));
+
+	return (srv);
+}
+
+static void
+sub_free(sub_t *sub)
+{
+	close(sub->fd);
+	free(sub);
+}
+
+void
+fans_remote_srv_free(fans_remote_srv_t *srv)
+{
+	sub_t *sub;
+
+	if (srv == NULL)
+		return;
+	while ((sub = list_remove_head(&srv->subs)) != NULL)
+		sub_free(sub);
+	list_destroy(&srv->subs);
+	for (unsigned i = 0; i < srv->num_listeners; i++) {
+		close(srv->listen_fds[i]);
+		if (srv->unix_paths[i] != NULL) {
+			unlink(srv->unix_paths[i]);
+			free(srv->unix_paths[i]);
+		}
+	}
+	free(srv);
+}
+
+static bool
+start_listen(int fd)
+{
+	return (set_nonblock(fd) && listen(fd, LISTEN_BACKLOG) != -1);
+}
+
+static void
+add_listener(fans_remote_srv_t *srv, int fd, const char *unix_path)
+{
+	ASSERT3U(srv->num_listeners, <, MAX_LISTENERS);
+	srv->listen_fds[srv->num_listeners] = fd;
+	if (unix_path != NULL)
+		srv->unix_paths[srv->num_listeners] = strdup(unix_path);
+	srv->num_listeners++;
+}
+
+/*
+ * Starts listening for remote display connections on a TCP port. If
+ * `addr' is NULL, we listen on all local addresses. The addresses
+ * returned by the resolver are tried in order until one of them can be
+ * bound to, so that e.g. an unavailable IPv6 stack doesn't prevent us
+ * from listening on IPv4.
+ */
+bool
+fans_remote_srv_listen_tcp(fans_remote_srv_t *srv, const char *addr,
+    unsigned port)
+{
+	struct addrinfo hints = {
+	    .ai_family = AF_UNSPEC,
+	    .ai_socktype = SOCK_STREAM,
+	    .ai_flags = AI_PASSIVE
+	};
+	struct addrinfo *ai_full;
+	char portbuf[16];
+	int fd = -1, error, saved_errno = 0;
+
+	ASSERT(srv != NULL);
+	ASSERT(port != 0);
+	if (srv->num_listeners == MAX_LISTENERS)
+		return (false);
+
+	snprintf(portbuf, sizeof (portbuf), "%u", port);
+	error = getaddrinfo(addr, portbuf, &hints, &ai_full);
+	if (error != 0) {
+		fprintf(stderr, "Can't resolve %s: %s\n",
+		    addr != NULL ? addr : "<any>", gai_strerror(error));
+		return (false);
+	}
+	for (const struct addrinfo *ai = ai_full; ai != NULL;
+	    ai = ai->ai_next) {
+		int one = 1;
+
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd == -1) {
+			saved_errno = errno;
+			continue;
+		}
+		(void) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one,
+		    sizeof (one));
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) != -1 &&
+		    start_listen(fd))
+			break;
+		saved_errno = errno;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(ai_full);
+	if (fd == -1) {
+		fprintf(stderr, "Can't listen for remote displays on "
+		    "port %u: %s\n", port, strerror(saved_errno));
+		return (false);
+	}
+	add_listener(srv, fd, NULL);
+
+	return (true);
+}
+
+/*
+ * Starts listening for remote display connections on a UNIX socket.
+ * Any stale socket file at `path' is removed first.
+ */
+bool
+fans_remote_srv_listen_unix(fans_remote_srv_t *srv, const char *path)
+{
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	int fd;
+
+	ASSERT(srv != NULL);
+	ASSERT(path != NULL);
+	if (srv->num_listeners == MAX_LISTENERS ||
+	    strlen(path) >= sizeof (sa.sun_path))
+		return (false);
+
+	cpdlc_strlcpy(sa.sun_path, path, sizeof (sa.sun_path));
+	unlink(path);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1 ||
+	    bind(fd, (struct sockaddr *)&sa, sizeof (sa)) == -1 ||
+	    !start_listen(fd)) {
+		fprintf(stderr, "Can't listen for remote displays on %s: "
+		    "%s\n", path, strerror(errno));
+		if (fd != -1)
+			close(fd);
+		return (false);
+	}
+	add_listener(srv, fd, path);
+
+	return (true);
+}
+
+static void
+accept_subs(fans_remote_srv_t *srv)
+{
+	for (unsigned i = 0; i < srv->num_listeners; i++) {
+		int fd;
+
+		while ((fd = accept(srv->listen_fds[i], NULL, NULL)) != -1) {
+			sub_t *sub;
+#ifdef	SO_NOSIGPIPE
+			int one = 1;
+
+			(void) setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one,
+			    sizeof (one));
+#endif
+			if (list_count(&srv->subs) >= MAX_SUBS ||
+			    !set_nonblock(fd)) {
+				close(fd);
+				continue;
+			}
+			sub = safe_calloc(1, sizeof (*sub));
+			sub->fd = fd;
+			list_insert_tail(&srv->subs, sub);
+		}
+	}
+}
+
+/*
+ * Subscribers don't send us anything, so we just discard any input and
+ * use this to detect when the remote end has gone away.
+ */
+static bool
+sub_poll_input(sub_t *sub)
+{
+	uint8_t buf[256];
+
+	for (;;) {
+		ssize_t n = recv(sub->fd, buf, sizeof (buf), 0);
+
+		if (n > 0)
+			continue;
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return (true);
+		if (n == -1 && errno == EINTR)
+			continue;
+		return (false);
+	}
+}
+
+static bool
+sub_flush(sub_t *sub)
+{
+	while (sub->off < sub->len) {
+		ssize_t n = send(sub->fd, &sub->buf[sub->off],
+		    sub->len - sub->off, MSG_NOSIGNAL);
+
+		if (n == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return (true);
+			if (errno == EINTR)
+				continue;
+			return (false);
+		}
+		sub->off += n;
+	}
+	return (true);
+}
+
+/*
+ * Accepts new subscribers and streams screen updates to existing ones.
+ * Call this after fans_update from the same thread that drives the box.
+ */
+void
+fans_remote_srv_update(fans_remote_srv_t *srv)
+{
+	uint64_t gen;
+
+	ASSERT(srv != NULL);
+
+	accept_subs(srv);
+	gen = fans_get_gen(srv->box);
+
+	for (sub_t *sub = list_head(&srv->subs), *sub_next = NULL;
+	    sub != NULL; sub = sub_next) {
+		sub_next = list_next(&srv->subs, sub);
+
+		if (!sub_poll_input(sub)) {
+			list_remove(&srv->subs, sub);
+			sub_free(sub);
+			continue;
+		}
+		if (sub->off == sub->len) {
+			sub->off = 0;
+			if (!sub->keyframe_sent) {
+				sub->len = fans_export_keyframe(srv->box,
+				    sub->buf, sizeof (sub->buf));
+				sub->keyframe_sent = true;
+				sub->sent_gen = gen;
+			} else if (sub->sent_gen != gen) {
+				sub->len = fans_export_diff(srv->box,
+				    sub->sent_gen, sub->buf,
+				    sizeof (sub->buf));
+				if (sub->len != 0)
+					sub->sent_gen = gen;
+			} else {
+				sub->len = 0;
+			}
+		}
+		if (!sub_flush(sub)) {
+			list_remove(&srv->subs, sub);
+			sub_free(sub);
+		}
+	}
+}
+
+unsigned
+fans_remote_srv_get_num_subs(const fans_remote_srv_t *srv)
+{
+	ASSERT(srv != NULL);
+	return (list_count(&srv->subs));
+}
+
+#endif	/* !_WIN32 */
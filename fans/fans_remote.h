@@ -0,0 +1,87 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef	_LIBCPDLC_FANS_REMOTE_H_
+#define	_LIBCPDLC_FANS_REMOTE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fans.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Screen frame wire format. All integers are little-endian.
+ *
+ *	u8	magic (FANS_FRAME_MAGIC)
+ *	u8	type (FANS_FRAME_KEYFRAME or FANS_FRAME_DIFF)
+ *	u16	payload length in bytes, excluding this header
+ *	u64	base generation (the receiver's generation a diff applies to)
+ *	u64	generation of the screen after applying the frame
+ *	...	runs of changed cells:
+ *		u8	row
+ *		u8	starting column
+ *		u8	number of cells in the run
+ *		...	cells, 2 bytes each: char, color | (size << 3)
+ *
+ * A keyframe contains one run for every row and ignores the base gen.
+ */
+#define	FANS_FRAME_MAGIC	0xFA
+#define	FANS_FRAME_KEYFRAME	'K'
+#define	FANS_FRAME_DIFF		'D'
+#define	FANS_FRAME_HDR_SZ	20
+#define	FANS_FRAME_MAX_SZ	\
+	(FANS_FRAME_HDR_SZ + FMS_ROWS * (3 + 2 * FMS_COLS))
+
+size_t fans_export_keyframe(const fans_t *box, uint8_t *buf, size_t cap);
+size_t fans_export_diff(const fans_t *box, uint64_t since_gen, uint8_t *buf,
+    size_t cap);
+int fans_import_frame(fms_char_t scr[FMS_ROWS][FMS_COLS], uint64_t *gen,
+    const uint8_t *buf, size_t len);
+
+#ifndef	_WIN32
+
+typedef struct fans_remote_srv_s fans_remote_srv_t;
+
+fans_remote_srv_t *fans_remote_srv_alloc(const fans_t *box);
+void fans_remote_srv_free(fans_remote_srv_t *srv);
+
+bool fans_remote_srv_listen_tcp(fans_remote_srv_t *srv, const char *addr,
+    unsigned port);
+bool fans_remote_srv_listen_unix(fans_remote_srv_t *srv, const char *path);
+
+void fans_remote_srv_update(fans_remote_srv_t *srv);
+unsigned fans_remote_srv_get_num_subs(const fans_remote_srv_t *srv);
+
+#endif	/* !_WIN32 */
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _LIBCPDLC_FANS_REMOTE_H_ */
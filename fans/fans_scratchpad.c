@@ -252,14 +252,57 @@ fans_scratchpad_xfer_alt(fans_t *box, cpdlc_arg_t *useralt,
 		memset(useralt, 0, sizeof (*useralt));
 }
 
+/*
+ * If a navdb is set, checks that a named position exists and fills in
+ * its coordinates. Ambiguous identifiers resolve to the entry closest
+ * to our present position, if we know it.
+ */
+static const char *
+resolve_pos(fans_t *box, fms_pos_t *pos)
+{
+	static const fans_navdb_type_t types[] = {
+	    [FMS_POS_NAVAID] = FANS_NAVDB_NAVAID,
+	    [FMS_POS_ARPT] = FANS_NAVDB_ARPT,
+	    [FMS_POS_FIX] = FANS_NAVDB_FIX
+	};
+	fans_navdb_ent_t ent;
+	double lat = 0, lon = 0;
+	bool found;
+
+	if (box->navdb == NULL || !pos->set || pos->type > FMS_POS_FIX)
+		return (NULL);
+	if (box->funcs.get_cur_pos != NULL &&
+	    box->funcs.get_cur_pos(box->userinfo, &lat, &lon)) {
+		found = fans_navdb_lookup_nearest(box->navdb, pos->name,
+		    types[pos->type], lat, lon, &ent);
+	} else {
+		found = (fans_navdb_lookup(box->navdb, pos->name,
+		    types[pos->type], &ent, 1) != 0);
+	}
+	if (!found)
+		return ("NOT IN DATA BASE");
+	pos->lat = ent.lat;
+	pos->lon = ent.lon;
+
+	return (NULL);
+}
+
 void
 fans_scratchpad_xfer_pos_impl(fans_t *box, fms_pos_t *pos)
 {
 	char buf[32];
+	fms_pos_t tmp = *pos;
+	const char *error;
 
 	fans_print_pos(pos, buf, sizeof (buf), POS_PRINT_NORM);
 	fans_scratchpad_xfer(box, buf, sizeof (buf), true);
-	fans_set_error(box, fans_parse_pos(buf, pos));
+	/* Only modify `pos' once the new entry is known to be good */
+	error = fans_parse_pos(buf, &tmp);
+	if (error == NULL)
+		error = resolve_pos(box, &tmp);
+	if (error == NULL)
+		*pos = tmp;
+	fans_set_error(box, error);
 }
 
 void
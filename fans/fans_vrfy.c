@@ -53,13 +53,13 @@ void
 fans_vrfy_draw_cb(fans_t *box)
 {
 	enum { MAX_LINES = 8 };
-	char **lines = NULL;
-	unsigned n_lines = 0;
+	char **lines;
+	unsigned n_lines;
 
 	ASSERT(box != NULL);
 	ASSERT(box->verify.msg != NULL);
 
-	fans_msg2lines(box->verify.msg, &lines, &n_lines);
+	fans_msg2lines(box->verify.msg, FMS_COLS, &lines, &n_lines);
 	ASSERT(n_lines != 0);
 	fans_set_num_subpages(box, ceil(n_lines / (double)MAX_LINES));
 
@@ -78,7 +78,7 @@ fans_vrfy_draw_cb(fans_t *box)
 	fans_put_lsk_action(box, FMS_KEY_LSK_R5, FMS_COLOR_CYAN, "SEND*");
 	fans_put_lsk_action(box, FMS_KEY_LSK_L6, FMS_COLOR_WHITE, "<RETURN");
 
-	fans_free_lines(lines, n_lines);
+	fans_free_lines(lines);
 }
 
 bool
@@ -24,11 +24,14 @@
  */
 
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #ifdef	_WIN32
 #include <windows.h>
@@ -37,6 +40,7 @@
 #include <acfutils/glew.h>
 #include <acfutils/log.h>
 #include <acfutils/png.h>
+#include <acfutils/safe_alloc.h>
 #include <acfutils/time.h>
 
 #include <GLFW/glfw3.h>
@@ -44,9 +48,11 @@
 #include <cglm/cglm.h>
 
 #include "../fans/fans.h"
+#include "../fans/fans_remote.h"
 #include "mtcr_mini.h"
 
 #define	EVENT_POLL_TIMEOUT	0.1	/* seconds */
+#define	HEADLESS_DFL_DURATION	10	/* seconds */
 
 typedef struct {
 	double	x, y, w, h;
@@ -56,10 +62,27 @@ typedef struct {
 
 static GLFWwindow*		window = NULL;
 static GLFWcursor		*hand_cursor = NULL;
-static uint64_t			dirty = 0;
 static mtcr_t			*mtcr = NULL;
+static bool			show_mtcr_stats = false;
+/*
+ * We only redraw the window when the FANS screen generation changes, or
+ * when `redraw' is set due to a change in window or clickspot state.
+ * Similarly, only screen cells which have changed since `blit_gen' are
+ * blitted into the `screen' surface.
+ */
+static bool			redraw = true;
+static uint64_t			drawn_gen = 0;
+static uint64_t			blit_gen = 0;
+static struct {
+	unsigned long		ticks;
+	unsigned long		frames;
+	unsigned long		cells;
+} render_stats;
 
 static fans_t			*box = NULL;
+#ifndef	_WIN32
+static fans_remote_srv_t	*remote = NULL;
+#endif
 static double			mouse_x, mouse_y;
 static uint64_t			clr_press_microtime = 0;
 
@@ -85,7 +108,18 @@ static uint32_t			font_bg_colors[FMS_COLOR_MAGENTA + 1] = {
 	0x00000000u,	/* FMS_COLOR_CYAN */
 	0x00000000u	/* FMS_COLOR_MAGENTA */
 };
-static cairo_surface_t *font_bitmaps[FMS_FONT_LARGE + 1][FMS_COLOR_MAGENTA + 1];
+/*
+ * Font glyphs are kept as one alpha-only atlas per font size, with each
+ * byte being either 0x00 (background) or 0xff (foreground). The color
+ * is applied at blit time. font_cells maps every character to the
+ * position of its glyph in the atlas.
+ */
+static uint8_t			*font_atlas[FMS_FONT_LARGE + 1];
+static unsigned			font_atlas_w[FMS_FONT_LARGE + 1];
+static unsigned			font_atlas_h[FMS_FONT_LARGE + 1];
+static struct {
+	uint16_t	x, y;
+} font_cells[256];
 #define	FONT_CELL_W	13	/* pixels */
 #define	FONT_CELL_H	20	/* pixels */
 #define	FONT_X(nr)	((nr) * FONT_CELL_W)
@@ -240,30 +274,77 @@ char2fontcell(char c, int *font_x, int *font_y)
 	}
 }
 
+static void
+font_cells_init(void)
+{
+	for (unsigned i = 0; i < ARRAY_NUM_ELEM(font_cells); i++) {
+		int font_x, font_y;
+
+		char2fontcell(i, &font_x, &font_y);
+		font_cells[i].x = font_x;
+		font_cells[i].y = font_y;
+	}
+}
+
 static void
 put_fms_char(const fms_char_t *c, int scr_x, int scr_y)
 {
-	cairo_surface_t *font_surf = font_bitmaps[c->size][c->color];
-	unsigned char *src = cairo_image_surface_get_data(font_surf);
-	int src_stride = cairo_image_surface_get_stride(font_surf);
+	const uint8_t *atlas = font_atlas[c->size];
+	unsigned atlas_w = font_atlas_w[c->size];
 	unsigned char *dest = cairo_image_surface_get_data(screen);
 	int dest_stride = cairo_image_surface_get_stride(screen);
+	uint32_t bg = font_bg_colors[c->color];
+	uint32_t tint = font_fg_colors[c->color] ^ bg;
 
 	int draw_x = TEXT_CHAR_W * scr_x + 1;
 	int draw_y = TEXT_CHAR_H * scr_y + 1;
-	int font_x, font_y;
-
-	char2fontcell(c->c, &font_x, &font_y);
+	unsigned font_x = font_cells[(uint8_t)c->c].x;
+	unsigned font_y = font_cells[(uint8_t)c->c].y;
 
+	ASSERT3U(font_x + FONT_CELL_W, <=, atlas_w);
+	ASSERT3U(font_y + FONT_CELL_H, <=, font_atlas_h[c->size]);
 	for (unsigned y = 0; y < FONT_CELL_H; y++) {
-		uint32_t *src_row =
-		    (uint32_t *)&src[(y + font_y) * src_stride];
+		const uint8_t *src_row =
+		    &atlas[(y + font_y) * atlas_w + font_x];
 		uint32_t *dest_row =
-		    (uint32_t *)&dest[(y + draw_y) * dest_stride];
+		    (uint32_t *)&dest[(y + draw_y) * dest_stride] + draw_x;
 
+		/*
+		 * Branchless select between fg & bg, so the compiler can
+		 * vectorize this: the mask is all ones for foreground
+		 * pixels and all zeros for background pixels.
+		 */
 		for (unsigned x = 0; x < FONT_CELL_W; x++)
-			dest_row[x + draw_x] = src_row[x + font_x];
+			dest_row[x] = bg ^ (tint & -(uint32_t)(src_row[x] & 1));
+	}
+}
+
+static void
+update_screen(void)
+{
+	uint64_t gen = fans_get_gen(box);
+	unsigned dirty_rows;
+
+	if (gen == blit_gen)
+		return;
+
+	cairo_surface_flush(screen);
+	dirty_rows = fans_get_dirty_rows(box, blit_gen);
+	for (unsigned row_i = 0; row_i < FMS_ROWS; row_i++) {
+		const fms_char_t *row;
+
+		if ((dirty_rows & (1u << row_i)) == 0)
+			continue;
+		row = fans_get_screen_row(box, row_i);
+		for (unsigned col_i = 0; col_i < FMS_COLS; col_i++) {
+			if (fans_get_cell_gen(box, row_i, col_i) > blit_gen) {
+				put_fms_char(&row[col_i], col_i, row_i);
+				render_stats.cells++;
+			}
+		}
 	}
+	cairo_surface_mark_dirty(screen);
+	blit_gen = gen;
 }
 
 static void
@@ -276,12 +357,8 @@ render_cb(cairo_t *cr, unsigned w, unsigned h, void *userinfo)
 	cairo_set_source_surface(cr, bgimg, 0, 0);
 	cairo_paint(cr);
 
-	for (unsigned row_i = 0; row_i < FMS_ROWS; row_i++) {
-		const fms_char_t *row = fans_get_screen_row(box, row_i);
-
-		for (unsigned col_i = 0; col_i < FMS_COLS; col_i++)
-			put_fms_char(&row[col_i], col_i, row_i);
-	}
+	update_screen();
+	render_stats.frames++;
 
 	cairo_translate(cr, TEXT_AREA_X, TEXT_AREA_Y);
 	cairo_scale(cr, 1.37, 1.1);
@@ -325,7 +402,7 @@ mouse_button_cb(GLFWwindow *window, int button, int action, int mods)
 		}
 		cur_clickspot = -1;
 		clr_press_microtime = 0;
-		dirty = 0;
+		redraw = true;
 		return;
 	}
 
@@ -342,7 +419,7 @@ mouse_button_cb(GLFWwindow *window, int button, int action, int mods)
 			break;
 		}
 	}
-	dirty = 0;
+	redraw = true;
 }
 
 static void
@@ -393,7 +470,6 @@ key_cb(GLFWwindow *window, int key, int scancode, int action, int mods)
 	} else if (key == GLFW_KEY_PAGE_DOWN) {
 		fans_push_key(box, FMS_KEY_NEXT);
 	}
-	dirty = 0;
 }
 
 static void
@@ -402,39 +478,122 @@ resize_cb(GLFWwindow *window, int x, int y)
 	UNUSED(window);
 	UNUSED(x);
 	UNUSED(y);
-	dirty = 0;
+	redraw = true;
+}
+
+static void
+refresh_cb(GLFWwindow *window)
+{
+	UNUSED(window);
+	redraw = true;
 }
 
-static cairo_surface_t *
-load_bitmap_font_img(const char *filename, uint32_t fg_color, uint32_t bg_color)
+/*
+ * Converts a font bitmap PNG to an alpha-only atlas. Opaque black pixels
+ * in the PNG are glyph foreground, everything else is background.
+ */
+static bool
+load_font_atlas(fms_font_t size)
 {
 	cairo_surface_t *surf;
-	unsigned char *bytes;
+	const unsigned char *bytes;
 	int stride;
 	unsigned w, h;
 
-	ASSERT(filename != NULL);
-
-	surf = load_cairo_png(filename);
+	surf = load_cairo_png(font_sz_names[size]);
 	if (surf == NULL)
-		return (NULL);
+		return (false);
 
 	bytes = cairo_image_surface_get_data(surf);
 	stride = cairo_image_surface_get_stride(surf);
 	w = cairo_image_surface_get_width(surf);
 	h = cairo_image_surface_get_height(surf);
+	font_atlas[size] = safe_malloc(w * h);
+	font_atlas_w[size] = w;
+	font_atlas_h[size] = h;
 	for (unsigned y = 0; y < h; y++) {
-		uint32_t *pixels = (uint32_t *)&bytes[y * stride];
+		const uint32_t *pixels = (const uint32_t *)&bytes[y * stride];
 
 		for (unsigned x = 0; x < w; x++) {
-			if (pixels[x] != 0xff000000)
-				pixels[x] = bg_color;
-			else
-				pixels[x] = fg_color;
+			font_atlas[size][y * w + x] =
+			    (pixels[x] == 0xff000000 ? 0xff : 0x00);
 		}
 	}
+	cairo_surface_destroy(surf);
 
-	return (surf);
+	return (true);
+}
+
+/*
+ * Checks that put_fms_char produces exactly the same pixels as the
+ * original renderer, which pre-rendered each font bitmap in every color
+ * and copied glyph pixels out of it. Every character is drawn in every
+ * size and color and compared against a reference recolored straight
+ * from the font PNG. Returns the number of mismatching glyphs.
+ */
+static unsigned
+verify_font_atlas(void)
+{
+	unsigned errors = 0;
+
+	for (int sz = 0; sz < FMS_FONT_LARGE + 1; sz++) {
+		cairo_surface_t *ref = load_cairo_png(font_sz_names[sz]);
+		const unsigned char *ref_bytes;
+		int ref_stride;
+
+		if (ref == NULL)
+			return (1);
+		ref_bytes = cairo_image_surface_get_data(ref);
+		ref_stride = cairo_image_surface_get_stride(ref);
+
+		for (int color = 0; color < FMS_COLOR_MAGENTA + 1; color++) {
+			for (int i = 0; i < 256; i++) {
+				fms_char_t c = { .c = i, .color = color,
+				    .size = sz };
+				const unsigned char *dest;
+				int dest_stride, font_x, font_y;
+				bool ok = true;
+
+				cairo_surface_flush(screen);
+				put_fms_char(&c, 0, 0);
+				cairo_surface_mark_dirty(screen);
+				dest = cairo_image_surface_get_data(screen);
+				dest_stride =
+				    cairo_image_surface_get_stride(screen);
+				char2fontcell(i, &font_x, &font_y);
+
+				for (int y = 0; y < FONT_CELL_H && ok; y++) {
+					const uint32_t *ref_row = (const
+					    uint32_t *)&ref_bytes[(y + font_y) *
+					    ref_stride] + font_x;
+					const uint32_t *dest_row = (const
+					    uint32_t *)&dest[(y + 1) *
+					    dest_stride] + 1;
+
+					for (int x = 0; x < FONT_CELL_W; x++) {
+						uint32_t exp =
+						    (ref_row[x] == 0xff000000 ?
+						    font_fg_colors[color] :
+						    font_bg_colors[color]);
+						if (dest_row[x] != exp) {
+							ok = false;
+							break;
+						}
+					}
+				}
+				if (!ok) {
+					logMsg("Glyph mismatch: char %02x "
+					    "size %d color %d", i, sz, color);
+					errors++;
+				}
+			}
+		}
+		cairo_surface_destroy(ref);
+	}
+	/* Force the next frame to redraw every cell */
+	blit_gen = 0;
+
+	return (errors);
 }
 
 static bool
@@ -448,14 +607,10 @@ load_imgs(void)
 	win_ratio = bgimg_w / (double)bgimg_h;
 
 	for (int sz = 0; sz < FMS_FONT_LARGE + 1; sz++) {
-		for (int color = 0; color < FMS_COLOR_MAGENTA + 1; color++) {
-			font_bitmaps[sz][color] = load_bitmap_font_img(
-			    font_sz_names[sz], font_fg_colors[color],
-			    font_bg_colors[color]);
-			if (font_bitmaps[sz][color] == NULL)
-				return (false);
-		}
+		if (!load_font_atlas(sz))
+			return (false);
 	}
+	font_cells_init();
 	screen = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
 	    FMS_COLS * TEXT_CHAR_W, FMS_ROWS * TEXT_CHAR_H);
 
@@ -478,6 +633,7 @@ window_init(void)
 	glfwMakeContextCurrent(window);
 	glfwSetKeyCallback(window, key_cb);
 	glfwSetWindowSizeCallback(window, resize_cb);
+	glfwSetWindowRefreshCallback(window, refresh_cb);
 	glfwSetMouseButtonCallback(window, mouse_button_cb);
 	glfwSetCursorPosCallback(window, mouse_hover_cb);
 
@@ -497,10 +653,88 @@ fms_init(void)
 	cpdlc_client_set_ca_file(cl, "ca_cert.pem");
 }
 
+/*
+ * Starts streaming our screen to remote displays. `spec' is either a
+ * TCP port number or a UNIX socket path.
+ */
+/*
+ * Parses a decimal number in [min, max]. Unlike plain strtoul, this
+ * rejects empty strings, signs, whitespace and trailing garbage.
+ */
+static bool
+parse_num(const char *str, unsigned long min, unsigned long max,
+    unsigned long *val)
+{
+	char *end;
+
+	if (!isdigit((unsigned char)str[0]))
+		return (false);
+	errno = 0;
+	*val = strtoul(str, &end, 10);
+	return (errno == 0 && *end == '\0' && *val >= min && *val <= max);
+}
+
+/*
+ * `port' is the TCP port to listen on, or 0 to listen on the UNIX
+ * socket at `spec'.
+ */
+static bool
+remote_init(const char *spec, unsigned port)
+{
+#ifndef	_WIN32
+	ASSERT(box != NULL);
+	remote = fans_remote_srv_alloc(box);
+	if (port != 0)
+		return (fans_remote_srv_listen_tcp(remote, NULL, port));
+	return (fans_remote_srv_listen_unix(remote, spec));
+#else	/* _WIN32 */
+	logMsg("Remote displays are not supported on this platform");
+	UNUSED(spec);
+	UNUSED(port);
+	return (false);
+#endif	/* _WIN32 */
+}
+
+static void
+remote_update(void)
+{
+#ifndef	_WIN32
+	if (remote != NULL)
+		fans_remote_srv_update(remote);
+#endif
+}
+
+static void
+print_mtcr_stats(void)
+{
+	mtcr_stats_t st;
+
+	mtcr_get_stats(mtcr, &st);
+	printf("frames: %llu rendered, %llu skipped\n",
+	    (unsigned long long)st.frames_rendered,
+	    (unsigned long long)st.frames_skipped);
+	printf("render time histogram (us):\n");
+	for (int i = 0; i < MTCR_HIST_BINS; i++) {
+		if (st.render_hist[i] == 0)
+			continue;
+		printf("  %6llu+ %llu\n", i == 0 ? 0ull : 1ull << i,
+		    (unsigned long long)st.render_hist[i]);
+	}
+#define	PRINT_TIMING(name, t) \
+	printf("%-8s avg %.0f us, max %llu us\n", name, (t).count != 0 ? \
+	    (t).total / (double)(t).count : 0, (unsigned long long)(t).max)
+	PRINT_TIMING("render", st.render);
+	PRINT_TIMING("upload", st.upload);
+	PRINT_TIMING("latency", st.latency);
+#undef	PRINT_TIMING
+}
+
 static void
 cleanup(void)
 {
 	if (mtcr != NULL) {
+		if (show_mtcr_stats)
+			print_mtcr_stats();
 		mtcr_fini(mtcr);
 		mtcr = NULL;
 	}
@@ -509,17 +743,17 @@ cleanup(void)
 		bgimg = NULL;
 	}
 	for (int sz = 0; sz < FMS_FONT_LARGE + 1; sz++) {
-		for (int color = 0; color < FMS_COLOR_MAGENTA + 1; color++) {
-			if (font_bitmaps[sz][color] != NULL) {
-				cairo_surface_destroy(font_bitmaps[sz][color]);
-				font_bitmaps[sz][color] = NULL;
-			}
-		}
+		free(font_atlas[sz]);
+		font_atlas[sz] = NULL;
 	}
 	if (screen != NULL) {
 		cairo_surface_destroy(screen);
 		screen = NULL;
 	}
+#ifndef	_WIN32
+	fans_remote_srv_free(remote);
+	remote = NULL;
+#endif
 	if (box != NULL) {
 		fans_free(box);
 		box = NULL;
@@ -553,25 +787,156 @@ window_draw(void)
 	glm_ortho(0, win_w, 0, win_h, 0, 1, pvm);
 
 	glClear(GL_COLOR_BUFFER_BIT);
+	drawn_gen = fans_get_gen(box);
+	redraw = false;
 	mtcr_once_wait(mtcr);
 	mtcr_draw(mtcr, ZERO_VECT2, VECT2(win_w, win_h), (GLfloat *)pvm);
 
 	glfwSwapBuffers(window);
 }
 
+/*
+ * Runs the FANS without a window, rendering into an offscreen surface
+ * using the same change-driven logic as the windowed main loop. This
+ * allows measuring rendering cost on machines without a GPU. Prints
+ * the rendering statistics on exit and optionally saves the last
+ * rendered frame to `outfile'.
+ */
+static bool
+headless_run(unsigned duration, const char *outfile)
+{
+	cairo_surface_t *surf = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+	    bgimg_w, bgimg_h);
+	cairo_t *cr = cairo_create(surf);
+	clock_t cpu_start = clock();
+	uint64_t start = microclock();
+	double cpu_secs;
+	bool result = true;
+
+	while (microclock() - start < SEC2USEC(duration)) {
+		fans_update(box);
+		remote_update();
+		render_stats.ticks++;
+		if (redraw || fans_get_gen(box) != drawn_gen) {
+			drawn_gen = fans_get_gen(box);
+			redraw = false;
+			render_cb(cr, bgimg_w, bgimg_h, NULL);
+		}
+		usleep(SEC2USEC(EVENT_POLL_TIMEOUT));
+	}
+	cpu_secs = (clock() - cpu_start) / (double)CLOCKS_PER_SEC;
+
+	printf("ticks: %lu\nframes: %lu\ncells: %lu\n"
+	    "cpu: %.3f s (%.2f%%)\n", render_stats.ticks, render_stats.frames,
+	    render_stats.cells, cpu_secs, 100 * cpu_secs / duration);
+
+	if (outfile != NULL) {
+		cairo_surface_flush(surf);
+		if (cairo_surface_write_to_png(surf, outfile) !=
+		    CAIRO_STATUS_SUCCESS) {
+			logMsg("Can't write %s", outfile);
+			result = false;
+		}
+	}
+	cairo_destroy(cr);
+	cairo_surface_destroy(surf);
+
+	return (result);
+}
+
+static void
+print_usage(const char *progname, FILE *fp)
+{
+	fprintf(fp, "Usage: %s [-hST] [-s <port|path>] "
+	    "[-H [-t <secs>] [-o <file.png>]]\n"
+	    "  -h : show this help screen\n"
+	    "  -S : show renderer frame statistics on screen and print\n"
+	    "       them on exit\n"
+	    "  -T : verify glyph rendering against the font bitmaps\n"
+	    "  -H : run headless, rendering into an offscreen surface\n"
+	    "  -t <secs> : headless run duration (default: %d seconds)\n"
+	    "  -o <file.png> : save the last headless frame to a PNG file\n"
+	    "  -s <port|path> : stream the screen to remote displays on a\n"
+	    "       TCP port or UNIX socket\n",
+	    progname, HEADLESS_DFL_DURATION);
+}
+
 int
-main(void)
+main(int argc, char *argv[])
 {
 	GLenum err;
+	int opt;
+	bool headless = false, verify = false;
+	unsigned duration = HEADLESS_DFL_DURATION;
+	const char *outfile = NULL, *remote_spec = NULL;
+	unsigned long remote_port = 0, val;
 
-	memset(font_bitmaps, 0, sizeof (font_bitmaps));
 	log_init(do_log_msg, "fansgui");
 
+	while ((opt = getopt(argc, argv, "hHSTt:o:s:")) != -1) {
+		switch (opt) {
+		case 'h':
+			print_usage(argv[0], stdout);
+			return (0);
+		case 'H':
+			headless = true;
+			break;
+		case 'S':
+			show_mtcr_stats = true;
+			break;
+		case 'T':
+			verify = true;
+			break;
+		case 't':
+			if (!parse_num(optarg, 1, UINT_MAX, &val)) {
+				print_usage(argv[0], stderr);
+				return (1);
+			}
+			duration = val;
+			break;
+		case 'o':
+			outfile = optarg;
+			break;
+		case 's':
+			/* Anything that isn't a path must be a valid port */
+			remote_port = 0;
+			if (strspn(optarg, "0123456789") == strlen(optarg) &&
+			    !parse_num(optarg, 1, 65535, &remote_port)) {
+				print_usage(argv[0], stderr);
+				return (1);
+			}
+			remote_spec = optarg;
+			break;
+		default:
+			print_usage(argv[0], stderr);
+			return (1);
+		}
+	}
+
 	if (!load_imgs())
 		goto errout;
+	if (verify) {
+		unsigned errors = verify_font_atlas();
+
+		printf("%u glyph mismatches\n", errors);
+		cleanup();
+		return (errors == 0 ? 0 : 1);
+	}
+	if (headless) {
+		fms_init();
+		if (remote_spec != NULL &&
+		    !remote_init(remote_spec, remote_port))
+			goto errout;
+		if (!headless_run(duration, outfile))
+			goto errout;
+		cleanup();
+		return (0);
+	}
 	if (!window_init())
 		goto errout;
 	fms_init();
+	if (remote_spec != NULL && !remote_init(remote_spec, remote_port))
+		goto errout;
 
 	glewExperimental = GL_TRUE;
 	err = glewInit();
@@ -582,6 +947,7 @@ main(void)
 		goto errout;
 	}
 	mtcr = mtcr_init(bgimg_w, bgimg_h, 0, NULL, render_cb, NULL, NULL);
+	mtcr_set_stats_overlay(mtcr, show_mtcr_stats);
 
 	while (!glfwWindowShouldClose(window)) {
 		uint64_t now = microclock();
@@ -591,14 +957,14 @@ main(void)
 			fans_push_key(box, FMS_KEY_CLR_DEL_LONG);
 			clr_press_microtime = 0;
 			cur_clickspot = -1;
-			dirty = 0;
+			redraw = true;
 		}
 
-		if (now - dirty > SEC2USEC(1)) {
-			window_draw();
-			dirty = now;
-		}
 		fans_update(box);
+		remote_update();
+		render_stats.ticks++;
+		if (redraw || fans_get_gen(box) != drawn_gen)
+			window_draw();
 		glfwWaitEventsTimeout(EVENT_POLL_TIMEOUT);
 	}
 
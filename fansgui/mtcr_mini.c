@@ -23,6 +23,9 @@
  * OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <stdio.h>
+#include <string.h>
+
 #include <acfutils/assert.h>
 #include <acfutils/geom.h>
 #include <acfutils/glew.h>
@@ -54,6 +57,8 @@ typedef struct {
 typedef	struct {
 	bool_t		chg;
 	bool_t		rdy;
+	/* When the frame currently in this surface was requested */
+	uint64_t	req_t;
 
 	GLuint		tex;
 	cairo_surface_t	*surf;
@@ -77,6 +82,10 @@ struct mtcr_s {
 	mutex_t			lock;
 	bool_t			started;
 	bool_t			shutdown;
+	/* Pending mtcr_once request time, 0 if none. Protected by `lock' */
+	uint64_t		req_t;
+	mtcr_stats_t		stats;
+	bool_t			stats_overlay;
 
 	/* Only accessed from OpenGL drawing thread, so no locking req'd */
 	struct {
@@ -131,6 +140,72 @@ static const char *frag_shader410 =
     "	color_out = texture(tex, tex_coord);\n"
     "}\n";
 
+static void
+timing_add(mtcr_timing_t *t, uint64_t us)
+{
+	t->total += us;
+	if (us > t->max)
+		t->max = us;
+	t->count++;
+}
+
+static void
+render_hist_add(mtcr_stats_t *stats, uint64_t us)
+{
+	unsigned bin = 0;
+
+	while (us > 1 && bin + 1 < MTCR_HIST_BINS) {
+		us >>= 1;
+		bin++;
+	}
+	stats->render_hist[bin]++;
+}
+
+static double
+timing_avg(const mtcr_timing_t *t)
+{
+	return (t->count != 0 ? t->total / (double)t->count : 0);
+}
+
+/*
+ * Draws the current frame statistics into the top left corner of the
+ * surface. This happens after the render callback has been timed, so
+ * the overlay doesn't skew the numbers it's showing.
+ */
+static void
+draw_stats_overlay(cairo_t *cr, const mtcr_stats_t *stats)
+{
+	enum { LINE_H = 14, BOX_W = 280, MARGIN = 4 };
+	char lines[4][64];
+
+	snprintf(lines[0], sizeof (lines[0]), "frames %llu  skipped %llu",
+	    (unsigned long long)stats->frames_rendered,
+	    (unsigned long long)stats->frames_skipped);
+	snprintf(lines[1], sizeof (lines[1]), "render avg %.0f max %llu us",
+	    timing_avg(&stats->render),
+	    (unsigned long long)stats->render.max);
+	snprintf(lines[2], sizeof (lines[2]), "upload avg %.0f max %llu us",
+	    timing_avg(&stats->upload),
+	    (unsigned long long)stats->upload.max);
+	snprintf(lines[3], sizeof (lines[3]), "latency avg %.0f max %llu us",
+	    timing_avg(&stats->latency),
+	    (unsigned long long)stats->latency.max);
+
+	cairo_save(cr);
+	cairo_set_source_rgba(cr, 0, 0, 0, 0.7);
+	cairo_rectangle(cr, 0, 0, BOX_W, 4 * LINE_H + 2 * MARGIN);
+	cairo_fill(cr);
+	cairo_set_source_rgb(cr, 1, 1, 0);
+	cairo_select_font_face(cr, "monospace", CAIRO_FONT_SLANT_NORMAL,
+	    CAIRO_FONT_WEIGHT_NORMAL);
+	cairo_set_font_size(cr, LINE_H - 2);
+	for (int i = 0; i < 4; i++) {
+		cairo_move_to(cr, MARGIN, MARGIN + (i + 1) * LINE_H - 3);
+		cairo_show_text(cr, lines[i]);
+	}
+	cairo_restore(cr);
+}
+
 /*
  * Main mtcr_t worker thread. Simply waits around for the
  * required interval and fires off the rendering callback. This performs
@@ -149,6 +224,9 @@ worker(mtcr_t *mtcr)
 
 	while (!mtcr->shutdown) {
 		render_surf_t *rs;
+		uint64_t req_t, start, end;
+		bool_t overlay;
+		mtcr_stats_t stats;
 
 		if (!mtcr->one_shot_block) {
 			if (mtcr->fps > 0) {
@@ -160,6 +238,10 @@ worker(mtcr_t *mtcr)
 		}
 		if (mtcr->shutdown)
 			break;
+		start = microclock();
+		req_t = (mtcr->req_t != 0 ? mtcr->req_t : start);
+		mtcr->req_t = 0;
+		overlay = mtcr->stats_overlay;
 		mutex_exit(&mtcr->lock);
 
 		/* always draw into the non-current texture */
@@ -167,6 +249,21 @@ worker(mtcr_t *mtcr)
 
 		ASSERT(mtcr->render_cb != NULL);
 		mtcr->render_cb(rs->cr, mtcr->w, mtcr->h, mtcr->userinfo);
+		end = microclock();
+
+		mutex_enter(&mtcr->lock);
+		/* The previous frame in this surface never made it to GL */
+		if (rs->chg)
+			mtcr->stats.frames_skipped++;
+		mtcr->stats.frames_rendered++;
+		timing_add(&mtcr->stats.render, end - start);
+		render_hist_add(&mtcr->stats, end - start);
+		stats = mtcr->stats;
+		mutex_exit(&mtcr->lock);
+
+		if (overlay)
+			draw_stats_overlay(rs->cr, &stats);
+		rs->req_t = req_t;
 		rs->chg = B_TRUE;
 
 		mutex_enter(&mtcr->lock);
@@ -339,6 +436,8 @@ void
 mtcr_once(mtcr_t *mtcr)
 {
 	mutex_enter(&mtcr->lock);
+	if (mtcr->req_t == 0)
+		mtcr->req_t = microclock();
 	cv_broadcast(&mtcr->cv);
 	mutex_exit(&mtcr->lock);
 }
@@ -352,6 +451,8 @@ mtcr_once_wait(mtcr_t *mtcr)
 {
 	mutex_enter(&mtcr->lock);
 	mtcr->one_shot_block = B_TRUE;
+	if (mtcr->req_t == 0)
+		mtcr->req_t = microclock();
 	cv_broadcast(&mtcr->cv);
 	cv_wait(&mtcr->render_done_cv, &mtcr->lock);
 	mtcr->one_shot_block = B_FALSE;
@@ -361,10 +462,17 @@ mtcr_once_wait(mtcr_t *mtcr)
 static void
 bind_tex_sync(mtcr_t *mtcr, render_surf_t *rs)
 {
+	uint64_t start, end;
+
 	ASSERT(rs->tex != 0);
+
+	start = microclock();
 	glBindTexture(GL_TEXTURE_2D, rs->tex);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, mtcr->w, mtcr->h, 0, GL_BGRA,
 	    GL_UNSIGNED_BYTE, cairo_image_surface_get_data(rs->surf));
+	end = microclock();
+	timing_add(&mtcr->stats.upload, end - start);
+	timing_add(&mtcr->stats.latency, end - rs->req_t);
 	rs->rdy = B_TRUE;
 	rs->chg = B_FALSE;
 }
@@ -448,10 +556,8 @@ mtcr_draw(mtcr_t *mtcr, vect2_t pos, vect2_t size, const GLfloat *pvm)
 	double x1 = 0, x2 = 1;
 	double y1 = 0, y2 = 1;
 
-	if (mtcr->cur_rs == -1) {
-		mutex_exit(&mtcr->lock);
+	if (mtcr->cur_rs == -1)
 		return;
-	}
 	ASSERT3S(mtcr->cur_rs, >=, 0);
 	ASSERT3S(mtcr->cur_rs, <, 2);
 
@@ -489,6 +595,38 @@ mtcr_get_height(mtcr_t *mtcr)
 	return (mtcr->h);
 }
 
+void
+mtcr_get_stats(mtcr_t *mtcr, mtcr_stats_t *stats)
+{
+	ASSERT(mtcr != NULL);
+	ASSERT(stats != NULL);
+	mutex_enter(&mtcr->lock);
+	*stats = mtcr->stats;
+	mutex_exit(&mtcr->lock);
+}
+
+void
+mtcr_reset_stats(mtcr_t *mtcr)
+{
+	ASSERT(mtcr != NULL);
+	mutex_enter(&mtcr->lock);
+	memset(&mtcr->stats, 0, sizeof (mtcr->stats));
+	mutex_exit(&mtcr->lock);
+}
+
+/*
+ * Enables drawing of the frame statistics on top of every frame. Takes
+ * effect from the next rendered frame.
+ */
+void
+mtcr_set_stats_overlay(mtcr_t *mtcr, bool_t flag)
+{
+	ASSERT(mtcr != NULL);
+	mutex_enter(&mtcr->lock);
+	mtcr->stats_overlay = flag;
+	mutex_exit(&mtcr->lock);
+}
+
 void
 mtcr_rounded_rectangle(cairo_t *cr, double x, double y,
     double w, double h, double radius)
@@ -26,6 +26,8 @@
 #ifndef	_MTCR_MINI_H_
 #define	_MTCR_MINI_H_
 
+#include <stdint.h>
+
 #include <cairo.h>
 #include <cairo-ft.h>
 #include <ft2build.h>
@@ -45,6 +47,33 @@ typedef void (*mtcr_render_cb_t)(cairo_t *cr, unsigned w, unsigned h,
     void *userinfo);
 typedef struct mtcr_s mtcr_t;
 
+/*
+ * Render duration histogram. Bin `i' counts frames which took between
+ * 2^i and 2^(i+1) microseconds to render (bin 0 also includes anything
+ * faster), the last bin counts everything slower than that.
+ */
+#define	MTCR_HIST_BINS	16
+
+typedef struct {
+	uint64_t	total;	/* microseconds */
+	uint64_t	max;	/* microseconds */
+	uint64_t	count;
+} mtcr_timing_t;
+
+typedef struct {
+	/* Frames produced by the render callback */
+	uint64_t	frames_rendered;
+	/* Rendered frames replaced by a newer frame before being uploaded */
+	uint64_t	frames_skipped;
+	uint64_t	render_hist[MTCR_HIST_BINS];
+	/* Time spent in the render callback */
+	mtcr_timing_t	render;
+	/* Time spent submitting frames to GL (glTexImage2D) */
+	mtcr_timing_t	upload;
+	/* From the frame request (timer or mtcr_once) to its upload */
+	mtcr_timing_t	latency;
+} mtcr_stats_t;
+
 mtcr_t *mtcr_init(unsigned w, unsigned h, double fps, mtcr_init_cb_t init_cb,
     mtcr_render_cb_t render_cb, mtcr_fini_cb_t fini_cb, void *userinfo);
 
@@ -57,6 +86,10 @@ void mtcr_draw(mtcr_t *mtcr, vect2_t pos, vect2_t size, const GLfloat *pvm);
 unsigned mtcr_get_width(mtcr_t *mtcr);
 unsigned mtcr_get_height(mtcr_t *mtcr);
 
+void mtcr_get_stats(mtcr_t *mtcr, mtcr_stats_t *stats);
+void mtcr_reset_stats(mtcr_t *mtcr);
+void mtcr_set_stats_overlay(mtcr_t *mtcr, bool_t flag);
+
 void mtcr_rounded_rectangle(cairo_t *cr, double x, double y,
     double w, double h, double radius);
 
@@ -0,0 +1,125 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../fans/fans_navdb.h"
+
+static const char *type_names[FANS_NAVDB_NUM_TYPES] = {
+	"FIX", "NAVAID", "ARPT"
+};
+
+static void
+print_usage(const char *progname, FILE *fp)
+{
+	fprintf(fp, "Usage: %s [-h] <source.txt> <index.navdb>\n"
+	    "       %s -q <index.navdb> <ident> [<lat> <lon>]\n"
+	    "\n"
+	    "The first form builds a navdb index from a text source file\n"
+	    "with one \"<FIX|NAVAID|ARPT> <ident> <lat> <lon>\" entry per\n"
+	    "line. The second form looks up an identifier in an index,\n"
+	    "optionally picking the match nearest to <lat> <lon>.\n",
+	    progname, progname);
+}
+
+static int
+query(int argc, char *argv[])
+{
+	fans_navdb_t *db;
+	unsigned total = 0;
+
+	if (argc != 2 && argc != 4)
+		return (-1);
+	db = fans_navdb_open(argv[0]);
+	if (db == NULL)
+		return (1);
+	for (int type = 0; type < FANS_NAVDB_NUM_TYPES; type++) {
+		enum { MAX_ENTS = 32 };
+		fans_navdb_ent_t ents[MAX_ENTS];
+		unsigned n;
+
+		if (argc == 4) {
+			n = fans_navdb_lookup_nearest(db, argv[1], type,
+			    atof(argv[2]), atof(argv[3]), &ents[0]);
+		} else {
+			n = fans_navdb_lookup(db, argv[1], type, ents,
+			    MAX_ENTS);
+		}
+		for (unsigned i = 0; i < n && i < MAX_ENTS; i++) {
+			printf("%-6s %-7s %12.7f %12.7f\n", type_names[type],
+			    ents[i].ident, ents[i].lat, ents[i].lon);
+		}
+		total += n;
+	}
+	fans_navdb_close(db);
+
+	return (total != 0 ? 0 : 1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *progname = argv[0];
+	int opt, res;
+	bool do_query = false;
+	unsigned num_ents;
+
+	while ((opt = getopt(argc, argv, "hq")) != -1) {
+		switch (opt) {
+		case 'h':
+			print_usage(progname, stdout);
+			return (0);
+		case 'q':
+			do_query = true;
+			break;
+		default:
+			print_usage(progname, stderr);
+			return (1);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (do_query) {
+		res = query(argc, argv);
+		if (res == -1) {
+			print_usage(progname, stderr);
+			return (1);
+		}
+		return (res);
+	}
+	if (argc != 2) {
+		print_usage(progname, stderr);
+		return (1);
+	}
+	if (!fans_navdb_build(argv[0], argv[1], &num_ents))
+		return (1);
+	printf("%s: %u entries\n", argv[1], num_ents);
+
+	return (0);
+}
@@ -49,6 +49,7 @@
 #include "cpdlc_alloc.h"
 #include "cpdlc_assert.h"
 #include "cpdlc_client.h"
+#include "cpdlc_clock.h"
 #include "cpdlc_string.h"
 #include "cpdlc_thread.h"
 #include "minilist.h"
@@ -156,6 +157,21 @@ struct cpdlc_client_s {
 	gnutls_certificate_credentials_t xcred;
 #endif	/* !CPDLC_CLIENT_LWS */
 
+	/*
+	 * Custom transport. When set, the client doesn't start a worker
+	 * thread and is instead driven by calls to cpdlc_client_poll.
+	 * Protected by `lock'.
+	 */
+	cpdlc_transport_t		tp;
+	void				*tp_userinfo;
+	bool				tp_open;
+	/*
+	 * Set by cpdlc_client_set_polled. The TLS connection is then run
+	 * without a worker thread, by calls to cpdlc_client_poll or
+	 * cpdlc_client_poll_multi. Protected by `lock'.
+	 */
+	bool				polled;
+
 	cpdlc_msg_sent_cb_t		msg_sent_cb;
 	cpdlc_msg_recv_cb_t		msg_recv_cb;
 	void				*cb_userinfo;
@@ -203,6 +219,9 @@ static bool poll_for_msgs(cpdlc_client_t *cl,
     cpdlc_msg_token_t **out_tokens, unsigned *num_out_tokens);
 #endif	/* !CPDLC_CLIENT_LWS */
 
+static bool poll_tp(cpdlc_client_t *cl, cpdlc_msg_token_t **out_tokens,
+    unsigned *num_out_tokens);
+
 static void reset_link_state(cpdlc_client_t *cl);
 
 static void send_logon(cpdlc_client_t *cl);
@@ -244,14 +263,24 @@ check_keepalive(cpdlc_client_t *cl)
 {
 	ASSERT(cl != NULL);
 
-	if (time(NULL) - cl->last_data_rdwr < KEEPALIVE_TIMEOUT)
+	if (cpdlc_clock_time() - cl->last_data_rdwr < KEEPALIVE_TIMEOUT)
 		return;
 
 	cpdlc_msg_t *ping = cpdlc_msg_alloc(CPDLC_PKT_PING);
 	send_msg_impl(cl, ping, false);
 	cpdlc_msg_free(ping);
 	/* Reset the keepalive timer */
-	cl->last_data_rdwr = time(NULL);
+	cl->last_data_rdwr = cpdlc_clock_time();
+}
+
+/*
+ * Returns true if the client has no worker thread of its own and is
+ * instead driven by the caller through cpdlc_client_poll.
+ */
+static bool
+is_polled(const cpdlc_client_t *cl)
+{
+	return (cl->polled || cl->tp.open != NULL);
 }
 
 #ifndef	CPDLC_CLIENT_LWS
@@ -264,100 +293,155 @@ set_fd_nonblock(int fd)
 	    fcntl(fd, F_SETFL, flags | O_NONBLOCK) >= 0);
 }
 
+/*
+ * How long to wait for network activity in a single worker step. A
+ * polled client must never block, the caller does its waiting for it.
+ */
+static int
+poll_timeout(const cpdlc_client_t *cl)
+{
+	return (cl->polled ? 0 : WORKER_POLL_INTVAL);
+}
+
 #endif	/* !CPDLC_CLIENT_LWS */
 
+/*
+ * Starts connecting to the server. Called with `lock' held when the
+ * worker starts up.
+ */
 static void
-logon_worker(void *userinfo)
+worker_init(cpdlc_client_t *cl)
 {
-	cpdlc_client_t *cl = userinfo;
-
 	ASSERT(cl != NULL);
 
-	mutex_enter(&cl->lock);
-
+	if (cl->tp.open != NULL) {
+		if (cl->tp.open(cl->tp_userinfo)) {
+			cl->tp_open = true;
+			cl->logon_status = CPDLC_LOGON_LINK_AVAIL;
+			set_logon_failure(cl, NULL);
+		} else {
+			set_logon_failure(cl, "Connection failed");
+		}
+		return;
+	}
 #ifdef	CPDLC_CLIENT_LWS
 	init_conn_lws(cl);
 #else	/* !CPDLC_CLIENT_LWS */
 	if (resolve_host(cl))
 		init_conn(cl);
 #endif	/* !CPDLC_CLIENT_LWS */
+}
 
-	while (cl->logon_status != CPDLC_LOGON_NONE &&
-	    cl->logon_failure[0] == '\0') {
-		bool new_msgs = false;
-		cpdlc_msg_token_t *out_tokens = NULL;
-		unsigned num_out_tokens = 0;
-
-		switch (cl->logon_status) {
-		case CPDLC_LOGON_CONNECTING_LINK:
+/*
+ * Exchanges data with the server once the link is up.
+ */
+static bool
+poll_link(cpdlc_client_t *cl, cpdlc_msg_token_t **out_tokens,
+    unsigned *num_out_tokens)
+{
+	if (cl->tp.open != NULL)
+		return (poll_tp(cl, out_tokens, num_out_tokens));
 #ifdef	CPDLC_CLIENT_LWS
-			ASSERT(cl->lws_sock != NULL);
-			new_msgs = poll_lws(cl, &out_tokens, &num_out_tokens);
+	return (poll_lws(cl, out_tokens, num_out_tokens));
 #else	/* !CPDLC_CLIENT_LWS */
-			ASSERT(cl->sock != -1);
-			complete_conn(cl);
-#endif	/* !CPDLC_CLIENT_LWS */
-			break;
-		case CPDLC_LOGON_HANDSHAKING_LINK:
-#ifndef	CPDLC_CLIENT_LWS
-			ASSERT(cl->sock != -1);
-			tls_handshake(cl);
+	return (poll_for_msgs(cl, out_tokens, num_out_tokens));
 #endif	/* !CPDLC_CLIENT_LWS */
-			break;
-		case CPDLC_LOGON_LINK_AVAIL:
-			if (cl->logon.do_logon) {
-				send_logon(cl);
-			} else {
+}
+
+/*
+ * Runs one iteration of the worker's state machine. Called with `lock'
+ * held, but drops it temporarily while blocking on the network and
+ * while calling user callbacks. Returns false once the connection has
+ * ended and the worker should stop.
+ */
+static bool
+worker_step(cpdlc_client_t *cl)
+{
+	bool new_msgs = false;
+	cpdlc_msg_token_t *out_tokens = NULL;
+	unsigned num_out_tokens = 0;
+
+	if (cl->logon_status == CPDLC_LOGON_NONE ||
+	    cl->logon_failure[0] != '\0')
+		return (false);
+
+	switch (cl->logon_status) {
+	case CPDLC_LOGON_CONNECTING_LINK:
 #ifdef	CPDLC_CLIENT_LWS
-				new_msgs = poll_lws(cl, &out_tokens,
-				    &num_out_tokens);
+		ASSERT(cl->lws_sock != NULL);
+		new_msgs = poll_lws(cl, &out_tokens, &num_out_tokens);
 #else	/* !CPDLC_CLIENT_LWS */
-				new_msgs = poll_for_msgs(cl, &out_tokens,
-				    &num_out_tokens);
+		ASSERT(cl->sock != -1);
+		complete_conn(cl);
 #endif	/* !CPDLC_CLIENT_LWS */
-			}
-			break;
-		case CPDLC_LOGON_IN_PROG:
-		case CPDLC_LOGON_COMPLETE:
-#ifdef	CPDLC_CLIENT_LWS
-			new_msgs = poll_lws(cl, &out_tokens, &num_out_tokens);
-#else	/* !CPDLC_CLIENT_LWS */
-			new_msgs = poll_for_msgs(cl, &out_tokens,
-			    &num_out_tokens);
+		break;
+	case CPDLC_LOGON_HANDSHAKING_LINK:
+#ifndef	CPDLC_CLIENT_LWS
+		ASSERT(cl->sock != -1);
+		tls_handshake(cl);
 #endif	/* !CPDLC_CLIENT_LWS */
-			break;
-		default:
-			VERIFY_MSG(0, "client reached impossible "
-			    "logon_status = %x", cl->logon_status);
-		}
-		/* Schedules a keepalive message if necessary */
-		if (cl->logon_status == CPDLC_LOGON_COMPLETE)
-			check_keepalive(cl);
-
-		if (new_msgs && cl->msg_recv_cb != NULL) {
-			/*
-			 * To prevent locking inversions, we need to drop
-			 * our lock here.
-			 */
-			cpdlc_msg_recv_cb_t cb = cl->msg_recv_cb;
+		break;
+	case CPDLC_LOGON_LINK_AVAIL:
+		if (cl->logon.do_logon)
+			send_logon(cl);
+		else
+			new_msgs = poll_link(cl, &out_tokens, &num_out_tokens);
+		break;
+	case CPDLC_LOGON_IN_PROG:
+	case CPDLC_LOGON_COMPLETE:
+		new_msgs = poll_link(cl, &out_tokens, &num_out_tokens);
+		break;
+	default:
+		VERIFY_MSG(0, "client reached impossible "
+		    "logon_status = %x", cl->logon_status);
+	}
+	/* Schedules a keepalive message if necessary */
+	if (cl->logon_status == CPDLC_LOGON_COMPLETE)
+		check_keepalive(cl);
+
+	if (new_msgs && cl->msg_recv_cb != NULL) {
+		/*
+		 * To prevent locking inversions, we need to drop
+		 * our lock here.
+		 */
+		cpdlc_msg_recv_cb_t cb = cl->msg_recv_cb;
+		mutex_exit(&cl->lock);
+		cb(cl);
+		mutex_enter(&cl->lock);
+	}
+	if (num_out_tokens != 0) {
+		cpdlc_msg_sent_cb_t cb = cl->msg_sent_cb;
+
+		if (cb != NULL) {
 			mutex_exit(&cl->lock);
-			cb(cl);
+			cb(cl, out_tokens, num_out_tokens);
 			mutex_enter(&cl->lock);
 		}
-		if (num_out_tokens != 0) {
-			cpdlc_msg_sent_cb_t cb = cl->msg_sent_cb;
-
-			if (cb != NULL) {
-				mutex_exit(&cl->lock);
-				cb(cl, out_tokens, num_out_tokens);
-				mutex_enter(&cl->lock);
-			}
-			free(out_tokens);
-		}
+		free(out_tokens);
 	}
+
+	return (true);
+}
+
+static void
+worker_fini(cpdlc_client_t *cl)
+{
 	reset_link_state(cl);
 	cl->worker_started = false;
+}
+
+static void
+logon_worker(void *userinfo)
+{
+	cpdlc_client_t *cl = userinfo;
 
+	ASSERT(cl != NULL);
+
+	mutex_enter(&cl->lock);
+	worker_init(cl);
+	while (worker_step(cl))
+		;
+	worker_fini(cl);
 	mutex_exit(&cl->lock);
 }
 
@@ -410,7 +494,11 @@ cpdlc_client_free(cpdlc_client_t *cl)
 	ASSERT(cl != NULL);
 
 	mutex_enter(&cl->lock);
-	if (cl->worker_started) {
+	if (cl->worker_started && is_polled(cl)) {
+		/* No worker thread, tear down the link ourselves */
+		worker_fini(cl);
+		mutex_exit(&cl->lock);
+	} else if (cl->worker_started) {
 		cl->logon_status = CPDLC_LOGON_NONE;
 		mutex_exit(&cl->lock);
 		thread_join(&cl->worker);
@@ -560,6 +648,10 @@ reset_link_state(cpdlc_client_t *cl)
 	free(cl->logon.to);
 	cl->logon.to = NULL;
 
+	if (cl->tp_open) {
+		cl->tp.close(cl->tp_userinfo);
+		cl->tp_open = false;
+	}
 #ifdef	CPDLC_CLIENT_LWS
 	if (cl->lws_ctx != NULL) {
 		lws_context_destroy(cl->lws_ctx);
@@ -583,6 +675,7 @@ reset_link_state(cpdlc_client_t *cl)
 	}
 	if (cl->sock != -1) {
 		shutdown(cl->sock, SHUT_RDWR);
+		close(cl->sock);
 		cl->sock = -1;
 	}
 #endif	/* !CPDLC_CLIENT_LWS */
@@ -748,7 +841,7 @@ init_conn(cpdlc_client_t *cl)
 			return;
 		}
 		new_status = CPDLC_LOGON_CONNECTING_LINK;
-		cl->conn_begin_time = time(NULL);
+		cl->conn_begin_time = cpdlc_clock_time();
 	} else {
 		new_status = CPDLC_LOGON_HANDSHAKING_LINK;
 	}
@@ -771,13 +864,14 @@ complete_conn(cpdlc_client_t *cl)
 	pfd.fd = cl->sock;
 
 	mutex_exit(&cl->lock);
-	res = poll(&pfd, 1, WORKER_POLL_INTVAL);
+	res = poll(&pfd, 1, poll_timeout(cl));
 	mutex_enter(&cl->lock);
 
 	switch (res) {
 	case 0:
 		/* Still in progress, check timeout */
-		if (time(NULL) - cl->conn_begin_time > CONNECTION_TIMEOUT) {
+		if (cpdlc_clock_time() - cl->conn_begin_time >
+		    CONNECTION_TIMEOUT) {
 			set_logon_failure(cl, "Connection timeout");
 			goto errout;
 		}
@@ -1017,7 +1111,7 @@ process_msg(cpdlc_client_t *cl, cpdlc_msg_t *msg)
 
 			if (strcmp(logon_data, "SUCCESS") == 0) {
 				cl->logon_status = CPDLC_LOGON_COMPLETE;
-				cl->last_data_rdwr = time(NULL);
+				cl->last_data_rdwr = cpdlc_clock_time();
 				set_logon_failure(cl, NULL);
 			} else {
 				cl->logon_status = CPDLC_LOGON_LINK_AVAIL;
@@ -1100,10 +1194,12 @@ sanitize_input(const uint8_t *buf, size_t len)
 	return (true);
 }
 
-#ifdef	CPDLC_CLIENT_LWS
-
+/*
+ * Appends received data to the input buffer and decodes any complete
+ * messages in it. The data must have passed sanitize_input.
+ */
 static bool
-do_msg_input_lws(cpdlc_client_t *cl, const uint8_t *buf, size_t len)
+queue_input(cpdlc_client_t *cl, const uint8_t *buf, size_t len)
 {
 	ASSERT(cl != NULL);
 	ASSERT(buf != NULL);
@@ -1113,12 +1209,12 @@ do_msg_input_lws(cpdlc_client_t *cl, const uint8_t *buf, size_t len)
 	cpdlc_strlcpy(&cl->inbuf[cl->inbuf_sz], (const char *)buf, len + 1);
 	cl->inbuf_sz += len;
 	/* Reset the keepalive timer */
-	cl->last_data_rdwr = time(NULL);
+	cl->last_data_rdwr = cpdlc_clock_time();
 
 	return (process_input(cl));
 }
 
-#else	/* !CPDLC_CLIENT_LWS */
+#ifndef	CPDLC_CLIENT_LWS
 
 static bool
 do_msg_input(cpdlc_client_t *cl)
@@ -1148,14 +1244,7 @@ do_msg_input(cpdlc_client_t *cl)
 			cl->logon_status = CPDLC_LOGON_NONE;
 			break;
 		}
-		cl->inbuf = realloc(cl->inbuf, cl->inbuf_sz + bytes + 1);
-		cpdlc_strlcpy(&cl->inbuf[cl->inbuf_sz], (const char *)buf,
-		    bytes + 1);
-		cl->inbuf_sz += bytes;
-		/* Reset the keepalive timer */
-		cl->last_data_rdwr = time(NULL);
-
-		new_msgs |= process_input(cl);
+		new_msgs |= queue_input(cl, buf, bytes);
 	}
 
 	return (new_msgs);
@@ -1163,6 +1252,41 @@ do_msg_input(cpdlc_client_t *cl)
 
 #endif	/* !CPDLC_CLIENT_LWS */
 
+/*
+ * Accounts for `bytes' of an outgoing message having been written to
+ * the link. Once the message has been sent completely, it is retired
+ * and its token (if tracked) is appended to `tokens'. Returns false if
+ * the message is still incomplete and we need to wait for the link to
+ * take more data.
+ */
+static bool
+outmsgbuf_sent(cpdlc_client_t *cl, outmsgbuf_t *outmsgbuf, int bytes,
+    cpdlc_msg_token_t **tokens, unsigned *num_tokens)
+{
+	outmsgbuf->bytes_sent += bytes;
+	ASSERT3S(outmsgbuf->bytes_sent, <=, outmsgbuf->bufsz);
+	/* Reset the keepalive timer */
+	cl->last_data_rdwr = cpdlc_clock_time();
+	if (outmsgbuf->bytes_sent < outmsgbuf->bufsz)
+		return (false);
+	list_remove(&cl->outmsgbufs.sending, outmsgbuf);
+	/* Don't need the buffer inside anymore */
+	free(outmsgbuf->buf);
+	outmsgbuf->buf = NULL;
+	outmsgbuf->bufsz = 0;
+	if (outmsgbuf->track_sent) {
+		outmsgbuf->status = CPDLC_MSG_STATUS_SENT;
+		list_insert_tail(&cl->outmsgbufs.sent, outmsgbuf);
+		*tokens = safe_realloc(*tokens, (*num_tokens + 1) *
+		    sizeof (**tokens));
+		(*tokens)[(*num_tokens)++] = outmsgbuf->token;
+	} else {
+		free(outmsgbuf);
+	}
+
+	return (true);
+}
+
 #ifdef	CPDLC_CLIENT_LWS
 static cpdlc_msg_token_t *
 do_msg_output(cpdlc_client_t *cl, struct lws *wsi, unsigned *num_tokens_p)
@@ -1216,32 +1340,74 @@ do_msg_output(cpdlc_client_t *cl, unsigned *num_tokens_p)
 			break;
 		}
 #endif	/* !CPDLC_CLIENT_LWS */
-		outmsgbuf->bytes_sent += bytes;
-		ASSERT3S(outmsgbuf->bytes_sent, <=, outmsgbuf->bufsz);
-		/* Reset the keepalive timer */
-		cl->last_data_rdwr = time(NULL);
 		/* short byte count sent, need to wait for more writing */
-		if (outmsgbuf->bytes_sent < outmsgbuf->bufsz)
+		if (!outmsgbuf_sent(cl, outmsgbuf, bytes, &tokens,
+		    &num_tokens))
+			break;
+	}
+
+	*num_tokens_p = num_tokens;
+	return (tokens);
+}
+
+static cpdlc_msg_token_t *
+do_msg_output_tp(cpdlc_client_t *cl, unsigned *num_tokens_p)
+{
+	unsigned num_tokens = 0;
+	cpdlc_msg_token_t *tokens = NULL;
+
+	ASSERT(cl != NULL);
+	ASSERT(num_tokens_p != NULL);
+
+	for (outmsgbuf_t *outmsgbuf = list_head(&cl->outmsgbufs.sending);
+	    outmsgbuf != NULL; outmsgbuf = list_head(&cl->outmsgbufs.sending)) {
+		int bytes = cl->tp.send(cl->tp_userinfo,
+		    &outmsgbuf->buf[SENDBUF_PRE_PAD + outmsgbuf->bytes_sent],
+		    outmsgbuf->bufsz - outmsgbuf->bytes_sent);
+
+		if (bytes < 0) {
+			cl->logon_status = CPDLC_LOGON_NONE;
 			break;
-		list_remove(&cl->outmsgbufs.sending, outmsgbuf);
-		/* Don't need the buffer inside anymore */
-		free(outmsgbuf->buf);
-		outmsgbuf->buf = NULL;
-		outmsgbuf->bufsz = 0;
-		if (outmsgbuf->track_sent) {
-			list_insert_tail(&cl->outmsgbufs.sent, outmsgbuf);
-			tokens = safe_realloc(tokens, (num_tokens + 1) *
-			    sizeof (*tokens));
-			tokens[num_tokens] = outmsgbuf->token;
-		} else {
-			free(outmsgbuf);
 		}
+		if (bytes == 0 || !outmsgbuf_sent(cl, outmsgbuf, bytes,
+		    &tokens, &num_tokens))
+			break;
 	}
 
 	*num_tokens_p = num_tokens;
 	return (tokens);
 }
 
+static bool
+poll_tp(cpdlc_client_t *cl, cpdlc_msg_token_t **out_tokens,
+    unsigned *num_out_tokens)
+{
+	bool new_msgs = false;
+
+	ASSERT(cl != NULL);
+	ASSERT(cl->tp_open);
+
+	for (;;) {
+		uint8_t buf[READBUF_SZ];
+		int bytes = cl->tp.recv(cl->tp_userinfo, buf, sizeof (buf));
+
+		if (bytes == 0)
+			break;
+		if (bytes < 0 || !sanitize_input(buf, bytes)) {
+			cl->logon_status = CPDLC_LOGON_NONE;
+			break;
+		}
+		new_msgs |= queue_input(cl, buf, bytes);
+		/* Input might have killed the connection */
+		if (cl->logon_status == CPDLC_LOGON_NONE)
+			break;
+	}
+	if (cl->logon_status != CPDLC_LOGON_NONE)
+		*out_tokens = do_msg_output_tp(cl, num_out_tokens);
+
+	return (new_msgs);
+}
+
 #ifdef	CPDLC_CLIENT_LWS
 
 static bool
@@ -1295,7 +1461,7 @@ cpdlc_lws_cb(struct lws *wsi, enum lws_callback_reasons reason,
 			    sizeof (cl->logon_failure));
 		}
 		if (cl->logon_status != CPDLC_LOGON_NONE)
-			cl->pollinfo.new_msgs |= do_msg_input_lws(cl, in, len);
+			cl->pollinfo.new_msgs |= queue_input(cl, in, len);
 		mutex_exit(&cl->lock);
 		break;
 	case LWS_CALLBACK_CLIENT_WRITEABLE:
@@ -1361,7 +1527,7 @@ poll_for_msgs(cpdlc_client_t *cl, cpdlc_msg_token_t **out_tokens,
 
 	/* Release the lock to allow for state updates while running */
 	mutex_exit(&cl->lock);
-	ret = poll(&pfd, 1, WORKER_POLL_INTVAL);
+	ret = poll(&pfd, 1, poll_timeout(cl));
 	mutex_enter(&cl->lock);
 	/* Poll error or external shutdown request */
 	if (ret < 0 || cl->logon_status == CPDLC_LOGON_NONE) {
@@ -1444,7 +1610,10 @@ cpdlc_client_logon(cpdlc_client_t *cl, const char *logon_data,
 
 	if (!cl->worker_started) {
 		cl->worker_started = true;
-		VERIFY(thread_create(&cl->worker, logon_worker, cl));
+		if (is_polled(cl))
+			worker_init(cl);
+		else
+			VERIFY(thread_create(&cl->worker, logon_worker, cl));
 	}
 
 	mutex_exit(&cl->lock);
@@ -1620,3 +1789,154 @@ cpdlc_client_set_msg_recv_cb(cpdlc_client_t *cl, cpdlc_msg_recv_cb_t cb)
 	cl->msg_recv_cb = cb;
 	mutex_exit(&cl->lock);
 }
+
+/*
+ * Replaces the TLS connection with a custom transport (see
+ * cpdlc_transport_t). Must be called before the first logon. Passing
+ * NULL reverts to the regular network connection. With a transport
+ * set, no background thread is started and the caller must drive the
+ * client by calling cpdlc_client_poll regularly.
+ */
+void
+cpdlc_client_set_transport(cpdlc_client_t *cl, const cpdlc_transport_t *tp,
+    void *userinfo)
+{
+	ASSERT(cl != NULL);
+	ASSERT(tp == NULL || (tp->open != NULL && tp->send != NULL &&
+	    tp->recv != NULL && tp->close != NULL));
+
+	mutex_enter(&cl->lock);
+	ASSERT(!cl->worker_started);
+	if (tp != NULL)
+		cl->tp = *tp;
+	else
+		memset(&cl->tp, 0, sizeof (cl->tp));
+	cl->tp_userinfo = userinfo;
+	mutex_exit(&cl->lock);
+}
+
+/*
+ * Runs the client's connection state machine once, without blocking.
+ * Only used with a custom transport or on a client set up with
+ * cpdlc_client_set_polled, where this takes the place of the background
+ * thread. Sent and received message callbacks are called from in here.
+ */
+void
+cpdlc_client_poll(cpdlc_client_t *cl)
+{
+	ASSERT(cl != NULL);
+
+	mutex_enter(&cl->lock);
+	ASSERT(is_polled(cl));
+	if (cl->worker_started && !worker_step(cl))
+		worker_fini(cl);
+	mutex_exit(&cl->lock);
+}
+
+#ifndef	CPDLC_CLIENT_LWS
+
+/*
+ * Runs the TLS connection of `cl' without a worker thread of its own.
+ * Must be called before the first logon. Many polled clients (e.g. one
+ * for every aircraft in a multi-seat simulator) can then share a single
+ * I/O loop, which calls cpdlc_client_poll_multi on all of them. Note
+ * that the host name lookup is still done synchronously from within
+ * cpdlc_client_logon.
+ */
+void
+cpdlc_client_set_polled(cpdlc_client_t *cl, bool flag)
+{
+	ASSERT(cl != NULL);
+	mutex_enter(&cl->lock);
+	ASSERT(!cl->worker_started);
+	cl->polled = flag;
+	mutex_exit(&cl->lock);
+}
+
+/*
+ * Fills in what a polled client's connection is waiting for. Returns
+ * true if the client can make progress right away without waiting.
+ */
+static bool
+get_pollfd(cpdlc_client_t *cl, struct pollfd *pfd)
+{
+	bool ready = false;
+
+	pfd->fd = -1;
+	pfd->events = 0;
+	pfd->revents = 0;
+
+	mutex_enter(&cl->lock);
+	if (!cl->worker_started) {
+		mutex_exit(&cl->lock);
+		return (false);
+	}
+	if (cl->tp.open != NULL || cl->sock == -1 ||
+	    cl->logon_failure[0] != '\0') {
+		mutex_exit(&cl->lock);
+		return (true);
+	}
+	pfd->fd = cl->sock;
+	switch (cl->logon_status) {
+	case CPDLC_LOGON_CONNECTING_LINK:
+		pfd->events = POLLOUT;
+		break;
+	case CPDLC_LOGON_HANDSHAKING_LINK:
+		if (cl->session == NULL)
+			ready = true;
+		else if (gnutls_record_get_direction(cl->session) != 0)
+			pfd->events = POLLOUT;
+		else
+			pfd->events = POLLIN;
+		break;
+	case CPDLC_LOGON_LINK_AVAIL:
+		ready = cl->logon.do_logon;
+		/*FALLTHROUGH*/
+	case CPDLC_LOGON_IN_PROG:
+	case CPDLC_LOGON_COMPLETE:
+		pfd->events = POLLIN;
+		if (list_head(&cl->outmsgbufs.sending) != NULL)
+			pfd->events |= POLLOUT;
+		/* TLS may have decrypted more records than we've read */
+		if (gnutls_record_check_pending(cl->session) != 0)
+			ready = true;
+		break;
+	default:
+		ready = true;
+		break;
+	}
+	mutex_exit(&cl->lock);
+
+	return (ready);
+}
+
+/*
+ * Drives a set of polled clients (see cpdlc_client_set_polled) from a
+ * single thread. Waits up to `timeout_ms' milliseconds for network
+ * activity on any of the clients' connections and then runs every
+ * client's state machine once. Callers should use a timeout of no more
+ * than a few hundred milliseconds, since connection timeouts and
+ * keepalives are only checked when a client is polled.
+ */
+void
+cpdlc_client_poll_multi(cpdlc_client_t **cls, unsigned num_cls,
+    int timeout_ms)
+{
+	struct pollfd *pfds;
+
+	ASSERT(cls != NULL || num_cls == 0);
+
+	pfds = safe_calloc(MAX(num_cls, 1), sizeof (*pfds));
+	for (unsigned i = 0; i < num_cls; i++) {
+		ASSERT(cls[i] != NULL);
+		if (get_pollfd(cls[i], &pfds[i]))
+			timeout_ms = 0;
+	}
+	(void) poll(pfds, num_cls, timeout_ms);
+	free(pfds);
+
+	for (unsigned i = 0; i < num_cls; i++)
+		cpdlc_client_poll(cls[i]);
+}
+
+#endif	/* !CPDLC_CLIENT_LWS */
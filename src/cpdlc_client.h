@@ -27,6 +27,7 @@
 #define	_LIBCPDLC_CLIENT_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include <gnutls/gnutls.h>
@@ -68,6 +69,28 @@ typedef void (*cpdlc_msg_recv_cb_t)(cpdlc_client_t *client);
 typedef void (*cpdlc_msg_sent_cb_t)(cpdlc_client_t *client,
     const cpdlc_msg_token_t *token, unsigned num_tokens);
 
+/*
+ * Custom transport, replacing the TLS connection to the server. This is
+ * used to run clients against an in-process network simulation. All
+ * callbacks are invoked with the client's internal lock held and must
+ * not block or call back into the client.
+ *
+ * open: starts a new connection. Returns false if the link can't be
+ *	established.
+ * send: writes up to `len' bytes. Returns the number of bytes taken,
+ *	0 if the link can't take any more data right now, or -1 if the
+ *	connection has been lost.
+ * recv: reads up to `cap' bytes. Returns the number of bytes read, 0 if
+ *	no data is pending, or -1 if the connection has been closed.
+ * close: tears down the connection. Only called after a successful open.
+ */
+typedef struct {
+	bool	(*open)(void *userinfo);
+	int	(*send)(void *userinfo, const void *buf, size_t len);
+	int	(*recv)(void *userinfo, void *buf, size_t cap);
+	void	(*close)(void *userinfo);
+} cpdlc_transport_t;
+
 CPDLC_API cpdlc_client_t *cpdlc_client_alloc(bool is_atc);
 CPDLC_API void cpdlc_client_free(cpdlc_client_t *cl);
 
@@ -116,6 +139,15 @@ CPDLC_API void cpdlc_client_set_msg_sent_cb(cpdlc_client_t *cl,
 CPDLC_API void cpdlc_client_set_msg_recv_cb(cpdlc_client_t *cl,
     cpdlc_msg_recv_cb_t cb);
 
+CPDLC_API void cpdlc_client_set_transport(cpdlc_client_t *cl,
+    const cpdlc_transport_t *tp, void *userinfo);
+CPDLC_API void cpdlc_client_poll(cpdlc_client_t *cl);
+#ifndef	CPDLC_CLIENT_LWS
+CPDLC_API void cpdlc_client_set_polled(cpdlc_client_t *cl, bool flag);
+CPDLC_API void cpdlc_client_poll_multi(cpdlc_client_t **cls,
+    unsigned num_cls, int timeout_ms);
+#endif	/* !CPDLC_CLIENT_LWS */
+
 #ifdef	__cplusplus
 }
 #endif
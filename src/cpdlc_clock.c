@@ -0,0 +1,67 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stddef.h>
+
+#include "cpdlc_clock.h"
+#include "cpdlc_thread.h"
+
+static cpdlc_clock_func_t	clock_func = NULL;
+static void			*clock_userinfo = NULL;
+
+/*
+ * Installs a custom time source. Passing NULL reverts to the system
+ * clock.
+ */
+void
+cpdlc_clock_set_func(cpdlc_clock_func_t func, void *userinfo)
+{
+	clock_func = func;
+	clock_userinfo = userinfo;
+}
+
+/*
+ * Returns the current time in microseconds. Only the difference between
+ * two values is meaningful, the epoch is unspecified.
+ */
+uint64_t
+cpdlc_clock_us(void)
+{
+	if (clock_func != NULL)
+		return (clock_func(clock_userinfo));
+	return (cpdlc_thread_microclock());
+}
+
+/*
+ * Replacement for time(NULL). With a custom time source installed,
+ * this is the virtual time in whole seconds.
+ */
+time_t
+cpdlc_clock_time(void)
+{
+	if (clock_func != NULL)
+		return ((time_t)(clock_func(clock_userinfo) / 1000000));
+	return (time(NULL));
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef	_LIBCPDLC_CLOCK_H_
+#define	_LIBCPDLC_CLOCK_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include "cpdlc_core.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Time source for all of the library's timeouts (connection setup,
+ * keepalives, message response timeouts and update throttling). By
+ * default this is the system clock. Test harnesses can install their
+ * own function returning a virtual time in microseconds, so that hours
+ * of traffic can be simulated in seconds and reproduced exactly.
+ *
+ * The clock function must be installed before any clients or message
+ * lists are created and must not be changed while they exist. Virtual
+ * time must never go backwards.
+ */
+typedef uint64_t (*cpdlc_clock_func_t)(void *userinfo);
+
+CPDLC_API void cpdlc_clock_set_func(cpdlc_clock_func_t func, void *userinfo);
+CPDLC_API uint64_t cpdlc_clock_us(void);
+CPDLC_API time_t cpdlc_clock_time(void);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _LIBCPDLC_CLOCK_H_ */
@@ -406,7 +406,7 @@ static const cpdlc_msg_info_t ul_infos[] = {
     },
     {
 	.msg_type = CPDLC_UM50_CROSS_pos_BTWN_alt_AND_alt,
-	.text = "CROSS POSITION BETWEEN [altitude] AND [altitude]",
+	.text = "CROSS [position] BETWEEN [altitude] AND [altitude]",
 	.num_args = 3,
 	.args = { CPDLC_ARG_POSITION, CPDLC_ARG_ALTITUDE , CPDLC_ARG_ALTITUDE },
 	.resp = CPDLC_RESP_WU,
@@ -835,7 +835,7 @@ static const cpdlc_msg_info_t ul_infos[] = {
     {
 	.msg_type = CPDLC_UM103_AT_time_EXPCT_spd_TO_spd,
 	.text = "AT [time] EXPECT [speed] TO [speed]",
-	.num_args = 2,
+	.num_args = 3,
 	.args = { CPDLC_ARG_TIME, CPDLC_ARG_SPEED, CPDLC_ARG_SPEED },
 	.resp = CPDLC_RESP_R,
 	.timeout = LONG_TIMEOUT
@@ -843,7 +843,7 @@ static const cpdlc_msg_info_t ul_infos[] = {
     {
 	.msg_type = CPDLC_UM104_AT_pos_EXPCT_spd_TO_spd,
 	.text = "AT [position] EXPECT [speed] TO [speed]",
-	.num_args = 2,
+	.num_args = 3,
 	.args = { CPDLC_ARG_POSITION, CPDLC_ARG_SPEED, CPDLC_ARG_SPEED },
 	.resp = CPDLC_RESP_R,
 	.timeout = LONG_TIMEOUT
@@ -851,7 +851,7 @@ static const cpdlc_msg_info_t ul_infos[] = {
     {
 	.msg_type = CPDLC_UM105_AT_alt_EXPCT_spd_TO_spd,
 	.text = "AT [altitude] EXPECT [speed] TO [speed]",
-	.num_args = 2,
+	.num_args = 3,
 	.args = { CPDLC_ARG_ALTITUDE, CPDLC_ARG_SPEED, CPDLC_ARG_SPEED },
 	.resp = CPDLC_RESP_R,
 	.timeout = LONG_TIMEOUT
@@ -905,7 +905,7 @@ static const cpdlc_msg_info_t ul_infos[] = {
     {
 	.msg_type = CPDLC_UM112_INCR_SPD_TO_spd_OR_GREATER,
 	.text = "INCREASE SPEED TO [speed] OR GREATER",
-	.num_args = 2,
+	.num_args = 1,
 	.args = { CPDLC_ARG_SPEED },
 	.resp = CPDLC_RESP_WU,
 	.timeout = SHORT_TIMEOUT
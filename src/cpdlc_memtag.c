@@ -0,0 +1,253 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpdlc_alloc.h"
+#include "cpdlc_assert.h"
+#include "cpdlc_memtag.h"
+
+#ifdef	CPDLC_MEMTAG
+
+#if	!defined(__GNUC__) && !defined(__clang__)
+#error	"CPDLC_MEMTAG requires the GCC/clang __atomic builtins"
+#endif
+
+/*
+ * Prepended to every tagged allocation. Padded to 16 bytes, so that the
+ * pointer we hand out keeps malloc's alignment guarantees.
+ */
+typedef union {
+	struct {
+		cpdlc_memtag_t	*tag;
+		size_t		size;
+	} h;
+	uint8_t		pad[16];
+} memtag_hdr_t;
+
+/* Singly-linked list of all registered tags, only ever pushed onto */
+static cpdlc_memtag_t *tags = NULL;
+
+static void
+tag_register(cpdlc_memtag_t *tag)
+{
+	int unreg = 0;
+	cpdlc_memtag_t *head;
+
+	if (__atomic_load_n(&tag->registered, __ATOMIC_ACQUIRE) ||
+	    !__atomic_compare_exchange_n(&tag->registered, &unreg, 1, false,
+	    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+	head = __atomic_load_n(&tags, __ATOMIC_ACQUIRE);
+	do {
+		tag->next = head;
+	} while (!__atomic_compare_exchange_n(&tags, &head, tag, true,
+	    __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+}
+
+static void
+tag_charge(cpdlc_memtag_t *tag, int64_t bytes, int64_t objs)
+{
+	uint64_t live, peak;
+
+	tag_register(tag);
+	live = __atomic_add_fetch(&tag->live_bytes, bytes, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&tag->live_objs, objs, __ATOMIC_RELAXED);
+	if (objs > 0) {
+		__atomic_add_fetch(&tag->total_allocs, objs,
+		    __ATOMIC_RELAXED);
+	}
+	peak = __atomic_load_n(&tag->peak_bytes, __ATOMIC_RELAXED);
+	while (live > peak && !__atomic_compare_exchange_n(&tag->peak_bytes,
+	    &peak, live, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+static void *
+hdr_init(memtag_hdr_t *hdr, cpdlc_memtag_t *tag, size_t size)
+{
+	hdr->h.tag = tag;
+	hdr->h.size = size;
+	return (&hdr[1]);
+}
+
+void *
+safe_malloc_tag(cpdlc_memtag_t *tag, size_t size)
+{
+	memtag_hdr_t *hdr;
+
+	ASSERT(tag != NULL);
+	hdr = safe_malloc(sizeof (*hdr) + size);
+	tag_charge(tag, size, 1);
+	return (hdr_init(hdr, tag, size));
+}
+
+void *
+safe_calloc_tag(cpdlc_memtag_t *tag, size_t nmemb, size_t size)
+{
+	memtag_hdr_t *hdr;
+
+	ASSERT(tag != NULL);
+	VERIFY_MSG(size == 0 || nmemb <= (SIZE_MAX - sizeof (*hdr)) / size,
+	    "Cannot allocate %lu x %lu bytes: overflow",
+	    (long unsigned)nmemb, (long unsigned)size);
+	hdr = safe_calloc(1, sizeof (*hdr) + nmemb * size);
+	tag_charge(tag, nmemb * size, 1);
+	return (hdr_init(hdr, tag, nmemb * size));
+}
+
+void *
+safe_realloc_tag(cpdlc_memtag_t *tag, void *oldptr, size_t size)
+{
+	memtag_hdr_t *hdr;
+	size_t oldsize;
+
+	ASSERT(tag != NULL);
+	if (oldptr == NULL)
+		return (safe_malloc_tag(tag, size));
+	hdr = &((memtag_hdr_t *)oldptr)[-1];
+	ASSERT3P(hdr->h.tag, ==, tag);
+	oldsize = hdr->h.size;
+	hdr = safe_realloc(hdr, sizeof (*hdr) + size);
+	tag_charge(tag, (int64_t)size - (int64_t)oldsize, 0);
+	return (hdr_init(hdr, tag, size));
+}
+
+void
+safe_free_tag(void *ptr)
+{
+	memtag_hdr_t *hdr;
+
+	if (ptr == NULL)
+		return;
+	hdr = &((memtag_hdr_t *)ptr)[-1];
+	ASSERT(hdr->h.tag != NULL);
+	ASSERT(hdr->h.tag->registered);
+	tag_charge(hdr->h.tag, -(int64_t)hdr->h.size, -1);
+	free(hdr);
+}
+
+/*
+ * Charges (or with negative arguments, credits) a tag with memory which
+ * wasn't obtained through us, such as per-session state allocated by a
+ * third-party library on our behalf.
+ */
+void
+cpdlc_memtag_adjust(cpdlc_memtag_t *tag, int64_t bytes, int64_t objs)
+{
+	ASSERT(tag != NULL);
+	tag_charge(tag, bytes, objs);
+}
+
+/*
+ * Fills `stats' with up to `cap' registered tags. Returns the total
+ * number of registered tags, which can be larger than `cap'.
+ */
+size_t
+cpdlc_memtag_get_stats(cpdlc_memtag_stats_t *stats, size_t cap)
+{
+	size_t n = 0;
+
+	ASSERT(stats != NULL || cap == 0);
+	for (cpdlc_memtag_t *tag = __atomic_load_n(&tags, __ATOMIC_ACQUIRE);
+	    tag != NULL; tag = tag->next, n++) {
+		if (n >= cap)
+			continue;
+		stats[n].name = tag->name;
+		stats[n].live_bytes = __atomic_load_n(&tag->live_bytes,
+		    __ATOMIC_RELAXED);
+		stats[n].live_objs = __atomic_load_n(&tag->live_objs,
+		    __ATOMIC_RELAXED);
+		stats[n].peak_bytes = __atomic_load_n(&tag->peak_bytes,
+		    __ATOMIC_RELAXED);
+		stats[n].total_allocs = __atomic_load_n(&tag->total_allocs,
+		    __ATOMIC_RELAXED);
+	}
+
+	return (n);
+}
+
+#else	/* !CPDLC_MEMTAG */
+
+void *
+safe_malloc_tag(cpdlc_memtag_t *tag, size_t size)
+{
+	UNUSED(tag);
+	return (safe_malloc(size));
+}
+
+void *
+safe_calloc_tag(cpdlc_memtag_t *tag, size_t nmemb, size_t size)
+{
+	UNUSED(tag);
+	return (safe_calloc(nmemb, size));
+}
+
+void *
+safe_realloc_tag(cpdlc_memtag_t *tag, void *oldptr, size_t size)
+{
+	UNUSED(tag);
+	return (safe_realloc(oldptr, size));
+}
+
+void
+safe_free_tag(void *ptr)
+{
+	free(ptr);
+}
+
+void
+cpdlc_memtag_adjust(cpdlc_memtag_t *tag, int64_t bytes, int64_t objs)
+{
+	UNUSED(tag);
+	UNUSED(bytes);
+	UNUSED(objs);
+}
+
+size_t
+cpdlc_memtag_get_stats(cpdlc_memtag_stats_t *stats, size_t cap)
+{
+	UNUSED(stats);
+	UNUSED(cap);
+	return (0);
+}
+
+#endif	/* !CPDLC_MEMTAG */
+
+char *
+safe_strdup_tag(cpdlc_memtag_t *tag, const char *s)
+{
+	size_t l;
+	char *ns;
+
+	ASSERT(s != NULL);
+	l = strlen(s);
+	ns = safe_malloc_tag(tag, l + 1);
+	memcpy(ns, s, l + 1);
+	return (ns);
+}
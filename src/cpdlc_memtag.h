@@ -0,0 +1,97 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef	_LIBCPDLC_CPDLC_MEMTAG_H_
+#define	_LIBCPDLC_CPDLC_MEMTAG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpdlc_core.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Tagged allocations. These work like the safe_malloc family from
+ * cpdlc_alloc.h, except each allocation is charged to a memory tag,
+ * which keeps a count of live bytes and objects. This lets us tell
+ * exactly which subsystem is holding on to memory. A tag is usually a
+ * file-scope static in the subsystem which uses it:
+ *
+ *	static cpdlc_memtag_t conn_tag = CPDLC_MEMTAG_INIT("conn");
+ *	...
+ *	conn_t *conn = safe_calloc_tag(&conn_tag, 1, sizeof (*conn));
+ *	...
+ *	safe_free_tag(conn);
+ *
+ * Tags register themselves on first use and are never unregistered.
+ * Memory obtained from a *_tag function MUST only be released using
+ * safe_free_tag or resized using safe_realloc_tag, and vice versa.
+ *
+ * The accounting is only compiled in with CPDLC_MEMTAG defined (pass
+ * MEMTAG=1 to make). It then costs a 16-byte header per allocation and
+ * a few atomic ops per call. Otherwise the *_tag functions are plain
+ * allocator calls and cpdlc_memtag_get_stats always returns 0.
+ */
+typedef struct cpdlc_memtag_s {
+	const char		*name;
+	uint64_t		live_bytes;
+	uint64_t		live_objs;
+	uint64_t		peak_bytes;
+	uint64_t		total_allocs;
+	int			registered;
+	struct cpdlc_memtag_s	*next;
+} cpdlc_memtag_t;
+
+#define	CPDLC_MEMTAG_INIT(name)	{ (name), 0, 0, 0, 0, 0, NULL }
+
+typedef struct {
+	const char	*name;
+	uint64_t	live_bytes;
+	uint64_t	live_objs;
+	uint64_t	peak_bytes;
+	uint64_t	total_allocs;
+} cpdlc_memtag_stats_t;
+
+CPDLC_API void *safe_malloc_tag(cpdlc_memtag_t *tag, size_t size);
+CPDLC_API void *safe_calloc_tag(cpdlc_memtag_t *tag, size_t nmemb,
+    size_t size);
+CPDLC_API void *safe_realloc_tag(cpdlc_memtag_t *tag, void *oldptr,
+    size_t size);
+CPDLC_API char *safe_strdup_tag(cpdlc_memtag_t *tag, const char *s);
+CPDLC_API void safe_free_tag(void *ptr);
+
+CPDLC_API void cpdlc_memtag_adjust(cpdlc_memtag_t *tag, int64_t bytes,
+    int64_t objs);
+CPDLC_API size_t cpdlc_memtag_get_stats(cpdlc_memtag_stats_t *stats,
+    size_t cap);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _LIBCPDLC_CPDLC_MEMTAG_H_ */
@@ -28,12 +28,14 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "cpdlc_alloc.h"
 #include "cpdlc_assert.h"
 #include "cpdlc_string.h"
 #include "cpdlc_msg.h"
+#include "cpdlc_probe.h"
 
 #define	APPEND_SNPRINTF(__total_bytes, __bufptr, __bufcap, ...) \
 	do { \
@@ -108,31 +110,40 @@ msg_infos_lookup(bool is_dl, int msg_type, char msg_subtype)
 	return (NULL);
 }
 
+/*
+ * Returns the buffer size needed for the escaped string, including the
+ * terminating NUL. If `cap' is too small, the output is cut short at the
+ * last character (or escape sequence) which fits in its entirety.
+ */
 unsigned
 cpdlc_escape_percent(const char *in_buf, char *out_buf, unsigned cap)
 {
+	unsigned j = 0, written = 0;
+
 	ASSERT(in_buf != NULL);
+	ASSERT(out_buf != NULL || cap == 0);
 
-	for (unsigned i = 0, j = 0;; i++, j++) {
-		char c = in_buf[i];
+	for (unsigned i = 0; in_buf[i] != '\0'; i++) {
+		uint8_t c = in_buf[i];
 
-		if (c == '\0') {
-			if (j < cap)
-				out_buf[j] = '\0';
-			return (j + 1);
-		}
-		if (j + 1 == cap) {
-			/* Terminate the output in case of short outbuf */
-			out_buf[j] = '\0';
-		}
 		if (isalnum(c) || c == '.' || c == ',') {
-			out_buf[j] = in_buf[i];
+			if (written == j && j + 1 < cap) {
+				out_buf[j] = c;
+				written = j + 1;
+			}
+			j++;
 		} else {
-			if (j + 4 < cap)
+			if (written == j && j + 3 < cap) {
 				snprintf(&out_buf[j], 4, "%%%02x", c);
-			j += 2;
+				written = j + 3;
+			}
+			j += 3;
 		}
 	}
+	if (cap != 0)
+		out_buf[written] = '\0';
+
+	return (j + 1);
 }
 
 int
@@ -169,6 +180,22 @@ cpdlc_unescape_percent(const char *in_buf, char *out_buf, unsigned cap)
 	return (j);
 }
 
+/*
+ * Appends a space and `str' percent-escaped. Free text and routes can be
+ * arbitrarily long, so this doesn't go through a fixed size buffer.
+ */
+static void
+append_escaped(const char *str, unsigned *n_bytes_p, char **buf_p,
+    unsigned *cap_p)
+{
+	unsigned l = cpdlc_escape_percent(str, NULL, 0);
+	char *textbuf = safe_malloc(l);
+
+	cpdlc_escape_percent(str, textbuf, l);
+	APPEND_SNPRINTF(*n_bytes_p, *buf_p, *cap_p, " %s", textbuf);
+	free(textbuf);
+}
+
 static void
 encode_arg(const cpdlc_arg_type_t arg_type, const cpdlc_arg_t *arg,
     bool readable, unsigned *n_bytes_p, char **buf_p, unsigned *cap_p)
@@ -295,10 +322,8 @@ encode_arg(const cpdlc_arg_type_t arg_type, const cpdlc_arg_t *arg,
 				APPEND_SNPRINTF(*n_bytes_p, *buf_p, *cap_p,
 				    "%s", arg->route);
 			} else {
-				cpdlc_escape_percent(arg->route, textbuf,
-				    sizeof (textbuf));
-				APPEND_SNPRINTF(*n_bytes_p, *buf_p, *cap_p,
-				    " %s", textbuf);
+				append_escaped(arg->route, n_bytes_p, buf_p,
+				    cap_p);
 			}
 		} else {
 			APPEND_SNPRINTF(*n_bytes_p, *buf_p, *cap_p, "%sNIL",
@@ -373,19 +398,15 @@ encode_arg(const cpdlc_arg_type_t arg_type, const cpdlc_arg_t *arg,
 		}
 		break;
 	case CPDLC_ARG_FREETEXT:
-		if (arg->freetext != NULL) {
-			if (readable) {
-				cpdlc_strlcpy(textbuf, arg->freetext,
-				    sizeof (textbuf));
-			} else {
-				cpdlc_escape_percent(arg->freetext, textbuf,
-				    sizeof (textbuf));
-			}
+		if (arg->freetext == NULL) {
+			APPEND_SNPRINTF(*n_bytes_p, *buf_p, *cap_p, "%s",
+			    readable ? "" : " ");
+		} else if (readable) {
+			APPEND_SNPRINTF(*n_bytes_p, *buf_p, *cap_p, "%s",
+			    arg->freetext);
 		} else {
-			textbuf[0] = '\0';
+			append_escaped(arg->freetext, n_bytes_p, buf_p, cap_p);
 		}
-		APPEND_SNPRINTF(*n_bytes_p, *buf_p, *cap_p, "%s%s",
-		    readable ? "" : " ", textbuf);
 		break;
 	}
 }
@@ -426,10 +447,10 @@ cpdlc_msg_free(cpdlc_msg_t *msg)
 {
 	ASSERT(msg != NULL);
 
+	free(msg->logon_data);
 	for (unsigned i = 0; i < msg->num_segs; i++) {
 		cpdlc_msg_seg_t *seg = &msg->segs[i];
 
-		free(msg->logon_data);
 		if (seg->info == NULL)
 			continue;
 		for (unsigned j = 0; j < seg->info->num_args; j++) {
@@ -462,27 +483,32 @@ cpdlc_msg_encode(const cpdlc_msg_t *msg, char *buf, unsigned cap)
 {
 	unsigned n_bytes = 0;
 
+	CPDLC_PROBE2(libcpdlc, msg__encode__start, msg, buf);
 	APPEND_SNPRINTF(n_bytes, buf, cap, "PKT=%s/MIN=%d",
 	    pkt_type2str(msg->pkt_type), msg->min);
 
 	if (msg->mrn != CPDLC_INVALID_MSG_SEQ_NR)
 		APPEND_SNPRINTF(n_bytes, buf, cap, "/MRN=%d", msg->mrn);
 	if (msg->is_logon) {
-		char textbuf[64];
+		unsigned l;
+		char *textbuf;
+
 		ASSERT(msg->logon_data != NULL);
-		cpdlc_escape_percent(msg->logon_data, textbuf,
-		    sizeof (textbuf));
+		l = cpdlc_escape_percent(msg->logon_data, NULL, 0);
+		textbuf = safe_malloc(l);
+		cpdlc_escape_percent(msg->logon_data, textbuf, l);
 		APPEND_SNPRINTF(n_bytes, buf, cap, "/LOGON=%s", textbuf);
+		free(textbuf);
 	}
 	if (msg->is_logoff)
 		APPEND_SNPRINTF(n_bytes, buf, cap, "/LOGOFF");
 	if (msg->from[0] != '\0') {
-		char textbuf[32];
+		char textbuf[3 * sizeof (msg->from)];
 		cpdlc_escape_percent(msg->from, textbuf, sizeof (textbuf));
 		APPEND_SNPRINTF(n_bytes, buf, cap, "/FROM=%s", textbuf);
 	}
 	if (msg->to[0] != '\0') {
-		char textbuf[32];
+		char textbuf[3 * sizeof (msg->to)];
 		cpdlc_escape_percent(msg->to, textbuf, sizeof (textbuf));
 		APPEND_SNPRINTF(n_bytes, buf, cap, "/TO=%s", textbuf);
 	}
@@ -490,6 +516,7 @@ cpdlc_msg_encode(const cpdlc_msg_t *msg, char *buf, unsigned cap)
 	for (unsigned i = 0; i < msg->num_segs; i++)
 		encode_seg(&msg->segs[i], &n_bytes, &buf, &cap);
 	APPEND_SNPRINTF(n_bytes, buf, cap, "\n");
+	CPDLC_PROBE2(libcpdlc, msg__encode__done, msg, n_bytes);
 
 	return (n_bytes);
 }
@@ -543,6 +570,9 @@ cpdlc_msg_readable(const cpdlc_msg_t *msg, char *buf, unsigned cap)
 {
 	unsigned n_bytes = 0;
 
+	/* Messages without segments (e.g. PING) have no readable text */
+	if (cap != 0)
+		buf[0] = '\0';
 	for (unsigned i = 0; i < msg->num_segs; i++) {
 		readable_seg(&msg->segs[i], &n_bytes, &buf, &cap);
 		if (i + 1 < msg->num_segs)
@@ -670,6 +700,29 @@ contains_spaces(const char *str)
 	return (false);
 }
 
+/*
+ * Returns a newly allocated, unescaped copy of the argument between
+ * `start' and `end', or NULL if it contains an invalid escape. Like
+ * append_escaped, this doesn't limit the length of the argument.
+ */
+static char *
+unescape_arg(const char *start, const char *end)
+{
+	unsigned l = end - start;
+	char *textbuf = safe_malloc(l + 1), *out = NULL;
+	int n;
+
+	cpdlc_strlcpy(textbuf, start, l + 1);
+	n = cpdlc_unescape_percent(textbuf, NULL, 0);
+	if (n != -1) {
+		out = safe_malloc(n + 1);
+		cpdlc_unescape_percent(textbuf, out, n + 1);
+	}
+	free(textbuf);
+
+	return (out);
+}
+
 static bool
 msg_decode_seg(cpdlc_msg_seg_t *seg, const char *start, const char *end,
     char *reason, unsigned reason_cap)
@@ -741,7 +794,6 @@ msg_decode_seg(cpdlc_msg_seg_t *seg, const char *start, const char *end,
 	for (num_args = 0; num_args < info->num_args && start < end;
 	    num_args++) {
 		cpdlc_arg_t *arg = &seg->args[num_args];
-		int l;
 		const char *arg_end;
 
 		switch (info->args[num_args]) {
@@ -767,16 +819,19 @@ msg_decode_seg(cpdlc_msg_seg_t *seg, const char *start, const char *end,
 			arg_end = find_arg_end(start, end);
 			if (*(arg_end - 1) == 'M')
 				arg->alt.met = true;
-			/* Multiply non-metric FLs by 100 */
-			if (arg->alt.fl && !arg->alt.met)
-				arg->alt.alt *= 100;
-			/* Second round of validation for FLs */
+			/*
+			 * Second round of validation for FLs. This must be
+			 * done before scaling, huge FLs could overflow.
+			 */
 			if (arg->alt.fl &&
-			    ((!arg->alt.met && arg->alt.alt > 100000) ||
+			    ((!arg->alt.met && arg->alt.alt > 1000) ||
 			    (arg->alt.met && arg->alt.alt > 30000))) {
 				MALFORMED_MSG("invalid flight level");
 				return (false);
 			}
+			/* Multiply non-metric FLs by 100 */
+			if (arg->alt.fl && !arg->alt.met)
+				arg->alt.alt *= 100;
 			break;
 		case CPDLC_ARG_SPEED:
 			if (start + 1 < end && start[0] == 'M') {
@@ -884,17 +939,12 @@ msg_decode_seg(cpdlc_msg_seg_t *seg, const char *start, const char *end,
 			}
 			break;
 		case CPDLC_ARG_ROUTE:
-			cpdlc_strlcpy(textbuf, start, MIN(sizeof (textbuf),
-			    (uintptr_t)(end - start) + 1));
-			l = cpdlc_unescape_percent(textbuf, NULL, 0);
-			if (l == -1) {
+			free(arg->route);
+			arg->route = unescape_arg(start, end);
+			if (arg->route == NULL) {
 				MALFORMED_MSG("invalid URL escape");
 				return (false);
 			}
-			if (arg->route != NULL)
-				free(arg->route);
-			arg->route = malloc(l + 1);
-			cpdlc_unescape_percent(textbuf, arg->route, l + 1);
 			start = end;
 			break;
 		case CPDLC_ARG_PROCEDURE:
@@ -975,6 +1025,7 @@ msg_decode_seg(cpdlc_msg_seg_t *seg, const char *start, const char *end,
 			}
 			switch(start[0]) {
 			case 'A':
+				arg->baro.hpa = false;
 				arg->baro.val = atof(&start[1]);
 				if (arg->baro.val < 28 || arg->baro.val > 32) {
 					MALFORMED_MSG("invalid baro value");
@@ -982,6 +1033,7 @@ msg_decode_seg(cpdlc_msg_seg_t *seg, const char *start, const char *end,
 				}
 				break;
 			case 'Q':
+				arg->baro.hpa = true;
 				arg->baro.val = atoi(&start[1]);
 				if (arg->baro.val < 900 ||
 				    arg->baro.val > 1100) {
@@ -996,16 +1048,12 @@ msg_decode_seg(cpdlc_msg_seg_t *seg, const char *start, const char *end,
 			}
 			break;
 		case CPDLC_ARG_FREETEXT:
-			cpdlc_strlcpy(textbuf, start, MIN(sizeof (textbuf),
-			    (uintptr_t)(end - start) + 1));
-			l = cpdlc_unescape_percent(textbuf, NULL, 0);
-			if (l == -1) {
+			free(arg->freetext);
+			arg->freetext = unescape_arg(start, end);
+			if (arg->freetext == NULL) {
 				MALFORMED_MSG("invalid URL escape");
 				return (false);
 			}
-			free(arg->freetext);
-			arg->freetext = malloc(l + 1);
-			cpdlc_unescape_percent(textbuf, arg->freetext, l + 1);
 			start = end;
 			break;
 		}
@@ -1027,6 +1075,24 @@ end:
 	return (true);
 }
 
+/*
+ * Parses a MIN or MRN header value. This mustn't use sscanf, as that
+ * first runs strlen over the entire rest of the input buffer, making
+ * decoding a line with many headers quadratic in the line length.
+ */
+static bool
+decode_seq_nr(const char *str, unsigned *nr)
+{
+	char *end;
+	unsigned long val = strtoul(str, &end, 10);
+
+	if (end == str)
+		return (false);
+	*nr = val;
+
+	return (true);
+}
+
 bool
 cpdlc_msg_decode(const char *in_buf, cpdlc_msg_t **msg_p, int *consumed,
     char *reason, unsigned reason_cap)
@@ -1056,6 +1122,7 @@ cpdlc_msg_decode(const char *in_buf, cpdlc_msg_t **msg_p, int *consumed,
 		return (true);
 	}
 
+	CPDLC_PROBE2(libcpdlc, msg__decode__start, in_buf, term - in_buf);
 	msg = safe_calloc(1, sizeof (*msg));
 	msg->min = CPDLC_INVALID_MSG_SEQ_NR;
 	msg->mrn = CPDLC_INVALID_MSG_SEQ_NR;
@@ -1079,12 +1146,12 @@ cpdlc_msg_decode(const char *in_buf, cpdlc_msg_t **msg_p, int *consumed,
 			}
 			pkt_type_seen = true;
 		} else if (strncmp(in_buf, "MIN=", 4) == 0) {
-			if (sscanf(&in_buf[4], "%u", &msg->min) != 1) {
+			if (!decode_seq_nr(&in_buf[4], &msg->min)) {
 				MALFORMED_MSG("invalid MIN value");
 				goto errout;
 			}
 		} else if (strncmp(in_buf, "MRN=", 4) == 0) {
-			if (sscanf(&in_buf[4], "%u", &msg->mrn) != 1) {
+			if (!decode_seq_nr(&in_buf[4], &msg->mrn)) {
 				MALFORMED_MSG("invalid MRN value");
 				goto errout;
 			}
@@ -1094,8 +1161,12 @@ cpdlc_msg_decode(const char *in_buf, cpdlc_msg_t **msg_p, int *consumed,
 
 			free(msg->logon_data);
 			cpdlc_strlcpy(textbuf, &in_buf[6], l + 1);
-			msg->logon_data = safe_malloc(l + 1);
-			cpdlc_unescape_percent(textbuf, msg->logon_data, l + 1);
+			msg->logon_data = safe_calloc(1, l + 1);
+			if (cpdlc_unescape_percent(textbuf, msg->logon_data,
+			    l + 1) == -1) {
+				MALFORMED_MSG("invalid URL escape");
+				goto errout;
+			}
 			msg->is_logon = true;
 		} else if (strncmp(in_buf, "LOGOFF", 6) == 0) {
 			msg->is_logoff = true;
@@ -1104,15 +1175,21 @@ cpdlc_msg_decode(const char *in_buf, cpdlc_msg_t **msg_p, int *consumed,
 
 			cpdlc_strlcpy(textbuf, &in_buf[3], MIN(sizeof (textbuf),
 			    (uintptr_t)(sep - &in_buf[3]) + 1));
-			cpdlc_unescape_percent(textbuf, msg->to,
-			    sizeof (msg->to));
+			if (cpdlc_unescape_percent(textbuf, msg->to,
+			    sizeof (msg->to)) == -1) {
+				MALFORMED_MSG("invalid URL escape");
+				goto errout;
+			}
 		} else if (strncmp(in_buf, "FROM=", 5) == 0) {
 			char textbuf[32];
 
 			cpdlc_strlcpy(textbuf, &in_buf[5], MIN(sizeof (textbuf),
 			    (uintptr_t)(sep - &in_buf[5]) + 1));
-			cpdlc_unescape_percent(textbuf, msg->from,
-			    sizeof (msg->from));
+			if (cpdlc_unescape_percent(textbuf, msg->from,
+			    sizeof (msg->from)) == -1) {
+				MALFORMED_MSG("invalid URL escape");
+				goto errout;
+			}
 		} else if (strncmp(in_buf, "MSG=", 4) == 0) {
 			cpdlc_msg_seg_t *seg;
 
@@ -1120,17 +1197,20 @@ cpdlc_msg_decode(const char *in_buf, cpdlc_msg_t **msg_p, int *consumed,
 				MALFORMED_MSG("too many message segments");
 				goto errout;
 			}
-			seg = &msg->segs[msg->num_segs];
+			/*
+			 * Count the segment right away, so that if decoding
+			 * fails, cpdlc_msg_free releases whatever arguments
+			 * had been allocated for it.
+			 */
+			seg = &msg->segs[msg->num_segs++];
 			if (!msg_decode_seg(seg, &in_buf[4], sep, reason,
 			    reason_cap))
 				goto errout;
-			if (msg->num_segs > 0 && msg->segs[0].info->is_dl !=
-			    seg->info->is_dl) {
+			if (msg->segs[0].info->is_dl != seg->info->is_dl) {
 				MALFORMED_MSG("can't mix DM and UM message "
 				    "segments");
 				goto errout;
 			}
-			msg->num_segs++;
 		} else {
 			MALFORMED_MSG("unknown message header");
 			goto errout;
@@ -1148,9 +1228,11 @@ cpdlc_msg_decode(const char *in_buf, cpdlc_msg_t **msg_p, int *consumed,
 
 	*msg_p = msg;
 	*consumed = ((term - start) + 1 + (skipped_cr ? 1 : 0));
+	CPDLC_PROBE2(libcpdlc, msg__decode__done, msg, *consumed);
 	return (true);
 errout:
-	free(msg);
+	CPDLC_PROBE2(libcpdlc, msg__decode__fail, start, reason);
+	cpdlc_msg_free(msg);
 	*msg_p = NULL;
 	*consumed = 0;
 	return (false);
@@ -24,10 +24,13 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "cpdlc_alloc.h"
 #include "cpdlc_assert.h"
+#include "cpdlc_clock.h"
 #include "cpdlc_msglist.h"
+#include "cpdlc_string.h"
 #include "cpdlc_thread.h"
 #include "minilist.h"
 
@@ -35,25 +38,84 @@ typedef struct msg_bucket_s {
 	cpdlc_msg_t		*msg;
 	cpdlc_msg_token_t	tok;
 	bool			sent;
-	list_node_t		node;
 	unsigned		hours;
 	unsigned		mins;
 	time_t			time;
 } msg_bucket_t;
 
+/*
+ * Per-peer thread index. Every thread with at least one message belongs
+ * to exactly one peer, identified by the callsign of the other party.
+ * Threads whose peer is not yet known (e.g. downlinks sent without an
+ * explicit recipient) are kept under the peer with an empty callsign,
+ * until a message from the other party arrives in the thread.
+ */
+typedef struct {
+	char			callsign[CPDLC_CALLSIGN_LEN];
+	/* All threads of this peer, ordered by thread ID, newest first */
+	list_t			thrs;
+	/* Threads awaiting a response from us, oldest first */
+	list_t			pending;
+	unsigned		num_open;
+	list_node_t		pending_peers_node;
+} msg_peer_t;
+
 typedef struct msg_thr_s {
 	cpdlc_msg_thr_id_t	thr_id;
 	cpdlc_msg_thr_status_t	status;
-	list_t			buckets;
+	/* Messages in the thread, oldest first */
+	msg_bucket_t		*buckets;
+	unsigned		num_buckets;
+	unsigned		buckets_cap;
 	list_node_t		node;
 	bool			dirty;
+	/* Callsign of the other party, taken from the first message */
+	char			peer[CPDLC_CALLSIGN_LEN];
+	msg_peer_t		*peer_p;
+	list_node_t		peer_node;
+	list_node_t		pending_node;
+	bool			peer_open;
+	bool			peer_pending;
+	/*
+	 * Response time tracking. These hold the times at which the
+	 * currently outstanding received & sent requests were seen, and
+	 * when a STANDBY was issued for them (0 if none).
+	 */
+	time_t			rx_req_t;
+	time_t			tx_req_t;
+	time_t			stby_t;
+	/* rx_req_t at the time the thread was queued on peer->pending */
+	time_t			pending_t;
+	/*
+	 * Set to the msglist's `upd_seq' when the thread is added to the
+	 * pending update set, so it only gets reported once per batch.
+	 */
+	uint64_t		upd_seq;
 } msg_thr_t;
 
 struct cpdlc_msglist_s {
 	cpdlc_client_t			*cl;
 	mutex_t				lock;
 
+	/* Threads ordered by thread ID, newest first */
 	list_t				thr;
+	/*
+	 * Lookup table of threads by ID. Slot `i' holds the thread with
+	 * ID `thr_slots_base + i', or NULL if that thread was removed.
+	 * Covers all IDs from thr_slots_base up to next_thr_id.
+	 */
+	msg_thr_t			**thr_slots;
+	unsigned			thr_slots_cap;
+	cpdlc_msg_thr_id_t		thr_slots_base;
+	/* Peer index, sorted by callsign */
+	msg_peer_t			**peers;
+	unsigned			num_peers;
+	unsigned			peers_cap;
+	/*
+	 * Peers with at least one thread awaiting a response from us,
+	 * ordered by their oldest pending request
+	 */
+	list_t				pending_peers;
 
 	unsigned			min;
 	unsigned			mrn;
@@ -62,11 +124,123 @@ struct cpdlc_msglist_s {
 	cpdlc_msglist_update_cb_t	update_cb;
 	void				*userinfo;
 
+	/*
+	 * Deduplicated set of threads which have changed since the last
+	 * call to update_cb. Calls to update_cb are serialized using
+	 * upd_busy and are spaced at least upd_intval microseconds apart,
+	 * unless forced by cpdlc_msglist_flush_updates (upd_force records
+	 * a flush requested while another delivery was in progress).
+	 */
+	bool				upd_busy;
+	bool				upd_force;
+	cpdlc_msg_thr_id_t		*upd_thrs;
+	unsigned			num_upd_thrs;
+	unsigned			upd_thrs_cap;
+	uint64_t			upd_seq;
+	uint64_t			upd_intval;
+	uint64_t			last_upd_t;
+
 	cpdlc_get_time_func_t		get_time_func;
+
+	cpdlc_msglist_stats_t		stats;
+	/* Incremented on every change to any thread */
+	uint64_t			gen;
 };
 
 static msg_thr_t *msglist_send_impl(cpdlc_msglist_t *msglist,
     cpdlc_msg_t *msg, cpdlc_msg_thr_id_t thr_id);
+static void thr_peer_sync(cpdlc_msglist_t *msglist, msg_thr_t *thr);
+
+static void
+thr_mark_updated(cpdlc_msglist_t *msglist, msg_thr_t *thr)
+{
+	ASSERT(msglist != NULL);
+	ASSERT(thr != NULL);
+
+	if (msglist->update_cb == NULL || thr->upd_seq == msglist->upd_seq)
+		return;
+	if (msglist->num_upd_thrs == msglist->upd_thrs_cap) {
+		msglist->upd_thrs_cap = MAX(2 * msglist->upd_thrs_cap, 8);
+		msglist->upd_thrs = safe_realloc(msglist->upd_thrs,
+		    msglist->upd_thrs_cap * sizeof (*msglist->upd_thrs));
+	}
+	msglist->upd_thrs[msglist->num_upd_thrs++] = thr->thr_id;
+	thr->upd_seq = msglist->upd_seq;
+}
+
+static void
+thr_unmark_updated(cpdlc_msglist_t *msglist, msg_thr_t *thr)
+{
+	ASSERT(msglist != NULL);
+	ASSERT(thr != NULL);
+
+	if (thr->upd_seq != msglist->upd_seq)
+		return;
+	for (unsigned i = 0; i < msglist->num_upd_thrs; i++) {
+		if (msglist->upd_thrs[i] == thr->thr_id) {
+			memmove(&msglist->upd_thrs[i],
+			    &msglist->upd_thrs[i + 1],
+			    (msglist->num_upd_thrs - i - 1) *
+			    sizeof (*msglist->upd_thrs));
+			msglist->num_upd_thrs--;
+			break;
+		}
+	}
+	thr->upd_seq = 0;
+}
+
+/*
+ * Delivers the accumulated set of updated threads to the update callback.
+ * Unless `force' is true, this does nothing if the previous notification
+ * was less than upd_intval ago. The callback is called without holding
+ * any msglist locks to avoid locking inversions with the application.
+ * Deliveries are serialized using `upd_busy': if another thread is
+ * already running the callback, we just leave our updates in the pending
+ * set and the delivering thread picks them up once its callback returns.
+ */
+static void
+msglist_notify(cpdlc_msglist_t *msglist, bool force)
+{
+	ASSERT(msglist != NULL);
+
+	mutex_enter(&msglist->lock);
+	if (msglist->upd_busy) {
+		msglist->upd_force |= force;
+		mutex_exit(&msglist->lock);
+		return;
+	}
+	for (;;) {
+		cpdlc_msglist_update_cb_t update_cb;
+		cpdlc_msg_thr_id_t *upd_thrs;
+		unsigned num_upd_thrs;
+		uint64_t now = cpdlc_clock_us();
+
+		force |= msglist->upd_force;
+		msglist->upd_force = false;
+		if (msglist->num_upd_thrs == 0 || (!force &&
+		    now - msglist->last_upd_t < msglist->upd_intval))
+			break;
+		update_cb = msglist->update_cb;
+		upd_thrs = msglist->upd_thrs;
+		num_upd_thrs = msglist->num_upd_thrs;
+		msglist->upd_thrs = NULL;
+		msglist->num_upd_thrs = 0;
+		msglist->upd_thrs_cap = 0;
+		msglist->upd_seq++;
+		msglist->last_upd_t = now;
+		msglist->upd_busy = true;
+		mutex_exit(&msglist->lock);
+
+		if (update_cb != NULL)
+			update_cb(msglist, upd_thrs, num_upd_thrs);
+		free(upd_thrs);
+
+		mutex_enter(&msglist->lock);
+		msglist->upd_busy = false;
+		force = false;
+	}
+	mutex_exit(&msglist->lock);
+}
 
 static bool
 msg_is_dl_req(const cpdlc_msg_t *msg)
@@ -190,15 +364,52 @@ thr_status_is_final(cpdlc_msg_thr_status_t st)
 	    st == CPDLC_MSG_THR_ERROR || st == CPDLC_MSG_THR_CONN_ENDED);
 }
 
+static inline msg_bucket_t *
+thr_first(const msg_thr_t *thr)
+{
+	ASSERT(thr != NULL);
+	return (thr->num_buckets != 0 ? &thr->buckets[0] : NULL);
+}
+
+static inline msg_bucket_t *
+thr_last(const msg_thr_t *thr)
+{
+	ASSERT(thr != NULL);
+	return (thr->num_buckets != 0 ?
+	    &thr->buckets[thr->num_buckets - 1] : NULL);
+}
+
+/*
+ * Appends a new zeroed-out bucket to the end of a thread. Note that this
+ * can reallocate the bucket array, invalidating any bucket pointers
+ * previously obtained from the thread.
+ */
+static msg_bucket_t *
+thr_add_bucket(msg_thr_t *thr)
+{
+	msg_bucket_t *bucket;
+
+	ASSERT(thr != NULL);
+
+	if (thr->num_buckets == thr->buckets_cap) {
+		thr->buckets_cap = MAX(2 * thr->buckets_cap, 4);
+		thr->buckets = safe_realloc(thr->buckets,
+		    thr->buckets_cap * sizeof (*thr->buckets));
+	}
+	bucket = &thr->buckets[thr->num_buckets++];
+	memset(bucket, 0, sizeof (*bucket));
+
+	return (bucket);
+}
+
 static unsigned
 thr_get_timeout(msg_thr_t *thr)
 {
 	unsigned timeout = UINT32_MAX;
 
 	ASSERT(thr != NULL);
-	for (msg_bucket_t *bucket = list_head(&thr->buckets); bucket != NULL;
-	    bucket = list_next(&thr->buckets, bucket)) {
-		const cpdlc_msg_t *msg = bucket->msg;
+	for (unsigned b = 0; b < thr->num_buckets; b++) {
+		const cpdlc_msg_t *msg = thr->buckets[b].msg;
 
 		ASSERT(msg != NULL);
 		for (unsigned i = 0, n = cpdlc_msg_get_num_segs(msg); i < n;
@@ -217,10 +428,11 @@ thr_get_timeout(msg_thr_t *thr)
 static void
 thr_status_upd(cpdlc_msglist_t *msglist, msg_thr_t *thr)
 {
-	msg_bucket_t *first = list_head(&thr->buckets);
-	msg_bucket_t *last = list_tail(&thr->buckets);
-	time_t now = time(NULL);
+	msg_bucket_t *first = thr_first(thr);
+	msg_bucket_t *last = thr_last(thr);
+	time_t now = cpdlc_clock_time();
 	unsigned timeout;
+	cpdlc_msg_thr_status_t old_status = thr->status;
 
 	if (thr_status_is_final(thr->status))
 		return;
@@ -256,8 +468,12 @@ thr_status_upd(cpdlc_msglist_t *msglist, msg_thr_t *thr)
 		cpdlc_msg_set_mrn(msg, cpdlc_msg_get_min(last->msg));
 		cpdlc_msg_add_seg(msg, true, CPDLC_DM62_ERROR_errorinfo, 0);
 		cpdlc_msg_seg_set_arg(msg, 0, 0, "TIMEDOUT", NULL);
+		/* Don't count the automatic reply as a response time */
+		thr->rx_req_t = 0;
+		thr->stby_t = 0;
 		msglist_send_impl(msglist, msg, thr->thr_id);
 		thr->status = CPDLC_MSG_THR_TIMEDOUT;
+		msglist->stats.num_timeouts++;
 	} else if (is_disregard_msg(last->msg)) {
 		thr->status = CPDLC_MSG_THR_DISREGARD;
 	} else if (is_error_msg(last->msg)) {
@@ -267,12 +483,351 @@ thr_status_upd(cpdlc_msglist_t *msglist, msg_thr_t *thr)
 		thr->dirty = false;
 		thr->status = CPDLC_MSG_THR_CONN_ENDED;
 	}
+	if (thr->status != old_status) {
+		thr_mark_updated(msglist, thr);
+		msglist->gen++;
+	}
+	thr_peer_sync(msglist, thr);
+}
+
+/*
+ * Binary search of the peer index. Returns the index at which a peer
+ * with `callsign' is located, or should be inserted if `found' is false.
+ */
+static unsigned
+peer_lookup(const cpdlc_msglist_t *msglist, const char *callsign, bool *found)
+{
+	unsigned lo = 0, hi = msglist->num_peers;
+
+	ASSERT(callsign != NULL);
+	ASSERT(found != NULL);
+
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+		int c = strcmp(msglist->peers[mid]->callsign, callsign);
+
+		if (c == 0) {
+			*found = true;
+			return (mid);
+		}
+		if (c < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*found = false;
+	return (lo);
+}
+
+static msg_peer_t *
+peer_find(const cpdlc_msglist_t *msglist, const char *callsign)
+{
+	bool found;
+	unsigned i = peer_lookup(msglist, callsign, &found);
+	return (found ? msglist->peers[i] : NULL);
+}
+
+static msg_peer_t *
+peer_get(cpdlc_msglist_t *msglist, const char *callsign)
+{
+	bool found;
+	unsigned i = peer_lookup(msglist, callsign, &found);
+	msg_peer_t *peer;
+
+	if (found)
+		return (msglist->peers[i]);
+
+	peer = safe_calloc(1, sizeof (*peer));
+	cpdlc_strlcpy(peer->callsign, callsign, sizeof (peer->callsign));
+	list_create(&peer->thrs, sizeof (msg_thr_t),
+	    offsetof(msg_thr_t, peer_node));
+	list_create(&peer->pending, sizeof (msg_thr_t),
+	    offsetof(msg_thr_t, pending_node));
+	if (msglist->num_peers == msglist->peers_cap) {
+		msglist->peers_cap = MAX(2 * msglist->peers_cap, 8);
+		msglist->peers = safe_realloc(msglist->peers,
+		    msglist->peers_cap * sizeof (*msglist->peers));
+	}
+	memmove(&msglist->peers[i + 1], &msglist->peers[i],
+	    (msglist->num_peers - i) * sizeof (*msglist->peers));
+	msglist->peers[i] = peer;
+	msglist->num_peers++;
+
+	return (peer);
+}
+
+static void
+peer_free(cpdlc_msglist_t *msglist, msg_peer_t *peer)
+{
+	bool found;
+	unsigned i = peer_lookup(msglist, peer->callsign, &found);
+
+	ASSERT(found);
+	ASSERT3P(msglist->peers[i], ==, peer);
+	memmove(&msglist->peers[i], &msglist->peers[i + 1],
+	    (msglist->num_peers - i - 1) * sizeof (*msglist->peers));
+	msglist->num_peers--;
+
+	list_destroy(&peer->thrs);
+	list_destroy(&peer->pending);
+	free(peer);
+}
+
+/*
+ * (Re)inserts `peer' into the pending peers list, which is kept sorted
+ * by the time of each peer's oldest pending request. The peer is
+ * usually the one with the newest request, so we search from the tail.
+ */
+static void
+peer_pending_insert(cpdlc_msglist_t *msglist, msg_peer_t *peer)
+{
+	time_t t = ((msg_thr_t *)list_head(&peer->pending))->pending_t;
+	msg_peer_t *prev;
+
+	for (prev = list_tail(&msglist->pending_peers); prev != NULL &&
+	    ((msg_thr_t *)list_head(&prev->pending))->pending_t > t;
+	    prev = list_prev(&msglist->pending_peers, prev))
+		;
+	if (prev != NULL)
+		list_insert_after(&msglist->pending_peers, peer, prev);
+	else
+		list_insert_head(&msglist->pending_peers, peer);
+}
+
+/*
+ * Brings the peer's open and pending thread accounting up to date with
+ * the thread's current state. Both the peer's pending threads and the
+ * pending peers are kept oldest first, so answering a request (or a new
+ * request arriving in a thread which was already pending) can move the
+ * thread and its peer.
+ */
+static void
+thr_peer_sync(cpdlc_msglist_t *msglist, msg_thr_t *thr)
+{
+	msg_peer_t *peer = thr->peer_p;
+	msg_thr_t *prev;
+	bool open, pending;
+
+	if (peer == NULL)
+		return;
+
+	open = !thr_status_is_final(thr->status);
+	if (open != thr->peer_open) {
+		if (open)
+			peer->num_open++;
+		else
+			peer->num_open--;
+		thr->peer_open = open;
+	}
+	pending = (open && thr->rx_req_t != 0);
+	if (pending == thr->peer_pending &&
+	    (!pending || thr->pending_t == thr->rx_req_t))
+		return;
+
+	if (list_count(&peer->pending) != 0)
+		list_remove(&msglist->pending_peers, peer);
+	if (thr->peer_pending)
+		list_remove(&peer->pending, thr);
+	if (pending) {
+		thr->pending_t = thr->rx_req_t;
+		for (prev = list_tail(&peer->pending); prev != NULL &&
+		    prev->pending_t > thr->pending_t;
+		    prev = list_prev(&peer->pending, prev))
+			;
+		if (prev != NULL)
+			list_insert_after(&peer->pending, thr, prev);
+		else
+			list_insert_head(&peer->pending, thr);
+	}
+	thr->peer_pending = pending;
+	if (list_count(&peer->pending) != 0)
+		peer_pending_insert(msglist, peer);
+}
+
+static void
+thr_peer_detach(cpdlc_msglist_t *msglist, msg_thr_t *thr)
+{
+	msg_peer_t *peer = thr->peer_p;
+
+	if (peer == NULL)
+		return;
+
+	/* Forcing the thread closed drops it out of the accounting */
+	thr->status = CPDLC_MSG_THR_CLOSED;
+	thr_peer_sync(msglist, thr);
+	list_remove(&peer->thrs, thr);
+	thr->peer_p = NULL;
+	if (list_count(&peer->thrs) == 0)
+		peer_free(msglist, peer);
+}
+
+static void
+thr_peer_attach(cpdlc_msglist_t *msglist, msg_thr_t *thr)
+{
+	msg_peer_t *peer;
+	msg_thr_t *next;
+
+	ASSERT3P(thr->peer_p, ==, NULL);
+
+	peer = peer_get(msglist, thr->peer);
+	/* Usually the thread is the newest one, so this terminates quickly */
+	for (next = list_head(&peer->thrs); next != NULL &&
+	    next->thr_id > thr->thr_id; next = list_next(&peer->thrs, next))
+		;
+	if (next != NULL)
+		list_insert_before(&peer->thrs, thr, next);
+	else
+		list_insert_tail(&peer->thrs, thr);
+	thr->peer_p = peer;
+	thr->peer_open = false;
+	thr->peer_pending = false;
+	thr_peer_sync(msglist, thr);
+}
+
+static void
+thr_set_peer(cpdlc_msglist_t *msglist, msg_thr_t *thr, const cpdlc_msg_t *msg,
+    bool sent)
+{
+	ASSERT(msglist != NULL);
+	ASSERT(thr != NULL);
+	ASSERT(msg != NULL);
+
+	if (thr->peer[0] != '\0') {
+		if (thr->peer_p == NULL)
+			thr_peer_attach(msglist, thr);
+		return;
+	}
+	cpdlc_strlcpy(thr->peer, sent ? cpdlc_msg_get_to(msg) :
+	    cpdlc_msg_get_from(msg), sizeof (thr->peer));
+	if (thr->peer_p != NULL) {
+		cpdlc_msg_thr_status_t status = thr->status;
+
+		/* Still don't know who we're talking to, stay put */
+		if (thr->peer[0] == '\0')
+			return;
+		thr_peer_detach(msglist, thr);
+		thr->status = status;
+	}
+	thr_peer_attach(msglist, thr);
+}
+
+static bool
+thr_matches_query(const msg_thr_t *thr, const cpdlc_msglist_query_t *query)
+{
+	const msg_bucket_t *last;
+
+	ASSERT(thr != NULL);
+	ASSERT(query != NULL);
+
+	if (query->status_mask != 0 &&
+	    (query->status_mask & CPDLC_MSG_THR_STATUS_BIT(thr->status)) == 0)
+		return (false);
+	if (query->ignore_closed && !thr->dirty &&
+	    thr_status_is_final(thr->status))
+		return (false);
+	if ((query->dirty == CPDLC_MSGLIST_DIRTY_ONLY && !thr->dirty) ||
+	    (query->dirty == CPDLC_MSGLIST_DIRTY_NONE && thr->dirty))
+		return (false);
+	if (query->peer != NULL && strcmp(query->peer, thr->peer) != 0)
+		return (false);
+	if (query->time_min != 0 || query->time_max != 0) {
+		last = thr_last(thr);
+		if (last == NULL)
+			return (false);
+		if (query->time_min != 0 && last->time < query->time_min)
+			return (false);
+		if (query->time_max != 0 && last->time > query->time_max)
+			return (false);
+	}
+	return (true);
+}
+
+static void
+thr_get_info(const msg_thr_t *thr, cpdlc_msglist_thr_info_t *info)
+{
+	const msg_bucket_t *last;
+
+	ASSERT(thr != NULL);
+	ASSERT(info != NULL);
+
+	last = thr_last(thr);
+	info->thr_id = thr->thr_id;
+	info->status = thr->status;
+	info->dirty = thr->dirty;
+	info->num_msgs = thr->num_buckets;
+	info->last_time = (last != NULL ? last->time : 0);
+	cpdlc_strlcpy(info->peer, thr->peer, sizeof (info->peer));
+}
+
+static void
+hist_add(cpdlc_msglist_hist_t *hist, time_t start, time_t end)
+{
+	unsigned d = (end > start ? end - start : 0);
+	unsigned bin = 0;
+
+	ASSERT(hist != NULL);
+
+	for (unsigned lim = 1; d >= lim && bin + 1 < CPDLC_MSGLIST_HIST_BINS;
+	    lim <<= 1)
+		bin++;
+	hist->bins[bin]++;
+	if (hist->count == 0 || d < hist->min)
+		hist->min = d;
+	hist->max = MAX(hist->max, d);
+	hist->count++;
+	hist->sum += d;
+}
+
+/*
+ * Updates the response time statistics after a new bucket was appended
+ * to a thread. Any message travelling in the opposite direction to an
+ * outstanding request, other than a STANDBY, is taken as the response to
+ * that request. This is a constant-time operation.
+ */
+static void
+thr_stats_upd(cpdlc_msglist_t *msglist, msg_thr_t *thr)
+{
+	const msg_bucket_t *bucket = thr_last(thr);
+	const cpdlc_msg_t *msg;
+	time_t *req_t, *resp_req_t;
+	cpdlc_msglist_hist_t *hist;
+
+	ASSERT(msglist != NULL);
+	ASSERT(bucket != NULL);
+	msg = bucket->msg;
+	ASSERT(msg->segs[0].info != NULL);
+
+	if (bucket->sent) {
+		req_t = &thr->tx_req_t;
+		resp_req_t = &thr->rx_req_t;
+		hist = &msglist->stats.rx_resp;
+	} else {
+		req_t = &thr->rx_req_t;
+		resp_req_t = &thr->tx_req_t;
+		hist = &msglist->stats.tx_resp;
+	}
+	if (*resp_req_t != 0) {
+		if (msg_is_stby(msg)) {
+			if (thr->stby_t == 0)
+				thr->stby_t = bucket->time;
+			return;
+		}
+		hist_add(hist, *resp_req_t, bucket->time);
+		if (thr->stby_t != 0) {
+			hist_add(&msglist->stats.stby, thr->stby_t,
+			    bucket->time);
+			thr->stby_t = 0;
+		}
+		*resp_req_t = 0;
+	}
+	if (msg->segs[0].info->resp != CPDLC_RESP_N && !msg_is_stby(msg))
+		*req_t = bucket->time;
 }
 
 static void
 dfl_get_time_func(void *unused, unsigned *hours, unsigned *mins)
 {
-	time_t now = time(NULL);
+	time_t now = cpdlc_clock_time();
 	const struct tm *tm = localtime(&now);
 	UNUSED(unused);
 	ASSERT(hours != NULL);
@@ -281,23 +836,57 @@ dfl_get_time_func(void *unused, unsigned *hours, unsigned *mins)
 	*mins = tm->tm_min;
 }
 
+/*
+ * Makes room for at least one more thread in the slot table. If at least
+ * half of the table is taken up by leading slots of removed threads, we
+ * slide the table down instead of growing it, so the table size stays
+ * proportional to the ID range of live threads.
+ */
+static void
+thr_slots_grow(cpdlc_msglist_t *msglist)
+{
+	unsigned n_slots = msglist->next_thr_id - msglist->thr_slots_base;
+	unsigned n_free = 0;
+
+	while (n_free < n_slots && msglist->thr_slots[n_free] == NULL)
+		n_free++;
+	if (n_free != 0 && n_free >= n_slots / 2) {
+		memmove(msglist->thr_slots, &msglist->thr_slots[n_free],
+		    (n_slots - n_free) * sizeof (*msglist->thr_slots));
+		msglist->thr_slots_base += n_free;
+	} else {
+		msglist->thr_slots_cap = MAX(2 * msglist->thr_slots_cap, 16);
+		msglist->thr_slots = safe_realloc(msglist->thr_slots,
+		    msglist->thr_slots_cap * sizeof (*msglist->thr_slots));
+	}
+}
+
 static msg_thr_t *
 find_msg_thr(cpdlc_msglist_t *msglist, cpdlc_msg_thr_id_t thr_id)
 {
 	ASSERT(msglist != NULL);
 
 	if (thr_id != CPDLC_NO_MSG_THR_ID) {
-		for (msg_thr_t *thr = list_head(&msglist->thr); thr != NULL;
-		    thr = list_next(&msglist->thr, thr)) {
-			if (thr->thr_id == thr_id)
-				return (thr);
+		msg_thr_t *thr = NULL;
+
+		if (thr_id >= msglist->thr_slots_base &&
+		    thr_id < msglist->next_thr_id) {
+			thr = msglist->thr_slots[thr_id -
+			    msglist->thr_slots_base];
 		}
-		VERIFY_MSG(0, "Invalid message thread ID %x", thr_id);
+		VERIFY_MSG(thr != NULL, "Invalid message thread ID %x", thr_id);
+		ASSERT3U(thr->thr_id, ==, thr_id);
+		return (thr);
 	} else {
 		msg_thr_t *thr = safe_calloc(1, sizeof (*thr));
+		unsigned n_slots = msglist->next_thr_id -
+		    msglist->thr_slots_base;
+
+		if (n_slots == msglist->thr_slots_cap)
+			thr_slots_grow(msglist);
+		n_slots = msglist->next_thr_id - msglist->thr_slots_base;
 		thr->thr_id = msglist->next_thr_id++;
-		list_create(&thr->buckets, sizeof (msg_bucket_t),
-		    offsetof(msg_bucket_t, node));
+		msglist->thr_slots[n_slots] = thr;
 		list_insert_head(&msglist->thr, thr);
 		return (thr);
 	}
@@ -306,16 +895,13 @@ find_msg_thr(cpdlc_msglist_t *msglist, cpdlc_msg_thr_id_t thr_id)
 static void
 free_msg_thr(msg_thr_t *thr)
 {
-	msg_bucket_t *bucket;
-
 	ASSERT(thr != NULL);
 
-	while ((bucket = list_remove_head(&thr->buckets)) != NULL) {
-		ASSERT(bucket->msg != NULL);
-		cpdlc_msg_free(bucket->msg);
-		free(bucket);
+	for (unsigned i = 0; i < thr->num_buckets; i++) {
+		ASSERT(thr->buckets[i].msg != NULL);
+		cpdlc_msg_free(thr->buckets[i].msg);
 	}
-	list_destroy(&thr->buckets);
+	free(thr->buckets);
 	free(thr);
 }
 
@@ -338,16 +924,13 @@ msg_matches_bucket(const cpdlc_msg_t *msg, const msg_bucket_t *bucket)
 		return (bucket->sent && min == mrn);
 }
 
-msg_thr_t *
-msg_thr_find_by_mrn(cpdlc_msglist_t *msglist, const cpdlc_msg_t *msg)
+static msg_thr_t *
+peer_find_thr_by_mrn(msg_peer_t *peer, const cpdlc_msg_t *msg)
 {
-	ASSERT(msglist != NULL);
-	ASSERT(msg != NULL);
-
-	if (cpdlc_msg_get_mrn(msg) == CPDLC_INVALID_MSG_SEQ_NR)
+	if (peer == NULL)
 		return (NULL);
-	for (msg_thr_t *thr = list_tail(&msglist->thr); thr != NULL;
-	    thr = list_prev(&msglist->thr, thr)) {
+	for (msg_thr_t *thr = list_tail(&peer->thrs); thr != NULL;
+	    thr = list_prev(&peer->thrs, thr)) {
 		/*
 		 * Skip manually closed threads. This allows the FMS
 		 * to force the message list to receive all uplink
@@ -355,8 +938,9 @@ msg_thr_find_by_mrn(cpdlc_msglist_t *msglist, const cpdlc_msg_t *msg)
 		 */
 		if (thr->status == CPDLC_MSG_THR_CLOSED)
 			continue;
-		for (msg_bucket_t *bucket = list_tail(&thr->buckets);
-		    bucket != NULL; bucket = list_prev(&thr->buckets, bucket)) {
+		for (unsigned i = thr->num_buckets; i-- > 0;) {
+			const msg_bucket_t *bucket = &thr->buckets[i];
+
 			ASSERT(bucket->msg != NULL);
 			if (msg_matches_bucket(msg, bucket))
 				return (thr);
@@ -365,14 +949,35 @@ msg_thr_find_by_mrn(cpdlc_msglist_t *msglist, const cpdlc_msg_t *msg)
 	return (NULL);
 }
 
+/*
+ * MIN/MRN matching is done per peer, so we only need to look through
+ * the threads of the message's sender, plus any threads for which we
+ * haven't yet learned who the other party is.
+ */
+static msg_thr_t *
+msg_thr_find_by_mrn(cpdlc_msglist_t *msglist, const cpdlc_msg_t *msg)
+{
+	const char *from;
+	msg_thr_t *thr = NULL;
+
+	ASSERT(msglist != NULL);
+	ASSERT(msg != NULL);
+
+	if (cpdlc_msg_get_mrn(msg) == CPDLC_INVALID_MSG_SEQ_NR)
+		return (NULL);
+	from = cpdlc_msg_get_from(msg);
+	if (from[0] != '\0')
+		thr = peer_find_thr_by_mrn(peer_find(msglist, from), msg);
+	if (thr == NULL)
+		thr = peer_find_thr_by_mrn(peer_find(msglist, ""), msg);
+	return (thr);
+}
+
 static void
 msg_recv_cb(cpdlc_client_t *cl)
 {
 	cpdlc_msglist_t *msglist;
 	cpdlc_msg_t *msg;
-	cpdlc_msg_thr_id_t *upd_thrs = NULL;
-	unsigned num_upd_thrs = 0;
-	cpdlc_msglist_update_cb_t update_cb;
 
 	ASSERT(cl != NULL);
 	msglist = cpdlc_client_get_cb_userinfo(cl);
@@ -380,41 +985,29 @@ msg_recv_cb(cpdlc_client_t *cl)
 
 	mutex_enter(&msglist->lock);
 
-	update_cb = msglist->update_cb;
-
 	while ((msg = cpdlc_client_recv_msg(cl)) != NULL) {
 		msg_thr_t *thr = msg_thr_find_by_mrn(msglist, msg);
 		msg_bucket_t *bucket;
 
 		if (thr == NULL)
 			thr = find_msg_thr(msglist, CPDLC_NO_MSG_THR_ID);
-		bucket = safe_calloc(1, sizeof (*bucket));
+		bucket = thr_add_bucket(thr);
 		bucket->msg = msg;
 		bucket->tok = CPDLC_INVALID_MSG_TOKEN;
 		ASSERT(msglist->get_time_func != NULL);
 		msglist->get_time_func(msglist->userinfo, &bucket->hours,
 		    &bucket->mins);
-		bucket->time = time(NULL);
+		bucket->time = cpdlc_clock_time();
 		thr->dirty = true;
-
-		list_insert_tail(&thr->buckets, bucket);
+		msglist->gen++;
+		thr_set_peer(msglist, thr, msg, false);
+		thr_stats_upd(msglist, thr);
+		thr_mark_updated(msglist, thr);
 		thr_status_upd(msglist, thr);
-
-		if (update_cb != NULL) {
-			upd_thrs = safe_realloc(upd_thrs, (num_upd_thrs + 1) *
-			    sizeof (*upd_thrs));
-			upd_thrs[num_upd_thrs] = thr->thr_id;
-			num_upd_thrs++;
-		}
 	}
 	mutex_exit(&msglist->lock);
-	/*
-	 * Call this outside of locking context to avoid locking inversions.
-	 */
-	if (update_cb != NULL) {
-		update_cb(msglist, upd_thrs, num_upd_thrs);
-		free(upd_thrs);
-	}
+
+	msglist_notify(msglist, false);
 }
 
 cpdlc_msglist_t *
@@ -428,8 +1021,11 @@ cpdlc_msglist_alloc(cpdlc_client_t *cl)
 	cpdlc_client_set_cb_userinfo(cl, msglist);
 
 	mutex_init(&msglist->lock);
+	msglist->upd_seq = 1;
 	list_create(&msglist->thr, sizeof (msg_thr_t),
 	    offsetof(msg_thr_t, node));
+	list_create(&msglist->pending_peers, sizeof (msg_peer_t),
+	    offsetof(msg_peer_t, pending_peers_node));
 	msglist->cl = cl;
 	msglist->get_time_func = dfl_get_time_func;
 
@@ -443,8 +1039,16 @@ cpdlc_msglist_free(cpdlc_msglist_t *msglist)
 
 	ASSERT(msglist != NULL);
 
-	while ((thr = list_remove_head(&msglist->thr)) != NULL)
+	while ((thr = list_remove_head(&msglist->thr)) != NULL) {
+		thr_peer_detach(msglist, thr);
 		free_msg_thr(thr);
+	}
+	list_destroy(&msglist->thr);
+	ASSERT0(msglist->num_peers);
+	free(msglist->peers);
+	list_destroy(&msglist->pending_peers);
+	free(msglist->thr_slots);
+	free(msglist->upd_thrs);
 	mutex_destroy(&msglist->lock);
 	free(msglist);
 }
@@ -461,6 +1065,37 @@ cpdlc_msglist_update(cpdlc_msglist_t *msglist)
 		thr_status_upd(msglist, thr);
 
 	mutex_exit(&msglist->lock);
+
+	msglist_notify(msglist, false);
+}
+
+/*
+ * Returns a counter which is incremented whenever any thread in the
+ * msglist changes. Consumers can compare it against a previously
+ * returned value to cheaply determine if they need to re-read threads.
+ */
+uint64_t
+cpdlc_msglist_get_gen(cpdlc_msglist_t *msglist)
+{
+	uint64_t gen;
+
+	ASSERT(msglist != NULL);
+	mutex_enter(&msglist->lock);
+	gen = msglist->gen;
+	mutex_exit(&msglist->lock);
+
+	return (gen);
+}
+
+/*
+ * Immediately delivers any pending thread updates to the update callback,
+ * regardless of the configured update interval.
+ */
+void
+cpdlc_msglist_flush_updates(cpdlc_msglist_t *msglist)
+{
+	ASSERT(msglist != NULL);
+	msglist_notify(msglist, true);
 }
 
 static msg_thr_t *
@@ -481,24 +1116,27 @@ msglist_send_impl(cpdlc_msglist_t *msglist, cpdlc_msg_t *msg,
 	thr_id = thr->thr_id;
 
 	/* Assign the appropriate MIN and MRN flags */
-	for (msg_bucket_t *bucket = list_tail(&thr->buckets); bucket != NULL;
-	    bucket = list_prev(&thr->buckets, bucket)) {
-		if (cpdlc_msg_get_dl(bucket->msg) != cpdlc_msg_get_dl(msg)) {
-			cpdlc_msg_set_mrn(msg, cpdlc_msg_get_min(bucket->msg));
+	for (unsigned i = thr->num_buckets; i-- > 0;) {
+		const cpdlc_msg_t *prev = thr->buckets[i].msg;
+
+		if (cpdlc_msg_get_dl(prev) != cpdlc_msg_get_dl(msg)) {
+			cpdlc_msg_set_mrn(msg, cpdlc_msg_get_min(prev));
 			break;
 		}
 	}
 	cpdlc_msg_set_min(msg, msglist->min++);
 
-	bucket = safe_calloc(1, sizeof (*bucket));
+	bucket = thr_add_bucket(thr);
 	bucket->msg = msg;
 	bucket->tok = cpdlc_client_send_msg(msglist->cl, msg);
 	bucket->sent = true;
 	ASSERT(msglist->get_time_func != NULL);
 	msglist->get_time_func(msglist->userinfo, &bucket->hours,
 	    &bucket->mins);
-	bucket->time = time(NULL);
-	list_insert_tail(&thr->buckets, bucket);
+	bucket->time = cpdlc_clock_time();
+	thr_set_peer(msglist, thr, msg, true);
+	msglist->gen++;
+	thr_stats_upd(msglist, thr);
 
 	return (thr);
 }
@@ -550,6 +1188,81 @@ cpdlc_msglist_get_thr_ids(cpdlc_msglist_t *msglist, bool ignore_closed,
 		*cap = MIN(*cap, thr_i);
 }
 
+/*
+ * Looks up threads matching `query', newest first, and fills in up to
+ * `max_results' entries in `results'. If `cursor' is not NULL, it is used
+ * to resume a previous query: on entry, only threads older than the one
+ * it identifies are considered (pass CPDLC_NO_MSG_THR_ID to start from
+ * the newest thread), and on return it holds the ID of the last thread
+ * returned. A return value less than `max_results' signals that no more
+ * matching threads exist. If `num_matches' is not NULL, it is filled
+ * with the total number of threads matching the filter, irrespective of
+ * the cursor, offset and `max_results'.
+ */
+unsigned
+cpdlc_msglist_query(cpdlc_msglist_t *msglist,
+    const cpdlc_msglist_query_t *query, cpdlc_msg_thr_id_t *cursor,
+    cpdlc_msglist_thr_info_t *results, unsigned max_results,
+    unsigned *num_matches)
+{
+	unsigned n_results = 0, n_matches = 0, skip;
+	cpdlc_msg_thr_id_t start = CPDLC_NO_MSG_THR_ID;
+	list_t *thrs;
+
+	ASSERT(msglist != NULL);
+	ASSERT(query != NULL);
+	ASSERT(results != NULL || max_results == 0);
+
+	if (cursor != NULL)
+		start = *cursor;
+	skip = query->offset;
+
+	mutex_enter(&msglist->lock);
+	if (query->peer != NULL) {
+		msg_peer_t *peer = peer_find(msglist, query->peer);
+
+		if (peer == NULL) {
+			mutex_exit(&msglist->lock);
+			if (num_matches != NULL)
+				*num_matches = 0;
+			return (0);
+		}
+		thrs = &peer->thrs;
+	} else {
+		thrs = &msglist->thr;
+	}
+	for (msg_thr_t *thr = list_head(thrs); thr != NULL;
+	    thr = list_next(thrs, thr)) {
+		/*
+		 * Stop early if the caller isn't interested in the total
+		 * match count and we've filled up the results buffer.
+		 */
+		if (n_results == max_results && num_matches == NULL)
+			break;
+		if (!thr_matches_query(thr, query))
+			continue;
+		n_matches++;
+		if (start != CPDLC_NO_MSG_THR_ID && thr->thr_id >= start)
+			continue;
+		if (skip != 0) {
+			skip--;
+			continue;
+		}
+		if (n_results < max_results) {
+			thr_get_info(thr, &results[n_results]);
+			n_results++;
+		}
+	}
+	mutex_exit(&msglist->lock);
+
+	if (cursor != NULL && n_results != 0)
+		*cursor = results[n_results - 1].thr_id;
+	if (num_matches != NULL)
+		*num_matches = n_matches;
+
+	return (n_results);
+}
+
 cpdlc_msg_thr_status_t
 cpdlc_msglist_get_thr_status(cpdlc_msglist_t *msglist,
     cpdlc_msg_thr_id_t thr_id, bool *dirty)
@@ -580,7 +1293,10 @@ cpdlc_msglist_thr_mark_seen(cpdlc_msglist_t *msglist, cpdlc_msg_thr_id_t thr_id)
 
 	mutex_enter(&msglist->lock);
 	thr = find_msg_thr(msglist, thr_id);
-	thr->dirty = false;
+	if (thr->dirty) {
+		thr->dirty = false;
+		msglist->gen++;
+	}
 	mutex_exit(&msglist->lock);
 }
 
@@ -596,7 +1312,7 @@ cpdlc_msglist_get_thr_msg_count(cpdlc_msglist_t *msglist,
 
 	mutex_enter(&msglist->lock);
 	thr = find_msg_thr(msglist, thr_id);
-	count = list_count(&thr->buckets);
+	count = thr->num_buckets;
 	mutex_exit(&msglist->lock);
 
 	return (count);
@@ -616,11 +1332,8 @@ cpdlc_msglist_get_thr_msg(cpdlc_msglist_t *msglist, cpdlc_msg_thr_id_t thr_id,
 	mutex_enter(&msglist->lock);
 
 	thr = find_msg_thr(msglist, thr_id);
-	ASSERT3U(msg_nr, <, list_count(&thr->buckets));
-	bucket = list_head(&thr->buckets);
-	for (unsigned i = 0; i < msg_nr; i++)
-		bucket = list_next(&thr->buckets, bucket);
-	ASSERT(bucket != NULL);
+	ASSERT3U(msg_nr, <, thr->num_buckets);
+	bucket = &thr->buckets[msg_nr];
 	if (msg_p != NULL)
 		*msg_p = bucket->msg;
 	if (token_p != NULL)
@@ -645,7 +1358,11 @@ cpdlc_msglist_remove_thr(cpdlc_msglist_t *msglist, cpdlc_msg_thr_id_t thr_id)
 
 	mutex_enter(&msglist->lock);
 	thr = find_msg_thr(msglist, thr_id);
+	thr_unmark_updated(msglist, thr);
+	thr_peer_detach(msglist, thr);
 	list_remove(&msglist->thr, thr);
+	msglist->thr_slots[thr_id - msglist->thr_slots_base] = NULL;
+	msglist->gen++;
 	mutex_exit(&msglist->lock);
 
 	free_msg_thr(thr);
@@ -678,8 +1395,101 @@ cpdlc_msglist_thr_close(cpdlc_msglist_t *msglist, cpdlc_msg_thr_id_t thr_id)
 
 	mutex_enter(&msglist->lock);
 	thr = find_msg_thr(msglist, thr_id);
-	if (!thr_status_is_final(thr->status))
+	if (!thr_status_is_final(thr->status)) {
 		thr->status = CPDLC_MSG_THR_CLOSED;
+		msglist->gen++;
+	}
+	thr_peer_sync(msglist, thr);
+	mutex_exit(&msglist->lock);
+}
+
+static void
+peer_get_summary(const msg_peer_t *peer, cpdlc_msglist_peer_summary_t *sum)
+{
+	const msg_thr_t *oldest = list_head(&peer->pending);
+
+	cpdlc_strlcpy(sum->peer, peer->callsign, sizeof (sum->peer));
+	sum->num_thrs = list_count(&peer->thrs);
+	sum->num_open = peer->num_open;
+	sum->num_pending = list_count(&peer->pending);
+	sum->oldest_pending = (oldest != NULL ? oldest->rx_req_t : 0);
+}
+
+/*
+ * Fills in summaries of up to `max_peers' peers. If `pending_only' is
+ * true, only peers with threads awaiting a response from us are
+ * returned, oldest first, otherwise all peers are returned sorted by
+ * callsign. If `num_peers' is not NULL, it is filled with the total
+ * number of peers which would be returned given unlimited space.
+ */
+unsigned
+cpdlc_msglist_get_peers(cpdlc_msglist_t *msglist, bool pending_only,
+    cpdlc_msglist_peer_summary_t *sums, unsigned max_peers,
+    unsigned *num_peers)
+{
+	unsigned n = 0;
+
+	ASSERT(msglist != NULL);
+	ASSERT(sums != NULL || max_peers == 0);
+
+	mutex_enter(&msglist->lock);
+	if (pending_only) {
+		for (msg_peer_t *peer = list_head(&msglist->pending_peers);
+		    peer != NULL && n < max_peers;
+		    peer = list_next(&msglist->pending_peers, peer))
+			peer_get_summary(peer, &sums[n++]);
+		if (num_peers != NULL)
+			*num_peers = list_count(&msglist->pending_peers);
+	} else {
+		for (; n < max_peers && n < msglist->num_peers; n++)
+			peer_get_summary(msglist->peers[n], &sums[n]);
+		if (num_peers != NULL)
+			*num_peers = msglist->num_peers;
+	}
+	mutex_exit(&msglist->lock);
+
+	return (n);
+}
+
+bool
+cpdlc_msglist_get_peer_summary(cpdlc_msglist_t *msglist, const char *peer,
+    cpdlc_msglist_peer_summary_t *sum)
+{
+	const msg_peer_t *p;
+
+	ASSERT(msglist != NULL);
+	ASSERT(peer != NULL);
+	ASSERT(sum != NULL);
+
+	mutex_enter(&msglist->lock);
+	p = peer_find(msglist, peer);
+	if (p != NULL)
+		peer_get_summary(p, sum);
+	mutex_exit(&msglist->lock);
+
+	return (p != NULL);
+}
+
+/*
+ * Returns a consistent snapshot of the response time statistics
+ * collected since the msglist was created or last reset.
+ */
+void
+cpdlc_msglist_get_stats(cpdlc_msglist_t *msglist, cpdlc_msglist_stats_t *stats)
+{
+	ASSERT(msglist != NULL);
+	ASSERT(stats != NULL);
+	mutex_enter(&msglist->lock);
+	*stats = msglist->stats;
+	mutex_exit(&msglist->lock);
+}
+
+void
+cpdlc_msglist_reset_stats(cpdlc_msglist_t *msglist)
+{
+	ASSERT(msglist != NULL);
+	mutex_enter(&msglist->lock);
+	memset(&msglist->stats, 0, sizeof (msglist->stats));
 	mutex_exit(&msglist->lock);
 }
 
@@ -692,6 +1502,13 @@ cpdlc_msglist_set_userinfo(cpdlc_msglist_t *msglist, void *userinfo)
 	mutex_exit(&msglist->lock);
 }
 
+cpdlc_client_t *
+cpdlc_msglist_get_client(cpdlc_msglist_t *msglist)
+{
+	ASSERT(msglist != NULL);
+	return (msglist->cl);
+}
+
 void *
 cpdlc_msglist_get_userinfo(cpdlc_msglist_t *msglist)
 {
@@ -700,6 +1517,16 @@ cpdlc_msglist_get_userinfo(cpdlc_msglist_t *msglist)
 	return (msglist->userinfo);
 }
 
+/*
+ * Sets the callback which is notified of changed threads. The callback
+ * is called synchronously from whichever thread delivers the update:
+ * the client's receive path (its background thread, or the caller of
+ * cpdlc_client_poll), or any application thread calling
+ * cpdlc_msglist_update or cpdlc_msglist_flush_updates. Deliveries are
+ * serialized and no msglist locks are held while the callback runs, so
+ * it may call back into the msglist, but it must not block waiting on
+ * another thread which might itself be delivering updates.
+ */
 void
 cpdlc_msglist_set_update_cb(cpdlc_msglist_t *msglist,
     cpdlc_msglist_update_cb_t update_cb)
@@ -710,6 +1537,26 @@ cpdlc_msglist_set_update_cb(cpdlc_msglist_t *msglist,
 	mutex_exit(&msglist->lock);
 }
 
+/*
+ * Sets the minimum interval between two successive calls to the update
+ * callback. Thread updates which arrive within this interval are merged
+ * into a single notification, which is delivered on the next message
+ * reception or call to cpdlc_msglist_update after the interval elapses.
+ * There is no timer behind this, so applications which enable rate
+ * limiting must keep calling cpdlc_msglist_update (or flush pending
+ * updates using cpdlc_msglist_flush_updates) at least once per interval,
+ * otherwise held-back updates are delayed until the next message arrives.
+ * An interval of 0 (the default) disables rate limiting.
+ */
+void
+cpdlc_msglist_set_update_intval(cpdlc_msglist_t *msglist, unsigned intval_ms)
+{
+	ASSERT(msglist != NULL);
+	mutex_enter(&msglist->lock);
+	msglist->upd_intval = intval_ms * 1000llu;
+	mutex_exit(&msglist->lock);
+}
+
 void
 cpdlc_msglist_set_get_time_func(cpdlc_msglist_t *msglist,
     cpdlc_get_time_func_t func)
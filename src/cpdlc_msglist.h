@@ -27,6 +27,7 @@
 #define	_LIBCPDLC_MSGLIST_H_
 
 #include <stdint.h>
+#include <time.h>
 
 #include "cpdlc_client.h"
 #include "cpdlc_msg.h"
@@ -40,6 +41,10 @@ typedef struct cpdlc_msglist_s cpdlc_msglist_t;
 #define	CPDLC_NO_MSG_THR_ID	UINT32_MAX
 typedef uint32_t cpdlc_msg_thr_id_t;
 
+/*
+ * Called with the set of threads changed since the previous call. See
+ * cpdlc_msglist_set_update_cb for which thread the callback runs on.
+ */
 typedef void (*cpdlc_msglist_update_cb_t)(cpdlc_msglist_t *msglist,
     cpdlc_msg_thr_id_t *updated_threads, unsigned num_updated_threads);
 typedef void (*cpdlc_get_time_func_t)(void *userinfo, unsigned *hours,
@@ -59,15 +64,92 @@ typedef enum {
 	CPDLC_MSG_THR_CONN_ENDED
 } cpdlc_msg_thr_status_t;
 
+#define	CPDLC_MSG_THR_STATUS_BIT(st)	(1u << (st))
+
+typedef enum {
+	CPDLC_MSGLIST_DIRTY_ANY,
+	CPDLC_MSGLIST_DIRTY_ONLY,
+	CPDLC_MSGLIST_DIRTY_NONE
+} cpdlc_msglist_dirty_filter_t;
+
+/*
+ * Thread filter for cpdlc_msglist_query. An all-zero query matches all
+ * threads. The time limits apply to the time of the last message in the
+ * thread and are ignored when set to zero.
+ */
+typedef struct {
+	/* Mask of CPDLC_MSG_THR_STATUS_BIT values, 0 = any status */
+	unsigned			status_mask;
+	bool				ignore_closed;
+	cpdlc_msglist_dirty_filter_t	dirty;
+	const char			*peer;		/* NULL = any */
+	time_t				time_min;
+	time_t				time_max;
+	unsigned			offset;
+} cpdlc_msglist_query_t;
+
+typedef struct {
+	cpdlc_msg_thr_id_t		thr_id;
+	cpdlc_msg_thr_status_t		status;
+	bool				dirty;
+	unsigned			num_msgs;
+	time_t				last_time;
+	char				peer[CPDLC_CALLSIGN_LEN];
+} cpdlc_msglist_thr_info_t;
+
+/*
+ * Per-peer thread summary. A thread is pending if the last request in
+ * it came from the peer and we haven't responded to it yet.
+ */
+typedef struct {
+	char				peer[CPDLC_CALLSIGN_LEN];
+	unsigned			num_thrs;
+	unsigned			num_open;
+	unsigned			num_pending;
+	time_t				oldest_pending;	/* 0 if none */
+} cpdlc_msglist_peer_summary_t;
+
+/*
+ * Histogram of durations in seconds. Bin 0 counts durations under 1
+ * second, bin `i' counts durations in [2^(i-1), 2^i) seconds and the
+ * last bin counts everything longer than that.
+ */
+#define	CPDLC_MSGLIST_HIST_BINS	12
+typedef struct {
+	uint64_t	count;
+	uint64_t	sum;
+	unsigned	min;
+	unsigned	max;
+	uint64_t	bins[CPDLC_MSGLIST_HIST_BINS];
+} cpdlc_msglist_hist_t;
+
+typedef struct {
+	/* Received request to our response (e.g. uplink to WILCO) */
+	cpdlc_msglist_hist_t	rx_resp;
+	/* Our request to the peer's response (e.g. request to clearance) */
+	cpdlc_msglist_hist_t	tx_resp;
+	/* STANDBY to the final response, in either direction */
+	cpdlc_msglist_hist_t	stby;
+	/* Received requests which were auto-answered as TIMEDOUT */
+	uint64_t		num_timeouts;
+} cpdlc_msglist_stats_t;
+
 CPDLC_API cpdlc_msglist_t *cpdlc_msglist_alloc(cpdlc_client_t *cl);
 CPDLC_API void cpdlc_msglist_free(cpdlc_msglist_t *msglist);
+CPDLC_API cpdlc_client_t *cpdlc_msglist_get_client(cpdlc_msglist_t *msglist);
 
 CPDLC_API void cpdlc_msglist_update(cpdlc_msglist_t *msglist);
+CPDLC_API void cpdlc_msglist_flush_updates(cpdlc_msglist_t *msglist);
+CPDLC_API uint64_t cpdlc_msglist_get_gen(cpdlc_msglist_t *msglist);
 
 CPDLC_API cpdlc_msg_thr_id_t cpdlc_msglist_send(cpdlc_msglist_t *msglist,
     cpdlc_msg_t *msg, cpdlc_msg_thr_id_t thr_id);
 CPDLC_API void cpdlc_msglist_get_thr_ids(cpdlc_msglist_t *msglist,
     bool ignore_closed, cpdlc_msg_thr_id_t *thr_ids, unsigned *cap);
+CPDLC_API unsigned cpdlc_msglist_query(cpdlc_msglist_t *msglist,
+    const cpdlc_msglist_query_t *query, cpdlc_msg_thr_id_t *cursor,
+    cpdlc_msglist_thr_info_t *results, unsigned max_results,
+    unsigned *num_matches);
 CPDLC_API bool cpdlc_msglist_thr_is_done(cpdlc_msglist_t *msglist,
     cpdlc_msg_thr_id_t thr_id);
 CPDLC_API void cpdlc_msglist_thr_close(cpdlc_msglist_t *msglist,
@@ -86,12 +168,24 @@ CPDLC_API void cpdlc_msglist_get_thr_msg(cpdlc_msglist_t *msglist,
     cpdlc_msg_token_t *token_p, unsigned *hours_p, unsigned *mins_p,
     bool *is_sent_p);
 
+CPDLC_API unsigned cpdlc_msglist_get_peers(cpdlc_msglist_t *msglist,
+    bool pending_only, cpdlc_msglist_peer_summary_t *sums,
+    unsigned max_peers, unsigned *num_peers);
+CPDLC_API bool cpdlc_msglist_get_peer_summary(cpdlc_msglist_t *msglist,
+    const char *peer, cpdlc_msglist_peer_summary_t *sum);
+
+CPDLC_API void cpdlc_msglist_get_stats(cpdlc_msglist_t *msglist,
+    cpdlc_msglist_stats_t *stats);
+CPDLC_API void cpdlc_msglist_reset_stats(cpdlc_msglist_t *msglist);
+
 CPDLC_API void cpdlc_msglist_set_userinfo(cpdlc_msglist_t *msglist,
     void *userinfo);
 CPDLC_API void *cpdlc_msglist_get_userinfo(cpdlc_msglist_t *msglist);
 
 CPDLC_API void cpdlc_msglist_set_update_cb(cpdlc_msglist_t *msglist,
     cpdlc_msglist_update_cb_t update_cb);
+CPDLC_API void cpdlc_msglist_set_update_intval(cpdlc_msglist_t *msglist,
+    unsigned intval_ms);
 CPDLC_API void cpdlc_msglist_set_get_time_func(cpdlc_msglist_t *msglist,
     cpdlc_get_time_func_t func);
 
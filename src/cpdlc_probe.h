@@ -0,0 +1,73 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef	_LIBCPDLC_CPDLC_PROBE_H_
+#define	_LIBCPDLC_CPDLC_PROBE_H_
+
+/*
+ * Static tracing probes. When built with CPDLC_USDT defined (pass USDT=1
+ * to make), these become SystemTap/DTrace-style USDT probe points, which
+ * bpftrace, perf and stap can attach to on a live process, e.g. to
+ * count routed messages by recipient:
+ *
+ *	bpftrace -e 'usdt:./cpdlcd:cpdlcd:msg__route
+ *	    { @[str(arg2)] = count(); }'
+ *
+ * String arguments are passed as plain pointers, so they need str() in
+ * bpftrace (or user_string() in stap) to get at the text.
+ *
+ * Probe names use the usual double-underscore convention, which the
+ * tools display as a dash ("msg-route"). An unused USDT probe costs a
+ * single NOP. Without CPDLC_USDT, the probes compile to nothing and
+ * their arguments aren't evaluated. Only pass integers and pointers.
+ *
+ * USDT probes need <sys/sdt.h> (systemtap-sdt-dev on Debian/Ubuntu,
+ * systemtap-sdt-devel on Fedora) and are only supported on Linux.
+ */
+
+#if	defined(CPDLC_USDT) && LIN
+
+#include <sys/sdt.h>
+
+#define	CPDLC_PROBE0(prov, name)	DTRACE_PROBE(prov, name)
+#define	CPDLC_PROBE1(prov, name, a1)	DTRACE_PROBE1(prov, name, a1)
+#define	CPDLC_PROBE2(prov, name, a1, a2) \
+	DTRACE_PROBE2(prov, name, a1, a2)
+#define	CPDLC_PROBE3(prov, name, a1, a2, a3) \
+	DTRACE_PROBE3(prov, name, a1, a2, a3)
+#define	CPDLC_PROBE4(prov, name, a1, a2, a3, a4) \
+	DTRACE_PROBE4(prov, name, a1, a2, a3, a4)
+
+#else	/* !defined(CPDLC_USDT) || !LIN */
+
+#define	CPDLC_PROBE0(prov, name)			do { } while (0)
+#define	CPDLC_PROBE1(prov, name, a1)			do { } while (0)
+#define	CPDLC_PROBE2(prov, name, a1, a2)		do { } while (0)
+#define	CPDLC_PROBE3(prov, name, a1, a2, a3)		do { } while (0)
+#define	CPDLC_PROBE4(prov, name, a1, a2, a3, a4)	do { } while (0)
+
+#endif	/* !defined(CPDLC_USDT) || !LIN */
+
+#endif	/* _LIBCPDLC_CPDLC_PROBE_H_ */
@@ -144,6 +144,18 @@ extern "C" {
 #define	thread_set_name(name)	pthread_setname_np((name))
 #endif	/* APL */
 
+static inline uint64_t
+cpdlc_thread_microclock(void)
+{
+	/*
+	 * Must use the same clock as pthread_cond_timedwait, so that
+	 * deadlines computed from this can be passed to cv_timedwait.
+	 */
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
 #define	cv_wait(cv, mtx)	pthread_cond_wait((cv), (mtx))
 static inline int
 cv_timedwait(condvar_t *cv, mutex_t *mtx, uint64_t limit)
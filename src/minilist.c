@@ -140,14 +140,12 @@ list_remove(list_t *list, void *elem)
 		list->head = P2N(list, elem)->next;
 	if (list->tail == elem)
 		list->tail = P2N(list, elem)->prev;
-	if (P2N(list, elem)->next != NULL) {
+	if (P2N(list, elem)->next != NULL)
 		P2N(list, P2N(list, elem)->next)->prev = P2N(list, elem)->prev;
-		P2N(list, elem)->next = NULL;
-	}
-	if (P2N(list, elem)->prev != NULL) {
+	if (P2N(list, elem)->prev != NULL)
 		P2N(list, P2N(list, elem)->prev)->next = P2N(list, elem)->next;
-		P2N(list, elem)->prev = NULL;
-	}
+	P2N(list, elem)->next = NULL;
+	P2N(list, elem)->prev = NULL;
 	list->count--;
 }
 
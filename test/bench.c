@@ -0,0 +1,194 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/cpdlc_alloc.h"
+#include "../src/cpdlc_assert.h"
+
+#include "bench.h"
+
+void
+samples_add(samples_t *s, uint64_t us)
+{
+	ASSERT(s != NULL);
+	if (s->num_samples == s->cap) {
+		s->cap = (s->cap != 0 ? s->cap * 2 : 1024);
+		s->samples = safe_realloc(s->samples,
+		    s->cap * sizeof (*s->samples));
+	}
+	s->samples[s->num_samples++] = us;
+	s->sorted = false;
+}
+
+void
+samples_merge(samples_t *dst, const samples_t *src)
+{
+	ASSERT(dst != NULL);
+	ASSERT(src != NULL);
+	for (unsigned i = 0; i < src->num_samples; i++)
+		samples_add(dst, src->samples[i]);
+}
+
+static int
+samples_compar(const void *a, const void *b)
+{
+	uint64_t ua = *(const uint64_t *)a, ub = *(const uint64_t *)b;
+
+	if (ua < ub)
+		return (-1);
+	if (ua > ub)
+		return (1);
+	return (0);
+}
+
+void
+samples_sort(samples_t *s)
+{
+	ASSERT(s != NULL);
+	if (!s->sorted) {
+		qsort(s->samples, s->num_samples, sizeof (*s->samples),
+		    samples_compar);
+		s->sorted = true;
+	}
+}
+
+/*
+ * Nearest-rank percentile, `pct' is in the range of 0 - 100 (so 99.9
+ * gives the p999 value). Returns 0 for an empty sample set.
+ */
+uint64_t
+samples_pct(samples_t *s, double pct)
+{
+	uint64_t idx;
+
+	ASSERT(s != NULL);
+	ASSERT(pct >= 0 && pct <= 100);
+	if (s->num_samples == 0)
+		return (0);
+	samples_sort(s);
+	idx = (uint64_t)(s->num_samples * pct / 100.0 + 0.999999);
+	if (idx != 0)
+		idx--;
+	return (s->samples[MIN(idx, s->num_samples - 1)]);
+}
+
+uint64_t
+samples_max(samples_t *s)
+{
+	ASSERT(s != NULL);
+	if (s->num_samples == 0)
+		return (0);
+	samples_sort(s);
+	return (s->samples[s->num_samples - 1]);
+}
+
+/*
+ * Prints the sample set as a JSON object member, without a trailing
+ * comma or newline, e.g.:
+ *	"name": {"n": 10, "p50": 1, "p99": 2, "p999": 2, "max": 2}
+ */
+void
+samples_print_json(FILE *fp, const char *name, samples_t *s)
+{
+	fprintf(fp, "\"%s\": {\"n\": %u, \"p50\": %llu, \"p90\": %llu, "
+	    "\"p99\": %llu, \"p999\": %llu, \"max\": %llu}", name,
+	    s->num_samples, (unsigned long long)samples_pct(s, 50),
+	    (unsigned long long)samples_pct(s, 90),
+	    (unsigned long long)samples_pct(s, 99),
+	    (unsigned long long)samples_pct(s, 99.9),
+	    (unsigned long long)samples_max(s));
+}
+
+void
+samples_free(samples_t *s)
+{
+	ASSERT(s != NULL);
+	free(s->samples);
+	s->samples = NULL;
+	s->num_samples = 0;
+	s->cap = 0;
+	s->sorted = false;
+}
+
+/*
+ * Samples the CPU time, memory usage, thread count and number of open
+ * file descriptors of a process from procfs. Only available on Linux,
+ * elsewhere `valid' is left false.
+ */
+void
+proc_stats_get(int pid, proc_stats_t *ps)
+{
+	char path[64], line[256];
+	FILE *fp;
+	DIR *dp;
+	unsigned long utime, stime;
+
+	memset(ps, 0, sizeof (*ps));
+	if (pid <= 0)
+		return;
+
+	snprintf(path, sizeof (path), "/proc/%d/stat", pid);
+	if ((fp = fopen(path, "r")) == NULL)
+		return;
+	/* Skip past the command name, which may contain spaces */
+	if (fgets(line, sizeof (line), fp) == NULL ||
+	    strrchr(line, ')') == NULL ||
+	    sscanf(strrchr(line, ')') + 2, "%*c %*d %*d %*d %*d %*d %*u "
+	    "%*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+		fclose(fp);
+		return;
+	}
+	fclose(fp);
+	ps->cpu_s = (utime + stime) / (double)sysconf(_SC_CLK_TCK);
+
+	snprintf(path, sizeof (path), "/proc/%d/status", pid);
+	if ((fp = fopen(path, "r")) == NULL)
+		return;
+	while (fgets(line, sizeof (line), fp) != NULL) {
+		if (strncmp(line, "VmRSS:", 6) == 0)
+			ps->rss_kb = strtoul(&line[6], NULL, 10);
+		else if (strncmp(line, "VmHWM:", 6) == 0)
+			ps->hwm_kb = strtoul(&line[6], NULL, 10);
+		else if (strncmp(line, "Threads:", 8) == 0)
+			ps->num_threads = strtoul(&line[8], NULL, 10);
+	}
+	fclose(fp);
+
+	snprintf(path, sizeof (path), "/proc/%d/fd", pid);
+	if ((dp = opendir(path)) != NULL) {
+		struct dirent *de;
+
+		while ((de = readdir(dp)) != NULL) {
+			if (de->d_name[0] != '.')
+				ps->num_fds++;
+		}
+		closedir(dp);
+	}
+	ps->valid = true;
+}
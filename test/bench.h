@@ -0,0 +1,71 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef	_LIBCPDLC_TEST_BENCH_H_
+#define	_LIBCPDLC_TEST_BENCH_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * A growable set of latency samples (in microseconds), shared by the
+ * benchmark programs.
+ */
+typedef struct {
+	uint64_t	*samples;
+	unsigned	num_samples;
+	unsigned	cap;
+	bool		sorted;
+} samples_t;
+
+void samples_add(samples_t *s, uint64_t us);
+void samples_merge(samples_t *dst, const samples_t *src);
+void samples_sort(samples_t *s);
+uint64_t samples_pct(samples_t *s, double pct);
+uint64_t samples_max(samples_t *s);
+void samples_print_json(FILE *fp, const char *name, samples_t *s);
+void samples_free(samples_t *s);
+
+typedef struct {
+	bool		valid;
+	double		cpu_s;
+	unsigned long	rss_kb;
+	unsigned long	hwm_kb;
+	unsigned	num_fds;
+	unsigned	num_threads;
+} proc_stats_t;
+
+void proc_stats_get(int pid, proc_stats_t *ps);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _LIBCPDLC_TEST_BENCH_H_ */
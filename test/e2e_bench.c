@@ -0,0 +1,490 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * End-to-end cpdlcd throughput and latency benchmark. Logs on a number
+ * of ATC stations and aircraft to a running cpdlcd, all at once, and then
+ * has every aircraft run a sequence of closed-loop clearance transactions
+ * with its ATC station:
+ *
+ *	aircraft -> DM6 REQUEST <alt>
+ *	ATC      -> UM20 CLIMB TO <alt> (MRN = request MIN)
+ *	aircraft -> DM0 WILCO (MRN = clearance MIN)
+ *
+ * Every aircraft has at most one transaction outstanding, so the offered
+ * load scales with the number of aircraft. Since all stations live in
+ * this process, every message's one-way latency is measured directly.
+ *
+ * For the aircraft/ATC mix to pass cpdlcd's message flow checks, the
+ * daemon must be pointed at an authenticator which marks stations whose
+ * LOGON data starts with "ATC" as ATC stations (see mock_auth.c). The
+ * e2e_bench.sh script sets all of that up.
+ *
+ * The results are printed as a single JSON object on stdout.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/cpdlc_alloc.h"
+#include "../src/cpdlc_assert.h"
+#include "../src/cpdlc_client.h"
+#include "../src/cpdlc_thread.h"
+
+#include "bench.h"
+
+#define	ACFT_PREFIX	"BN"
+#define	ATC_PREFIX	"ATC"
+#define	WAKEUP_INTVAL	10000		/* us */
+#define	LOGON_POLL	1000		/* us */
+#define	DFL_TIMEOUT	300		/* seconds */
+
+typedef enum {
+	TXN_IDLE,
+	TXN_REQ_SENT,
+	TXN_CLR_SENT,
+	TXN_WILCO_SENT
+} txn_state_t;
+
+typedef struct {
+	cpdlc_client_t	*cl;
+	char		callsign[16];
+	bool		is_atc;
+	unsigned	atc_idx;	/* aircraft only */
+	unsigned	next_min;
+	uint64_t	logon_start;
+	bool		logged_on;
+	/* aircraft only, state of the outstanding transaction */
+	txn_state_t	txn_state;
+	unsigned	txns_done;
+	uint64_t	txn_start;
+	uint64_t	sent_t;		/* send time of the last message */
+	unsigned	sent_min;	/* MIN of the last message */
+} station_t;
+
+static mutex_t		wakeup_lock;
+static condvar_t	wakeup_cv;
+static bool		wakeup_pending = false;
+
+static station_t	*acft = NULL;
+static unsigned		num_acft = 100;
+static station_t	*atc = NULL;
+static unsigned		num_atc = 4;
+static unsigned		num_txns = 20;
+
+static samples_t	logon_lat = {};
+static samples_t	msg_lat = {};
+static samples_t	txn_lat = {};
+static uint64_t		msgs_sent = 0, msgs_rcvd = 0, errors = 0;
+static unsigned		txns_left = 0;
+
+/*
+ * Called from the client's worker thread, so we only use this to kick
+ * the main loop, all message handling happens on the main thread.
+ */
+static void
+msg_recv_cb(cpdlc_client_t *cl)
+{
+	UNUSED(cl);
+	mutex_enter(&wakeup_lock);
+	wakeup_pending = true;
+	cv_broadcast(&wakeup_cv);
+	mutex_exit(&wakeup_lock);
+}
+
+static void
+station_init(station_t *st, const char *host, unsigned port,
+    const char *ca_file, bool is_atc, unsigned idx)
+{
+	st->is_atc = is_atc;
+	snprintf(st->callsign, sizeof (st->callsign), "%s%04u",
+	    is_atc ? ATC_PREFIX : ACFT_PREFIX, idx);
+	st->cl = cpdlc_client_alloc(is_atc);
+	cpdlc_client_set_host(st->cl, host);
+	cpdlc_client_set_port(st->cl, port);
+	if (ca_file != NULL)
+		cpdlc_client_set_ca_file(st->cl, ca_file);
+	cpdlc_client_set_msg_recv_cb(st->cl, msg_recv_cb);
+	if (!is_atc)
+		st->atc_idx = idx % num_atc;
+}
+
+static void
+station_logon(station_t *st)
+{
+	st->logon_start = cpdlc_thread_microclock();
+	if (st->is_atc) {
+		cpdlc_client_logon(st->cl, ATC_PREFIX, st->callsign,
+		    st->callsign);
+	} else {
+		cpdlc_client_logon(st->cl, "ACFT", st->callsign,
+		    atc[st->atc_idx].callsign);
+	}
+}
+
+static bool
+station_check_logon(station_t *st)
+{
+	if (!st->logged_on && cpdlc_client_get_logon_status(st->cl, NULL) ==
+	    CPDLC_LOGON_COMPLETE) {
+		st->logged_on = true;
+		samples_add(&logon_lat,
+		    cpdlc_thread_microclock() - st->logon_start);
+	}
+	return (st->logged_on);
+}
+
+static void
+station_fini(station_t *st)
+{
+	cpdlc_client_logoff(st->cl);
+	cpdlc_client_free(st->cl);
+}
+
+/*
+ * Sends a single-segment altitude message (DM6, UM20) or a WILCO.
+ */
+static void
+send_msg(station_t *from, const char *to, int msg_type, unsigned mrn,
+    bool has_mrn, int alt)
+{
+	cpdlc_msg_t *msg = cpdlc_msg_alloc(CPDLC_PKT_CPDLC);
+	int seg = cpdlc_msg_add_seg(msg, !from->is_atc, msg_type, 0);
+
+	if (msg_type != CPDLC_DM0_WILCO) {
+		bool fl = true;
+		cpdlc_msg_seg_set_arg(msg, seg, 0, &fl, &alt);
+	}
+	if (to != NULL)
+		cpdlc_msg_set_to(msg, to);
+	cpdlc_msg_set_min(msg, from->next_min);
+	if (has_mrn)
+		cpdlc_msg_set_mrn(msg, mrn);
+	if (cpdlc_client_send_msg(from->cl, msg) == CPDLC_INVALID_MSG_TOKEN)
+		errors++;
+	else
+		msgs_sent++;
+	cpdlc_msg_free(msg);
+	from->next_min++;
+}
+
+static void
+acft_start_txn(station_t *ac)
+{
+	int alt = 200 + (ac->txns_done % 20) * 10;
+
+	ac->txn_start = ac->sent_t = cpdlc_thread_microclock();
+	ac->sent_min = ac->next_min;
+	ac->txn_state = TXN_REQ_SENT;
+	send_msg(ac, NULL, CPDLC_DM6_REQ_alt, 0, false, alt);
+}
+
+static station_t *
+find_acft(const char *callsign)
+{
+	unsigned idx;
+
+	if (strncmp(callsign, ACFT_PREFIX, strlen(ACFT_PREFIX)) != 0 ||
+	    sscanf(&callsign[strlen(ACFT_PREFIX)], "%u", &idx) != 1 ||
+	    idx >= num_acft) {
+		return (NULL);
+	}
+	return (&acft[idx]);
+}
+
+static int
+msg_type(const cpdlc_msg_t *msg)
+{
+	if (cpdlc_msg_get_num_segs(msg) == 0)
+		return (-1);
+	return (msg->segs[0].info->msg_type);
+}
+
+static void
+atc_handle_msg(station_t *st, const cpdlc_msg_t *msg, uint64_t now)
+{
+	station_t *ac = find_acft(cpdlc_msg_get_from(msg));
+
+	if (ac == NULL || !cpdlc_msg_get_dl(msg)) {
+		errors++;
+		return;
+	}
+	if (ac->txn_state == TXN_REQ_SENT &&
+	    msg_type(msg) == CPDLC_DM6_REQ_alt &&
+	    cpdlc_msg_get_min(msg) == ac->sent_min) {
+		int alt = 0;
+		bool fl = false;
+
+		samples_add(&msg_lat, now - ac->sent_t);
+		cpdlc_msg_seg_get_arg(msg, 0, 0, &fl, 0, &alt);
+		ac->sent_t = cpdlc_thread_microclock();
+		ac->sent_min = st->next_min;
+		ac->txn_state = TXN_CLR_SENT;
+		send_msg(st, ac->callsign, CPDLC_UM20_CLB_TO_alt,
+		    cpdlc_msg_get_min(msg), true, alt);
+	} else if (ac->txn_state == TXN_WILCO_SENT &&
+	    msg_type(msg) == CPDLC_DM0_WILCO &&
+	    cpdlc_msg_get_min(msg) == ac->sent_min) {
+		samples_add(&msg_lat, now - ac->sent_t);
+		samples_add(&txn_lat, now - ac->txn_start);
+		ac->txn_state = TXN_IDLE;
+		ac->txns_done++;
+		ASSERT(txns_left != 0);
+		txns_left--;
+		if (ac->txns_done < num_txns)
+			acft_start_txn(ac);
+	} else {
+		errors++;
+	}
+}
+
+static void
+acft_handle_msg(station_t *ac, const cpdlc_msg_t *msg, uint64_t now)
+{
+	if (ac->txn_state == TXN_CLR_SENT && !cpdlc_msg_get_dl(msg) &&
+	    msg_type(msg) == CPDLC_UM20_CLB_TO_alt &&
+	    cpdlc_msg_get_min(msg) == ac->sent_min) {
+		unsigned mrn = cpdlc_msg_get_min(msg);
+
+		samples_add(&msg_lat, now - ac->sent_t);
+		ac->sent_t = cpdlc_thread_microclock();
+		ac->sent_min = ac->next_min;
+		ac->txn_state = TXN_WILCO_SENT;
+		send_msg(ac, NULL, CPDLC_DM0_WILCO, mrn, true, 0);
+	} else {
+		errors++;
+	}
+}
+
+static void
+drain_station(station_t *st)
+{
+	cpdlc_msg_t *msg;
+
+	while ((msg = cpdlc_client_recv_msg(st->cl)) != NULL) {
+		uint64_t now = cpdlc_thread_microclock();
+
+		msgs_rcvd++;
+		if (st->is_atc)
+			atc_handle_msg(st, msg, now);
+		else
+			acft_handle_msg(st, msg, now);
+		cpdlc_msg_free(msg);
+	}
+}
+
+static void
+wait_wakeup(void)
+{
+	uint64_t deadline = cpdlc_thread_microclock() + WAKEUP_INTVAL;
+
+	mutex_enter(&wakeup_lock);
+	while (!wakeup_pending) {
+		if (cv_timedwait(&wakeup_cv, &wakeup_lock, deadline) != 0)
+			break;
+	}
+	wakeup_pending = false;
+	mutex_exit(&wakeup_lock);
+}
+
+static void
+print_usage(const char *progname, FILE *fp)
+{
+	fprintf(fp, "Usage: %s [-h] [-s <host>] [-p <port>] [-c <cafile>] "
+	    "[-n <aircraft>]\n"
+	    "    [-m <atc>] [-r <txns>] [-t <timeout>] [-P <server_pid>]\n"
+	    "\n"
+	    "  -s <host>       cpdlcd hostname (default: localhost)\n"
+	    "  -p <port>       cpdlcd port (default: library default)\n"
+	    "  -c <cafile>     CA certificate file for server validation\n"
+	    "  -n <aircraft>   number of aircraft stations (default: 100)\n"
+	    "  -m <atc>        number of ATC stations (default: 4)\n"
+	    "  -r <txns>       clearance transactions per aircraft "
+	    "(default: 20)\n"
+	    "  -t <timeout>    give up after this many seconds "
+	    "(default: %d)\n"
+	    "  -P <pid>        cpdlcd process ID for CPU/RSS sampling\n",
+	    progname, DFL_TIMEOUT);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *host = "localhost", *ca_file = NULL;
+	unsigned port = 0, timeout = DFL_TIMEOUT, logged_on = 0;
+	int opt, srv_pid = 0;
+	uint64_t t_start, t_logon, t_end, deadline;
+	proc_stats_t ps_start, ps_logon, ps_end;
+	double logon_s, traffic_s;
+	bool ok = true;
+
+	while ((opt = getopt(argc, argv, "hs:p:c:n:m:r:t:P:")) != -1) {
+		switch (opt) {
+		case 'h':
+			print_usage(argv[0], stdout);
+			return (0);
+		case 's':
+			host = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'c':
+			ca_file = optarg;
+			break;
+		case 'n':
+			num_acft = atoi(optarg);
+			break;
+		case 'm':
+			num_atc = atoi(optarg);
+			break;
+		case 'r':
+			num_txns = atoi(optarg);
+			break;
+		case 't':
+			timeout = atoi(optarg);
+			break;
+		case 'P':
+			srv_pid = atoi(optarg);
+			break;
+		default:
+			print_usage(argv[0], stderr);
+			return (1);
+		}
+	}
+	if (num_acft == 0 || num_atc == 0) {
+		fprintf(stderr, "Need at least one aircraft and one ATC "
+		    "station\n");
+		return (1);
+	}
+
+	mutex_init(&wakeup_lock);
+	cv_init(&wakeup_cv);
+	atc = safe_calloc(num_atc, sizeof (*atc));
+	acft = safe_calloc(num_acft, sizeof (*acft));
+	for (unsigned i = 0; i < num_atc; i++)
+		station_init(&atc[i], host, port, ca_file, true, i);
+	for (unsigned i = 0; i < num_acft; i++)
+		station_init(&acft[i], host, port, ca_file, false, i);
+
+	/*
+	 * Phase 1: connection & LOGON storm. Everybody logs on at once.
+	 */
+	proc_stats_get(srv_pid, &ps_start);
+	t_start = cpdlc_thread_microclock();
+	deadline = t_start + timeout * 1000000llu;
+	for (unsigned i = 0; i < num_atc; i++)
+		station_logon(&atc[i]);
+	for (unsigned i = 0; i < num_acft; i++)
+		station_logon(&acft[i]);
+	while (logged_on < num_atc + num_acft) {
+		logged_on = 0;
+		for (unsigned i = 0; i < num_atc; i++)
+			logged_on += station_check_logon(&atc[i]);
+		for (unsigned i = 0; i < num_acft; i++)
+			logged_on += station_check_logon(&acft[i]);
+		if (cpdlc_thread_microclock() > deadline) {
+			fprintf(stderr, "Timed out waiting for LOGON, "
+			    "%u/%u stations logged on\n", logged_on,
+			    num_atc + num_acft);
+			ok = false;
+			goto out;
+		}
+		usleep(LOGON_POLL);
+	}
+	t_logon = cpdlc_thread_microclock();
+	proc_stats_get(srv_pid, &ps_logon);
+
+	/*
+	 * Phase 2: clearance traffic.
+	 */
+	txns_left = num_acft * num_txns;
+	for (unsigned i = 0; i < num_acft && num_txns != 0; i++)
+		acft_start_txn(&acft[i]);
+	while (txns_left != 0) {
+		wait_wakeup();
+		for (unsigned i = 0; i < num_atc; i++)
+			drain_station(&atc[i]);
+		for (unsigned i = 0; i < num_acft; i++)
+			drain_station(&acft[i]);
+		if (cpdlc_thread_microclock() > deadline) {
+			fprintf(stderr, "Timed out waiting for traffic, "
+			    "%u transactions outstanding\n", txns_left);
+			ok = false;
+			break;
+		}
+	}
+	t_end = cpdlc_thread_microclock();
+	proc_stats_get(srv_pid, &ps_end);
+
+	logon_s = (t_logon - t_start) / 1000000.0;
+	traffic_s = (t_end - t_logon) / 1000000.0;
+	printf("{\"aircraft\": %u, \"atc\": %u, \"txns_per_aircraft\": %u, "
+	    "\"complete\": %s,\n", num_acft, num_atc, num_txns,
+	    ok ? "true" : "false");
+	printf(" \"logon\": {\"time_s\": %.3f, \"conns_per_s\": %.1f, ",
+	    logon_s, (num_atc + num_acft) / MAX(logon_s, 1e-6));
+	samples_print_json(stdout, "latency_us", &logon_lat);
+	printf("},\n");
+	printf(" \"traffic\": {\"time_s\": %.3f, \"msgs_sent\": %llu, "
+	    "\"msgs_rcvd\": %llu, \"msgs_per_s\": %.1f, \"txns\": %u, "
+	    "\"txns_per_s\": %.1f, \"errors\": %llu,\n  ", traffic_s,
+	    (unsigned long long)msgs_sent, (unsigned long long)msgs_rcvd,
+	    msgs_rcvd / MAX(traffic_s, 1e-6), txn_lat.num_samples,
+	    txn_lat.num_samples / MAX(traffic_s, 1e-6),
+	    (unsigned long long)errors);
+	samples_print_json(stdout, "msg_latency_us", &msg_lat);
+	printf(",\n  ");
+	samples_print_json(stdout, "txn_latency_us", &txn_lat);
+	printf("},\n");
+	if (ps_end.valid && ps_start.valid) {
+		printf(" \"server\": {\"pid\": %d, \"logon_cpu_s\": %.2f, "
+		    "\"traffic_cpu_s\": %.2f, \"traffic_cpu_util\": %.3f, "
+		    "\"rss_kb\": %lu, \"hwm_kb\": %lu}\n", srv_pid,
+		    ps_logon.cpu_s - ps_start.cpu_s,
+		    ps_end.cpu_s - ps_logon.cpu_s,
+		    (ps_end.cpu_s - ps_logon.cpu_s) / MAX(traffic_s, 1e-6),
+		    ps_end.rss_kb, ps_end.hwm_kb);
+	} else {
+		printf(" \"server\": null\n");
+	}
+	printf("}\n");
+out:
+	for (unsigned i = 0; i < num_acft; i++)
+		station_fini(&acft[i]);
+	for (unsigned i = 0; i < num_atc; i++)
+		station_fini(&atc[i]);
+	free(acft);
+	free(atc);
+	samples_free(&logon_lat);
+	samples_free(&msg_lat);
+	samples_free(&txn_lat);
+	cv_destroy(&wakeup_cv);
+	mutex_destroy(&wakeup_lock);
+
+	return (ok ? 0 : 1);
+}
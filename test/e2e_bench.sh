@@ -0,0 +1,90 @@
+#!/bin/bash
+#
+# Copyright 2019 Saso Kiselkov
+#
+# Permission is hereby granted, free of charge, to any person
+# obtaining a copy of this software and associated documentation
+# files (the "Software"), to deal in the Software without
+# restriction, including without limitation the rights to use,
+# copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following
+# conditions:
+#
+# The above copyright notice and this permission notice shall be
+# included in all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+# OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+# WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+
+# Runs the end-to-end cpdlcd benchmark on loopback. We generate a
+# throwaway CA and server certificate, start the mock authenticator and
+# a cpdlcd instance on private ports and then run e2e_bench against them.
+# The JSON results go to stdout (or the file given with -o), everything
+# else goes to stderr.
+#
+# Build cpdlcd (in ../cpdlcd) and the test programs (`make' in this
+# directory) first.
+
+source "$(dirname "$0")/srv_env.sh"
+
+E2E_BENCH="${E2E_BENCH:-$TESTDIR/e2e_bench}"
+
+PORT=17690
+AUTH_PORT=17691
+OUTFILE=""
+BENCH_ARGS=()
+
+function usage() {
+	echo "Usage: $0 [-h] [-p <port>] [-o <result.json>] [-- <e2e_bench args>]"
+	echo "  -p <port>    cpdlcd port (default: $PORT, auth uses port + 1)"
+	echo "  -o <file>    write the JSON results into <file>"
+	echo "Arguments after -- are passed to e2e_bench, e.g. -n 500 -m 10."
+}
+
+while getopts "hp:o:" opt; do
+	case "$opt" in
+	h)
+		usage
+		exit 0
+		;;
+	p)
+		PORT="$OPTARG"
+		AUTH_PORT=$(( PORT + 1 ))
+		;;
+	o)
+		OUTFILE="$OPTARG"
+		;;
+	*)
+		usage >&2
+		exit 1
+		;;
+	esac
+done
+shift $(( OPTIND - 1 ))
+BENCH_ARGS=("$@")
+
+srv_env_check_progs "$E2E_BENCH" || exit 1
+srv_env_init || exit 1
+srv_start_auth "$AUTH_PORT" || exit 1
+srv_start_cpdlcd "$PORT" "$AUTH_PORT" || exit 1
+
+if [ -n "$OUTFILE" ]; then
+	"$E2E_BENCH" -s localhost -p "$PORT" -c "$WORKDIR/ca_cert.pem" \
+	    -P "$SRV_PID" "${BENCH_ARGS[@]}" > "$OUTFILE"
+else
+	"$E2E_BENCH" -s localhost -p "$PORT" -c "$WORKDIR/ca_cert.pem" \
+	    -P "$SRV_PID" "${BENCH_ARGS[@]}"
+fi
+RESULT=$?
+if [ $RESULT -ne 0 ]; then
+	echo "e2e_bench failed, cpdlcd log follows:" >&2
+	cat "$SRV_LOG" >&2
+fi
+exit $RESULT
@@ -0,0 +1,404 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Headless FANS keystroke latency benchmark. We log on a FANS box and
+ * an ATC station to a running cpdlcd, have the ATC station uplink a
+ * few hundred clearances to pre-populate the box's message list and
+ * then replay scripted key sequences across the MCDU pages. Every
+ * fans_push_key/fans_push_char call runs the page key callback and a
+ * full fans_update (including cpdlc_msglist_update), so timing the
+ * call gives us the key-to-screen latency.
+ *
+ * Note that cpdlcd without an authenticator treats all connections as
+ * ATC, so downlinks sent by the request scripts will be answered with
+ * an error. That still exercises the same FANS code paths.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/cpdlc_alloc.h"
+#include "../src/cpdlc_assert.h"
+#include "../src/cpdlc_client.h"
+#include "../src/cpdlc_msglist.h"
+#include "../src/cpdlc_thread.h"
+#include "../fans/fans.h"
+
+#include "bench.h"
+
+#define	WAIT_TIMEOUT	30000000	/* us */
+#define	POLL_INTVAL	10000		/* us */
+#define	SEND_BATCH	50
+
+typedef enum {
+	STEP_KEY,
+	STEP_STR
+} step_type_t;
+
+typedef struct {
+	step_type_t	type;
+	fms_key_t	key;
+	const char	*str;
+} step_t;
+
+#define	KEY(k)		{ .type = STEP_KEY, .key = (k) }
+#define	STR(s)		{ .type = STEP_STR, .str = (s) }
+#define	END_SCRIPT	{ .type = STEP_STR, .str = NULL }
+
+typedef struct {
+	const char	*name;
+	const step_t	*steps;
+} script_t;
+
+static const step_t msg_log_script[] = {
+	KEY(FMS_KEY_IDX),
+	KEY(FMS_KEY_LSK_R1),
+	KEY(FMS_KEY_NEXT), KEY(FMS_KEY_NEXT), KEY(FMS_KEY_NEXT),
+	KEY(FMS_KEY_PREV), KEY(FMS_KEY_PREV), KEY(FMS_KEY_PREV),
+	KEY(FMS_KEY_LSK_R5), KEY(FMS_KEY_LSK_R5),
+	KEY(FMS_KEY_LSK_L1),
+	KEY(FMS_KEY_NEXT),
+	KEY(FMS_KEY_LSK_L6),
+	KEY(FMS_KEY_LSK_L2),
+	KEY(FMS_KEY_LSK_L5),	/* STANDBY */
+	KEY(FMS_KEY_LSK_L6),
+	KEY(FMS_KEY_LSK_L3),
+	KEY(FMS_KEY_LSK_L4),	/* WILCO */
+	KEY(FMS_KEY_LSK_L6),
+	END_SCRIPT
+};
+
+static const step_t req_script[] = {
+	KEY(FMS_KEY_IDX),
+	KEY(FMS_KEY_LSK_L2),
+	KEY(FMS_KEY_LSK_L1),
+	STR("FL350"),
+	KEY(FMS_KEY_LSK_L1),
+	KEY(FMS_KEY_LSK_L2),
+	KEY(FMS_KEY_NEXT),
+	STR("BENCHMARK"),
+	KEY(FMS_KEY_LSK_L1),
+	KEY(FMS_KEY_PREV),
+	KEY(FMS_KEY_LSK_L5),	/* VERIFY */
+	KEY(FMS_KEY_LSK_R5),	/* SEND */
+	KEY(FMS_KEY_LSK_L2),
+	KEY(FMS_KEY_LSK_L3),
+	STR("M.82"),
+	KEY(FMS_KEY_LSK_L1),
+	KEY(FMS_KEY_CLR_DEL),
+	KEY(FMS_KEY_LSK_L6),
+	KEY(FMS_KEY_LSK_L6),
+	END_SCRIPT
+};
+
+static const step_t pos_rep_script[] = {
+	KEY(FMS_KEY_IDX),
+	KEY(FMS_KEY_LSK_L3),
+	STR("FL350"),
+	KEY(FMS_KEY_LSK_L2),
+	STR("1234"),
+	KEY(FMS_KEY_LSK_R1),
+	STR("-54"),
+	KEY(FMS_KEY_LSK_R4),
+	KEY(FMS_KEY_NEXT),
+	KEY(FMS_KEY_PREV),
+	KEY(FMS_KEY_LSK_L6),
+	END_SCRIPT
+};
+
+static const step_t emer_script[] = {
+	KEY(FMS_KEY_IDX),
+	KEY(FMS_KEY_LSK_R2),
+	KEY(FMS_KEY_LSK_L2),
+	KEY(FMS_KEY_LSK_L2),
+	STR("0130"),
+	KEY(FMS_KEY_LSK_L3),
+	STR("150"),
+	KEY(FMS_KEY_LSK_L4),
+	STR("FL100"),
+	KEY(FMS_KEY_LSK_R2),
+	KEY(FMS_KEY_LSK_R5),
+	KEY(FMS_KEY_NEXT),
+	KEY(FMS_KEY_PREV),
+	KEY(FMS_KEY_CLR_DEL_LONG),
+	KEY(FMS_KEY_LSK_L6),
+	END_SCRIPT
+};
+
+static const script_t scripts[] = {
+	{ "msg_log", msg_log_script },
+	{ "requests", req_script },
+	{ "pos_rep", pos_rep_script },
+	{ "emer", emer_script },
+	{ NULL, NULL }
+};
+
+static void
+samples_print(const char *name, samples_t *s)
+{
+	if (s->num_samples == 0) {
+		printf("%-10s %8u\n", name, 0);
+		return;
+	}
+	printf("%-10s %8u %8llu %8llu %8llu %8llu\n", name, s->num_samples,
+	    (unsigned long long)samples_pct(s, 50),
+	    (unsigned long long)samples_pct(s, 90),
+	    (unsigned long long)samples_pct(s, 99),
+	    (unsigned long long)samples_max(s));
+}
+
+static void
+run_script(fans_t *box, const script_t *script, samples_t *s)
+{
+	for (const step_t *step = script->steps;
+	    step->type != STEP_STR || step->str != NULL; step++) {
+		if (step->type == STEP_KEY) {
+			uint64_t t = cpdlc_thread_microclock();
+
+			fans_push_key(box, step->key);
+			samples_add(s, cpdlc_thread_microclock() - t);
+		} else {
+			for (const char *c = step->str; *c != '\0'; c++) {
+				uint64_t t = cpdlc_thread_microclock();
+
+				fans_push_char(box, *c);
+				samples_add(s, cpdlc_thread_microclock() - t);
+			}
+		}
+	}
+}
+
+static bool
+wait_logon(cpdlc_client_t *cl, fans_t *box)
+{
+	uint64_t deadline = cpdlc_thread_microclock() + WAIT_TIMEOUT;
+
+	while (cpdlc_client_get_logon_status(cl, NULL) !=
+	    CPDLC_LOGON_COMPLETE) {
+		if (cpdlc_thread_microclock() > deadline)
+			return (false);
+		if (box != NULL)
+			fans_update(box);
+		usleep(POLL_INTVAL);
+	}
+	return (true);
+}
+
+static unsigned
+count_thrs(fans_t *box)
+{
+	cpdlc_msglist_query_t query = { .offset = 0 };
+	unsigned num_matches = 0;
+
+	cpdlc_msglist_query(fans_get_msglist(box), &query, NULL, NULL, 0,
+	    &num_matches);
+	return (num_matches);
+}
+
+static void
+drain_atc(cpdlc_client_t *atc)
+{
+	cpdlc_msg_t *msg;
+
+	while ((msg = cpdlc_client_recv_msg(atc)) != NULL)
+		cpdlc_msg_free(msg);
+}
+
+/*
+ * Has the ATC station uplink `num_thrs' CLIMB TO clearances, each of
+ * which starts a new thread on the box. We send them in small batches
+ * and wait for each batch to arrive, so as not to overrun the server's
+ * per-connection buffers.
+ */
+static bool
+populate(fans_t *box, cpdlc_client_t *atc, const char *callsign,
+    unsigned num_thrs)
+{
+	unsigned start = count_thrs(box);
+
+	for (unsigned i = 0; i < num_thrs; i += SEND_BATCH) {
+		unsigned n = MIN(SEND_BATCH, num_thrs - i);
+		uint64_t deadline = cpdlc_thread_microclock() + WAIT_TIMEOUT;
+
+		for (unsigned j = 0; j < n; j++) {
+			cpdlc_msg_t *msg = cpdlc_msg_alloc(CPDLC_PKT_CPDLC);
+			bool fl = true;
+			int alt = 10000 + ((i + j) % 30) * 1000;
+			int seg = cpdlc_msg_add_seg(msg, false,
+			    CPDLC_UM20_CLB_TO_alt, 0);
+
+			cpdlc_msg_seg_set_arg(msg, seg, 0, &fl, &alt);
+			cpdlc_msg_set_to(msg, callsign);
+			cpdlc_msg_set_min(msg, i + j);
+			VERIFY(cpdlc_client_send_msg(atc, msg) !=
+			    CPDLC_INVALID_MSG_TOKEN);
+			cpdlc_msg_free(msg);
+		}
+		while (count_thrs(box) < start + i + n) {
+			if (cpdlc_thread_microclock() > deadline)
+				return (false);
+			fans_update(box);
+			drain_atc(atc);
+			usleep(POLL_INTVAL);
+		}
+	}
+	return (true);
+}
+
+static void
+print_usage(const char *progname, FILE *fp)
+{
+	fprintf(fp, "Usage: %s [-h] [-s <host>] [-p <port>] [-c <cafile>] "
+	    "[-f <callsign>]\n"
+	    "    [-a <station>] [-n <num_thrs>] [-i <iterations>]\n"
+	    "\n"
+	    "  -s <host>       cpdlcd hostname (default: localhost)\n"
+	    "  -p <port>       cpdlcd port (default: library default)\n"
+	    "  -c <cafile>     CA certificate file for server validation\n"
+	    "  -f <callsign>   aircraft callsign (default: BENCH1)\n"
+	    "  -a <station>    ATC station identity (default: KZAK)\n"
+	    "  -n <num_thrs>   message threads to pre-populate (default: 500)\n"
+	    "  -i <iterations> number of passes over all scripts "
+	    "(default: 20)\n", progname);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *host = "localhost", *ca_file = NULL;
+	const char *callsign = "BENCH1", *station = "KZAK";
+	unsigned port = 0, num_thrs = 500, iters = 20;
+	samples_t samples[sizeof (scripts) / sizeof (scripts[0])] = {};
+	samples_t upd_samples = {}, all_samples = {};
+	cpdlc_client_t *atc;
+	fans_t *box;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "hs:p:c:f:a:n:i:")) != -1) {
+		switch (opt) {
+		case 'h':
+			print_usage(argv[0], stdout);
+			return (0);
+		case 's':
+			host = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'c':
+			ca_file = optarg;
+			break;
+		case 'f':
+			callsign = optarg;
+			break;
+		case 'a':
+			station = optarg;
+			break;
+		case 'n':
+			num_thrs = atoi(optarg);
+			break;
+		case 'i':
+			iters = atoi(optarg);
+			break;
+		default:
+			print_usage(argv[0], stderr);
+			return (1);
+		}
+	}
+
+	atc = cpdlc_client_alloc(true);
+	cpdlc_client_set_host(atc, host);
+	cpdlc_client_set_port(atc, port);
+	if (ca_file != NULL)
+		cpdlc_client_set_ca_file(atc, ca_file);
+	cpdlc_client_logon(atc, station, station, station);
+	if (!wait_logon(atc, NULL)) {
+		fprintf(stderr, "ATC station %s failed to log on\n", station);
+		return (1);
+	}
+
+	box = fans_alloc(NULL, NULL);
+	cpdlc_client_set_host(fans_get_client(box), host);
+	cpdlc_client_set_port(fans_get_client(box), port);
+	if (ca_file != NULL)
+		cpdlc_client_set_ca_file(fans_get_client(box), ca_file);
+	/* Drive the logon through the LOGON/STATUS page, like a pilot would */
+	fans_push_key(box, FMS_KEY_IDX);
+	fans_push_key(box, FMS_KEY_LSK_L1);
+	for (const char *c = callsign; *c != '\0'; c++)
+		fans_push_char(box, *c);
+	fans_push_key(box, FMS_KEY_LSK_L4);
+	for (const char *c = station; *c != '\0'; c++)
+		fans_push_char(box, *c);
+	fans_push_key(box, FMS_KEY_LSK_R4);
+	fans_push_key(box, FMS_KEY_LSK_R5);
+	if (!wait_logon(fans_get_client(box), box)) {
+		fprintf(stderr, "Aircraft %s failed to log on\n", callsign);
+		return (1);
+	}
+
+	if (!populate(box, atc, callsign, num_thrs)) {
+		fprintf(stderr, "Timed out populating message threads, "
+		    "got %u/%u\n", count_thrs(box), num_thrs);
+		return (1);
+	}
+
+	for (unsigned i = 0; i < iters; i++) {
+		for (unsigned j = 0; scripts[j].name != NULL; j++) {
+			uint64_t t;
+
+			run_script(box, &scripts[j], &samples[j]);
+			/* An idle tick, as run by the host's frame loop */
+			t = cpdlc_thread_microclock();
+			fans_update(box);
+			samples_add(&upd_samples,
+			    cpdlc_thread_microclock() - t);
+			drain_atc(atc);
+		}
+	}
+
+	printf("threads: %u  iterations: %u  (latencies in us)\n",
+	    count_thrs(box), iters);
+	printf("%-10s %8s %8s %8s %8s %8s\n", "script", "keys", "p50", "p90",
+	    "p99", "max");
+	for (unsigned j = 0; scripts[j].name != NULL; j++) {
+		samples_merge(&all_samples, &samples[j]);
+		samples_print(scripts[j].name, &samples[j]);
+		samples_free(&samples[j]);
+	}
+	samples_print("all", &all_samples);
+	samples_print("idle_upd", &upd_samples);
+	samples_free(&all_samples);
+	samples_free(&upd_samples);
+
+	fans_free(box);
+	cpdlc_client_logoff(atc);
+	cpdlc_client_free(atc);
+
+	return (0);
+}
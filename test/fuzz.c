@@ -0,0 +1,863 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Fuzz targets for the message codec and cpdlcd's input framing. One
+ * source builds into three programs, the target being selected by
+ * defining FUZZ_TARGET to its name as a string:
+ *
+ *	fuzz_decode     Decodes every message in the input, then encodes
+ *			each one and renders it in readable form.
+ *	fuzz_roundtrip  Re-decodes the encoding of every decoded message.
+ *			This must succeed and re-encode to the same text.
+ *	fuzz_framing    Feeds the input through cpdlcd's framing code
+ *			(cpdlcd/framing.c) in chunks, with the server's
+ *			sanitization and buffer limits. The first byte of
+ *			the input selects the chunk sizes.
+ *
+ * Built with `make fuzz FUZZ=1 CC=clang', these are libFuzzer targets.
+ * Otherwise they get a standalone driver instead, which:
+ *
+ *	- runs the given files (or every file in the given directories),
+ *	  or stdin, through the target. Build it with CC=afl-clang-fast
+ *	  to fuzz with AFL, e.g. `afl-fuzz -i seeds -o out ./fuzz_decode'.
+ *	  It uses AFL's persistent mode when available.
+ *	- with "-g <dir>", writes a seed corpus for the target into <dir>.
+ *	  There is a seed per message type in cpdlc_infos.c, with typical
+ *	  arguments, plus logons, pings and multi-segment messages.
+ *	- with "-S", checks that the target's run time scales linearly with
+ *	  input size. Each input is inflated by repeating all of it, or its
+ *	  middle third, up to 2^n times. Inputs where the log-log slope of
+ *	  run time over size exceeds the given exponent twice in a row are
+ *	  reported as super-linear, and the exit code is then non-zero.
+ *
+ * In both builds, setting CPDLC_FUZZ_NS_PER_BYTE in the environment
+ * aborts on any input which takes longer than that many nanoseconds per
+ * input byte (plus a fixed 1ms allowance), so the fuzzer itself saves
+ * slow inputs alongside crashes.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "../src/cpdlc_alloc.h"
+#include "../src/cpdlc_assert.h"
+#include "../src/cpdlc_msg.h"
+#include "../cpdlcd/framing.h"
+
+#ifndef	FUZZ_TARGET
+#error	"FUZZ_TARGET must be defined to the name of a fuzz target"
+#endif
+
+/* Fixed allowance per input for CPDLC_FUZZ_NS_PER_BYTE */
+#define	SLOW_BASE_NS	1000000ull
+#define	READ_BUF_SZ	4096		/* cpdlcd's read size */
+#define	MAX_INPUT_SZ	(1 << 20)
+/*
+ * Parameters of the "-S" run time measurements, see scaling_slope. The
+ * slope is fitted over the SCALE_POINTS largest inflated inputs, each
+ * timed as the best of SCALE_ROUNDS rounds of at least SCALE_ROUND_NS.
+ * Points faster than SCALE_MIN_NS are dominated by fixed overhead.
+ */
+#define	SCALE_POINTS	4
+#define	SCALE_ROUNDS	3
+#define	SCALE_ROUND_NS	5000000ull
+#define	SCALE_MIN_NS	20000
+
+typedef void (*fuzz_func_t)(const uint8_t *data, size_t size);
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static fuzz_func_t	target = NULL;
+static uint64_t		max_ns_per_byte = 0;
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	VERIFY0(clock_gettime(CLOCK_MONOTONIC, &ts));
+	return ((uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec);
+}
+
+/*
+ * The codec works on NUL-terminated strings. Any NUL bytes in the input
+ * simply end the string early, just like they would in the server.
+ */
+static char *
+input2str(const uint8_t *data, size_t size)
+{
+	char *str = safe_malloc(size + 1);
+
+	memcpy(str, data, size);
+	str[size] = '\0';
+
+	return (str);
+}
+
+static char *
+encode(const cpdlc_msg_t *msg)
+{
+	unsigned l = cpdlc_msg_encode(msg, NULL, 0);
+	char *buf = safe_malloc(l + 1);
+
+	VERIFY3U(cpdlc_msg_encode(msg, buf, l + 1), ==, l);
+	VERIFY3U(strlen(buf), ==, l);
+
+	return (buf);
+}
+
+/*
+ * Runs a decoded message through everything a client or the server
+ * might do with it.
+ */
+static void
+exercise_msg(const cpdlc_msg_t *msg)
+{
+	unsigned l;
+	char *buf;
+
+	free(encode(msg));
+
+	l = cpdlc_msg_readable(msg, NULL, 0);
+	buf = safe_malloc(l + 1);
+	VERIFY3U(cpdlc_msg_readable(msg, buf, l + 1), ==, l);
+	VERIFY3U(strlen(buf), ==, l);
+	free(buf);
+	/* Truncated output must be handled too */
+	buf = safe_malloc(l / 2 + 1);
+	cpdlc_msg_readable(msg, buf, l / 2 + 1);
+	free(buf);
+}
+
+static void
+roundtrip_msg(const cpdlc_msg_t *msg)
+{
+	char *enc1, *enc2, error[128] = { 0 };
+	cpdlc_msg_t *msg2;
+	int consumed;
+
+	enc1 = encode(msg);
+	VERIFY_MSG(cpdlc_msg_decode(enc1, &msg2, &consumed, error,
+	    sizeof (error)), "re-decoding %s failed: %s", enc1, error);
+	VERIFY_MSG(msg2 != NULL, "re-decoding %s yielded no message", enc1);
+	VERIFY3S(consumed, ==, strlen(enc1));
+	enc2 = encode(msg2);
+	VERIFY_MSG(strcmp(enc1, enc2) == 0, "round trip mismatch:\n%s%s",
+	    enc1, enc2);
+	free(enc1);
+	free(enc2);
+	cpdlc_msg_free(msg2);
+}
+
+/*
+ * Decodes all messages in the input the same way cpdlcd's framing does,
+ * and passes each to `func'.
+ */
+static void
+decode_all(const uint8_t *data, size_t size,
+    void (*func)(const cpdlc_msg_t *msg))
+{
+	char *str = input2str(data, size), error[128];
+	size_t len = strlen(str);
+
+	for (size_t off = 0; off < len;) {
+		cpdlc_msg_t *msg;
+		int consumed;
+
+		if (!cpdlc_msg_decode(&str[off], &msg, &consumed, error,
+		    sizeof (error)) || msg == NULL)
+			break;
+		VERIFY3S(consumed, >, 0);
+		func(msg);
+		cpdlc_msg_free(msg);
+		off += consumed;
+		VERIFY3U(off, <=, len);
+	}
+	free(str);
+}
+
+static void
+fuzz_decode(const uint8_t *data, size_t size)
+{
+	decode_all(data, size, exercise_msg);
+}
+
+static void
+fuzz_roundtrip(const uint8_t *data, size_t size)
+{
+	decode_all(data, size, roundtrip_msg);
+}
+
+static void
+framing_cb(cpdlc_msg_t *msg, int bytes, void *userinfo)
+{
+	bool *logged_on = userinfo;
+
+	VERIFY3S(bytes, >, 0);
+	exercise_msg(msg);
+	/*
+	 * The server raises the buffer limit once the logon has been
+	 * authenticated, which is as good as immediately here.
+	 */
+	if (msg->is_logon)
+		*logged_on = true;
+}
+
+/*
+ * Mimics conn_read_input and conn_process_input in cpdlcd: the input is
+ * received in chunks, each of which must pass sanitization and fit in
+ * the input buffer, and every chunk triggers a framing pass over the
+ * buffered input.
+ */
+static void
+fuzz_framing(const uint8_t *data, size_t size)
+{
+	uint32_t rand_state, max_chunk;
+	char *inbuf = safe_calloc(1, 1), error[128];
+	size_t inbuf_sz = 0;
+	bool logged_on = false;
+
+	if (size == 0)
+		return;
+	/*
+	 * Low values of the first byte cut the input into chunks of up
+	 * to a full read, high values into tiny pieces.
+	 */
+	rand_state = data[0] | 0x100;
+	max_chunk = (data[0] < 0x80 ? READ_BUF_SZ : 16);
+	data++;
+	size--;
+
+	while (size != 0) {
+		size_t chunk, max_inbuf_sz = (logged_on ? MAX_BUF_SZ :
+		    MAX_BUF_SZ_NO_LOGON);
+		int consumed;
+
+		/* xorshift32 */
+		rand_state ^= rand_state << 13;
+		rand_state ^= rand_state >> 17;
+		rand_state ^= rand_state << 5;
+		chunk = MIN(1 + rand_state % max_chunk, size);
+
+		if (!framing_sanitize(data, chunk) ||
+		    inbuf_sz + chunk > max_inbuf_sz)
+			break;
+		inbuf = safe_realloc(inbuf, inbuf_sz + chunk + 1);
+		memcpy(&inbuf[inbuf_sz], data, chunk);
+		inbuf_sz += chunk;
+		inbuf[inbuf_sz] = '\0';
+		data += chunk;
+		size -= chunk;
+
+		consumed = framing_drain(inbuf, inbuf_sz, framing_cb,
+		    &logged_on, error, sizeof (error));
+		if (consumed < 0)
+			break;
+		VERIFY3U(consumed, <=, inbuf_sz);
+		inbuf_sz -= consumed;
+		memmove(inbuf, &inbuf[consumed], inbuf_sz + 1);
+	}
+	free(inbuf);
+}
+
+static void
+fuzz_assfail(const char *filename, int line, const char *msg,
+    void *userinfo)
+{
+	UNUSED(userinfo);
+	fprintf(stderr, "Assertion failed at %s:%d: %s\n", filename, line,
+	    msg);
+	abort();
+}
+
+static void
+init_target(void)
+{
+	static const struct {
+		const char	*name;
+		fuzz_func_t	func;
+	} targets[] = {
+	    { "fuzz_decode", fuzz_decode },
+	    { "fuzz_roundtrip", fuzz_roundtrip },
+	    { "fuzz_framing", fuzz_framing }
+	};
+	const char *str = getenv("CPDLC_FUZZ_NS_PER_BYTE");
+
+	cpdlc_assfail = fuzz_assfail;
+	for (size_t i = 0; i < sizeof (targets) / sizeof (*targets); i++) {
+		if (strcmp(targets[i].name, FUZZ_TARGET) == 0)
+			target = targets[i].func;
+	}
+	VERIFY_MSG(target != NULL, "unknown fuzz target %s", FUZZ_TARGET);
+	if (str != NULL)
+		max_ns_per_byte = strtoull(str, NULL, 10);
+}
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	uint64_t start, elapsed;
+
+	if (target == NULL)
+		init_target();
+	start = now_ns();
+	target(data, size);
+	elapsed = now_ns() - start;
+	if (max_ns_per_byte != 0 &&
+	    elapsed > SLOW_BASE_NS + max_ns_per_byte * size) {
+		fprintf(stderr, "Slow input: %zu bytes took %llu ns "
+		    "(%.0f ns/byte)\n", size, (unsigned long long)elapsed,
+		    (double)elapsed / MAX(size, 1));
+		abort();
+	}
+
+	return (0);
+}
+
+#ifndef	CPDLC_LIBFUZZER
+
+static bool	framed_input = false;
+
+static void
+print_usage(const char *progname, FILE *fp)
+{
+	fprintf(fp, "Usage: %s [-h] [-g <dir>] [-S] [-e <exponent>] "
+	    "[-m <max_bytes>] [file|dir ...]\n"
+	    "\n"
+	    "  -g <dir>        write a seed corpus into <dir> and exit\n"
+	    "  -S              check run time scaling instead of just "
+	    "running inputs\n"
+	    "  -e <exponent>   super-linear threshold for -S "
+	    "(default: 1.75)\n"
+	    "  -m <max_bytes>  largest inflated input for -S "
+	    "(default: 262144)\n"
+	    "\n"
+	    "Without files, a single input is read from stdin.\n", progname);
+}
+
+static void
+sample_arg(cpdlc_msg_t *msg, unsigned seg, unsigned arg, bool alt_form)
+{
+	bool b = alt_form;
+	int i1, i2;
+	unsigned u;
+	double d;
+	cpdlc_dir_t dir;
+
+	switch (cpdlc_msg_seg_get_arg_type(msg, seg, arg)) {
+	case CPDLC_ARG_ALTITUDE:
+		b = !alt_form;
+		i1 = (alt_form ? 5000 : 35000);
+		cpdlc_msg_seg_set_arg(msg, seg, arg, &b, &i1);
+		break;
+	case CPDLC_ARG_SPEED:
+		i1 = (alt_form ? 820 : 250);
+		cpdlc_msg_seg_set_arg(msg, seg, arg, &b, &i1);
+		break;
+	case CPDLC_ARG_TIME:
+		i1 = (alt_form ? 0 : 12);
+		i2 = (alt_form ? 5 : 34);
+		cpdlc_msg_seg_set_arg(msg, seg, arg, &i1, &i2);
+		break;
+	case CPDLC_ARG_POSITION:
+		cpdlc_msg_seg_set_arg(msg, seg, arg,
+		    alt_form ? "4530N12230W" : "ALCOA", NULL);
+		break;
+	case CPDLC_ARG_DIRECTION:
+		dir = (alt_form ? CPDLC_DIR_RIGHT : CPDLC_DIR_LEFT);
+		cpdlc_msg_seg_set_arg(msg, seg, arg, &dir, NULL);
+		break;
+	case CPDLC_ARG_DISTANCE:
+		d = (alt_form ? 2.5 : 15);
+		cpdlc_msg_seg_set_arg(msg, seg, arg, &d, NULL);
+		break;
+	case CPDLC_ARG_VVI:
+		i1 = (alt_form ? 3000 : 1500);
+		cpdlc_msg_seg_set_arg(msg, seg, arg, &i1, NULL);
+		break;
+	case CPDLC_ARG_TOFROM:
+		cpdlc_msg_seg_set_arg(msg, seg, arg, &b, NULL);
+		break;
+	case CPDLC_ARG_ROUTE:
+		cpdlc_msg_seg_set_arg(msg, seg, arg,
+		    alt_form ? "KSEA HAWKZ7 J5 BTG" : "ALCOA", NULL);
+		break;
+	case CPDLC_ARG_PROCEDURE:
+		cpdlc_msg_seg_set_arg(msg, seg, arg,
+		    alt_form ? "ILS16R" : "HAWKZ7", NULL);
+		break;
+	case CPDLC_ARG_SQUAWK:
+		u = (alt_form ? 7000 : 1234);
+		cpdlc_msg_seg_set_arg(msg, seg, arg, &u, NULL);
+		break;
+	case CPDLC_ARG_ICAONAME:
+		cpdlc_msg_seg_set_arg(msg, seg, arg, "KZSE",
+		    alt_form ? "SEATTLE/CENTER 100%" : "SEATTLE CENTER");
+		break;
+	case CPDLC_ARG_FREQUENCY:
+		d = (alt_form ? 8891 : 121.5);
+		cpdlc_msg_seg_set_arg(msg, seg, arg, &d, NULL);
+		break;
+	case CPDLC_ARG_DEGREES:
+		u = (alt_form ? 90 : 270);
+		cpdlc_msg_seg_set_arg(msg, seg, arg, &u, &b);
+		break;
+	case CPDLC_ARG_BARO:
+		d = (alt_form ? 1013 : 29.92);
+		cpdlc_msg_seg_set_arg(msg, seg, arg, &b, &d);
+		break;
+	case CPDLC_ARG_FREETEXT:
+		cpdlc_msg_seg_set_arg(msg, seg, arg, alt_form ?
+		    "TEST/100% \"QUOTED\" SLASH" : "HELLO WORLD", NULL);
+		break;
+	}
+}
+
+static void
+write_seed(const char *dir, const char *name, const char *const *bufs,
+    unsigned num_bufs)
+{
+	char path[strlen(dir) + strlen(name) + 2];
+	FILE *fp;
+
+	snprintf(path, sizeof (path), "%s/%s", dir, name);
+	fp = fopen(path, "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "Can't write %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+	/* Framing inputs start with the chunking selector */
+	if (framed_input)
+		fputc(name[0], fp);
+	for (unsigned i = 0; i < num_bufs; i++)
+		fputs(bufs[i], fp);
+	fclose(fp);
+}
+
+static void
+write_msg_seed(const char *dir, const char *name, const cpdlc_msg_t *msg)
+{
+	char *buf = encode(msg);
+
+	write_seed(dir, name, (const char *const *)&buf, 1);
+	free(buf);
+}
+
+static cpdlc_msg_t *
+seed_msg(const cpdlc_msg_info_t *info, bool alt_form, unsigned min)
+{
+	cpdlc_msg_t *msg = cpdlc_msg_alloc(CPDLC_PKT_CPDLC);
+	int seg = cpdlc_msg_add_seg(msg, info->is_dl, info->msg_type,
+	    info->msg_subtype);
+
+	VERIFY3S(seg, >=, 0);
+	cpdlc_msg_set_min(msg, min);
+	if (info->is_dl)
+		cpdlc_msg_set_from(msg, "N12345");
+	else
+		cpdlc_msg_set_to(msg, "N12345");
+	for (unsigned i = 0; i < info->num_args; i++)
+		sample_arg(msg, seg, i, alt_form);
+
+	return (msg);
+}
+
+static unsigned
+gen_info_seeds(const char *dir, const cpdlc_msg_info_t *infos)
+{
+	unsigned n = 0;
+
+	for (const cpdlc_msg_info_t *info = infos; info->msg_type != -1;
+	    info++) {
+		for (int alt_form = 0; alt_form < 2; alt_form++) {
+			cpdlc_msg_t *msg = seed_msg(info, alt_form, n + 1);
+			char name[32];
+
+			snprintf(name, sizeof (name), "%s%d%s_%d",
+			    info->is_dl ? "DM" : "UM", info->msg_type,
+			    info->msg_subtype != 0 ?
+			    (char [2]){ info->msg_subtype, 0 } : "",
+			    alt_form);
+			write_msg_seed(dir, name, msg);
+			cpdlc_msg_free(msg);
+			n++;
+			/* Argument-less types only need one seed */
+			if (info->num_args == 0)
+				break;
+		}
+	}
+	return (n);
+}
+
+/*
+ * Writes a seed per message type and argument form, plus the various
+ * non-CPDLC packets and a few multi-segment and multi-message inputs.
+ */
+static void
+gen_seeds(const char *dir)
+{
+	unsigned n = 0;
+	cpdlc_msg_t *msg, *msg2;
+	char *bufs[3];
+
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+		fprintf(stderr, "Can't create %s: %s\n", dir, strerror(errno));
+		exit(1);
+	}
+	n += gen_info_seeds(dir, cpdlc_ul_infos);
+	n += gen_info_seeds(dir, cpdlc_dl_infos);
+
+	msg = cpdlc_msg_alloc(CPDLC_PKT_CPDLC);
+	cpdlc_msg_set_logon_data(msg, "PASSWORD/WITH%SPECIALS");
+	cpdlc_msg_set_from(msg, "N12345");
+	cpdlc_msg_set_to(msg, "KZSE");
+	write_msg_seed(dir, "logon", msg);
+	cpdlc_msg_free(msg);
+	n++;
+
+	msg = cpdlc_msg_alloc(CPDLC_PKT_PING);
+	cpdlc_msg_set_min(msg, 1);
+	write_msg_seed(dir, "ping", msg);
+	cpdlc_msg_free(msg);
+	msg = cpdlc_msg_alloc(CPDLC_PKT_PONG);
+	cpdlc_msg_set_mrn(msg, 1);
+	write_msg_seed(dir, "pong", msg);
+	cpdlc_msg_free(msg);
+	n += 2;
+
+	/* A clearance with an appended free text and a full downlink */
+	msg = seed_msg(&cpdlc_ul_infos[20], false, 1);
+	VERIFY3S(cpdlc_msg_add_seg(msg, false, CPDLC_UM169_FREETEXT_NORMAL_text,
+	    0), ==, 1);
+	sample_arg(msg, 1, 0, true);
+	msg2 = seed_msg(&cpdlc_dl_infos[6], false, 2);
+	cpdlc_msg_set_mrn(msg2, 1);
+	for (unsigned i = 1; i < CPDLC_MAX_MSG_SEGS; i++) {
+		int seg = cpdlc_msg_add_seg(msg2, true,
+		    CPDLC_DM67_FREETEXT_NORMAL_text, 0);
+		sample_arg(msg2, seg, 0, i & 1);
+	}
+	write_msg_seed(dir, "multiseg_ul", msg);
+	write_msg_seed(dir, "multiseg_dl", msg2);
+	n += 2;
+
+	/* Several messages in one input, with mixed line endings */
+	bufs[0] = encode(msg);
+	bufs[1] = encode(msg2);
+	bufs[1][strlen(bufs[1]) - 1] = '\r';
+	bufs[2] = "PKT=PING/MIN=3\r\nPKT=CPDLC/LOGOFF\n";
+	write_seed(dir, "stream", (const char *const *)bufs, 3);
+	write_seed(dir, "~stream", (const char *const *)bufs, 3);
+	free(bufs[0]);
+	free(bufs[1]);
+	cpdlc_msg_free(msg);
+	cpdlc_msg_free(msg2);
+	n += 2;
+
+	printf("Wrote %u seeds to %s\n", n, dir);
+}
+
+static uint8_t *
+read_file(FILE *fp, size_t *size)
+{
+	uint8_t *buf = safe_malloc(MAX_INPUT_SZ);
+
+	*size = fread(buf, 1, MAX_INPUT_SZ, fp);
+	return (buf);
+}
+
+/*
+ * Average run time of the target on an input in ns, taking the best of
+ * SCALE_ROUNDS rounds of runs lasting at least SCALE_ROUND_NS each.
+ * Preemption and other noise only ever make a round slower, so the best
+ * round is the closest to the true run time.
+ */
+static double
+time_input(const uint8_t *data, size_t size)
+{
+	double best = INFINITY;
+
+	for (int round = 0; round < SCALE_ROUNDS; round++) {
+		uint64_t start = now_ns(), elapsed;
+		unsigned iters = 0;
+
+		do {
+			target(data, size);
+			iters++;
+			elapsed = now_ns() - start;
+		} while (elapsed < SCALE_ROUND_NS);
+		best = MIN(best, (double)elapsed / iters);
+	}
+	return (best);
+}
+
+/*
+ * Repeats the `slice_len' bytes at `slice_off' in the input `reps' times.
+ */
+static uint8_t *
+inflate_input(const uint8_t *data, size_t size, size_t slice_off,
+    size_t slice_len, unsigned reps, size_t *out_size)
+{
+	size_t tail = size - slice_off - slice_len;
+	uint8_t *out;
+
+	*out_size = size + slice_len * (reps - 1);
+	out = safe_malloc(*out_size);
+	memcpy(out, data, slice_off);
+	for (unsigned i = 0; i < reps; i++) {
+		memcpy(&out[slice_off + i * slice_len], &data[slice_off],
+		    slice_len);
+	}
+	memcpy(&out[slice_off + reps * slice_len],
+	    &data[slice_off + slice_len], tail);
+
+	return (out);
+}
+
+/*
+ * Measures the run time over increasingly inflated copies of the input
+ * and returns the log-log slope of time over size, as a least squares
+ * fit over the SCALE_POINTS largest sizes (each double the previous).
+ * Only using the largest sizes keeps the linear part of a super-linear
+ * target from diluting the slope, and fitting several points keeps a
+ * single noisy measurement from swinging it much. Returns NAN if the
+ * input can't be inflated enough, or if any of the points is too fast
+ * to measure, e.g. because the target bails out early on the inflated
+ * input.
+ */
+static double
+scaling_slope(const uint8_t *data, size_t size, size_t slice_off,
+    size_t slice_len, size_t max_size)
+{
+	unsigned max_reps = 1, n = 0;
+	double sx = 0, sy = 0, sxx = 0, sxy = 0;
+
+	while (size + slice_len * (2 * max_reps - 1) <= max_size)
+		max_reps *= 2;
+	if (max_reps < 1u << (SCALE_POINTS - 1))
+		return (NAN);
+	for (unsigned reps = max_reps >> (SCALE_POINTS - 1);
+	    reps <= max_reps; reps *= 2) {
+		size_t inf_size;
+		uint8_t *inf = inflate_input(data, size, slice_off, slice_len,
+		    reps, &inf_size);
+		double t = time_input(inf, inf_size);
+		double x = log(inf_size), y = log(t);
+
+		free(inf);
+		if (t < SCALE_MIN_NS)
+			return (NAN);
+		sx += x;
+		sy += y;
+		sxx += x * x;
+		sxy += x * y;
+		n++;
+	}
+	return ((n * sxy - sx * sy) / (n * sxx - sx * sx));
+}
+
+static bool
+check_scaling(const char *name, const uint8_t *data, size_t size,
+    size_t max_size, double max_exp)
+{
+	size_t hdr = (framed_input ? 1 : 0);
+	struct {
+		const char	*what;
+		size_t		off;
+		size_t		len;
+	} slices[2] = {
+	    { "whole", hdr, size - MIN(size, hdr) },
+	    { "middle", hdr + (size - MIN(size, hdr)) / 3,
+	    (size - MIN(size, hdr)) / 3 }
+	};
+	bool ok = true;
+
+	for (int i = 0; i < 2; i++) {
+		double slope;
+
+		if (slices[i].len == 0 ||
+		    size > max_size >> (SCALE_POINTS - 1))
+			continue;
+		slope = scaling_slope(data, size, slices[i].off,
+		    slices[i].len, max_size);
+		/* Confirm with a second measurement, to rule out noise */
+		if (slope > max_exp) {
+			slope = MIN(slope, scaling_slope(data, size,
+			    slices[i].off, slices[i].len, max_size));
+		}
+		if (isnan(slope)) {
+			printf("%s: %s: too fast to measure\n", name,
+			    slices[i].what);
+		} else if (slope > max_exp) {
+			printf("%s: %s: SUPER-LINEAR, exponent %.2f\n", name,
+			    slices[i].what, slope);
+			ok = false;
+		} else {
+			printf("%s: %s: exponent %.2f\n", name,
+			    slices[i].what, slope);
+		}
+	}
+	return (ok);
+}
+
+static bool
+run_file(const char *path, bool scaling, size_t max_size, double max_exp)
+{
+	FILE *fp = fopen(path, "rb");
+	uint8_t *data;
+	size_t size;
+	bool ok = true;
+
+	if (fp == NULL) {
+		fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+		return (false);
+	}
+	data = read_file(fp, &size);
+	fclose(fp);
+	if (scaling)
+		ok = check_scaling(path, data, size, max_size, max_exp);
+	else
+		LLVMFuzzerTestOneInput(data, size);
+	free(data);
+
+	return (ok);
+}
+
+static bool
+run_path(const char *path, bool scaling, size_t max_size, double max_exp,
+    unsigned *num_inputs)
+{
+	struct stat st;
+	DIR *dp;
+	bool ok = true;
+
+	if (stat(path, &st) != 0) {
+		fprintf(stderr, "Can't stat %s: %s\n", path, strerror(errno));
+		return (false);
+	}
+	if (!S_ISDIR(st.st_mode)) {
+		(*num_inputs)++;
+		return (run_file(path, scaling, max_size, max_exp));
+	}
+	dp = opendir(path);
+	if (dp == NULL) {
+		fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+		return (false);
+	}
+	for (struct dirent *de = readdir(dp); de != NULL; de = readdir(dp)) {
+		char subpath[strlen(path) + strlen(de->d_name) + 2];
+
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(subpath, sizeof (subpath), "%s/%s", path, de->d_name);
+		if (stat(subpath, &st) == 0 && S_ISREG(st.st_mode)) {
+			(*num_inputs)++;
+			ok &= run_file(subpath, scaling, max_size, max_exp);
+		}
+	}
+	closedir(dp);
+
+	return (ok);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int opt;
+	bool scaling = false, ok = true;
+	size_t max_size = 262144;
+	double max_exp = 1.75;
+	unsigned num_inputs = 0;
+	const char *seed_dir = NULL;
+
+	init_target();
+	framed_input = (target == fuzz_framing);
+	while ((opt = getopt(argc, argv, "hg:Se:m:")) != -1) {
+		switch (opt) {
+		case 'h':
+			print_usage(argv[0], stdout);
+			return (0);
+		case 'g':
+			seed_dir = optarg;
+			break;
+		case 'S':
+			scaling = true;
+			break;
+		case 'e':
+			max_exp = atof(optarg);
+			break;
+		case 'm':
+			max_size = atoll(optarg);
+			break;
+		default:
+			print_usage(argv[0], stderr);
+			return (1);
+		}
+	}
+	if (seed_dir != NULL) {
+		gen_seeds(seed_dir);
+		return (0);
+	}
+
+	if (optind == argc) {
+#ifdef	__AFL_LOOP
+		while (__AFL_LOOP(1000)) {
+#endif
+			size_t size;
+			uint8_t *data = read_file(stdin, &size);
+
+			if (scaling)
+				ok = check_scaling("stdin", data, size,
+				    max_size, max_exp);
+			else
+				LLVMFuzzerTestOneInput(data, size);
+			free(data);
+#ifdef	__AFL_LOOP
+		}
+#endif
+		return (ok ? 0 : 1);
+	}
+	for (int i = optind; i < argc; i++)
+		ok &= run_path(argv[i], scaling, max_size, max_exp,
+		    &num_inputs);
+	fflush(stdout);
+	fprintf(stderr, "%u inputs %s\n", num_inputs, scaling ?
+	    "checked" : "processed");
+
+	return (ok ? 0 : 1);
+}
+
+#endif	/* !CPDLC_LIBFUZZER */
@@ -0,0 +1,395 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Logon storm benchmark for cpdlcd's authentication pipeline. Fires a
+ * series of bursts of simultaneous LOGONs at a running cpdlcd, every one
+ * from a fresh connection with a unique callsign, and measures how long
+ * each takes to be accepted or denied. Between the bursts, everybody
+ * logs off again.
+ *
+ * While a burst is in progress, the server's thread count and open file
+ * descriptors are sampled, since cpdlcd runs every authentication on a
+ * thread of its own, with its own cURL handle and connection to the
+ * authenticator.
+ *
+ * If the authenticator is mock_auth and we're given its request log
+ * (mock_auth -o), every logon's latency is split up into:
+ *
+ *	auth_queue  LOGON sent until the authenticator accepted the
+ *		    request (TLS setup, cpdlcd's parsing, thread creation
+ *		    and the HTTP connection setup)
+ *	auth        time spent in the authenticator (mostly the delay it
+ *		    was told to add)
+ *	auth_done   authenticator response until the logon completed
+ *		    (cURL, cpdlcd's logon completion and the reply)
+ *
+ * With -1, all of a burst's clients are polled from the benchmark's
+ * main thread (see cpdlc_client_set_polled) instead of each running a
+ * worker thread of its own, the way a multi-aircraft simulator would.
+ *
+ * The results are printed as a JSON object on stdout.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/cpdlc_alloc.h"
+#include "../src/cpdlc_assert.h"
+#include "../src/cpdlc_client.h"
+#include "../src/cpdlc_string.h"
+#include "../src/cpdlc_thread.h"
+
+#include "bench.h"
+
+#define	ACFT_PREFIX	"LB"
+#define	POLL_INTVAL	1000		/* us */
+#define	SAMPLE_INTVAL	10000		/* us */
+
+typedef enum {
+	LOGON_PENDING,
+	LOGON_OK,
+	LOGON_DENIED,
+	LOGON_FAILED,
+	LOGON_TIMEDOUT
+} logon_result_t;
+
+typedef struct {
+	cpdlc_client_t	*cl;
+	char		callsign[16];
+	uint64_t	sent_t;
+	uint64_t	done_t;
+	logon_result_t	result;
+} logon_t;
+
+static const char	*host = "localhost";
+static unsigned		port = 0;
+static const char	*ca_file = NULL;
+static bool		single_loop = false;
+
+static logon_t		*logons = NULL;
+static unsigned		num_logons = 0;
+
+static samples_t	logon_lat = {};
+static samples_t	deny_lat = {};
+static samples_t	auth_queue = {};
+static samples_t	auth_time = {};
+static samples_t	auth_done = {};
+static uint64_t		results[LOGON_TIMEDOUT + 1] = {};
+static double		best_rate = 0;
+static unsigned		peak_threads = 0, peak_fds = 0;
+
+/*
+ * Checks on a pending logon. Returns true once it's finished, one way
+ * or another.
+ */
+static bool
+logon_check(logon_t *lo, uint64_t now)
+{
+	char failure[128];
+	cpdlc_logon_status_t st;
+
+	if (lo->result != LOGON_PENDING)
+		return (true);
+	st = cpdlc_client_get_logon_status(lo->cl, failure);
+	if (st == CPDLC_LOGON_COMPLETE) {
+		lo->result = LOGON_OK;
+	} else if (failure[0] != '\0') {
+		lo->result = (strcmp(failure, "Logon denied") == 0 ?
+		    LOGON_DENIED : LOGON_FAILED);
+	} else {
+		return (false);
+	}
+	lo->done_t = now;
+	return (true);
+}
+
+static void
+sample_server(int srv_pid)
+{
+	proc_stats_t ps;
+
+	proc_stats_get(srv_pid, &ps);
+	if (ps.valid) {
+		peak_threads = MAX(peak_threads, ps.num_threads);
+		peak_fds = MAX(peak_fds, ps.num_fds);
+	}
+}
+
+/*
+ * Runs a single burst of `n' logons, starting at logons[first].
+ */
+static void
+run_burst(unsigned burst, unsigned first, unsigned n, uint64_t timeout,
+    int srv_pid)
+{
+	uint64_t start, deadline, last_done = 0, next_sample = 0;
+	unsigned done = 0, ok = 0;
+	cpdlc_client_t **cls = safe_calloc(n, sizeof (*cls));
+
+	for (unsigned i = first; i < first + n; i++) {
+		logon_t *lo = &logons[i];
+
+		snprintf(lo->callsign, sizeof (lo->callsign), "%s%03u%04u",
+		    ACFT_PREFIX, burst, i - first);
+		lo->cl = cpdlc_client_alloc(false);
+		cpdlc_client_set_host(lo->cl, host);
+		if (port != 0)
+			cpdlc_client_set_port(lo->cl, port);
+		if (ca_file != NULL)
+			cpdlc_client_set_ca_file(lo->cl, ca_file);
+		cpdlc_client_set_polled(lo->cl, single_loop);
+		cls[i - first] = lo->cl;
+	}
+	start = cpdlc_thread_microclock();
+	deadline = start + timeout;
+	for (unsigned i = first; i < first + n; i++) {
+		logon_t *lo = &logons[i];
+
+		lo->sent_t = cpdlc_thread_microclock();
+		cpdlc_client_logon(lo->cl, "ACFT", lo->callsign, "ATC0000");
+	}
+	while (done < n) {
+		uint64_t now = cpdlc_thread_microclock();
+
+		if (now >= next_sample) {
+			sample_server(srv_pid);
+			next_sample = now + SAMPLE_INTVAL;
+		}
+		if (now >= deadline)
+			break;
+		done = 0;
+		for (unsigned i = first; i < first + n; i++)
+			done += logon_check(&logons[i], now);
+		if (single_loop)
+			cpdlc_client_poll_multi(cls, n, POLL_INTVAL / 1000);
+		else
+			usleep(POLL_INTVAL);
+	}
+	for (unsigned i = first; i < first + n; i++) {
+		logon_t *lo = &logons[i];
+
+		if (lo->result == LOGON_PENDING)
+			lo->result = LOGON_TIMEDOUT;
+		results[lo->result]++;
+		if (lo->result == LOGON_OK) {
+			ok++;
+			samples_add(&logon_lat, lo->done_t - lo->sent_t);
+			last_done = MAX(last_done, lo->done_t);
+		} else if (lo->result == LOGON_DENIED) {
+			samples_add(&deny_lat, lo->done_t - lo->sent_t);
+		}
+	}
+	if (ok != 0 && last_done > start)
+		best_rate = MAX(best_rate, ok / ((last_done - start) / 1e6));
+	/* Log off everybody first, so the clients shut down in parallel */
+	for (unsigned i = first; i < first + n; i++)
+		cpdlc_client_logoff(logons[i].cl);
+	for (unsigned i = first; i < first + n; i++) {
+		cpdlc_client_free(logons[i].cl);
+		logons[i].cl = NULL;
+	}
+	free(cls);
+}
+
+static logon_t *
+find_logon(const char *callsign)
+{
+	for (unsigned i = 0; i < num_logons; i++) {
+		if (strcmp(logons[i].callsign, callsign) == 0)
+			return (&logons[i]);
+	}
+	return (NULL);
+}
+
+/*
+ * Matches up the mock_auth request log with our logons. Returns the
+ * number of logons found in the log.
+ */
+static unsigned
+read_auth_log(const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	char from[32], result[16];
+	unsigned long long accept_t, resp_t;
+	unsigned matched = 0;
+
+	if (fp == NULL) {
+		perror(path);
+		return (0);
+	}
+	while (fscanf(fp, "%31s %llu %llu %15s", from, &accept_t, &resp_t,
+	    result) == 4) {
+		logon_t *lo = find_logon(from);
+
+		if (lo == NULL || lo->result == LOGON_TIMEDOUT ||
+		    accept_t < lo->sent_t || lo->done_t < resp_t)
+			continue;
+		samples_add(&auth_queue, accept_t - lo->sent_t);
+		samples_add(&auth_time, resp_t - accept_t);
+		samples_add(&auth_done, lo->done_t - resp_t);
+		matched++;
+	}
+	fclose(fp);
+
+	return (matched);
+}
+
+static void
+print_usage(const char *progname, FILE *fp)
+{
+	fprintf(fp, "Usage: %s [-h] [-s <host>] [-p <port>] [-c <cafile>] "
+	    "[-n <burst>] [-r <bursts>]\n"
+	    "    [-i <interval>] [-t <timeout>] [-P <server_pid>] "
+	    "[-A <auth_log>] [-1]\n"
+	    "\n"
+	    "  -s <host>       cpdlcd hostname (default: localhost)\n"
+	    "  -p <port>       cpdlcd port (default: library default)\n"
+	    "  -c <cafile>     CA certificate file for server validation\n"
+	    "  -n <burst>      logons per burst (default: 100)\n"
+	    "  -r <bursts>     number of bursts (default: 5)\n"
+	    "  -i <interval>   pause between bursts in seconds (default: 2)\n"
+	    "  -t <timeout>    time limit for every burst in seconds "
+	    "(default: 60)\n"
+	    "  -P <pid>        cpdlcd process ID for thread/FD sampling\n"
+	    "  -A <auth_log>   mock_auth request log (mock_auth -o)\n"
+	    "  -1              poll all clients from a single thread\n",
+	    progname);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned burst_sz = 100, num_bursts = 5, interval = 2, timeout = 60;
+	const char *auth_log = NULL;
+	int opt, srv_pid = 0;
+	unsigned matched = 0;
+	uint64_t t_start, t_end;
+	proc_stats_t ps_idle, ps_end;
+
+	while ((opt = getopt(argc, argv, "hs:p:c:n:r:i:t:P:A:1")) != -1) {
+		switch (opt) {
+		case 'h':
+			print_usage(argv[0], stdout);
+			return (0);
+		case 's':
+			host = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'c':
+			ca_file = optarg;
+			break;
+		case 'n':
+			burst_sz = atoi(optarg);
+			break;
+		case 'r':
+			num_bursts = atoi(optarg);
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		case 't':
+			timeout = atoi(optarg);
+			break;
+		case 'P':
+			srv_pid = atoi(optarg);
+			break;
+		case 'A':
+			auth_log = optarg;
+			break;
+		case '1':
+			single_loop = true;
+			break;
+		default:
+			print_usage(argv[0], stderr);
+			return (1);
+		}
+	}
+	if (burst_sz == 0 || num_bursts == 0 || num_bursts > 1000 ||
+	    burst_sz > 10000) {
+		fprintf(stderr, "Need 1-1000 bursts of 1-10000 logons\n");
+		return (1);
+	}
+	num_logons = burst_sz * num_bursts;
+	logons = safe_calloc(num_logons, sizeof (*logons));
+
+	proc_stats_get(srv_pid, &ps_idle);
+	t_start = cpdlc_thread_microclock();
+	for (unsigned b = 0; b < num_bursts; b++) {
+		if (b != 0)
+			sleep(interval);
+		run_burst(b, b * burst_sz, burst_sz, timeout * 1000000llu,
+		    srv_pid);
+	}
+	t_end = cpdlc_thread_microclock();
+	/* Give the server a moment to clean up after the last burst */
+	sleep(1);
+	proc_stats_get(srv_pid, &ps_end);
+	if (auth_log != NULL)
+		matched = read_auth_log(auth_log);
+
+	printf("{\"bursts\": %u, \"burst_size\": %u, \"time_s\": %.3f,\n",
+	    num_bursts, burst_sz, (t_end - t_start) / 1e6);
+	printf(" \"results\": {\"ok\": %llu, \"denied\": %llu, "
+	    "\"failed\": %llu, \"timedout\": %llu},\n",
+	    (unsigned long long)results[LOGON_OK],
+	    (unsigned long long)results[LOGON_DENIED],
+	    (unsigned long long)results[LOGON_FAILED],
+	    (unsigned long long)results[LOGON_TIMEDOUT]);
+	printf(" \"best_logons_per_s\": %.1f,\n ", best_rate);
+	samples_print_json(stdout, "logon_latency_us", &logon_lat);
+	printf(",\n ");
+	samples_print_json(stdout, "deny_latency_us", &deny_lat);
+	if (auth_log != NULL) {
+		printf(",\n \"auth_log_matched\": %u,\n ", matched);
+		samples_print_json(stdout, "auth_queue_us", &auth_queue);
+		printf(",\n ");
+		samples_print_json(stdout, "auth_us", &auth_time);
+		printf(",\n ");
+		samples_print_json(stdout, "auth_done_us", &auth_done);
+	}
+	if (ps_idle.valid) {
+		printf(",\n \"server\": {\"idle_threads\": %u, "
+		    "\"peak_threads\": %u, \"end_threads\": %u, "
+		    "\"idle_fds\": %u, \"peak_fds\": %u, \"end_fds\": %u, "
+		    "\"cpu_s\": %.2f}", ps_idle.num_threads, peak_threads,
+		    ps_end.num_threads, ps_idle.num_fds, peak_fds,
+		    ps_end.num_fds, ps_end.cpu_s - ps_idle.cpu_s);
+	}
+	printf("\n}\n");
+
+	free(logons);
+	samples_free(&logon_lat);
+	samples_free(&deny_lat);
+	samples_free(&auth_queue);
+	samples_free(&auth_time);
+	samples_free(&auth_done);
+
+	return (results[LOGON_OK] + results[LOGON_DENIED] != 0 ? 0 : 1);
+}
@@ -0,0 +1,88 @@
+#!/bin/bash
+#
+# Copyright 2019 Saso Kiselkov
+#
+# Permission is hereby granted, free of charge, to any person
+# obtaining a copy of this software and associated documentation
+# files (the "Software"), to deal in the Software without
+# restriction, including without limitation the rights to use,
+# copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following
+# conditions:
+#
+# The above copyright notice and this permission notice shall be
+# included in all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+# OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+# WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+
+# Runs the logon storm benchmark on loopback, against a private cpdlcd
+# instance and mock_auth (see srv_env.sh). The authenticator's behavior
+# is set with the options below, and its request log is handed to
+# logon_bench so it can break down where the logon time goes. The JSON
+# results go to stdout.
+
+source "$(dirname "$0")/srv_env.sh"
+
+LOGON_BENCH="${LOGON_BENCH:-$TESTDIR/logon_bench}"
+
+PORT=17696
+AUTH_PORT=17697
+AUTH_ARGS=()
+
+function usage() {
+	echo "Usage: $0 [-h] [-p <port>] [-d <delay>] [-j <jitter>]" \
+	    "[-f <rate>] [-e <rate>]"
+	echo "    [-- <logon_bench args>]"
+	echo "  -p <port>    cpdlcd port (default: $PORT, auth uses port + 1)"
+	echo "  -d <delay>   authenticator response delay in ms"
+	echo "  -j <jitter>  max additional random authenticator delay in ms"
+	echo "  -f <rate>    fraction of logons the authenticator denies"
+	echo "  -e <rate>    fraction of authenticator requests failing" \
+	    "with HTTP 503"
+	echo "Arguments after -- are passed to logon_bench, e.g." \
+	    "-n 500 -r 10."
+}
+
+while getopts "hp:d:j:f:e:" opt; do
+	case "$opt" in
+	h)
+		usage
+		exit 0
+		;;
+	p)
+		PORT="$OPTARG"
+		AUTH_PORT=$(( PORT + 1 ))
+		;;
+	d|j|f|e)
+		AUTH_ARGS+=("-$opt" "$OPTARG")
+		;;
+	*)
+		usage >&2
+		exit 1
+		;;
+	esac
+done
+shift $(( OPTIND - 1 ))
+
+srv_env_check_progs "$LOGON_BENCH" || exit 1
+srv_env_init || exit 1
+srv_start_auth "$AUTH_PORT" -o "$WORKDIR/auth.log" "${AUTH_ARGS[@]}" || \
+    exit 1
+srv_start_cpdlcd "$PORT" "$AUTH_PORT" || exit 1
+
+"$LOGON_BENCH" -s localhost -p "$PORT" -c "$WORKDIR/ca_cert.pem" \
+    -P "$SRV_PID" -A "$WORKDIR/auth.log" "$@"
+RESULT=$?
+if [ $RESULT -ne 0 ]; then
+	echo "logon_bench failed, last lines of the cpdlcd log follow:" >&2
+	tail -n 50 "$SRV_LOG" >&2
+fi
+exit $RESULT
@@ -0,0 +1,362 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Minimal stand-in for a cpdlcd remote authenticator (see the auth/url
+ * option in cpdlcd/sample.conf). It accepts every LOGON and marks the
+ * station as ATC if its LOGON= data starts with a configurable prefix,
+ * so that benchmarks can run a realistic aircraft/ATC mix through the
+ * daemon's message flow checks without a real authentication service.
+ *
+ * To model a real authentication service, every response can be held
+ * back by a fixed delay plus a random jitter, and a fraction of the
+ * requests can be denied (AUTH=0) or failed with an HTTP error. The
+ * response body can also be replaced outright, to test how cpdlcd
+ * parses odd AUTH=/ATC= responses.
+ *
+ * With -o, every request is logged to a file as a line of:
+ *
+ *	<FROM> <accept time> <response time> <ok|deny|error>
+ *
+ * Times are in microseconds since the epoch, so a benchmark on the same
+ * machine can split its logon latency into the time spent before the
+ * request reached us, in here, and after we've responded.
+ *
+ * Every request is served on its own thread, just like cpdlcd's auth.c
+ * performs every authentication on its own thread.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "../src/cpdlc_alloc.h"
+#include "../src/cpdlc_assert.h"
+#include "../src/cpdlc_string.h"
+#include "../src/cpdlc_thread.h"
+
+#define	MAX_REQ_SZ	8192
+#define	DFL_PORT	17680
+#define	DFL_ATC_PREFIX	"ATC"
+
+static const char	*atc_prefix = DFL_ATC_PREFIX;
+static bool		verbose = false;
+static unsigned		delay_ms = 0;
+static unsigned		jitter_ms = 0;
+static double		deny_rate = 0;
+static double		error_rate = 0;
+static const char	*fixed_resp = NULL;
+
+static mutex_t		lock;
+static FILE		*log_fp = NULL;	/* protected by `lock' */
+
+/*
+ * random() isn't guaranteed to be thread-safe, so serialize it.
+ */
+static double
+rand_unif(void)
+{
+	long r;
+
+	mutex_enter(&lock);
+	r = random();
+	mutex_exit(&lock);
+
+	return (r / ((double)RAND_MAX + 1));
+}
+
+/*
+ * Locates a field in an x-www-form-urlencoded body and copies its
+ * (still encoded) value into `value'.
+ */
+static bool
+find_field(const char *body, const char *name, char *value, size_t cap)
+{
+	size_t name_len = strlen(name);
+
+	for (const char *p = body; p != NULL && *p != '\0';) {
+		const char *end = strchr(p, '&');
+		size_t len = (end != NULL ? (size_t)(end - p) : strlen(p));
+
+		if (len > name_len && p[name_len] == '=' &&
+		    strncasecmp(p, name, name_len) == 0) {
+			len = MIN(len - name_len - 1, cap - 1);
+			memcpy(value, &p[name_len + 1], len);
+			value[len] = '\0';
+			return (true);
+		}
+		p = (end != NULL ? end + 1 : NULL);
+	}
+	return (false);
+}
+
+/*
+ * Returns the numeric value of the Content-Length header, or 0 if the
+ * request doesn't contain one. `hdrs_end' points just past the headers.
+ */
+static size_t
+content_length(const char *buf, const char *hdrs_end)
+{
+	for (const char *p = strstr(buf, "\r\n"); p != NULL && p < hdrs_end;
+	    p = strstr(p + 2, "\r\n")) {
+		if (strncasecmp(p + 2, "Content-Length:", 15) == 0)
+			return (atoi(p + 17));
+	}
+	return (0);
+}
+
+/*
+ * Reads a complete HTTP request (headers plus a Content-Length body)
+ * into `buf'. Returns a pointer to the start of the body, or NULL on
+ * error.
+ */
+static char *
+read_req(int fd, char *buf, size_t cap)
+{
+	size_t len = 0;
+	char *body = NULL;
+	size_t body_len = 0;
+
+	for (;;) {
+		ssize_t n = read(fd, &buf[len], cap - len - 1);
+
+		if (n <= 0)
+			return (NULL);
+		len += n;
+		buf[len] = '\0';
+		if (body == NULL) {
+			body = strstr(buf, "\r\n\r\n");
+			if (body == NULL) {
+				if (len + 1 >= cap)
+					return (NULL);
+				continue;
+			}
+			body += 4;
+			body_len = content_length(buf, body);
+		}
+		if ((size_t)(&buf[len] - body) >= body_len)
+			return (body);
+		if (len + 1 >= cap)
+			return (NULL);
+	}
+}
+
+typedef struct {
+	int		fd;
+	uint64_t	accept_t;
+} req_t;
+
+static void
+handle_conn(void *arg)
+{
+	req_t *req = arg;
+	char *buf = safe_malloc(MAX_REQ_SZ);
+	char from[64] = "", logon[64] = "", resp_body[256], resp[512];
+	const char *body = read_req(req->fd, buf, MAX_REQ_SZ);
+	const char *result = "ok";
+	uint64_t delay_us, resp_t;
+	bool atc;
+
+	if (body == NULL) {
+		const char *bad = "HTTP/1.1 400 Bad Request\r\n"
+		    "Content-Length: 0\r\nConnection: close\r\n\r\n";
+		(void) write(req->fd, bad, strlen(bad));
+		goto out;
+	}
+	find_field(body, "FROM", from, sizeof (from));
+	find_field(body, "LOGON", logon, sizeof (logon));
+	atc = (strncmp(logon, atc_prefix, strlen(atc_prefix)) == 0);
+
+	delay_us = delay_ms * 1000llu + (jitter_ms != 0 ?
+	    (uint64_t)(rand_unif() * jitter_ms * 1000) : 0);
+	if (delay_us != 0)
+		usleep(delay_us);
+
+	if (error_rate > 0 && rand_unif() < error_rate) {
+		result = "error";
+		snprintf(resp, sizeof (resp), "HTTP/1.1 503 Service "
+		    "Unavailable\r\nContent-Length: 0\r\n"
+		    "Connection: close\r\n\r\n");
+	} else {
+		if (fixed_resp != NULL) {
+			cpdlc_strlcpy(resp_body, fixed_resp,
+			    sizeof (resp_body));
+		} else if (deny_rate > 0 && rand_unif() < deny_rate) {
+			result = "deny";
+			cpdlc_strlcpy(resp_body, "AUTH=0&ATC=0",
+			    sizeof (resp_body));
+		} else {
+			snprintf(resp_body, sizeof (resp_body),
+			    "AUTH=1&ATC=%d", atc);
+		}
+		snprintf(resp, sizeof (resp), "HTTP/1.1 200 OK\r\n"
+		    "Content-Type: application/x-www-form-urlencoded\r\n"
+		    "Content-Length: %d\r\nConnection: close\r\n\r\n%s",
+		    (int)strlen(resp_body), resp_body);
+	}
+	if (verbose) {
+		fprintf(stderr, "LOGON FROM=%s ATC=%d %s\n", from, atc,
+		    result);
+	}
+	resp_t = cpdlc_thread_microclock();
+	(void) write(req->fd, resp, strlen(resp));
+	if (log_fp != NULL) {
+		mutex_enter(&lock);
+		fprintf(log_fp, "%s %llu %llu %s\n", from[0] != '\0' ? from :
+		    "-", (unsigned long long)req->accept_t,
+		    (unsigned long long)resp_t, result);
+		fflush(log_fp);
+		mutex_exit(&lock);
+	}
+out:
+	close(req->fd);
+	free(buf);
+	free(req);
+}
+
+static void
+print_usage(const char *progname, FILE *fp)
+{
+	fprintf(fp, "Usage: %s [-hv] [-l <addr>] [-p <port>] "
+	    "[-a <atc_prefix>] [-d <delay>] [-j <jitter>]\n"
+	    "    [-f <rate>] [-e <rate>] [-R <response>] [-o <logfile>]\n"
+	    "  -l <addr>       listen address (default: 127.0.0.1)\n"
+	    "  -p <port>       listen port (default: %d)\n"
+	    "  -a <prefix>     LOGON data prefix marking ATC stations "
+	    "(default: %s)\n"
+	    "  -d <delay>      response delay in ms (default: 0)\n"
+	    "  -j <jitter>     max additional random delay in ms "
+	    "(default: 0)\n"
+	    "  -f <rate>       fraction of logons to deny (default: 0)\n"
+	    "  -e <rate>       fraction of requests failed with HTTP 503 "
+	    "(default: 0)\n"
+	    "  -R <response>   fixed response body, e.g. \"AUTH=1&ATC=1\"\n"
+	    "  -o <logfile>    log the timing of every request to "
+	    "<logfile>\n"
+	    "  -v              log every request to stderr\n",
+	    progname, DFL_PORT, DFL_ATC_PREFIX);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *addr = "127.0.0.1";
+	int port = DFL_PORT, opt, fd, one = 1;
+	struct sockaddr_in sa = { .sin_family = AF_INET };
+
+	while ((opt = getopt(argc, argv, "hvl:p:a:d:j:f:e:R:o:")) != -1) {
+		switch (opt) {
+		case 'h':
+			print_usage(argv[0], stdout);
+			return (0);
+		case 'v':
+			verbose = true;
+			break;
+		case 'l':
+			addr = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'a':
+			atc_prefix = optarg;
+			break;
+		case 'd':
+			delay_ms = atoi(optarg);
+			break;
+		case 'j':
+			jitter_ms = atoi(optarg);
+			break;
+		case 'f':
+			deny_rate = atof(optarg);
+			break;
+		case 'e':
+			error_rate = atof(optarg);
+			break;
+		case 'R':
+			fixed_resp = optarg;
+			break;
+		case 'o':
+			if ((log_fp = fopen(optarg, "w")) == NULL) {
+				fprintf(stderr, "Can't open %s: %s\n", optarg,
+				    strerror(errno));
+				return (1);
+			}
+			break;
+		default:
+			print_usage(argv[0], stderr);
+			return (1);
+		}
+	}
+	if (port <= 0 || port > UINT16_MAX ||
+	    inet_pton(AF_INET, addr, &sa.sin_addr) != 1) {
+		fprintf(stderr, "Invalid listen address %s:%d\n", addr, port);
+		return (1);
+	}
+	sa.sin_port = htons(port);
+	signal(SIGPIPE, SIG_IGN);
+	mutex_init(&lock);
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd == -1 ||
+	    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one)) < 0 ||
+	    bind(fd, (struct sockaddr *)&sa, sizeof (sa)) < 0 ||
+	    listen(fd, SOMAXCONN) < 0) {
+		fprintf(stderr, "Can't listen on %s:%d: %s\n", addr, port,
+		    strerror(errno));
+		return (1);
+	}
+	for (;;) {
+		int conn = accept(fd, NULL, NULL);
+		thread_t thr;
+		req_t *req;
+
+		if (conn == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			fprintf(stderr, "accept: %s\n", strerror(errno));
+			return (1);
+		}
+		req = safe_malloc(sizeof (*req));
+		req->fd = conn;
+		req->accept_t = cpdlc_thread_microclock();
+		if (!thread_create(&thr, handle_conn, req)) {
+			close(conn);
+			free(req);
+			continue;
+		}
+		pthread_detach(thr);
+	}
+}
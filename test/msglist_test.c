@@ -0,0 +1,879 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Unit test of the message list. A client is connected to an in-memory
+ * transport, which answers the logon and otherwise discards whatever the
+ * client sends. Messages from peers are injected straight into the
+ * receive buffer and time is driven by a virtual clock, so every check
+ * below is deterministic. Most tests run as an ATC station, since only
+ * those can talk to more than one peer.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/cpdlc_alloc.h"
+#include "../src/cpdlc_assert.h"
+#include "../src/cpdlc_client.h"
+#include "../src/cpdlc_clock.h"
+#include "../src/cpdlc_msglist.h"
+
+#define	TEST_EPOCH	1577836800llu	/* 2020-01-01, seconds */
+#define	ATC_CALLSIGN	"ATC0"
+#define	ACFT_CALLSIGN	"ACFT0"
+#define	MAX_UPD_THRS	16
+#define	NUM_QUERY_THRS	24
+
+static uint64_t now_us = TEST_EPOCH * 1000000llu;
+static bool is_atc = false;
+
+/* Transport state */
+static char *tx_part = NULL;
+static size_t tx_part_len = 0;
+static char *rx = NULL;
+static size_t rx_len = 0;
+
+/* What the update callback last saw */
+static unsigned num_upd_calls = 0;
+static cpdlc_msg_thr_id_t upd_thrs[MAX_UPD_THRS];
+static unsigned num_upd_thrs = 0;
+
+static void
+test_assfail(const char *filename, int line, const char *msg,
+    void *userinfo)
+{
+	UNUSED(userinfo);
+	fprintf(stderr, "Assertion failed at %s:%d: %s\n", filename, line,
+	    msg);
+	abort();
+}
+
+static uint64_t
+test_clock(void *userinfo)
+{
+	UNUSED(userinfo);
+	return (now_us);
+}
+
+static void
+advance(unsigned secs)
+{
+	now_us += secs * 1000000llu;
+}
+
+static time_t
+now(void)
+{
+	return (cpdlc_clock_time());
+}
+
+static void
+rx_append(const cpdlc_msg_t *msg)
+{
+	unsigned len = cpdlc_msg_encode(msg, NULL, 0);
+
+	rx = safe_realloc(rx, rx_len + len + 1);
+	cpdlc_msg_encode(msg, &rx[rx_len], len + 1);
+	rx_len += len;
+}
+
+/*
+ * Answers logon requests the way cpdlcd does. Anything else the client
+ * sends goes nowhere, its effect is inspected through the msglist.
+ */
+static void
+tx_line(const char *line)
+{
+	cpdlc_msg_t *msg, *resp;
+	int consumed;
+	char reason[128];
+
+	VERIFY(cpdlc_msg_decode(line, &msg, &consumed, reason,
+	    sizeof (reason)));
+	VERIFY(msg != NULL);
+	if (msg->is_logon) {
+		resp = cpdlc_msg_alloc(CPDLC_PKT_CPDLC);
+		cpdlc_msg_set_mrn(resp, cpdlc_msg_get_min(msg));
+		cpdlc_msg_set_from(resp, "ATN");
+		cpdlc_msg_set_logon_data(resp, "SUCCESS");
+		rx_append(resp);
+		cpdlc_msg_free(resp);
+	}
+	cpdlc_msg_free(msg);
+}
+
+static bool
+tp_open(void *userinfo)
+{
+	UNUSED(userinfo);
+	return (true);
+}
+
+static int
+tp_send(void *userinfo, const void *buf, size_t len)
+{
+	char *nl;
+
+	UNUSED(userinfo);
+	tx_part = safe_realloc(tx_part, tx_part_len + len + 1);
+	memcpy(&tx_part[tx_part_len], buf, len);
+	tx_part_len += len;
+	tx_part[tx_part_len] = '\0';
+	while ((nl = strchr(tx_part, '\n')) != NULL) {
+		size_t l = nl - tx_part + 1;
+		char c = tx_part[l];
+
+		tx_part[l] = '\0';
+		tx_line(tx_part);
+		tx_part[l] = c;
+		memmove(tx_part, &tx_part[l], tx_part_len - l + 1);
+		tx_part_len -= l;
+	}
+	return (len);
+}
+
+static int
+tp_recv(void *userinfo, void *buf, size_t cap)
+{
+	size_t n = MIN(cap, rx_len);
+
+	UNUSED(userinfo);
+	if (n == 0)
+		return (0);
+	memcpy(buf, rx, n);
+	memmove(rx, &rx[n], rx_len - n);
+	rx_len -= n;
+
+	return (n);
+}
+
+static void
+tp_close(void *userinfo)
+{
+	UNUSED(userinfo);
+}
+
+static const cpdlc_transport_t test_tp = {
+	.open = tp_open,
+	.send = tp_send,
+	.recv = tp_recv,
+	.close = tp_close
+};
+
+static void
+update_cb(cpdlc_msglist_t *msglist, cpdlc_msg_thr_id_t *thr_ids,
+    unsigned num_thr_ids)
+{
+	UNUSED(msglist);
+	VERIFY3U(num_thr_ids, <=, MAX_UPD_THRS);
+	memcpy(upd_thrs, thr_ids, num_thr_ids * sizeof (*thr_ids));
+	num_upd_thrs = num_thr_ids;
+	num_upd_calls++;
+}
+
+static bool
+upd_has(cpdlc_msg_thr_id_t thr_id)
+{
+	for (unsigned i = 0; i < num_upd_thrs; i++) {
+		if (upd_thrs[i] == thr_id)
+			return (true);
+	}
+	return (false);
+}
+
+/*
+ * Creates a logged on client and its msglist. An aircraft is logged on
+ * to ATC1, all other senders get rejected by the client.
+ */
+static cpdlc_msglist_t *
+setup(bool atc)
+{
+	cpdlc_client_t *cl = cpdlc_client_alloc(atc);
+	cpdlc_msglist_t *msglist;
+
+	is_atc = atc;
+	cpdlc_client_set_transport(cl, &test_tp, NULL);
+	msglist = cpdlc_msglist_alloc(cl);
+	if (atc)
+		cpdlc_client_logon(cl, "ATC", ATC_CALLSIGN, ATC_CALLSIGN);
+	else
+		cpdlc_client_logon(cl, "ACFT", ACFT_CALLSIGN, "ATC1");
+	for (int i = 0; i < 10 && cpdlc_client_get_logon_status(cl, NULL) !=
+	    CPDLC_LOGON_COMPLETE; i++)
+		cpdlc_client_poll(cl);
+	VERIFY3U(cpdlc_client_get_logon_status(cl, NULL), ==,
+	    CPDLC_LOGON_COMPLETE);
+	num_upd_calls = 0;
+	num_upd_thrs = 0;
+
+	return (msglist);
+}
+
+static void
+teardown(cpdlc_msglist_t *msglist)
+{
+	cpdlc_client_t *cl = cpdlc_msglist_get_client(msglist);
+
+	cpdlc_msglist_free(msglist);
+	cpdlc_client_free(cl);
+	free(tx_part);
+	tx_part = NULL;
+	tx_part_len = 0;
+	free(rx);
+	rx = NULL;
+	rx_len = 0;
+}
+
+/*
+ * Returns the thread holding the received message with `min' from
+ * `from', or CPDLC_NO_MSG_THR_ID if there's none.
+ */
+static cpdlc_msg_thr_id_t
+find_rx_thr(cpdlc_msglist_t *msglist, const char *from, unsigned min)
+{
+	cpdlc_msg_thr_id_t thr_ids[64];
+	unsigned n = 64;
+
+	cpdlc_msglist_get_thr_ids(msglist, false, thr_ids, &n);
+	for (unsigned i = 0; i < n; i++) {
+		unsigned num_msgs = cpdlc_msglist_get_thr_msg_count(msglist,
+		    thr_ids[i]);
+
+		for (unsigned j = 0; j < num_msgs; j++) {
+			const cpdlc_msg_t *msg;
+			bool sent;
+
+			cpdlc_msglist_get_thr_msg(msglist, thr_ids[i], j, &msg,
+			    NULL, NULL, NULL, &sent);
+			if (!sent && cpdlc_msg_get_min(msg) == min &&
+			    strcmp(cpdlc_msg_get_from(msg), from) == 0)
+				return (thr_ids[i]);
+		}
+	}
+	return (CPDLC_NO_MSG_THR_ID);
+}
+
+static void
+set_args(cpdlc_msg_t *msg, bool is_dl, int type)
+{
+	bool fl = true;
+	int alt = 350;
+
+	if ((is_dl && type == CPDLC_DM6_REQ_alt) ||
+	    (!is_dl && type == CPDLC_UM20_CLB_TO_alt))
+		cpdlc_msg_seg_set_arg(msg, 0, 0, &fl, &alt);
+	else if ((is_dl && type == CPDLC_DM67_FREETEXT_NORMAL_text) ||
+	    (!is_dl && type == CPDLC_UM169_FREETEXT_NORMAL_text))
+		cpdlc_msg_seg_set_arg(msg, 0, 0, "TEST", NULL);
+}
+
+/*
+ * Delivers a message of type `type' from `from' and returns the thread
+ * in which the msglist placed it. Only the free text and altitude
+ * request/clearance types get arguments, so other types mustn't take
+ * any.
+ */
+static cpdlc_msg_thr_id_t
+deliver(cpdlc_msglist_t *msglist, const char *from, unsigned min,
+    unsigned mrn, int type)
+{
+	cpdlc_msg_t *msg = cpdlc_msg_alloc(CPDLC_PKT_CPDLC);
+	cpdlc_msg_thr_id_t thr_id;
+
+	cpdlc_msg_set_from(msg, from);
+	cpdlc_msg_set_to(msg, is_atc ? ATC_CALLSIGN : ACFT_CALLSIGN);
+	cpdlc_msg_set_min(msg, min);
+	if (mrn != CPDLC_INVALID_MSG_SEQ_NR)
+		cpdlc_msg_set_mrn(msg, mrn);
+	cpdlc_msg_add_seg(msg, is_atc, type, 0);
+	set_args(msg, is_atc, type);
+	rx_append(msg);
+	cpdlc_msg_free(msg);
+
+	cpdlc_client_poll(cpdlc_msglist_get_client(msglist));
+	thr_id = find_rx_thr(msglist, from, min);
+	VERIFY(thr_id != CPDLC_NO_MSG_THR_ID);
+
+	return (thr_id);
+}
+
+/*
+ * Sends a message of type `type' to `to' (may be NULL) in `thr_id' or
+ * in a new thread. Returns the thread ID.
+ */
+static cpdlc_msg_thr_id_t
+send_msg(cpdlc_msglist_t *msglist, cpdlc_msg_thr_id_t thr_id, const char *to,
+    int type)
+{
+	cpdlc_msg_t *msg = cpdlc_msg_alloc(CPDLC_PKT_CPDLC);
+
+	if (to != NULL)
+		cpdlc_msg_set_to(msg, to);
+	cpdlc_msg_add_seg(msg, !is_atc, type, 0);
+	set_args(msg, !is_atc, type);
+	thr_id = cpdlc_msglist_send(msglist, msg, thr_id);
+	cpdlc_client_poll(cpdlc_msglist_get_client(msglist));
+
+	return (thr_id);
+}
+
+/*
+ * The update callback runs synchronously on the thread calling into the
+ * msglist. Updates arriving within the update interval are merged into
+ * one deduplicated notification, which a flush delivers right away.
+ */
+static void
+test_notify(void)
+{
+	cpdlc_msglist_t *msglist = setup(true);
+	cpdlc_msg_thr_id_t thr1, thr2, thr3, thr4;
+
+	cpdlc_msglist_set_update_cb(msglist, update_cb);
+	cpdlc_msglist_set_update_intval(msglist, 1000);
+
+	/* Nothing was delivered yet, so the first update goes out at once */
+	thr1 = deliver(msglist, "ACFT1", 1, CPDLC_INVALID_MSG_SEQ_NR,
+	    CPDLC_DM67_FREETEXT_NORMAL_text);
+	VERIFY3U(num_upd_calls, ==, 1);
+	VERIFY3U(num_upd_thrs, ==, 1);
+	VERIFY3U(upd_thrs[0], ==, thr1);
+
+	/* A burst within the interval is held back */
+	thr2 = deliver(msglist, "ACFT1", 2, CPDLC_INVALID_MSG_SEQ_NR,
+	    CPDLC_DM67_FREETEXT_NORMAL_text);
+	thr3 = deliver(msglist, "ACFT2", 1, CPDLC_INVALID_MSG_SEQ_NR,
+	    CPDLC_DM67_FREETEXT_NORMAL_text);
+	VERIFY3U(send_msg(msglist, thr2, NULL, CPDLC_UM3_ROGER), ==, thr2);
+	VERIFY3U(cpdlc_msglist_get_thr_status(msglist, thr2, NULL), ==,
+	    CPDLC_MSG_THR_CLOSED);
+	cpdlc_msglist_update(msglist);
+	VERIFY3U(num_upd_calls, ==, 1);
+
+	/* The flush delivers it before returning, thr2 only once */
+	cpdlc_msglist_flush_updates(msglist);
+	VERIFY3U(num_upd_calls, ==, 2);
+	VERIFY3U(num_upd_thrs, ==, 2);
+	VERIFY(upd_has(thr2));
+	VERIFY(upd_has(thr3));
+	/* Nothing left to deliver */
+	cpdlc_msglist_flush_updates(msglist);
+	VERIFY3U(num_upd_calls, ==, 2);
+
+	/* Without a flush, the update waits for the interval to elapse */
+	thr4 = deliver(msglist, "ACFT2", 2, CPDLC_INVALID_MSG_SEQ_NR,
+	    CPDLC_DM67_FREETEXT_NORMAL_text);
+	cpdlc_msglist_update(msglist);
+	VERIFY3U(num_upd_calls, ==, 2);
+	advance(1);
+	cpdlc_msglist_update(msglist);
+	VERIFY3U(num_upd_calls, ==, 3);
+	VERIFY3U(num_upd_thrs, ==, 1);
+	VERIFY3U(upd_thrs[0], ==, thr4);
+
+	teardown(msglist);
+}
+
+/*
+ * Checks that `res' holds the `n' threads of `exp' starting at `first'.
+ */
+static void
+check_results(const cpdlc_msglist_thr_info_t *res, unsigned n,
+    const cpdlc_msg_thr_id_t *exp, unsigned first)
+{
+	for (unsigned i = 0; i < n; i++)
+		VERIFY3U(res[i].thr_id, ==, exp[first + i]);
+}
+
+/*
+ * A thread whose peer is not known yet (a request sent without a
+ * recipient) gets moved to the right peer once the peer answers,
+ * slotting in by thread ID between the peer's existing threads.
+ */
+static void
+test_query_reattach(void)
+{
+	cpdlc_msglist_t *msglist = setup(false);
+	cpdlc_msglist_query_t q = { .peer = "ATC1" };
+	cpdlc_msglist_thr_info_t res[4];
+	cpdlc_msg_thr_id_t old_thr, new_thr, anon_thr, cursor;
+	const cpdlc_msg_t *msg;
+	unsigned n_matches;
+
+	old_thr = deliver(msglist, "ATC1", 1, CPDLC_INVALID_MSG_SEQ_NR,
+	    CPDLC_UM169_FREETEXT_NORMAL_text);
+	anon_thr = send_msg(msglist, CPDLC_NO_MSG_THR_ID, NULL,
+	    CPDLC_DM6_REQ_alt);
+	new_thr = deliver(msglist, "ATC1", 2, CPDLC_INVALID_MSG_SEQ_NR,
+	    CPDLC_UM169_FREETEXT_NORMAL_text);
+	VERIFY(old_thr < anon_thr && anon_thr < new_thr);
+
+	VERIFY3U(cpdlc_msglist_query(msglist, &q, NULL, res, 4, &n_matches),
+	    ==, 2);
+	VERIFY3U(n_matches, ==, 2);
+	VERIFY3U(res[0].thr_id, ==, new_thr);
+	VERIFY3U(res[1].thr_id, ==, old_thr);
+	q.peer = "";
+	VERIFY3U(cpdlc_msglist_query(msglist, &q, NULL, res, 4, &n_matches),
+	    ==, 1);
+	VERIFY3U(res[0].thr_id, ==, anon_thr);
+
+	/* ATC1 answers our request, claiming the thread */
+	cpdlc_msglist_get_thr_msg(msglist, anon_thr, 0, &msg, NULL, NULL,
+	    NULL, NULL);
+	VERIFY3U(deliver(msglist, "ATC1", 3, cpdlc_msg_get_min(msg),
+	    CPDLC_UM20_CLB_TO_alt), ==, anon_thr);
+	VERIFY0(cpdlc_msglist_query(msglist, &q, NULL, res, 4, &n_matches));
+	VERIFY0(n_matches);
+	q.peer = "ATC1";
+	VERIFY3U(cpdlc_msglist_query(msglist, &q, NULL, res, 4, &n_matches),
+	    ==, 3);
+	VERIFY3U(n_matches, ==, 3);
+	VERIFY3U(res[0].thr_id, ==, new_thr);
+	VERIFY3U(res[1].thr_id, ==, anon_thr);
+	VERIFY3U(res[2].thr_id, ==, old_thr);
+	VERIFY0(strcmp(res[1].peer, "ATC1"));
+	VERIFY3U(res[1].num_msgs, ==, 2);
+
+	/* Paging through the peer's threads one at a time */
+	cursor = CPDLC_NO_MSG_THR_ID;
+	for (unsigned i = 0; i < 3; i++) {
+		VERIFY3U(cpdlc_msglist_query(msglist, &q, &cursor, res, 1,
+		    NULL), ==, 1);
+		VERIFY3U(cursor, ==, (i == 0 ? new_thr : i == 1 ? anon_thr :
+		    old_thr));
+	}
+	VERIFY0(cpdlc_msglist_query(msglist, &q, &cursor, res, 1, NULL));
+	VERIFY3U(cursor, ==, old_thr);
+
+	teardown(msglist);
+}
+
+/*
+ * Pages through more threads than fit in one result buffer, using the
+ * cursor, the offset or both, and narrows the results down using each
+ * of the filters.
+ */
+static void
+test_query(void)
+{
+	cpdlc_msglist_t *msglist = setup(true);
+	cpdlc_msglist_query_t q = { 0 };
+	cpdlc_msglist_thr_info_t res[10];
+	/* Newest first, as the query returns them */
+	cpdlc_msg_thr_id_t thrs[NUM_QUERY_THRS], cursor;
+	time_t t0 = now();
+	unsigned n, n_matches;
+	char peer[16];
+
+	/* Thread `i' comes from ACFT(i % 3 + 1) at t0 + 10 * i */
+	for (unsigned i = 0; i < NUM_QUERY_THRS; i++) {
+		snprintf(peer, sizeof (peer), "ACFT%u", i % 3 + 1);
+		thrs[NUM_QUERY_THRS - i - 1] = deliver(msglist, peer,
+		    i / 3 + 1, CPDLC_INVALID_MSG_SEQ_NR,
+		    CPDLC_DM67_FREETEXT_NORMAL_text);
+		advance(10);
+	}
+	for (unsigned i = 1; i < NUM_QUERY_THRS; i++)
+		VERIFY(thrs[i - 1] > thrs[i]);
+
+	/* Cursor paging: 10 + 10 + 4, the total doesn't change */
+	cursor = CPDLC_NO_MSG_THR_ID;
+	for (unsigned first = 0; first < NUM_QUERY_THRS; first += 10) {
+		unsigned exp_n = MIN(NUM_QUERY_THRS - first, 10);
+
+		n = cpdlc_msglist_query(msglist, &q, &cursor, res, 10,
+		    &n_matches);
+		VERIFY3U(n, ==, exp_n);
+		VERIFY3U(n_matches, ==, NUM_QUERY_THRS);
+		check_results(res, n, thrs, first);
+		VERIFY3U(cursor, ==, thrs[first + n - 1]);
+		VERIFY3U(res[0].last_time, ==, t0 + 10 *
+		    (NUM_QUERY_THRS - first - 1));
+	}
+	VERIFY0(cpdlc_msglist_query(msglist, &q, &cursor, res, 10,
+	    &n_matches));
+	VERIFY3U(n_matches, ==, NUM_QUERY_THRS);
+
+	/* Offset only */
+	q.offset = 20;
+	VERIFY3U(cpdlc_msglist_query(msglist, &q, NULL, res, 10, NULL), ==,
+	    4);
+	check_results(res, 4, thrs, 20);
+	/* Offset applies after the cursor */
+	q.offset = 5;
+	cursor = thrs[9];
+	VERIFY3U(cpdlc_msglist_query(msglist, &q, &cursor, res, 10,
+	    &n_matches), ==, 9);
+	VERIFY3U(n_matches, ==, NUM_QUERY_THRS);
+	check_results(res, 9, thrs, 15);
+	VERIFY3U(cursor, ==, thrs[23]);
+	q.offset = 0;
+
+	/* Per peer: ACFT2 sent threads 1, 4, ..., 22 */
+	q.peer = "ACFT2";
+	cursor = CPDLC_NO_MSG_THR_ID;
+	VERIFY3U(cpdlc_msglist_query(msglist, &q, &cursor, res, 5,
+	    &n_matches), ==, 5);
+	VERIFY3U(n_matches, ==, 8);
+	for (unsigned i = 0; i < 5; i++) {
+		VERIFY3U(res[i].thr_id, ==, thrs[NUM_QUERY_THRS - 23 + 3 * i]);
+		VERIFY0(strcmp(res[i].peer, "ACFT2"));
+	}
+	q.offset = 1;
+	VERIFY3U(cpdlc_msglist_query(msglist, &q, &cursor, res, 5,
+	    &n_matches), ==, 2);
+	VERIFY3U(n_matches, ==, 8);
+	VERIFY3U(res[0].thr_id, ==, thrs[NUM_QUERY_THRS - 23 + 3 * 6]);
+	VERIFY3U(res[1].thr_id, ==, thrs[NUM_QUERY_THRS - 23 + 3 * 7]);
+	q.offset = 0;
+	q.peer = "ACFT9";
+	VERIFY0(cpdlc_msglist_query(msglist, &q, NULL, res, 10, &n_matches));
+	VERIFY0(n_matches);
+	q.peer = NULL;
+
+	/* Dirty filter, after reading the five newest threads */
+	for (unsigned i = 0; i < 5; i++)
+		cpdlc_msglist_thr_mark_seen(msglist, thrs[i]);
+	q.dirty = CPDLC_MSGLIST_DIRTY_NONE;
+	VERIFY3U(cpdlc_msglist_query(msglist, &q, NULL, res, 10, &n_matches),
+	    ==, 5);
+	VERIFY3U(n_matches, ==, 5);
+	check_results(res, 5, thrs, 0);
+	q.dirty = CPDLC_MSGLIST_DIRTY_ONLY;
+	VERIFY3U(cpdlc_msglist_query(msglist, &q, NULL, res, 10, &n_matches),
+	    ==, 10);
+	VERIFY3U(n_matches, ==, NUM_QUERY_THRS - 5);
+	check_results(res, 10, thrs, 5);
+	q.dirty = CPDLC_MSGLIST_DIRTY_ANY;
+
+	/* Time filters, the limits are inclusive */
+	q.time_min = t0 + 10 * 20;
+	VERIFY3U(cpdlc_msglist_query(msglist, &q, NULL, res, 10, &n_matches),
+	    ==, 4);
+	check_results(res, 4, thrs, 0);
+	q.time_min = 0;
+	q.time_max = t0 + 10 * 3;
+	VERIFY3U(cpdlc_msglist_query(msglist, &q, NULL, res, 10, &n_matches),
+	    ==, 4);
+	check_results(res, 4, thrs, NUM_QUERY_THRS - 4);
+	q.time_min = t0 + 10 * 5;
+	q.time_max = t0 + 10 * 10;
+	VERIFY3U(cpdlc_msglist_query(msglist, &q, NULL, res, 10, &n_matches),
+	    ==, 6);
+	VERIFY3U(n_matches, ==, 6);
+	check_results(res, 6, thrs, NUM_QUERY_THRS - 11);
+	/* ...combined with the peer: threads 6 and 9 */
+	q.peer = "ACFT1";
+	VERIFY3U(cpdlc_msglist_query(msglist, &q, NULL, res, 10, &n_matches),
+	    ==, 2);
+	VERIFY3U(n_matches, ==, 2);
+	VERIFY3U(res[0].thr_id, ==, thrs[NUM_QUERY_THRS - 10]);
+	VERIFY3U(res[1].thr_id, ==, thrs[NUM_QUERY_THRS - 7]);
+	/* ...and the dirty filter, which all of these still are */
+	q.dirty = CPDLC_MSGLIST_DIRTY_NONE;
+	VERIFY0(cpdlc_msglist_query(msglist, &q, NULL, res, 10, &n_matches));
+	VERIFY0(n_matches);
+	memset(&q, 0, sizeof (q));
+
+	/* Status filter: close the oldest thread */
+	send_msg(msglist, thrs[NUM_QUERY_THRS - 1], NULL, CPDLC_UM3_ROGER);
+	q.status_mask = CPDLC_MSG_THR_STATUS_BIT(CPDLC_MSG_THR_CLOSED);
+	VERIFY3U(cpdlc_msglist_query(msglist, &q, NULL, res, 10, &n_matches),
+	    ==, 1);
+	VERIFY3U(n_matches, ==, 1);
+	VERIFY3U(res[0].thr_id, ==, thrs[NUM_QUERY_THRS - 1]);
+	VERIFY3U(res[0].num_msgs, ==, 2);
+	q.status_mask = CPDLC_MSG_THR_STATUS_BIT(CPDLC_MSG_THR_OPEN);
+	VERIFY3U(cpdlc_msglist_query(msglist, &q, NULL, res, 10, &n_matches),
+	    ==, 10);
+	VERIFY3U(n_matches, ==, NUM_QUERY_THRS - 1);
+
+	teardown(msglist);
+}
+
+static void
+check_peer(cpdlc_msglist_t *msglist, const char *peer, unsigned num_thrs,
+    unsigned num_open, unsigned num_pending, time_t oldest_pending)
+{
+	cpdlc_msglist_peer_summary_t sum;
+
+	VERIFY(cpdlc_msglist_get_peer_summary(msglist, peer, &sum));
+	VERIFY0(strcmp(sum.peer, peer));
+	VERIFY3U(sum.num_thrs, ==, num_thrs);
+	VERIFY3U(sum.num_open, ==, num_open);
+	VERIFY3U(sum.num_pending, ==, num_pending);
+	VERIFY3S(sum.oldest_pending, ==, oldest_pending);
+}
+
+static unsigned
+thr_min(cpdlc_msglist_t *msglist, cpdlc_msg_thr_id_t thr_id, unsigned nr)
+{
+	const cpdlc_msg_t *msg;
+
+	cpdlc_msglist_get_thr_msg(msglist, thr_id, nr, &msg, NULL, NULL,
+	    NULL, NULL);
+	return (cpdlc_msg_get_min(msg));
+}
+
+/*
+ * MIN/MRN matching only considers the sender's own threads, and the
+ * per-peer pending counts follow requests as they get answered, stood
+ * by or closed. Peers with pending requests are listed oldest first.
+ */
+static void
+test_peers(void)
+{
+	cpdlc_msglist_t *msglist = setup(true);
+	cpdlc_msglist_peer_summary_t sums[4];
+	cpdlc_msg_thr_id_t thr1, thr2, thr3, thr4;
+	time_t t0 = now();
+	unsigned n, min;
+
+	/* Both aircraft number their messages from 1 */
+	thr1 = deliver(msglist, "ACFT1", 1, CPDLC_INVALID_MSG_SEQ_NR,
+	    CPDLC_DM6_REQ_alt);
+	advance(5);
+	thr2 = deliver(msglist, "ACFT2", 1, CPDLC_INVALID_MSG_SEQ_NR,
+	    CPDLC_DM6_REQ_alt);
+	advance(5);
+	thr3 = deliver(msglist, "ACFT1", 2, CPDLC_INVALID_MSG_SEQ_NR,
+	    CPDLC_DM6_REQ_alt);
+	advance(5);
+	check_peer(msglist, "ACFT1", 2, 2, 2, t0);
+	check_peer(msglist, "ACFT2", 1, 1, 1, t0 + 5);
+	VERIFY3U(cpdlc_msglist_get_peers(msglist, true, sums, 4, &n), ==, 2);
+	VERIFY3U(n, ==, 2);
+	VERIFY0(strcmp(sums[0].peer, "ACFT1"));
+	VERIFY0(strcmp(sums[1].peer, "ACFT2"));
+	/* Limited space still reports the full count */
+	VERIFY3U(cpdlc_msglist_get_peers(msglist, false, sums, 1, &n), ==, 1);
+	VERIFY3U(n, ==, 2);
+	VERIFY0(strcmp(sums[0].peer, "ACFT1"));
+
+	/* Answering ACFT1's oldest request makes ACFT2 the oldest peer */
+	send_msg(msglist, thr1, NULL, CPDLC_UM20_CLB_TO_alt);
+	check_peer(msglist, "ACFT1", 2, 2, 1, t0 + 10);
+	VERIFY3U(cpdlc_msglist_get_peers(msglist, true, sums, 4, &n), ==, 2);
+	VERIFY0(strcmp(sums[0].peer, "ACFT2"));
+	VERIFY0(strcmp(sums[1].peer, "ACFT1"));
+
+	/* ACFT2 referring to our MIN in ACFT1's thread starts a new one */
+	min = thr_min(msglist, thr1, 1);
+	thr4 = deliver(msglist, "ACFT2", 2, min, CPDLC_DM0_WILCO);
+	VERIFY(thr4 != thr1 && thr4 != thr2);
+	VERIFY3U(cpdlc_msglist_get_thr_msg_count(msglist, thr1), ==, 2);
+	check_peer(msglist, "ACFT2", 2, 1, 1, t0 + 5);
+	/* While ACFT1 lands in the right thread */
+	VERIFY3U(deliver(msglist, "ACFT1", 3, min, CPDLC_DM0_WILCO), ==,
+	    thr1);
+	VERIFY3U(cpdlc_msglist_get_thr_status(msglist, thr1, NULL), ==,
+	    CPDLC_MSG_THR_ACCEPTED);
+	check_peer(msglist, "ACFT1", 2, 1, 1, t0 + 10);
+
+	/* A STANDBY doesn't answer the request */
+	send_msg(msglist, thr2, NULL, CPDLC_UM1_STANDBY);
+	check_peer(msglist, "ACFT2", 2, 1, 1, t0 + 5);
+
+	/* Closing ACFT1's last pending thread drops it from the list */
+	cpdlc_msglist_thr_close(msglist, thr3);
+	check_peer(msglist, "ACFT1", 2, 0, 0, 0);
+	VERIFY3U(cpdlc_msglist_get_peers(msglist, true, sums, 4, &n), ==, 1);
+	VERIFY3U(n, ==, 1);
+	VERIFY0(strcmp(sums[0].peer, "ACFT2"));
+
+	/* Removing threads drops the peer once it has none left */
+	cpdlc_msglist_remove_thr(msglist, thr1);
+	cpdlc_msglist_remove_thr(msglist, thr3);
+	VERIFY(!cpdlc_msglist_get_peer_summary(msglist, "ACFT1", &sums[0]));
+	VERIFY3U(cpdlc_msglist_get_peers(msglist, false, sums, 4, &n), ==, 1);
+	VERIFY0(strcmp(sums[0].peer, "ACFT2"));
+
+	teardown(msglist);
+}
+
+/*
+ * A request sent without a recipient sits with the unknown peer. Once
+ * the peer answers with a request of its own, the thread moves over and
+ * is pending there, behind the peer's older pending threads.
+ */
+static void
+test_peers_reattach(void)
+{
+	cpdlc_msglist_t *msglist = setup(false);
+	cpdlc_msglist_peer_summary_t sums[4];
+	cpdlc_msg_thr_id_t thr1, anon_thr;
+	time_t t0 = now();
+	unsigned n;
+
+	thr1 = deliver(msglist, "ATC1", 1, CPDLC_INVALID_MSG_SEQ_NR,
+	    CPDLC_UM20_CLB_TO_alt);
+	advance(5);
+	anon_thr = send_msg(msglist, CPDLC_NO_MSG_THR_ID, NULL,
+	    CPDLC_DM6_REQ_alt);
+	check_peer(msglist, "", 1, 1, 0, 0);
+	check_peer(msglist, "ATC1", 1, 1, 1, t0);
+	advance(5);
+
+	VERIFY3U(deliver(msglist, "ATC1", 2, thr_min(msglist, anon_thr, 0),
+	    CPDLC_UM20_CLB_TO_alt), ==, anon_thr);
+	VERIFY(!cpdlc_msglist_get_peer_summary(msglist, "", &sums[0]));
+	check_peer(msglist, "ATC1", 2, 2, 2, t0);
+
+	/* Answering the older one leaves the re-attached thread */
+	send_msg(msglist, thr1, NULL, CPDLC_DM0_WILCO);
+	check_peer(msglist, "ATC1", 2, 1, 1, t0 + 10);
+	cpdlc_msglist_thr_close(msglist, anon_thr);
+	check_peer(msglist, "ATC1", 2, 0, 0, 0);
+	VERIFY0(cpdlc_msglist_get_peers(msglist, true, sums, 4, &n));
+	VERIFY0(n);
+
+	teardown(msglist);
+}
+
+/*
+ * Checks a histogram's totals. `bins' lists the expected non-zero bins
+ * as pairs of bin number and count, terminated by -1.
+ */
+static void
+check_hist(const cpdlc_msglist_hist_t *hist, uint64_t count, uint64_t sum,
+    unsigned min, unsigned max, const int *bins)
+{
+	uint64_t exp_bins[CPDLC_MSGLIST_HIST_BINS] = { 0 };
+
+	VERIFY3U(hist->count, ==, count);
+	VERIFY3U(hist->sum, ==, sum);
+	VERIFY3U(hist->min, ==, min);
+	VERIFY3U(hist->max, ==, max);
+	for (; bins[0] != -1; bins += 2) {
+		VERIFY3S(bins[0], <, CPDLC_MSGLIST_HIST_BINS);
+		exp_bins[bins[0]] = bins[1];
+	}
+	for (int i = 0; i < CPDLC_MSGLIST_HIST_BINS; i++)
+		VERIFY3U(hist->bins[i], ==, exp_bins[i]);
+}
+
+/*
+ * Response time statistics for a known sequence of exchanges. Bin 0
+ * holds durations under 1s and bin `i' those in [2^(i-1), 2^i) seconds,
+ * so 8s and 10s go into bin 4 and 39s and 40s into bin 6.
+ */
+static void
+test_stats(void)
+{
+	cpdlc_msglist_t *msglist = setup(false);
+	cpdlc_msglist_stats_t stats;
+	cpdlc_msg_thr_id_t thr1, thr2, thr3, thr4;
+	cpdlc_msglist_stats_t zero = { 0 };
+	unsigned min;
+
+	cpdlc_msglist_get_stats(msglist, &stats);
+	VERIFY0(memcmp(&stats, &zero, sizeof (stats)));
+
+	/* Clearance, STANDBY after 2s, WILCO after 10s */
+	thr1 = deliver(msglist, "ATC1", 1, CPDLC_INVALID_MSG_SEQ_NR,
+	    CPDLC_UM20_CLB_TO_alt);
+	advance(2);
+	send_msg(msglist, thr1, NULL, CPDLC_DM2_STANDBY);
+	advance(8);
+	send_msg(msglist, thr1, NULL, CPDLC_DM0_WILCO);
+
+	/*
+	 * Our request, STANDBY after 1s and the clearance after 40s, which
+	 * we accept right away.
+	 */
+	thr2 = send_msg(msglist, CPDLC_NO_MSG_THR_ID, "ATC1",
+	    CPDLC_DM6_REQ_alt);
+	min = thr_min(msglist, thr2, 0);
+	advance(1);
+	VERIFY3U(deliver(msglist, "ATC1", 2, min, CPDLC_UM1_STANDBY), ==,
+	    thr2);
+	advance(39);
+	VERIFY3U(deliver(msglist, "ATC1", 3, min, CPDLC_UM20_CLB_TO_alt), ==,
+	    thr2);
+	send_msg(msglist, thr2, NULL, CPDLC_DM0_WILCO);
+
+	cpdlc_msglist_get_stats(msglist, &stats);
+	check_hist(&stats.rx_resp, 2, 10, 0, 10,
+	    (int[]){ 0, 1, 4, 1, -1 });
+	check_hist(&stats.tx_resp, 1, 40, 40, 40, (int[]){ 6, 1, -1 });
+	check_hist(&stats.stby, 2, 47, 8, 39, (int[]){ 4, 1, 6, 1, -1 });
+	VERIFY0(stats.num_timeouts);
+
+	/*
+	 * A clearance we never answer times out and isn't counted as a
+	 * response. One we put on STANDBY doesn't time out, and long waits
+	 * end up in the last bin.
+	 */
+	thr3 = deliver(msglist, "ATC1", 4, CPDLC_INVALID_MSG_SEQ_NR,
+	    CPDLC_UM20_CLB_TO_alt);
+	thr4 = deliver(msglist, "ATC1", 5, CPDLC_INVALID_MSG_SEQ_NR,
+	    CPDLC_UM20_CLB_TO_alt);
+	send_msg(msglist, thr4, NULL, CPDLC_DM2_STANDBY);
+	advance(101);
+	cpdlc_msglist_update(msglist);
+	VERIFY3U(cpdlc_msglist_get_thr_status(msglist, thr3, NULL), ==,
+	    CPDLC_MSG_THR_TIMEDOUT);
+	VERIFY3U(cpdlc_msglist_get_thr_status(msglist, thr4, NULL), ==,
+	    CPDLC_MSG_THR_STANDBY);
+	advance(3000);
+	send_msg(msglist, thr4, NULL, CPDLC_DM0_WILCO);
+
+	cpdlc_msglist_get_stats(msglist, &stats);
+	check_hist(&stats.rx_resp, 3, 3111, 0, 3101,
+	    (int[]){ 0, 1, 4, 1, 11, 1, -1 });
+	check_hist(&stats.tx_resp, 1, 40, 40, 40, (int[]){ 6, 1, -1 });
+	check_hist(&stats.stby, 3, 3148, 8, 3101,
+	    (int[]){ 4, 1, 6, 1, 11, 1, -1 });
+	VERIFY3U(stats.num_timeouts, ==, 1);
+
+	cpdlc_msglist_reset_stats(msglist);
+	cpdlc_msglist_get_stats(msglist, &stats);
+	VERIFY0(memcmp(&stats, &zero, sizeof (stats)));
+
+	teardown(msglist);
+}
+
+int
+main(void)
+{
+	cpdlc_assfail = test_assfail;
+	/* Must be in place before any client or msglist is created */
+	cpdlc_clock_set_func(test_clock, NULL);
+
+	test_notify();
+	test_query();
+	test_query_reattach();
+	test_peers();
+	test_peers_reattach();
+	test_stats();
+
+	cpdlc_clock_set_func(NULL, NULL);
+	printf("msglist_test: all tests passed\n");
+
+	return (0);
+}
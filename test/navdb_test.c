@@ -0,0 +1,251 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Test of the prebuilt navdb index. A small source file is built into
+ * an index with fans_navdb_build (the same path the `mknavdb' tool
+ * takes), which is then opened and queried for hits and misses. We
+ * also damage copies of the index by hand to check that records with
+ * an invalid type or out of sort order get the file rejected at open,
+ * and feed the builder bad source files.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/cpdlc_assert.h"
+#include "../fans/fans_navdb.h"
+
+#define	SRC_PATH	"navdb_test.txt"
+#define	DB_PATH		"navdb_test.navdb"
+#define	BAD_DB_PATH	"navdb_test_bad.navdb"
+/* On-disk layout, see navdb_hdr_t and navdb_rec_t in fans_navdb.c */
+#define	HDR_SZ		16
+#define	REC_SZ		20
+#define	REC_TYPE_OFF	FANS_NAVDB_IDENT_LEN
+#define	NUM_ENTS	7
+#define	MAX_LINE_LEN	256	/* source line buffer in fans_navdb.c */
+
+static const char *src_text =
+    "# Test navdb\n"
+    "ARPT\tKBOS\t42.3629444\t-71.0063889\n"
+    "arpt\tegll\t51.4775\t-0.4613889   # lowercase is accepted\n"
+    "\n"
+    "NAVAID\tBOS\t42.3573333\t-70.9896389\n"
+    "FIX\tALPHA\t40.0\t-74.0\n"
+    "FIX\tALPHA\t51.0\t-1.0\n"
+    "FIX\tALPHA\t51.0\t-1.0\n"
+    "FIX\tALPHA\t-33.9\t151.2\n"
+    "FIX\tBOS\t42.0\t-70.0\n";
+
+static void
+test_assfail(const char *filename, int line, const char *msg,
+    void *userinfo)
+{
+	UNUSED(userinfo);
+	fprintf(stderr, "Assertion failed at %s:%d: %s\n", filename, line,
+	    msg);
+	abort();
+}
+
+static void
+write_file(const char *path, const void *buf, size_t len)
+{
+	FILE *fp = fopen(path, "wb");
+
+	VERIFY(fp != NULL);
+	VERIFY3U(fwrite(buf, 1, len, fp), ==, len);
+	VERIFY0(fclose(fp));
+}
+
+static uint8_t *
+read_file(const char *path, size_t *len)
+{
+	FILE *fp = fopen(path, "rb");
+	uint8_t *buf;
+	long sz;
+
+	VERIFY(fp != NULL);
+	VERIFY0(fseek(fp, 0, SEEK_END));
+	sz = ftell(fp);
+	VERIFY3S(sz, >, 0);
+	VERIFY0(fseek(fp, 0, SEEK_SET));
+	buf = malloc(sz);
+	VERIFY3U(fread(buf, 1, sz, fp), ==, (size_t)sz);
+	fclose(fp);
+	*len = sz;
+
+	return (buf);
+}
+
+static void
+check_lookups(const fans_navdb_t *db)
+{
+	fans_navdb_ent_t ents[4];
+	fans_navdb_ent_t ent;
+
+	VERIFY3U(fans_navdb_get_num_ents(db), ==, NUM_ENTS);
+
+	/* Hits, including case folding done at build time */
+	VERIFY3U(fans_navdb_lookup(db, "KBOS", FANS_NAVDB_ARPT, ents, 4),
+	    ==, 1);
+	VERIFY0(strcmp(ents[0].ident, "KBOS"));
+	VERIFY3U(ents[0].type, ==, FANS_NAVDB_ARPT);
+	VERIFY(ents[0].lat > 42.3629 && ents[0].lat < 42.3630);
+	VERIFY(ents[0].lon > -71.0064 && ents[0].lon < -71.0063);
+	VERIFY3U(fans_navdb_lookup(db, "EGLL", FANS_NAVDB_ARPT, ents, 4),
+	    ==, 1);
+	/* Same identifier, different types */
+	VERIFY3U(fans_navdb_lookup(db, "BOS", FANS_NAVDB_NAVAID, ents, 4),
+	    ==, 1);
+	VERIFY3U(ents[0].type, ==, FANS_NAVDB_NAVAID);
+	VERIFY3U(fans_navdb_lookup(db, "BOS", FANS_NAVDB_FIX, ents, 4),
+	    ==, 1);
+	VERIFY3U(ents[0].type, ==, FANS_NAVDB_FIX);
+	/* Duplicate identifiers, exact duplicate entry dropped */
+	VERIFY3U(fans_navdb_lookup(db, "ALPHA", FANS_NAVDB_FIX, ents, 4),
+	    ==, 3);
+	VERIFY3U(fans_navdb_lookup(db, "ALPHA", FANS_NAVDB_FIX, ents, 1),
+	    ==, 3);
+	VERIFY3U(fans_navdb_lookup(db, "ALPHA", FANS_NAVDB_FIX, NULL, 0),
+	    ==, 3);
+
+	/* Misses */
+	VERIFY0(fans_navdb_lookup(db, "KJFK", FANS_NAVDB_ARPT, ents, 4));
+	VERIFY0(fans_navdb_lookup(db, "KBOS", FANS_NAVDB_FIX, ents, 4));
+	VERIFY0(fans_navdb_lookup(db, "ALPH", FANS_NAVDB_FIX, ents, 4));
+	VERIFY0(fans_navdb_lookup(db, "ALPHAA", FANS_NAVDB_FIX, ents, 4));
+	VERIFY0(fans_navdb_lookup(db, "AAAA", FANS_NAVDB_FIX, ents, 4));
+	VERIFY0(fans_navdb_lookup(db, "ZZZZ", FANS_NAVDB_FIX, ents, 4));
+	VERIFY0(fans_navdb_lookup(db, "kbos", FANS_NAVDB_ARPT, ents, 4));
+	VERIFY0(fans_navdb_lookup(db, "TOOLONGID", FANS_NAVDB_FIX, ents,
+	    4));
+	VERIFY(!fans_navdb_lookup_nearest(db, "KJFK", FANS_NAVDB_ARPT,
+	    0, 0, &ent));
+
+	/* Nearest match among duplicates, incl. across the antimeridian */
+	VERIFY(fans_navdb_lookup_nearest(db, "ALPHA", FANS_NAVDB_FIX,
+	    50, 0, &ent));
+	VERIFY(ent.lat == 51.0 && ent.lon == -1.0);
+	VERIFY(fans_navdb_lookup_nearest(db, "ALPHA", FANS_NAVDB_FIX,
+	    41, -73, &ent));
+	VERIFY(ent.lat == 40.0 && ent.lon == -74.0);
+	VERIFY(fans_navdb_lookup_nearest(db, "ALPHA", FANS_NAVDB_FIX,
+	    -30, -179, &ent));
+	VERIFY(ent.lat == -33.9 && ent.lon == 151.2);
+}
+
+/*
+ * Writes a copy of the index with `n' bytes at `off' replaced by
+ * `patch' and checks that fans_navdb_open refuses it.
+ */
+static void
+check_rejected(const uint8_t *db_buf, size_t len, size_t off,
+    const void *patch, size_t n)
+{
+	uint8_t *buf = malloc(len);
+
+	VERIFY3U(off + n, <=, len);
+	memcpy(buf, db_buf, len);
+	memcpy(&buf[off], patch, n);
+	write_file(BAD_DB_PATH, buf, len);
+	VERIFY3P(fans_navdb_open(BAD_DB_PATH), ==, NULL);
+	free(buf);
+}
+
+int
+main(void)
+{
+	fans_navdb_t *db;
+	uint8_t *db_buf;
+	uint8_t rec[REC_SZ];
+	uint8_t bad_type = FANS_NAVDB_NUM_TYPES;
+	char long_line[300];
+	const char *fix_line = "FIX\tBOS\t1\t1";
+	size_t len;
+	unsigned num_ents;
+
+	cpdlc_assfail = test_assfail;
+
+	write_file(SRC_PATH, src_text, strlen(src_text));
+	VERIFY(fans_navdb_build(SRC_PATH, DB_PATH, &num_ents));
+	VERIFY3U(num_ents, ==, NUM_ENTS);
+
+	db = fans_navdb_open(DB_PATH);
+	VERIFY(db != NULL);
+	check_lookups(db);
+	fans_navdb_close(db);
+
+	db_buf = read_file(DB_PATH, &len);
+	VERIFY3U(len, ==, HDR_SZ + NUM_ENTS * REC_SZ);
+	/* Intact copy must still open */
+	write_file(BAD_DB_PATH, db_buf, len);
+	db = fans_navdb_open(BAD_DB_PATH);
+	VERIFY(db != NULL);
+	check_lookups(db);
+	fans_navdb_close(db);
+	/* Invalid type in the first, a middle and the last record */
+	check_rejected(db_buf, len, HDR_SZ + REC_TYPE_OFF, &bad_type, 1);
+	check_rejected(db_buf, len, HDR_SZ + 3 * REC_SZ + REC_TYPE_OFF,
+	    &bad_type, 1);
+	check_rejected(db_buf, len, HDR_SZ + (NUM_ENTS - 1) * REC_SZ +
+	    REC_TYPE_OFF, &bad_type, 1);
+	/* Last record moved to the front breaks the sort order */
+	memcpy(rec, &db_buf[HDR_SZ + (NUM_ENTS - 1) * REC_SZ], REC_SZ);
+	check_rejected(db_buf, len, HDR_SZ, rec, REC_SZ);
+	/* Truncated file */
+	write_file(BAD_DB_PATH, db_buf, len - 1);
+	VERIFY3P(fans_navdb_open(BAD_DB_PATH), ==, NULL);
+	/* Bad source entries are refused at build time */
+	write_file(SRC_PATH, "FIX\tALPHA\t91\t0\n", 15);
+	VERIFY(!fans_navdb_build(SRC_PATH, DB_PATH, NULL));
+	write_file(SRC_PATH, "VOR\tBOS\t42\t-71\n", 15);
+	VERIFY(!fans_navdb_build(SRC_PATH, DB_PATH, NULL));
+	/*
+	 * Overlong lines are refused. Here the builder's line buffer
+	 * ends right before what looks like an entry, which mustn't be
+	 * parsed as one.
+	 */
+	memset(long_line, 'X', sizeof (long_line));
+	memcpy(long_line, "# ", 2);
+	strcpy(&long_line[MAX_LINE_LEN - 1], fix_line);
+	strcat(long_line, "\n");
+	write_file(SRC_PATH, long_line, strlen(long_line));
+	VERIFY(!fans_navdb_build(SRC_PATH, DB_PATH, NULL));
+	/* The last line doesn't need a newline */
+	write_file(SRC_PATH, fix_line, strlen(fix_line));
+	VERIFY(fans_navdb_build(SRC_PATH, DB_PATH, &num_ents));
+	VERIFY3U(num_ents, ==, 1);
+
+	free(db_buf);
+	remove(SRC_PATH);
+	remove(DB_PATH);
+	remove(BAD_DB_PATH);
+	printf("navdb_test: all tests passed\n");
+
+	return (0);
+}
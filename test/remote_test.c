@@ -0,0 +1,287 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Round-trip test of the FANS remote display frame format. A headless
+ * FANS box (not connected to any server) is driven through a few pages
+ * and every keyframe and diff it exports is applied to a mirror screen
+ * using fans_import_frame, which must then match the box's screen. We
+ * also check that diffs against the wrong base generation, truncated
+ * frames and malformed frames are rejected without touching the mirror.
+ * Frames are always passed in exactly-sized heap buffers, so that any
+ * read past the end of a frame shows up when built with ASan.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/cpdlc_assert.h"
+#include "../fans/fans.h"
+#include "../fans/fans_remote.h"
+
+#define	NUM_CORRUPT_ROUNDS	20000
+#define	RUN_HDR_SZ		3
+#define	CELL_SZ			2
+
+typedef struct {
+	fms_char_t	scr[FMS_ROWS][FMS_COLS];
+	uint64_t	gen;
+} mirror_t;
+
+static void
+test_assfail(const char *filename, int line, const char *msg,
+    void *userinfo)
+{
+	UNUSED(userinfo);
+	fprintf(stderr, "Assertion failed at %s:%d: %s\n", filename, line,
+	    msg);
+	abort();
+}
+
+static bool
+mirror_matches(const fans_t *box, const mirror_t *m)
+{
+	for (unsigned row = 0; row < FMS_ROWS; row++) {
+		const fms_char_t *chars = fans_get_screen_row(box, row);
+
+		for (unsigned col = 0; col < FMS_COLS; col++) {
+			if (chars[col].c != m->scr[row][col].c ||
+			    chars[col].color != m->scr[row][col].color ||
+			    chars[col].size != m->scr[row][col].size)
+				return (false);
+		}
+	}
+	return (m->gen == fans_get_gen(box));
+}
+
+static bool
+mirror_equal(const mirror_t *a, const mirror_t *b)
+{
+	for (unsigned row = 0; row < FMS_ROWS; row++) {
+		for (unsigned col = 0; col < FMS_COLS; col++) {
+			if (a->scr[row][col].c != b->scr[row][col].c ||
+			    a->scr[row][col].color != b->scr[row][col].color ||
+			    a->scr[row][col].size != b->scr[row][col].size)
+				return (false);
+		}
+	}
+	return (a->gen == b->gen);
+}
+
+/*
+ * Imports a frame from an exactly-sized copy of `frame'. If the import
+ * doesn't succeed, verifies that the mirror was left untouched.
+ */
+static int
+import(mirror_t *m, const uint8_t *frame, size_t len)
+{
+	uint8_t *buf = malloc(len > 0 ? len : 1);
+	mirror_t saved = *m;
+	int res;
+
+	memcpy(buf, frame, len);
+	res = fans_import_frame(m->scr, &m->gen, buf, len);
+	free(buf);
+	VERIFY(res >= -1 && res <= (int)len);
+	if (res <= 0)
+		VERIFY(mirror_equal(m, &saved));
+
+	return (res);
+}
+
+static void
+check_truncated(mirror_t *m, const uint8_t *frame, size_t len)
+{
+	for (size_t l = 0; l < len; l++)
+		VERIFY0(import(m, frame, l));
+}
+
+static size_t
+export_diff(const fans_t *box, uint64_t since_gen, uint8_t *frame)
+{
+	return (fans_export_diff(box, since_gen, frame, FANS_FRAME_MAX_SZ));
+}
+
+/*
+ * Exports the changes since the mirror's generation, checks truncated
+ * variants of the diff and applies it.
+ */
+static void
+sync_diff(const fans_t *box, mirror_t *m)
+{
+	uint8_t frame[FANS_FRAME_MAX_SZ];
+	size_t len = export_diff(box, m->gen, frame);
+
+	VERIFY(len != 0);
+	VERIFY3U(len, <, FANS_FRAME_MAX_SZ);
+	check_truncated(m, frame, len);
+	VERIFY3S(import(m, frame, len), ==, len);
+	VERIFY(mirror_matches(box, m));
+	VERIFY0(export_diff(box, m->gen, frame));
+}
+
+static void
+check_malformed(mirror_t *m, const uint8_t *frame, size_t len)
+{
+	uint8_t *bad = malloc(len);
+	unsigned payload_len = len - FANS_FRAME_HDR_SZ;
+
+#define	CHECK_BAD(off, val) \
+	do { \
+		memcpy(bad, frame, len); \
+		bad[(off)] = (val); \
+		VERIFY3S(import(m, bad, len), ==, -1); \
+	} while (0)
+	CHECK_BAD(0, FANS_FRAME_MAGIC ^ 1);
+	CHECK_BAD(1, 'X');
+	/* Payload length over the maximum frame size */
+	CHECK_BAD(3, 0xff);
+	/* First run: row, column, cell count and first cell's attributes */
+	CHECK_BAD(FANS_FRAME_HDR_SZ, FMS_ROWS);
+	CHECK_BAD(FANS_FRAME_HDR_SZ + 1, FMS_COLS);
+	CHECK_BAD(FANS_FRAME_HDR_SZ + 2, 0);
+	CHECK_BAD(FANS_FRAME_HDR_SZ + 2, FMS_COLS + 1);
+	CHECK_BAD(FANS_FRAME_HDR_SZ + 4, FMS_COLOR_MAGENTA + 1);
+	CHECK_BAD(FANS_FRAME_HDR_SZ + 4, (FMS_FONT_LARGE + 1) << 3);
+#undef	CHECK_BAD
+
+	/*
+	 * Payloads cut short at every possible length. The header says
+	 * the frame is complete, so unless the cut happens to fall on a
+	 * run boundary, the frame must be rejected.
+	 */
+	for (unsigned l = 1, next_run = 0; l < payload_len; l++) {
+		mirror_t tmp = *m;
+
+		while (next_run < l) {
+			next_run += RUN_HDR_SZ +
+			    CELL_SZ * frame[FANS_FRAME_HDR_SZ + next_run + 2];
+		}
+		memcpy(bad, frame, FANS_FRAME_HDR_SZ + l);
+		bad[2] = l & 0xff;
+		bad[3] = l >> 8;
+		VERIFY3S(import(&tmp, bad, FANS_FRAME_HDR_SZ + l), ==,
+		    l == next_run ? (int)(FANS_FRAME_HDR_SZ + l) : -1);
+	}
+	free(bad);
+}
+
+/*
+ * Randomly corrupts frames. Whatever the result, the import must not
+ * read out of bounds or leave a partially applied frame behind.
+ */
+static void
+check_corrupt(const mirror_t *base, const uint8_t *frame, size_t len)
+{
+	uint8_t *bad = malloc(len);
+
+	for (unsigned i = 0; i < NUM_CORRUPT_ROUNDS; i++) {
+		mirror_t m = *base;
+		unsigned n_flips = 1 + rand() % 4;
+
+		memcpy(bad, frame, len);
+		for (unsigned j = 0; j < n_flips; j++)
+			bad[rand() % len] = rand();
+		(void) import(&m, bad, len);
+	}
+	free(bad);
+}
+
+int
+main(void)
+{
+	uint8_t kf[FANS_FRAME_MAX_SZ], diff[FANS_FRAME_MAX_SZ];
+	size_t kf_len, diff_len;
+	mirror_t m = { .gen = 0 }, stale;
+	uint64_t old_gen;
+	fans_t *box;
+
+	cpdlc_assfail = test_assfail;
+	srand(1);
+	box = fans_alloc(NULL, NULL);
+
+	/* Initial keyframe */
+	kf_len = fans_export_keyframe(box, kf, sizeof (kf));
+	VERIFY3U(kf_len, ==, FANS_FRAME_MAX_SZ);
+	check_truncated(&m, kf, kf_len);
+	VERIFY3S(import(&m, kf, kf_len), ==, kf_len);
+	VERIFY(mirror_matches(box, &m));
+	VERIFY0(export_diff(box, m.gen, diff));
+
+	/* Scratchpad entry only touches a single row */
+	fans_push_chars(box, "FL350", 5);
+	diff_len = export_diff(box, m.gen, diff);
+	VERIFY3U(diff_len, <, kf_len / 4);
+	sync_diff(box, &m);
+
+	/* Page changes redraw most of the screen */
+	fans_push_key(box, FMS_KEY_LSK_R1);
+	sync_diff(box, &m);
+	fans_push_key(box, FMS_KEY_IDX);
+	sync_diff(box, &m);
+	fans_push_key(box, FMS_KEY_LSK_L1);
+	sync_diff(box, &m);
+	fans_push_key(box, FMS_KEY_CLR_DEL_LONG);
+	sync_diff(box, &m);
+
+	/*
+	 * Base generation mismatch: a diff computed against a generation
+	 * the receiver has already moved past must be rejected, after
+	 * which only a keyframe can resynchronize the receiver.
+	 */
+	old_gen = m.gen;
+	fans_push_char(box, 'X');
+	sync_diff(box, &m);
+	fans_push_char(box, 'Y');
+	diff_len = export_diff(box, old_gen, diff);
+	VERIFY(diff_len != 0);
+	VERIFY3S(import(&m, diff, diff_len), ==, -1);
+	stale = m;
+	stale.gen = 0;
+	diff_len = export_diff(box, m.gen, diff);
+	VERIFY3S(import(&stale, diff, diff_len), ==, -1);
+	kf_len = fans_export_keyframe(box, kf, sizeof (kf));
+	VERIFY3S(import(&stale, kf, kf_len), ==, kf_len);
+	VERIFY(mirror_matches(box, &stale));
+	VERIFY3S(import(&m, diff, diff_len), ==, diff_len);
+	VERIFY(mirror_matches(box, &m));
+
+	/* Malformed and corrupted frames */
+	fans_push_key(box, FMS_KEY_IDX);
+	diff_len = export_diff(box, m.gen, diff);
+	VERIFY(diff_len != 0);
+	check_malformed(&m, kf, kf_len);
+	check_malformed(&m, diff, diff_len);
+	check_corrupt(&m, kf, kf_len);
+	check_corrupt(&m, diff, diff_len);
+	VERIFY3S(import(&m, diff, diff_len), ==, diff_len);
+	VERIFY(mirror_matches(box, &m));
+
+	fans_free(box);
+	printf("remote_test: all tests passed\n");
+
+	return (0);
+}
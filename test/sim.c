@@ -0,0 +1,1214 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Deterministic simulation of a CPDLC network. A population of aircraft
+ * and ATC stations, each running a real cpdlc_client and cpdlc_msglist,
+ * is connected through an in-memory network to a small router which
+ * follows cpdlcd's rules for logons, message routing, queueing of
+ * messages to stations which aren't logged on and the logon grace
+ * period. The queue expiry and grace period checks are cpdlcd's own,
+ * from cpdlcd/timeouts.h. Everything runs on a single thread against
+ * a virtual clock (see cpdlc_clock.h), so hours of traffic take seconds
+ * to simulate and a run is exactly reproducible from its seed.
+ *
+ * The network delivers whole lines with a configurable latency, jitter,
+ * loss rate and reordering rate. Without reordering, lines on each
+ * connection are delivered in the order they were sent. The router can
+ * also kill connections at random, to simulate link failures.
+ *
+ * Aircraft log on for sessions of random length, send DM6 altitude
+ * requests at random intervals and WILCO any clearances they get. A
+ * configurable fraction of pilots is too slow to respond, so msglist's
+ * response timeout has to kick in. ATC stations clear every request.
+ *
+ * The results are printed as a JSON object on stdout. The digest is a
+ * hash over every line delivered and its delivery time, so two runs
+ * with the same parameters and seed must produce the same digest. On a
+ * clean network (no loss, reordering or link failures), any error
+ * message seen by a station fails the run.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/cpdlc_alloc.h"
+#include "../src/cpdlc_assert.h"
+#include "../src/cpdlc_client.h"
+#include "../src/cpdlc_clock.h"
+#include "../src/cpdlc_msglist.h"
+#include "../src/cpdlc_string.h"
+#include "../src/cpdlc_thread.h"
+#include "../src/minilist.h"
+#include "../cpdlcd/timeouts.h"
+
+#include "bench.h"
+
+#define	ACFT_PREFIX	"SIM"
+#define	ATC_PREFIX	"ATC"
+#define	SIM_EPOCH	1577836800llu	/* 2020-01-01, seconds */
+#define	SWEEP_INTVAL	60000000llu	/* us */
+#define	MIN_BACKOFF	5000000llu	/* us, before reconnecting */
+#define	MAX_BACKOFF	15000000llu	/* us */
+#define	SLOW_PILOT_MIN	120000000llu	/* us, past the UM20 timeout */
+#define	SLOW_PILOT_MAX	200000000llu	/* us */
+#define	MAX_THRS	4096
+#define	STALE_THR_MINS	30	/* open threads nobody will ever answer */
+
+typedef struct station_s station_t;
+
+/*
+ * A connection between a station and the router. It is referenced by
+ * the client until it closes it, by the router until it drops it and
+ * by every line in flight.
+ */
+typedef struct {
+	unsigned	id;
+	unsigned	refcnt;
+	station_t	*st;		/* NULL once the client closed it */
+	bool		srv_closed;
+	time_t		logoff_time;	/* as in cpdlcd, see timeouts.h */
+	uint64_t	last_t[2];	/* last delivery time, per direction */
+	/* client side */
+	char		*rx;
+	size_t		rx_len;
+	char		*tx_part;
+	size_t		tx_part_len;
+	/* router side */
+	bool		logged_on;
+	bool		is_atc;
+	char		from[CPDLC_CALLSIGN_LEN];
+	char		to[CPDLC_CALLSIGN_LEN];
+	unsigned	min;
+	list_node_t	node;
+} sim_conn_t;
+
+typedef struct {
+	uint64_t	t;		/* delivery time */
+	uint64_t	seq;		/* keeps the delivery order stable */
+	sim_conn_t	*conn;
+	bool		to_client;
+	char		*line;
+	uint64_t	sent_t;
+} sim_pkt_t;
+
+typedef struct {
+	char		to[CPDLC_CALLSIGN_LEN];
+	char		*line;
+	time_t		created;
+	list_node_t	node;
+} queued_line_t;
+
+typedef struct {
+	cpdlc_msg_thr_id_t	thr_id;
+	unsigned		num_msgs;	/* msgs in thread when queued */
+	uint64_t		due_t;
+} action_t;
+
+struct station_s {
+	bool			is_atc;
+	char			callsign[CPDLC_CALLSIGN_LEN];
+	char			atc[CPDLC_CALLSIGN_LEN];	/* aircraft */
+	cpdlc_client_t		*cl;
+	cpdlc_msglist_t		*ml;
+	sim_conn_t		*conn;
+	bool			online;
+	uint64_t		next_evt_t;	/* next logon or logoff */
+	uint64_t		next_req_t;
+	action_t		*actions;
+	unsigned		num_actions;
+	cpdlc_msg_thr_id_t	*req_thrs;	/* aircraft: open requests */
+	uint64_t		*req_t;
+	unsigned		num_reqs;
+};
+
+/* Parameters, all times in microseconds */
+static unsigned		num_acft = 50;
+static unsigned		num_atc = 2;
+static uint64_t		duration = 4 * 3600 * 1000000llu;
+static uint64_t		tick = 100000;
+static uint64_t		latency = 50000;
+static uint64_t		jitter = 20000;
+static double		loss = 0;
+static double		reorder = 0;
+static double		kill_rate = 0;		/* per connection-hour */
+static uint64_t		queue_timeout = QUEUED_MSG_TIMEOUT * 1000000llu;
+static double		session_mean = 1800e6;
+static double		offline_mean = 120e6;
+static double		req_mean = 300e6;
+static double		atc_resp_mean = 20e6;
+static double		pilot_resp_mean = 10e6;
+static double		slow_pilot = 0.02;
+static uint64_t		seed = 1;
+
+static uint64_t		sim_now = SIM_EPOCH * 1000000llu;
+static uint64_t		sim_start;
+static uint64_t		rng_state;
+
+static station_t	*stations = NULL;
+static unsigned		num_stations = 0;
+
+static list_t		srv_conns;
+static list_t		srv_queue;
+static unsigned		next_conn_id = 0;
+
+static sim_pkt_t	**heap = NULL;
+static unsigned		heap_len = 0, heap_cap = 0;
+static uint64_t		pkt_seq = 0;
+static uint64_t		digest = 14695981039346656037llu;
+
+static samples_t	msg_lat = {};
+static samples_t	txn_lat = {};
+
+static struct {
+	uint64_t	lines_sent;
+	uint64_t	lines_lost;
+	uint64_t	lines_reordered;
+	uint64_t	lines_delivered;
+	uint64_t	lines_dropped;	/* destination gone on arrival */
+	uint64_t	conns;
+	uint64_t	kills;
+	uint64_t	grace_closes;
+	uint64_t	bad_lines;
+	uint64_t	logons;
+	uint64_t	routed;
+	uint64_t	queued;
+	uint64_t	dequeued;
+	uint64_t	expired;
+	uint64_t	srv_errors;
+} net;
+
+static struct {
+	uint64_t	sessions;
+	uint64_t	drops;
+	uint64_t	reqs;
+	uint64_t	clearances;
+	uint64_t	wilcos;
+	uint64_t	late_wilcos;
+	uint64_t	error_msgs;
+	uint64_t	thr_status[CPDLC_MSG_THR_CONN_ENDED + 1];
+	uint64_t	auto_timeouts;
+	uint64_t	stale_thrs;
+} sim;
+
+static const char *thr_status_names[] = {
+	"open", "closed", "accepted", "rejected", "timedout", "standby",
+	"failed", "pending", "disregard", "error", "conn_ended"
+};
+
+/*
+ * xorshift64*, so that runs don't depend on the C library's rand().
+ */
+static uint64_t
+rng(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return (rng_state * 2685821657736338717llu);
+}
+
+static double
+rng_unif(void)
+{
+	return ((rng() >> 11) * (1.0 / 9007199254740992.0));
+}
+
+static uint64_t
+rng_range(uint64_t lo, uint64_t hi)
+{
+	return (lo + (uint64_t)(rng_unif() * (hi - lo)));
+}
+
+static uint64_t
+rng_exp(double mean)
+{
+	return ((uint64_t)(-mean * log(1 - rng_unif())));
+}
+
+static uint64_t
+sim_clock(void *userinfo)
+{
+	UNUSED(userinfo);
+	return (sim_now);
+}
+
+static void
+digest_add(const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+
+	for (size_t i = 0; i < len; i++) {
+		digest ^= p[i];
+		digest *= 1099511628211llu;
+	}
+}
+
+static bool
+pkt_before(const sim_pkt_t *a, const sim_pkt_t *b)
+{
+	return (a->t < b->t || (a->t == b->t && a->seq < b->seq));
+}
+
+static void
+heap_push(sim_pkt_t *pkt)
+{
+	unsigned i;
+
+	if (heap_len == heap_cap) {
+		heap_cap = MAX(2 * heap_cap, 256);
+		heap = safe_realloc(heap, heap_cap * sizeof (*heap));
+	}
+	for (i = heap_len++; i > 0 && pkt_before(pkt, heap[(i - 1) / 2]);
+	    i = (i - 1) / 2)
+		heap[i] = heap[(i - 1) / 2];
+	heap[i] = pkt;
+}
+
+static sim_pkt_t *
+heap_pop(void)
+{
+	sim_pkt_t *top, *last;
+	unsigned i = 0;
+
+	ASSERT(heap_len != 0);
+	top = heap[0];
+	last = heap[--heap_len];
+	for (;;) {
+		unsigned c = 2 * i + 1;
+
+		if (c >= heap_len)
+			break;
+		if (c + 1 < heap_len && pkt_before(heap[c + 1], heap[c]))
+			c++;
+		if (!pkt_before(heap[c], last))
+			break;
+		heap[i] = heap[c];
+		i = c;
+	}
+	if (heap_len != 0)
+		heap[i] = last;
+
+	return (top);
+}
+
+static void
+conn_rele(sim_conn_t *conn)
+{
+	ASSERT(conn->refcnt != 0);
+	if (--conn->refcnt != 0)
+		return;
+	free(conn->rx);
+	free(conn->tx_part);
+	free(conn);
+}
+
+/*
+ * Puts a line on the wire. Lost lines simply vanish, reordered lines
+ * are held back long enough for later lines to overtake them.
+ */
+static void
+net_send(sim_conn_t *conn, bool to_client, const char *line)
+{
+	sim_pkt_t *pkt;
+	uint64_t t;
+
+	net.lines_sent++;
+	if (loss > 0 && rng_unif() < loss) {
+		net.lines_lost++;
+		return;
+	}
+	t = sim_now + latency + (jitter != 0 ? rng_range(0, jitter) : 0);
+	if (reorder > 0 && rng_unif() < reorder) {
+		t += 2 * (latency + jitter);
+		net.lines_reordered++;
+	} else {
+		t = MAX(t, conn->last_t[to_client]);
+		conn->last_t[to_client] = t;
+	}
+	pkt = safe_calloc(1, sizeof (*pkt));
+	pkt->t = t;
+	pkt->seq = pkt_seq++;
+	pkt->conn = conn;
+	pkt->to_client = to_client;
+	pkt->line = strdup(line);
+	pkt->sent_t = sim_now;
+	conn->refcnt++;
+	heap_push(pkt);
+}
+
+static void
+srv_send_msg(sim_conn_t *conn, cpdlc_msg_t *msg)
+{
+	unsigned l;
+	char *buf;
+
+	cpdlc_msg_set_min(msg, conn->min++);
+	l = cpdlc_msg_encode(msg, NULL, 0);
+	buf = safe_malloc(l + 1);
+	cpdlc_msg_encode(msg, buf, l + 1);
+	net_send(conn, true, buf);
+	free(buf);
+}
+
+static void
+srv_send_error(sim_conn_t *conn, const cpdlc_msg_t *orig, const char *text)
+{
+	cpdlc_msg_t *msg = cpdlc_msg_alloc(CPDLC_PKT_CPDLC);
+
+	net.srv_errors++;
+	cpdlc_msg_set_mrn(msg, cpdlc_msg_get_min(orig));
+	cpdlc_msg_add_seg(msg, false, CPDLC_UM159_ERROR_description, 0);
+	cpdlc_msg_seg_set_arg(msg, 0, 0, (void *)text, NULL);
+	srv_send_msg(conn, msg);
+	cpdlc_msg_free(msg);
+}
+
+static void
+srv_close(sim_conn_t *conn)
+{
+	ASSERT(!conn->srv_closed);
+	conn->srv_closed = true;
+	list_remove(&srv_conns, conn);
+	conn_rele(conn);
+}
+
+/*
+ * Sends a line to every connection logged on as `to'. Returns false if
+ * there are none.
+ */
+static bool
+srv_route(const char *to, const char *line)
+{
+	bool found = false;
+
+	for (sim_conn_t *conn = list_head(&srv_conns); conn != NULL;
+	    conn = list_next(&srv_conns, conn)) {
+		if (conn->logged_on && strcmp(conn->from, to) == 0) {
+			net_send(conn, true, line);
+			found = true;
+		}
+	}
+	return (found);
+}
+
+static void
+srv_logon(sim_conn_t *conn, cpdlc_msg_t *msg)
+{
+	cpdlc_msg_t *resp = cpdlc_msg_alloc(CPDLC_PKT_CPDLC);
+
+	cpdlc_msg_set_mrn(resp, cpdlc_msg_get_min(msg));
+	cpdlc_msg_set_from(resp, "ATN");
+	if (msg->is_logoff) {
+		conn->logged_on = false;
+		conn->logoff_time = cpdlc_clock_time();
+		cpdlc_msg_free(resp);
+		return;
+	}
+	if (cpdlc_msg_get_from(msg)[0] == '\0' || msg->to[0] == '\0') {
+		cpdlc_msg_set_logon_data(resp, "FAILURE");
+	} else {
+		/* Same rule as mock_auth */
+		conn->is_atc = (strncmp(cpdlc_msg_get_logon_data(msg),
+		    ATC_PREFIX, strlen(ATC_PREFIX)) == 0);
+		cpdlc_strlcpy(conn->from, cpdlc_msg_get_from(msg),
+		    sizeof (conn->from));
+		cpdlc_strlcpy(conn->to, msg->to, sizeof (conn->to));
+		conn->logged_on = true;
+		net.logons++;
+		cpdlc_msg_set_logon_data(resp, "SUCCESS");
+	}
+	srv_send_msg(conn, resp);
+	cpdlc_msg_free(resp);
+}
+
+/*
+ * The subset of cpdlcd's conn_process_msg that matters for the
+ * simulation: logon enforcement, TO=/FROM= stamping, uplink/downlink
+ * checks and store-and-forward routing.
+ */
+static void
+srv_process_line(sim_conn_t *conn, const char *line)
+{
+	cpdlc_msg_t *msg;
+	char to[CPDLC_CALLSIGN_LEN], error[128];
+	int consumed;
+	unsigned l;
+	char *buf;
+
+	if (!cpdlc_msg_decode(line, &msg, &consumed, error, sizeof (error)) ||
+	    msg == NULL) {
+		net.bad_lines++;
+		srv_close(conn);
+		return;
+	}
+	if (!conn->logged_on && !msg->is_logon) {
+		srv_send_error(conn, msg, "LOGON REQUIRED");
+		goto out;
+	}
+	if (msg->is_logon || msg->is_logoff) {
+		srv_logon(conn, msg);
+		goto out;
+	}
+	if (msg->pkt_type == CPDLC_PKT_PING) {
+		cpdlc_msg_t *pong = cpdlc_msg_alloc(CPDLC_PKT_PONG);
+
+		cpdlc_msg_set_mrn(pong, cpdlc_msg_get_min(msg));
+		srv_send_msg(conn, pong);
+		cpdlc_msg_free(pong);
+		goto out;
+	}
+	if (msg->to[0] != '\0') {
+		if (!conn->is_atc) {
+			srv_send_error(conn, msg,
+			    "MESSAGE CANNOT CONTAIN TO= HEADER");
+			goto out;
+		}
+		cpdlc_strlcpy(to, msg->to, sizeof (to));
+	} else if (!conn->is_atc) {
+		cpdlc_strlcpy(to, conn->to, sizeof (to));
+		cpdlc_msg_set_to(msg, conn->to);
+	} else {
+		srv_send_error(conn, msg, "MESSAGE MISSING TO= HEADER");
+		goto out;
+	}
+	if (cpdlc_msg_get_num_segs(msg) == 0 ||
+	    cpdlc_msg_get_dl(msg) == conn->is_atc) {
+		srv_send_error(conn, msg, "MESSAGE UPLINK/DOWNLINK MISMATCH");
+		goto out;
+	}
+	cpdlc_msg_set_from(msg, conn->from);
+
+	l = cpdlc_msg_encode(msg, NULL, 0);
+	buf = safe_malloc(l + 1);
+	cpdlc_msg_encode(msg, buf, l + 1);
+	if (srv_route(to, buf)) {
+		net.routed++;
+		free(buf);
+	} else {
+		queued_line_t *ql = safe_calloc(1, sizeof (*ql));
+
+		cpdlc_strlcpy(ql->to, to, sizeof (ql->to));
+		ql->line = buf;
+		ql->created = cpdlc_clock_time();
+		list_insert_tail(&srv_queue, ql);
+		net.queued++;
+	}
+out:
+	cpdlc_msg_free(msg);
+}
+
+/*
+ * Periodic router housekeeping, as in cpdlcd's main loop: delivers or
+ * expires queued messages, enforces the logon grace period and kills
+ * random connections.
+ */
+static void
+srv_tick(void)
+{
+	time_t now = cpdlc_clock_time();
+
+	for (queued_line_t *ql = list_head(&srv_queue), *ql_next = NULL;
+	    ql != NULL; ql = ql_next) {
+		ql_next = list_next(&srv_queue, ql);
+		if (srv_route(ql->to, ql->line))
+			net.dequeued++;
+		else if (queued_msg_expired(ql->created,
+		    queue_timeout / 1000000, now))
+			net.expired++;
+		else
+			continue;
+		list_remove(&srv_queue, ql);
+		free(ql->line);
+		free(ql);
+	}
+	for (sim_conn_t *conn = list_head(&srv_conns), *conn_next = NULL;
+	    conn != NULL; conn = conn_next) {
+		conn_next = list_next(&srv_conns, conn);
+		if (conn_logon_timedout(conn->logged_on, conn->logoff_time,
+		    now)) {
+			net.grace_closes++;
+			srv_close(conn);
+		}
+	}
+	if (kill_rate > 0 && list_count(&srv_conns) != 0 &&
+	    rng_unif() < kill_rate * list_count(&srv_conns) * tick / 3600e6) {
+		sim_conn_t *conn = list_head(&srv_conns);
+
+		for (uint64_t i = rng_range(0, list_count(&srv_conns));
+		    i > 0; i--)
+			conn = list_next(&srv_conns, conn);
+		net.kills++;
+		srv_close(conn);
+	}
+}
+
+static void
+deliver_pkts(void)
+{
+	while (heap_len != 0 && heap[0]->t <= sim_now) {
+		sim_pkt_t *pkt = heap_pop();
+		sim_conn_t *conn = pkt->conn;
+		size_t l = strlen(pkt->line);
+
+		if (pkt->to_client ? conn->st == NULL : conn->srv_closed) {
+			net.lines_dropped++;
+		} else {
+			net.lines_delivered++;
+			digest_add(&pkt->t, sizeof (pkt->t));
+			digest_add(&conn->id, sizeof (conn->id));
+			digest_add(pkt->line, l);
+			samples_add(&msg_lat, pkt->t - pkt->sent_t);
+			if (pkt->to_client) {
+				conn->rx = safe_realloc(conn->rx,
+				    conn->rx_len + l);
+				memcpy(&conn->rx[conn->rx_len], pkt->line, l);
+				conn->rx_len += l;
+			} else {
+				srv_process_line(conn, pkt->line);
+			}
+		}
+		conn_rele(conn);
+		free(pkt->line);
+		free(pkt);
+	}
+}
+
+static bool
+tp_open(void *userinfo)
+{
+	station_t *st = userinfo;
+	sim_conn_t *conn = safe_calloc(1, sizeof (*conn));
+
+	ASSERT3P(st->conn, ==, NULL);
+	conn->id = next_conn_id++;
+	conn->refcnt = 2;	/* client + router */
+	conn->st = st;
+	conn->logoff_time = cpdlc_clock_time();
+	list_insert_tail(&srv_conns, conn);
+	st->conn = conn;
+	net.conns++;
+
+	return (true);
+}
+
+static int
+tp_send(void *userinfo, const void *buf, size_t len)
+{
+	station_t *st = userinfo;
+	sim_conn_t *conn = st->conn;
+	char *nl;
+
+	ASSERT(conn != NULL);
+	if (conn->srv_closed)
+		return (-1);
+	conn->tx_part = safe_realloc(conn->tx_part, conn->tx_part_len + len +
+	    1);
+	memcpy(&conn->tx_part[conn->tx_part_len], buf, len);
+	conn->tx_part_len += len;
+	conn->tx_part[conn->tx_part_len] = '\0';
+	/* Only complete lines go on the wire */
+	while ((nl = strchr(conn->tx_part, '\n')) != NULL) {
+		size_t l = nl - conn->tx_part + 1;
+		char c = conn->tx_part[l];
+
+		conn->tx_part[l] = '\0';
+		net_send(conn, false, conn->tx_part);
+		conn->tx_part[l] = c;
+		memmove(conn->tx_part, &conn->tx_part[l],
+		    conn->tx_part_len - l + 1);
+		conn->tx_part_len -= l;
+	}
+
+	return (len);
+}
+
+static int
+tp_recv(void *userinfo, void *buf, size_t cap)
+{
+	station_t *st = userinfo;
+	sim_conn_t *conn = st->conn;
+	size_t n;
+
+	ASSERT(conn != NULL);
+	if (conn->rx_len == 0)
+		return (conn->srv_closed ? -1 : 0);
+	n = MIN(cap, conn->rx_len);
+	memcpy(buf, conn->rx, n);
+	memmove(conn->rx, &conn->rx[n], conn->rx_len - n);
+	conn->rx_len -= n;
+
+	return (n);
+}
+
+static void
+tp_close(void *userinfo)
+{
+	station_t *st = userinfo;
+	sim_conn_t *conn = st->conn;
+
+	ASSERT(conn != NULL);
+	/* The router notices the closed connection right away */
+	if (!conn->srv_closed)
+		srv_close(conn);
+	conn->st = NULL;
+	st->conn = NULL;
+	conn_rele(conn);
+}
+
+static const cpdlc_transport_t sim_tp = {
+	.open = tp_open,
+	.send = tp_send,
+	.recv = tp_recv,
+	.close = tp_close
+};
+
+static bool
+action_pending(const station_t *st, cpdlc_msg_thr_id_t thr_id)
+{
+	for (unsigned i = 0; i < st->num_actions; i++) {
+		if (st->actions[i].thr_id == thr_id)
+			return (true);
+	}
+	return (false);
+}
+
+static void
+action_add(station_t *st, cpdlc_msg_thr_id_t thr_id, unsigned num_msgs,
+    uint64_t due_t)
+{
+	st->actions = safe_realloc(st->actions, (st->num_actions + 1) *
+	    sizeof (*st->actions));
+	st->actions[st->num_actions].thr_id = thr_id;
+	st->actions[st->num_actions].num_msgs = num_msgs;
+	st->actions[st->num_actions].due_t = due_t;
+	st->num_actions++;
+}
+
+static void
+req_done(station_t *st, cpdlc_msg_thr_id_t thr_id, bool answered)
+{
+	for (unsigned i = 0; i < st->num_reqs; i++) {
+		if (st->req_thrs[i] == thr_id) {
+			if (answered)
+				samples_add(&txn_lat, sim_now - st->req_t[i]);
+			st->num_reqs--;
+			st->req_thrs[i] = st->req_thrs[st->num_reqs];
+			st->req_t[i] = st->req_t[st->num_reqs];
+			return;
+		}
+	}
+}
+
+static bool
+msg_is_type(const cpdlc_msg_t *msg, bool dl, int msg_type)
+{
+	return (cpdlc_msg_get_num_segs(msg) != 0 &&
+	    msg->segs[0].info->is_dl == dl &&
+	    msg->segs[0].info->msg_type == msg_type);
+}
+
+/*
+ * Schedules our response to any request the peer is waiting on. ATC
+ * answers altitude requests with a clearance, aircraft WILCO the
+ * clearance.
+ */
+static void
+update_cb(cpdlc_msglist_t *ml, cpdlc_msg_thr_id_t *thr_ids, unsigned n)
+{
+	station_t *st = cpdlc_msglist_get_userinfo(ml);
+
+	for (unsigned i = 0; i < n; i++) {
+		cpdlc_msg_thr_id_t thr_id = thr_ids[i];
+		unsigned num_msgs = cpdlc_msglist_get_thr_msg_count(ml, thr_id);
+		const cpdlc_msg_t *msg;
+		bool sent;
+
+		if (num_msgs == 0)
+			continue;
+		cpdlc_msglist_get_thr_msg(ml, thr_id, num_msgs - 1, &msg, NULL,
+		    NULL, NULL, &sent);
+		if (sent)
+			continue;
+		if (msg_is_type(msg, false, CPDLC_UM159_ERROR_description) ||
+		    msg_is_type(msg, true, CPDLC_DM62_ERROR_errorinfo)) {
+			char text[64] = "";
+
+			cpdlc_msg_seg_get_arg(msg, 0, 0, text, sizeof (text),
+			    NULL);
+			if (strcmp(text, "TIMEDOUT") == 0)
+				sim.auto_timeouts++;
+			else
+				sim.error_msgs++;
+			continue;
+		}
+		if (cpdlc_msglist_get_thr_status(ml, thr_id, NULL) !=
+		    CPDLC_MSG_THR_OPEN || action_pending(st, thr_id))
+			continue;
+		if (st->is_atc && msg_is_type(msg, true, CPDLC_DM6_REQ_alt)) {
+			action_add(st, thr_id, num_msgs,
+			    sim_now + rng_exp(atc_resp_mean));
+		} else if (!st->is_atc &&
+		    msg_is_type(msg, false, CPDLC_UM20_CLB_TO_alt)) {
+			uint64_t delay = (rng_unif() < slow_pilot ?
+			    rng_range(SLOW_PILOT_MIN, SLOW_PILOT_MAX) :
+			    rng_exp(pilot_resp_mean));
+
+			sim.clearances++;
+			req_done(st, thr_id, true);
+			action_add(st, thr_id, num_msgs, sim_now + delay);
+		}
+	}
+}
+
+static void
+run_action(station_t *st, const action_t *act)
+{
+	cpdlc_msg_t *msg;
+
+	/* Somebody else (e.g. the response timeout) got there first */
+	if (cpdlc_msglist_get_thr_status(st->ml, act->thr_id, NULL) !=
+	    CPDLC_MSG_THR_OPEN || cpdlc_msglist_get_thr_msg_count(st->ml,
+	    act->thr_id) != act->num_msgs) {
+		if (!st->is_atc)
+			sim.late_wilcos++;
+		return;
+	}
+	msg = cpdlc_msg_alloc(CPDLC_PKT_CPDLC);
+	if (st->is_atc) {
+		const cpdlc_msg_t *req;
+		int alt = 0;
+		bool fl = false;
+
+		cpdlc_msglist_get_thr_msg(st->ml, act->thr_id,
+		    act->num_msgs - 1, &req, NULL, NULL, NULL, NULL);
+		cpdlc_msg_seg_get_arg(req, 0, 0, &fl, 0, &alt);
+		cpdlc_msg_add_seg(msg, false, CPDLC_UM20_CLB_TO_alt, 0);
+		cpdlc_msg_seg_set_arg(msg, 0, 0, &fl, &alt);
+		cpdlc_msg_set_to(msg, cpdlc_msg_get_from(req));
+	} else {
+		cpdlc_msg_add_seg(msg, true, CPDLC_DM0_WILCO, 0);
+		sim.wilcos++;
+	}
+	/* The msglist takes ownership of the message */
+	cpdlc_msglist_send(st->ml, msg, act->thr_id);
+}
+
+static void
+run_actions(station_t *st)
+{
+	for (unsigned i = 0; i < st->num_actions;) {
+		action_t act = st->actions[i];
+
+		if (act.due_t > sim_now) {
+			i++;
+			continue;
+		}
+		st->actions[i] = st->actions[--st->num_actions];
+		run_action(st, &act);
+	}
+}
+
+/*
+ * Minutes since the last message in a thread. The message list only
+ * keeps the time of day, which is fine for detecting stale threads.
+ */
+static unsigned
+thr_idle_mins(station_t *st, cpdlc_msg_thr_id_t thr_id)
+{
+	unsigned n = cpdlc_msglist_get_thr_msg_count(st->ml, thr_id);
+	unsigned hours, mins;
+	time_t now = cpdlc_clock_time();
+	const struct tm *tm = gmtime(&now);
+
+	if (n == 0)
+		return (0);
+	cpdlc_msglist_get_thr_msg(st->ml, thr_id, n - 1, NULL, NULL, &hours,
+	    &mins, NULL);
+	return ((tm->tm_hour * 60 + tm->tm_min + 1440 - (hours * 60 + mins)) %
+	    1440);
+}
+
+/*
+ * Retires finished threads, so the message lists don't grow without
+ * bound over a long run. On a lossy network, some threads never get
+ * their response, so we close those once they've gone stale, like a
+ * controller or pilot would.
+ */
+static void
+sweep_thrs(station_t *st)
+{
+	cpdlc_msg_thr_id_t thr_ids[MAX_THRS];
+	unsigned n = MAX_THRS;
+
+	cpdlc_msglist_get_thr_ids(st->ml, false, thr_ids, &n);
+	for (unsigned i = 0; i < n; i++) {
+		cpdlc_msg_thr_status_t status;
+
+		if (action_pending(st, thr_ids[i]))
+			continue;
+		if (!cpdlc_msglist_thr_is_done(st->ml, thr_ids[i])) {
+			if (thr_idle_mins(st, thr_ids[i]) < STALE_THR_MINS)
+				continue;
+			sim.stale_thrs++;
+			cpdlc_msglist_thr_close(st->ml, thr_ids[i]);
+		}
+		status = cpdlc_msglist_get_thr_status(st->ml, thr_ids[i], NULL);
+		sim.thr_status[status]++;
+		if (!st->is_atc)
+			req_done(st, thr_ids[i], false);
+		cpdlc_msglist_remove_thr(st->ml, thr_ids[i]);
+	}
+}
+
+static void
+send_req(station_t *st)
+{
+	cpdlc_msg_t *msg = cpdlc_msg_alloc(CPDLC_PKT_CPDLC);
+	cpdlc_msg_thr_id_t thr_id;
+	int alt = 200 + 10 * (int)rng_range(0, 20);
+	bool fl = true;
+
+	cpdlc_msg_add_seg(msg, true, CPDLC_DM6_REQ_alt, 0);
+	cpdlc_msg_seg_set_arg(msg, 0, 0, &fl, &alt);
+	thr_id = cpdlc_msglist_send(st->ml, msg, CPDLC_NO_MSG_THR_ID);
+	st->req_thrs = safe_realloc(st->req_thrs, (st->num_reqs + 1) *
+	    sizeof (*st->req_thrs));
+	st->req_t = safe_realloc(st->req_t, (st->num_reqs + 1) *
+	    sizeof (*st->req_t));
+	st->req_thrs[st->num_reqs] = thr_id;
+	st->req_t[st->num_reqs] = sim_now;
+	st->num_reqs++;
+	sim.reqs++;
+}
+
+static void
+station_logon(station_t *st)
+{
+	cpdlc_client_logon(st->cl, st->is_atc ? ATC_PREFIX : "ACFT",
+	    st->callsign, st->is_atc ? st->callsign : st->atc);
+	st->online = true;
+	st->next_evt_t = sim_now + rng_exp(session_mean);
+	st->next_req_t = sim_now + rng_exp(req_mean);
+	if (!st->is_atc)
+		sim.sessions++;
+}
+
+static void
+station_step(station_t *st)
+{
+	cpdlc_logon_status_t status;
+
+	cpdlc_client_poll(st->cl);
+	cpdlc_msglist_update(st->ml);
+	run_actions(st);
+
+	if (!st->online) {
+		if (sim_now >= st->next_evt_t)
+			station_logon(st);
+		return;
+	}
+	status = cpdlc_client_get_logon_status(st->cl, NULL);
+	if (status == CPDLC_LOGON_NONE) {
+		/* Link lost or logon failed, try again in a bit */
+		sim.drops++;
+		st->online = false;
+		st->next_evt_t = sim_now + rng_range(MIN_BACKOFF, MAX_BACKOFF);
+		return;
+	}
+	if (st->is_atc || status != CPDLC_LOGON_COMPLETE)
+		return;
+	if (sim_now >= st->next_evt_t) {
+		cpdlc_client_logoff(st->cl);
+		st->online = false;
+		st->next_evt_t = sim_now + rng_exp(offline_mean);
+	} else if (sim_now >= st->next_req_t) {
+		send_req(st);
+		st->next_req_t = sim_now + rng_exp(req_mean);
+	}
+}
+
+static void
+station_init(station_t *st, bool is_atc, unsigned idx)
+{
+	st->is_atc = is_atc;
+	if (is_atc) {
+		snprintf(st->callsign, sizeof (st->callsign), "%s%u",
+		    ATC_PREFIX, idx);
+	} else {
+		snprintf(st->callsign, sizeof (st->callsign), "%s%04u",
+		    ACFT_PREFIX, idx);
+		snprintf(st->atc, sizeof (st->atc), "%s%u", ATC_PREFIX,
+		    idx % num_atc);
+	}
+	st->cl = cpdlc_client_alloc(is_atc);
+	cpdlc_client_set_transport(st->cl, &sim_tp, st);
+	st->ml = cpdlc_msglist_alloc(st->cl);
+	cpdlc_msglist_set_userinfo(st->ml, st);
+	cpdlc_msglist_set_update_cb(st->ml, update_cb);
+	/* Stagger the initial logons, ATC stations go first */
+	st->next_evt_t = sim_now + (is_atc ? 0 : rng_exp(offline_mean));
+}
+
+static void
+station_fini(station_t *st)
+{
+	cpdlc_msglist_free(st->ml);
+	cpdlc_client_free(st->cl);
+	free(st->actions);
+	free(st->req_thrs);
+	free(st->req_t);
+}
+
+static void
+print_usage(const char *progname, FILE *fp)
+{
+	fprintf(fp, "Usage: %s [-h] [-n <aircraft>] [-m <atc>] "
+	    "[-d <duration>] [-t <tick>]\n"
+	    "    [-l <latency>] [-j <jitter>] [-L <loss>] [-r <reorder>] "
+	    "[-k <kills>]\n"
+	    "    [-Q <timeout>] [-s <session>] [-q <interval>] [-P <slow>] "
+	    "[-S <seed>]\n"
+	    "\n"
+	    "  -n <aircraft>   number of aircraft (default: %u)\n"
+	    "  -m <atc>        number of ATC stations (default: %u)\n"
+	    "  -d <duration>   simulated time in seconds (default: %llu)\n"
+	    "  -t <tick>       simulation step in ms (default: %llu)\n"
+	    "  -l <latency>    one-way network latency in ms (default: %llu)\n"
+	    "  -j <jitter>     max additional random latency in ms "
+	    "(default: %llu)\n"
+	    "  -L <loss>       fraction of lines lost (default: 0)\n"
+	    "  -r <reorder>    fraction of lines delivered out of order "
+	    "(default: 0)\n"
+	    "  -k <kills>      link failures per connection-hour "
+	    "(default: 0)\n"
+	    "  -Q <timeout>    router message queue timeout in seconds "
+	    "(default: %llu)\n"
+	    "  -s <session>    mean aircraft session length in seconds "
+	    "(default: %.0f)\n"
+	    "  -q <interval>   mean time between aircraft requests in seconds "
+	    "(default: %.0f)\n"
+	    "  -P <slow>       fraction of clearances the pilot answers too "
+	    "late (default: %.2f)\n"
+	    "  -S <seed>       random seed (default: %llu)\n",
+	    progname, num_acft, num_atc,
+	    (unsigned long long)(duration / 1000000),
+	    (unsigned long long)(tick / 1000),
+	    (unsigned long long)(latency / 1000),
+	    (unsigned long long)(jitter / 1000),
+	    (unsigned long long)(queue_timeout / 1000000),
+	    session_mean / 1e6, req_mean / 1e6, slow_pilot,
+	    (unsigned long long)seed);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int opt;
+	uint64_t wall_start, wall_t, sim_end, next_sweep;
+	bool clean, ok;
+	cpdlc_msglist_stats_t ml_stats;
+
+	while ((opt = getopt(argc, argv, "hn:m:d:t:l:j:L:r:k:Q:s:q:P:S:")) !=
+	    -1) {
+		switch (opt) {
+		case 'h':
+			print_usage(argv[0], stdout);
+			return (0);
+		case 'n':
+			num_acft = atoi(optarg);
+			break;
+		case 'm':
+			num_atc = atoi(optarg);
+			break;
+		case 'd':
+			duration = atof(optarg) * 1e6;
+			break;
+		case 't':
+			tick = atof(optarg) * 1e3;
+			break;
+		case 'l':
+			latency = atof(optarg) * 1e3;
+			break;
+		case 'j':
+			jitter = atof(optarg) * 1e3;
+			break;
+		case 'L':
+			loss = atof(optarg);
+			break;
+		case 'r':
+			reorder = atof(optarg);
+			break;
+		case 'k':
+			kill_rate = atof(optarg);
+			break;
+		case 'Q':
+			queue_timeout = atof(optarg) * 1e6;
+			break;
+		case 's':
+			session_mean = atof(optarg) * 1e6;
+			break;
+		case 'q':
+			req_mean = atof(optarg) * 1e6;
+			break;
+		case 'P':
+			slow_pilot = atof(optarg);
+			break;
+		case 'S':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			print_usage(argv[0], stderr);
+			return (1);
+		}
+	}
+	if (num_atc == 0 || tick == 0) {
+		fprintf(stderr, "Need at least one ATC station and a non-zero "
+		    "tick\n");
+		return (1);
+	}
+	/* xorshift must not start from zero */
+	rng_state = seed * 2654435761llu + 0x9E3779B97F4A7C15llu;
+	cpdlc_clock_set_func(sim_clock, NULL);
+	sim_start = sim_now;
+	sim_end = sim_now + duration;
+	next_sweep = sim_now + SWEEP_INTVAL;
+
+	list_create(&srv_conns, sizeof (sim_conn_t), offsetof(sim_conn_t,
+	    node));
+	list_create(&srv_queue, sizeof (queued_line_t),
+	    offsetof(queued_line_t, node));
+	num_stations = num_atc + num_acft;
+	stations = safe_calloc(num_stations, sizeof (*stations));
+	for (unsigned i = 0; i < num_stations; i++)
+		station_init(&stations[i], i < num_atc, i < num_atc ? i :
+		    i - num_atc);
+
+	wall_start = cpdlc_thread_microclock();
+	while (sim_now < sim_end) {
+		sim_now += tick;
+		deliver_pkts();
+		srv_tick();
+		for (unsigned i = 0; i < num_stations; i++)
+			station_step(&stations[i]);
+		if (sim_now >= next_sweep) {
+			for (unsigned i = 0; i < num_stations; i++)
+				sweep_thrs(&stations[i]);
+			next_sweep += SWEEP_INTVAL;
+		}
+	}
+	wall_t = cpdlc_thread_microclock() - wall_start;
+
+	memset(&ml_stats, 0, sizeof (ml_stats));
+	for (unsigned i = num_atc; i < num_stations; i++) {
+		cpdlc_msglist_stats_t st;
+
+		cpdlc_msglist_get_stats(stations[i].ml, &st);
+		ml_stats.tx_resp.count += st.tx_resp.count;
+		ml_stats.tx_resp.sum += st.tx_resp.sum;
+		ml_stats.tx_resp.max = MAX(ml_stats.tx_resp.max,
+		    st.tx_resp.max);
+		ml_stats.num_timeouts += st.num_timeouts;
+	}
+	clean = (loss == 0 && reorder == 0 && kill_rate == 0);
+	ok = (sim.reqs != 0 && (!clean || (sim.error_msgs == 0 &&
+	    net.srv_errors == 0 && net.bad_lines == 0)));
+
+	printf("{\"seed\": %llu, \"aircraft\": %u, \"atc\": %u, "
+	    "\"sim_time_s\": %.0f, \"wall_time_s\": %.3f, "
+	    "\"speedup\": %.0f,\n", (unsigned long long)seed, num_acft,
+	    num_atc, (sim_now - sim_start) / 1e6, wall_t / 1e6,
+	    (sim_now - sim_start) / (double)MAX(wall_t, 1));
+	printf(" \"net\": {\"lines_sent\": %llu, \"lost\": %llu, "
+	    "\"reordered\": %llu, \"delivered\": %llu, \"dropped\": %llu,\n"
+	    "    \"conns\": %llu, \"kills\": %llu, \"grace_closes\": %llu, "
+	    "\"bad_lines\": %llu},\n",
+	    (unsigned long long)net.lines_sent,
+	    (unsigned long long)net.lines_lost,
+	    (unsigned long long)net.lines_reordered,
+	    (unsigned long long)net.lines_delivered,
+	    (unsigned long long)net.lines_dropped,
+	    (unsigned long long)net.conns, (unsigned long long)net.kills,
+	    (unsigned long long)net.grace_closes,
+	    (unsigned long long)net.bad_lines);
+	printf(" \"router\": {\"logons\": %llu, \"routed\": %llu, "
+	    "\"queued\": %llu, \"dequeued\": %llu, \"expired\": %llu, "
+	    "\"errors\": %llu},\n", (unsigned long long)net.logons,
+	    (unsigned long long)net.routed, (unsigned long long)net.queued,
+	    (unsigned long long)net.dequeued, (unsigned long long)net.expired,
+	    (unsigned long long)net.srv_errors);
+	printf(" \"stations\": {\"sessions\": %llu, \"drops\": %llu, "
+	    "\"requests\": %llu, \"clearances\": %llu, \"wilcos\": %llu,\n"
+	    "    \"late_wilcos\": %llu, \"auto_timeouts\": %llu, "
+	    "\"msglist_timeouts\": %llu, \"stale_threads\": %llu, "
+	    "\"error_msgs\": %llu},\n",
+	    (unsigned long long)sim.sessions, (unsigned long long)sim.drops,
+	    (unsigned long long)sim.reqs, (unsigned long long)sim.clearances,
+	    (unsigned long long)sim.wilcos,
+	    (unsigned long long)sim.late_wilcos,
+	    (unsigned long long)sim.auto_timeouts,
+	    (unsigned long long)ml_stats.num_timeouts,
+	    (unsigned long long)sim.stale_thrs,
+	    (unsigned long long)sim.error_msgs);
+	printf(" \"threads\": {");
+	for (int i = 0; i <= CPDLC_MSG_THR_CONN_ENDED; i++) {
+		printf("%s\"%s\": %llu", i != 0 ? ", " : "",
+		    thr_status_names[i], (unsigned long long)sim.thr_status[i]);
+	}
+	printf("},\n ");
+	samples_print_json(stdout, "msg_latency_us", &msg_lat);
+	printf(",\n ");
+	samples_print_json(stdout, "txn_latency_us", &txn_lat);
+	printf(",\n \"digest\": \"%016llx\", \"pass\": %s}\n",
+	    (unsigned long long)digest, ok ? "true" : "false");
+
+	for (unsigned i = 0; i < num_stations; i++)
+		station_fini(&stations[i]);
+	free(stations);
+	while (heap_len != 0) {
+		sim_pkt_t *pkt = heap_pop();
+
+		conn_rele(pkt->conn);
+		free(pkt->line);
+		free(pkt);
+	}
+	free(heap);
+	for (queued_line_t *ql; (ql = list_remove_head(&srv_queue)) != NULL;) {
+		free(ql->line);
+		free(ql);
+	}
+	list_destroy(&srv_queue);
+	ASSERT0(list_count(&srv_conns));
+	list_destroy(&srv_conns);
+	samples_free(&msg_lat);
+	samples_free(&txn_lat);
+	cpdlc_clock_set_func(NULL, NULL);
+
+	return (ok ? 0 : 1);
+}
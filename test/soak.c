@@ -0,0 +1,869 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Long-duration soak test for cpdlcd. Keeps a steady population of
+ * short-lived aircraft sessions cycling against a running server for
+ * hours: every session connects, logs on, runs a few DM6 -> UM20
+ * request/clearance exchanges with a long-lived ATC station and then
+ * either logs off cleanly or disappears in the middle of a transaction,
+ * leaving the server with pending output and undeliverable replies.
+ * Aircraft callsigns are reused by later sessions, so some of those
+ * replies are delivered from the message queue and the rest expire.
+ * On top of that we:
+ *
+ *	- have the ATC stations send a trickle of messages to callsigns
+ *	  which never log on, so they go through queue expiry, and
+ *	- open raw TCP connections which are reset right away, after a
+ *	  bogus handshake, or after idling for a few seconds.
+ *
+ * While that runs, we periodically sample the server's RSS and open
+ * file descriptors from procfs, plus its heap usage and fragmentation
+ * through the admin socket ("heap" command), if given one. After the
+ * warmup period, each metric must reach a steady state: if the average
+ * of the last quarter of the samples has grown past the tolerance over
+ * the average of the first quarter, while the overall trend is upward,
+ * the metric is flagged as leaking and we exit with a non-zero status.
+ * A metric which was sampled, but has too few valid samples past the
+ * warmup to tell, is reported as skipped and also fails the run.
+ *
+ * To get through many sessions and queue expiries per hour, run the
+ * server with a short "msgqueue/timeout" (soak.sh does all the setup).
+ * The results are printed as a JSON object on stdout.
+ */
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../src/cpdlc_alloc.h"
+#include "../src/cpdlc_assert.h"
+#include "../src/cpdlc_client.h"
+#include "../src/cpdlc_thread.h"
+
+#include "bench.h"
+
+#define	ACFT_PREFIX	"SK"
+#define	ATC_PREFIX	"ATC"
+#define	OFFLINE_PREFIX	"QX"
+#define	NUM_OFFLINE	1000
+#define	WAKEUP_INTVAL	10000		/* us */
+#define	LOGON_TIMEOUT	30000000llu	/* us */
+#define	REPLY_TIMEOUT	30000000llu	/* us */
+/* Max pause between sessions */
+#define	MAX_HOLD	2000000		/* us */
+#define	MAX_RAW_IDLE	5000000		/* us */
+#define	MIN_TREND_SAMPLES	8
+
+typedef enum {
+	SLOT_IDLE,
+	SLOT_LOGON,
+	SLOT_ACTIVE
+} slot_state_t;
+
+typedef struct {
+	cpdlc_client_t	*cl;
+	char		callsign[16];
+	unsigned	atc_idx;
+	slot_state_t	state;
+	/* next action or timeout, microclock */
+	uint64_t	deadline;
+	unsigned	msgs_left;
+	/* drop out mid-transaction */
+	bool		abrupt;
+	unsigned	next_min;
+	unsigned	sent_min;
+} slot_t;
+
+typedef struct {
+	cpdlc_client_t	*cl;
+	char		callsign[16];
+	unsigned	next_min;
+} atc_t;
+
+typedef struct {
+	int		fd;
+	uint64_t	close_t;
+} raw_conn_t;
+
+/*
+ * Metrics which must settle. Heap metrics are only valid if we were
+ * given the admin socket. Fragmentation is kept in percent, so that its
+ * tolerance is in percentage points.
+ */
+enum {
+	M_RSS_KB,
+	M_FDS,
+	M_HEAP_IN_USE_KB,
+	M_HEAP_ARENA_KB,
+	M_HEAP_FRAG_PCT,
+	M_SELF_FDS,
+	NUM_METRICS
+};
+
+static const struct {
+	const char	*name;
+	/* growth below this is never a leak */
+	double		abs_tol;
+} metric_info[NUM_METRICS] = {
+	{ "rss_kb", 2048 },
+	{ "fds", 16 },
+	{ "heap_in_use_kb", 1024 },
+	{ "heap_arena_kb", 2048 },
+	{ "heap_frag_pct", 5 },
+	{ "self_fds", 16 }
+};
+
+typedef struct {
+	double		t;		/* seconds since start */
+	bool		valid[NUM_METRICS];
+	double		val[NUM_METRICS];
+} sample_t;
+
+static mutex_t		wakeup_lock;
+static condvar_t	wakeup_cv;
+static bool		wakeup_pending = false;
+
+static const char	*host = "localhost";
+static unsigned		port = 0;
+static const char	*ca_file = NULL;
+
+static slot_t		*slots = NULL;
+static unsigned		num_slots = 50;
+static atc_t		*atc = NULL;
+static unsigned		num_atc = 2;
+static unsigned		msgs_per_sess = 3;
+static unsigned		abrupt_pct = 30;
+static double		raw_rate = 5;
+static double		offline_rate = 5;
+
+static raw_conn_t	*raw_conns = NULL;
+static unsigned		num_raw_conns = 0;
+static struct addrinfo	*srv_ai = NULL;
+
+static sample_t		*samples = NULL;
+static unsigned		num_samples = 0;
+
+static struct {
+	uint64_t	sessions;
+	uint64_t	abrupt;
+	uint64_t	logon_fail;
+	uint64_t	reply_timeouts;
+	uint64_t	msgs_sent;
+	uint64_t	msgs_rcvd;
+	/* replies meant for an earlier session */
+	uint64_t	stale;
+	uint64_t	offline_sent;
+	uint64_t	raw_conns;
+	uint64_t	errors;
+} totals;
+
+static void
+msg_recv_cb(cpdlc_client_t *cl)
+{
+	UNUSED(cl);
+	mutex_enter(&wakeup_lock);
+	wakeup_pending = true;
+	cv_broadcast(&wakeup_cv);
+	mutex_exit(&wakeup_lock);
+}
+
+static void
+wait_wakeup(void)
+{
+	uint64_t deadline = cpdlc_thread_microclock() + WAKEUP_INTVAL;
+
+	mutex_enter(&wakeup_lock);
+	while (!wakeup_pending) {
+		if (cv_timedwait(&wakeup_cv, &wakeup_lock, deadline) != 0)
+			break;
+	}
+	wakeup_pending = false;
+	mutex_exit(&wakeup_lock);
+}
+
+static uint64_t
+rand_us(uint64_t max_us)
+{
+	return ((uint64_t)((rand() / (RAND_MAX + 1.0)) * max_us));
+}
+
+static cpdlc_client_t *
+client_alloc(bool is_atc)
+{
+	cpdlc_client_t *cl = cpdlc_client_alloc(is_atc);
+
+	cpdlc_client_set_host(cl, host);
+	cpdlc_client_set_port(cl, port);
+	if (ca_file != NULL)
+		cpdlc_client_set_ca_file(cl, ca_file);
+	cpdlc_client_set_msg_recv_cb(cl, msg_recv_cb);
+
+	return (cl);
+}
+
+static bool
+send_alt_msg(cpdlc_client_t *cl, bool dl, int msg_type, const char *to,
+    unsigned min, unsigned mrn, int alt)
+{
+	cpdlc_msg_t *msg = cpdlc_msg_alloc(CPDLC_PKT_CPDLC);
+	int seg = cpdlc_msg_add_seg(msg, dl, msg_type, 0);
+	bool fl = true, ok;
+
+	cpdlc_msg_seg_set_arg(msg, seg, 0, &fl, &alt);
+	if (to != NULL)
+		cpdlc_msg_set_to(msg, to);
+	cpdlc_msg_set_min(msg, min);
+	if (mrn != CPDLC_INVALID_MSG_SEQ_NR)
+		cpdlc_msg_set_mrn(msg, mrn);
+	ok = (cpdlc_client_send_msg(cl, msg) != CPDLC_INVALID_MSG_TOKEN);
+	cpdlc_msg_free(msg);
+	if (ok)
+		totals.msgs_sent++;
+	else
+		totals.errors++;
+
+	return (ok);
+}
+
+static void
+slot_send_req(slot_t *slot, uint64_t now)
+{
+	slot->sent_min = slot->next_min++;
+	slot->deadline = now + REPLY_TIMEOUT;
+	send_alt_msg(slot->cl, true, CPDLC_DM6_REQ_alt, NULL, slot->sent_min,
+	    CPDLC_INVALID_MSG_SEQ_NR, 200 + (slot->sent_min % 20) * 10);
+}
+
+static void
+slot_end(slot_t *slot, uint64_t now)
+{
+	if (!slot->abrupt)
+		cpdlc_client_logoff(slot->cl);
+	cpdlc_client_free(slot->cl);
+	slot->cl = NULL;
+	slot->state = SLOT_IDLE;
+	slot->deadline = now + rand_us(MAX_HOLD);
+	totals.sessions++;
+}
+
+static void
+slot_start(slot_t *slot, uint64_t now)
+{
+	slot->cl = client_alloc(false);
+	slot->state = SLOT_LOGON;
+	slot->deadline = now + LOGON_TIMEOUT;
+	slot->msgs_left = 1 + rand() % MAX(msgs_per_sess, 1);
+	slot->abrupt = ((unsigned)(rand() % 100) < abrupt_pct);
+	if (slot->abrupt)
+		totals.abrupt++;
+	cpdlc_client_logon(slot->cl, "ACFT", slot->callsign,
+	    atc[slot->atc_idx].callsign);
+}
+
+static void
+slot_drain(slot_t *slot, uint64_t now)
+{
+	cpdlc_msg_t *msg;
+
+	while ((msg = cpdlc_client_recv_msg(slot->cl)) != NULL) {
+		totals.msgs_rcvd++;
+		if (slot->state != SLOT_ACTIVE || cpdlc_msg_get_dl(msg) ||
+		    cpdlc_msg_get_mrn(msg) != slot->sent_min) {
+			totals.stale++;
+			cpdlc_msg_free(msg);
+			continue;
+		}
+		cpdlc_msg_free(msg);
+		/* Acknowledge the clearance */
+		{
+			cpdlc_msg_t *wilco = cpdlc_msg_alloc(CPDLC_PKT_CPDLC);
+
+			cpdlc_msg_add_seg(wilco, true, CPDLC_DM0_WILCO, 0);
+			cpdlc_msg_set_min(wilco, slot->next_min++);
+			cpdlc_msg_set_mrn(wilco, slot->sent_min);
+			if (cpdlc_client_send_msg(slot->cl, wilco) ==
+			    CPDLC_INVALID_MSG_TOKEN) {
+				totals.errors++;
+			} else {
+				totals.msgs_sent++;
+			}
+			cpdlc_msg_free(wilco);
+		}
+		ASSERT(slot->msgs_left != 0);
+		slot->msgs_left--;
+		if (slot->msgs_left == 0) {
+			slot_end(slot, now);
+			return;
+		}
+		slot_send_req(slot, now);
+		/*
+		 * Abrupt sessions vanish with the last request still
+		 * outstanding, so the reply ends up queued.
+		 */
+		if (slot->abrupt && slot->msgs_left == 1) {
+			slot_end(slot, now);
+			return;
+		}
+	}
+}
+
+static void
+slot_process(slot_t *slot, uint64_t now)
+{
+	switch (slot->state) {
+	case SLOT_IDLE:
+		if (now >= slot->deadline)
+			slot_start(slot, now);
+		break;
+	case SLOT_LOGON:
+		if (cpdlc_client_get_logon_status(slot->cl, NULL) ==
+		    CPDLC_LOGON_COMPLETE) {
+			slot->state = SLOT_ACTIVE;
+			slot_send_req(slot, now);
+			if (slot->abrupt && slot->msgs_left == 1)
+				slot_end(slot, now);
+		} else if (now >= slot->deadline) {
+			totals.logon_fail++;
+			slot_end(slot, now);
+		}
+		break;
+	case SLOT_ACTIVE:
+		slot_drain(slot, now);
+		if (slot->state == SLOT_ACTIVE && now >= slot->deadline) {
+			totals.reply_timeouts++;
+			slot_end(slot, now);
+		}
+		break;
+	}
+}
+
+/*
+ * ATC stations answer every altitude request with a clearance. Anything
+ * else (WILCOs, errors about undeliverable messages) is just counted.
+ */
+static void
+atc_drain(atc_t *st)
+{
+	cpdlc_msg_t *msg;
+
+	while ((msg = cpdlc_client_recv_msg(st->cl)) != NULL) {
+		totals.msgs_rcvd++;
+		if (cpdlc_msg_get_dl(msg) && cpdlc_msg_get_num_segs(msg) != 0 &&
+		    msg->segs[0].info->msg_type == CPDLC_DM6_REQ_alt &&
+		    cpdlc_msg_get_from(msg) != NULL) {
+			int alt = 0;
+			bool fl = false;
+
+			cpdlc_msg_seg_get_arg(msg, 0, 0, &fl, 0, &alt);
+			send_alt_msg(st->cl, false, CPDLC_UM20_CLB_TO_alt,
+			    cpdlc_msg_get_from(msg), st->next_min++,
+			    cpdlc_msg_get_min(msg), alt);
+		}
+		cpdlc_msg_free(msg);
+	}
+}
+
+static void
+send_offline_msg(uint64_t now)
+{
+	atc_t *st = &atc[rand() % num_atc];
+	char to[16];
+
+	UNUSED(now);
+	snprintf(to, sizeof (to), "%s%04u", OFFLINE_PREFIX,
+	    (unsigned)(rand() % NUM_OFFLINE));
+	if (send_alt_msg(st->cl, false, CPDLC_UM20_CLB_TO_alt, to,
+	    st->next_min++, CPDLC_INVALID_MSG_SEQ_NR, 300))
+		totals.offline_sent++;
+}
+
+/*
+ * Opens a raw TCP connection to the server which never completes a TLS
+ * handshake. It is either reset immediately, gets a bogus handshake
+ * record first, or sits idle for a while before being reset.
+ */
+static void
+raw_conn_open(uint64_t now)
+{
+	struct linger lg = { .l_onoff = 1, .l_linger = 0 };
+	int fd = socket(srv_ai->ai_family, SOCK_STREAM, 0);
+	int kind = rand() % 3;
+
+	totals.raw_conns++;
+	if (fd == -1) {
+		totals.errors++;
+		return;
+	}
+	/* Closing with a zero linger time sends a RST */
+	(void) setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof (lg));
+	if (connect(fd, srv_ai->ai_addr, srv_ai->ai_addrlen) != 0) {
+		totals.errors++;
+		close(fd);
+		return;
+	}
+	if (kind == 0) {
+		close(fd);
+		return;
+	}
+	if (kind == 1) {
+		static const uint8_t bogus[] = {
+		    0x16, 0x03, 0x01, 0x00, 0x40, 0x01, 0x00, 0x00, 0x3c
+		};
+		(void) write(fd, bogus, sizeof (bogus));
+	}
+	raw_conns = safe_realloc(raw_conns, (num_raw_conns + 1) *
+	    sizeof (*raw_conns));
+	raw_conns[num_raw_conns].fd = fd;
+	raw_conns[num_raw_conns].close_t = now + rand_us(MAX_RAW_IDLE);
+	num_raw_conns++;
+}
+
+static void
+raw_conns_expire(uint64_t now, bool all)
+{
+	for (unsigned i = 0; i < num_raw_conns;) {
+		if (all || now >= raw_conns[i].close_t) {
+			close(raw_conns[i].fd);
+			raw_conns[i] = raw_conns[--num_raw_conns];
+		} else {
+			i++;
+		}
+	}
+}
+
+/*
+ * Queries the server's heap statistics over the admin socket.
+ */
+static bool
+admin_heap_get(const char *sock_path, sample_t *s)
+{
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	char buf[1024];
+	size_t len = 0;
+	ssize_t n;
+	int fd;
+	unsigned long long in_use = 0, arena = 0;
+	double frag = 0;
+	bool have_in_use = false, have_arena = false, have_frag = false;
+
+	if (strlen(sock_path) >= sizeof (sa.sun_path))
+		return (false);
+	strcpy(sa.sun_path, sock_path);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+		return (false);
+	if (connect(fd, (struct sockaddr *)&sa, sizeof (sa)) != 0 ||
+	    write(fd, "heap\n", 5) != 5) {
+		close(fd);
+		return (false);
+	}
+	while (len + 1 < sizeof (buf) &&
+	    (n = read(fd, &buf[len], sizeof (buf) - len - 1)) > 0)
+		len += n;
+	close(fd);
+	buf[len] = '\0';
+
+	for (char *line = strtok(buf, "\n"); line != NULL;
+	    line = strtok(NULL, "\n")) {
+		if (sscanf(line, "in_use_bytes %llu", &in_use) == 1)
+			have_in_use = true;
+		else if (sscanf(line, "arena_bytes %llu", &arena) == 1)
+			have_arena = true;
+		else if (sscanf(line, "fragmentation %lf", &frag) == 1)
+			have_frag = true;
+	}
+	s->val[M_HEAP_IN_USE_KB] = in_use / 1024.0;
+	s->valid[M_HEAP_IN_USE_KB] = have_in_use;
+	s->val[M_HEAP_ARENA_KB] = arena / 1024.0;
+	s->valid[M_HEAP_ARENA_KB] = have_arena;
+	s->val[M_HEAP_FRAG_PCT] = frag * 100;
+	s->valid[M_HEAP_FRAG_PCT] = have_frag;
+
+	return (have_in_use && have_arena && have_frag);
+}
+
+static void
+take_sample(double t, int srv_pid, const char *admin_sock, FILE *csv)
+{
+	sample_t *s;
+	proc_stats_t ps;
+
+	samples = safe_realloc(samples, (num_samples + 1) * sizeof (*samples));
+	s = &samples[num_samples++];
+	memset(s, 0, sizeof (*s));
+	s->t = t;
+
+	proc_stats_get(srv_pid, &ps);
+	if (ps.valid) {
+		s->val[M_RSS_KB] = ps.rss_kb;
+		s->val[M_FDS] = ps.num_fds;
+		s->valid[M_RSS_KB] = s->valid[M_FDS] = true;
+	}
+	proc_stats_get(getpid(), &ps);
+	if (ps.valid) {
+		s->val[M_SELF_FDS] = ps.num_fds;
+		s->valid[M_SELF_FDS] = true;
+	}
+	if (admin_sock != NULL && !admin_heap_get(admin_sock, s))
+		fprintf(stderr, "Can't query heap stats from %s\n", admin_sock);
+
+	if (csv != NULL) {
+		fprintf(csv, "%.1f,%.0f,%.0f,%.0f,%.0f,%.4f,%.0f,%llu,%llu\n",
+		    s->t, s->val[M_RSS_KB], s->val[M_FDS],
+		    s->val[M_HEAP_IN_USE_KB], s->val[M_HEAP_ARENA_KB],
+		    s->val[M_HEAP_FRAG_PCT] / 100,
+		    s->val[M_SELF_FDS], (unsigned long long)totals.sessions,
+		    (unsigned long long)totals.errors);
+		fflush(csv);
+	}
+}
+
+/*
+ * Checks whether a metric has settled after the warmup period. Prints
+ * the verdict as a JSON object member and returns false on a leak, or
+ * if there aren't enough valid samples past the warmup to tell.
+ */
+static bool
+check_trend(int m, double warmup_t, double tol, bool first)
+{
+	unsigned start = 0, n, q;
+	double first_avg = 0, last_avg = 0, growth, limit, slope;
+	double sx = 0, sy = 0, sxx = 0, sxy = 0;
+	bool ok;
+
+	while (start < num_samples && samples[start].t < warmup_t)
+		start++;
+	n = 0;
+	for (unsigned i = start; i < num_samples; i++)
+		n += samples[i].valid[m];
+	if (n != num_samples - start || n < MIN_TREND_SAMPLES) {
+		const char *why = (n != num_samples - start ?
+		    "invalid samples" : "insufficient data");
+
+		fprintf(stderr, "%s: %s (%u of %u samples valid past the "
+		    "warmup, need %u), trend not checked\n",
+		    metric_info[m].name, why, n, num_samples - start,
+		    MIN_TREND_SAMPLES);
+		printf("%s    \"%s\": {\"samples\": %u, \"valid\": %u, "
+		    "\"skipped\": \"%s\", \"ok\": false}", first ? "" : ",\n",
+		    metric_info[m].name, num_samples - start, n, why);
+		return (false);
+	}
+
+	q = n / 4;
+	for (unsigned i = 0; i < q; i++) {
+		first_avg += samples[start + i].val[m] / q;
+		last_avg += samples[num_samples - q + i].val[m] / q;
+	}
+	for (unsigned i = start; i < num_samples; i++) {
+		double x = samples[i].t / 3600, y = samples[i].val[m];
+
+		sx += x;
+		sy += y;
+		sxx += x * x;
+		sxy += x * y;
+	}
+	slope = (n * sxy - sx * sy) / MAX(n * sxx - sx * sx, 1e-12);
+	growth = last_avg - first_avg;
+	limit = MAX(metric_info[m].abs_tol, first_avg * tol);
+	ok = (growth <= limit || slope <= 0);
+
+	printf("%s    \"%s\": {\"first\": %.1f, \"last\": %.1f, "
+	    "\"growth\": %.1f, \"limit\": %.1f, \"slope_per_h\": %.1f, "
+	    "\"ok\": %s}", first ? "" : ",\n", metric_info[m].name,
+	    first_avg, last_avg, growth, limit, slope, ok ? "true" : "false");
+
+	return (ok);
+}
+
+static void
+print_usage(const char *progname, FILE *fp)
+{
+	fprintf(fp, "Usage: %s [-h] [-s <host>] [-p <port>] [-c <cafile>] "
+	    "[-d <duration>]\n"
+	    "    [-n <aircraft>] [-m <atc>] [-k <msgs>] [-x <pct>] "
+	    "[-R <rate>] [-q <rate>]\n"
+	    "    [-i <interval>] [-w <warmup>] [-g <pct>] [-S <seed>] "
+	    "[-P <pid>] [-A <socket>]\n"
+	    "    [-o <samples.csv>]\n"
+	    "\n"
+	    "  -s <host>       cpdlcd hostname (default: localhost)\n"
+	    "  -p <port>       cpdlcd port (default: library default)\n"
+	    "  -c <cafile>     CA certificate file for server validation\n"
+	    "  -d <duration>   test duration in seconds (default: 3600)\n"
+	    "  -n <aircraft>   concurrent aircraft sessions (default: 50)\n"
+	    "  -m <atc>        number of ATC stations (default: 2)\n"
+	    "  -k <msgs>       max request/clearance exchanges per session "
+	    "(default: 3)\n"
+	    "  -x <pct>        percentage of sessions which drop out "
+	    "mid-transaction\n"
+	    "                  (default: 30)\n"
+	    "  -R <rate>       raw TCP connections per second (default: 5)\n"
+	    "  -q <rate>       messages per second to callsigns which never "
+	    "log on\n"
+	    "                  (default: 5)\n"
+	    "  -i <interval>   sampling interval in seconds (default: 10)\n"
+	    "  -w <warmup>     fraction of the run to ignore for trend "
+	    "checks\n"
+	    "                  (default: 0.25)\n"
+	    "  -g <pct>        tolerated growth past the steady state, in "
+	    "percent\n"
+	    "                  (default: 10)\n"
+	    "  -S <seed>       random seed (default: 1)\n"
+	    "  -P <pid>        cpdlcd process ID for RSS/fd sampling\n"
+	    "  -A <socket>     cpdlcd admin socket for heap sampling\n"
+	    "  -o <file>       write all samples to <file> in CSV format\n",
+	    progname);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned duration = 3600, interval = 10, seed = 1;
+	double warmup = 0.25, tol_pct = 10;
+	const char *admin_sock = NULL, *csv_path = NULL;
+	int opt, srv_pid = 0, error;
+	char port_str[16];
+	struct addrinfo hints = {
+	    .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM
+	};
+	uint64_t t_start, t_end, next_sample, next_raw, next_offline, now;
+	FILE *csv = NULL;
+	bool ok = true, first = true;
+
+	while ((opt = getopt(argc, argv,
+	    "hs:p:c:d:n:m:k:x:R:q:i:w:g:S:P:A:o:")) != -1) {
+		switch (opt) {
+		case 'h':
+			print_usage(argv[0], stdout);
+			return (0);
+		case 's':
+			host = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'c':
+			ca_file = optarg;
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'n':
+			num_slots = atoi(optarg);
+			break;
+		case 'm':
+			num_atc = atoi(optarg);
+			break;
+		case 'k':
+			msgs_per_sess = atoi(optarg);
+			break;
+		case 'x':
+			abrupt_pct = atoi(optarg);
+			break;
+		case 'R':
+			raw_rate = atof(optarg);
+			break;
+		case 'q':
+			offline_rate = atof(optarg);
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		case 'w':
+			warmup = atof(optarg);
+			break;
+		case 'g':
+			tol_pct = atof(optarg);
+			break;
+		case 'S':
+			seed = atoi(optarg);
+			break;
+		case 'P':
+			srv_pid = atoi(optarg);
+			break;
+		case 'A':
+			admin_sock = optarg;
+			break;
+		case 'o':
+			csv_path = optarg;
+			break;
+		default:
+			print_usage(argv[0], stderr);
+			return (1);
+		}
+	}
+	if (num_slots == 0 || num_atc == 0 || interval == 0) {
+		fprintf(stderr, "Need at least one aircraft and one ATC "
+		    "station and a non-zero sampling interval\n");
+		return (1);
+	}
+	srand(seed);
+
+	snprintf(port_str, sizeof (port_str), "%u", port != 0 ? port : 17622);
+	if ((error = getaddrinfo(host, port_str, &hints, &srv_ai)) != 0) {
+		fprintf(stderr, "Can't resolve %s: %s\n", host,
+		    gai_strerror(error));
+		return (1);
+	}
+	if (csv_path != NULL) {
+		if ((csv = fopen(csv_path, "w")) == NULL) {
+			fprintf(stderr, "Can't write %s: %s\n", csv_path,
+			    strerror(errno));
+			return (1);
+		}
+		fprintf(csv, "time_s,rss_kb,fds,heap_in_use_kb,heap_arena_kb,"
+		    "fragmentation,self_fds,sessions,errors\n");
+	}
+
+	mutex_init(&wakeup_lock);
+	cv_init(&wakeup_cv);
+	atc = safe_calloc(num_atc, sizeof (*atc));
+	slots = safe_calloc(num_slots, sizeof (*slots));
+
+	/* The ATC stations stay logged on for the whole run */
+	t_start = cpdlc_thread_microclock();
+	for (unsigned i = 0; i < num_atc; i++) {
+		snprintf(atc[i].callsign, sizeof (atc[i].callsign), "%s%04u",
+		    ATC_PREFIX, i);
+		atc[i].cl = client_alloc(true);
+		cpdlc_client_logon(atc[i].cl, ATC_PREFIX, atc[i].callsign,
+		    atc[i].callsign);
+	}
+	for (unsigned i = 0; i < num_atc; i++) {
+		while (cpdlc_client_get_logon_status(atc[i].cl, NULL) !=
+		    CPDLC_LOGON_COMPLETE) {
+			if (cpdlc_thread_microclock() - t_start >
+			    LOGON_TIMEOUT) {
+				fprintf(stderr, "Timed out waiting for ATC "
+				    "station %s to log on\n", atc[i].callsign);
+				ok = false;
+				goto out;
+			}
+			usleep(WAKEUP_INTVAL);
+		}
+	}
+	for (unsigned i = 0; i < num_slots; i++) {
+		snprintf(slots[i].callsign, sizeof (slots[i].callsign),
+		    "%s%04u", ACFT_PREFIX, i);
+		slots[i].atc_idx = i % num_atc;
+		slots[i].deadline = t_start + rand_us(MAX_HOLD);
+	}
+
+	t_end = t_start + duration * 1000000llu;
+	next_sample = next_raw = next_offline = t_start;
+	while ((now = cpdlc_thread_microclock()) < t_end) {
+		for (unsigned i = 0; i < num_atc; i++)
+			atc_drain(&atc[i]);
+		for (unsigned i = 0; i < num_slots; i++)
+			slot_process(&slots[i], now);
+		if (raw_rate > 0) {
+			for (; next_raw <= now; next_raw += 1000000 / raw_rate)
+				raw_conn_open(now);
+		}
+		raw_conns_expire(now, false);
+		if (offline_rate > 0) {
+			for (; next_offline <= now;
+			    next_offline += 1000000 / offline_rate)
+				send_offline_msg(now);
+		}
+		if (now >= next_sample) {
+			take_sample((now - t_start) / 1000000.0, srv_pid,
+			    admin_sock, csv);
+			next_sample += interval * 1000000llu;
+		}
+		wait_wakeup();
+	}
+	/* One last sample, so the final state is always included */
+	take_sample((cpdlc_thread_microclock() - t_start) / 1000000.0,
+	    srv_pid, admin_sock, csv);
+
+	printf("{\"duration_s\": %u, \"aircraft\": %u, \"atc\": %u, "
+	    "\"samples\": %u,\n", duration, num_slots, num_atc, num_samples);
+	printf(" \"totals\": {\"sessions\": %llu, \"abrupt\": %llu, "
+	    "\"logon_fail\": %llu, \"reply_timeouts\": %llu,\n"
+	    "    \"msgs_sent\": %llu, \"msgs_rcvd\": %llu, \"stale\": %llu, "
+	    "\"offline_sent\": %llu, \"raw_conns\": %llu, \"errors\": %llu},\n",
+	    (unsigned long long)totals.sessions,
+	    (unsigned long long)totals.abrupt,
+	    (unsigned long long)totals.logon_fail,
+	    (unsigned long long)totals.reply_timeouts,
+	    (unsigned long long)totals.msgs_sent,
+	    (unsigned long long)totals.msgs_rcvd,
+	    (unsigned long long)totals.stale,
+	    (unsigned long long)totals.offline_sent,
+	    (unsigned long long)totals.raw_conns,
+	    (unsigned long long)totals.errors);
+	if (num_samples != 0 &&
+	    samples[num_samples - 1].valid[M_HEAP_FRAG_PCT]) {
+		printf(" \"final_fragmentation\": %.4f,\n",
+		    samples[num_samples - 1].val[M_HEAP_FRAG_PCT] / 100);
+	}
+	printf(" \"trends\": {\n");
+	for (int m = 0; m < NUM_METRICS; m++) {
+		bool have = false;
+
+		for (unsigned i = 0; i < num_samples && !have; i++)
+			have = samples[i].valid[m];
+		if (!have)
+			continue;
+		if (!check_trend(m, duration * warmup, tol_pct / 100, first))
+			ok = false;
+		first = false;
+	}
+	if (totals.sessions == 0)
+		ok = false;
+	printf("\n },\n \"pass\": %s}\n", ok ? "true" : "false");
+out:
+	raw_conns_expire(0, true);
+	free(raw_conns);
+	for (unsigned i = 0; i < num_slots; i++) {
+		if (slots[i].cl != NULL)
+			cpdlc_client_free(slots[i].cl);
+	}
+	for (unsigned i = 0; i < num_atc; i++) {
+		if (atc[i].cl != NULL) {
+			cpdlc_client_logoff(atc[i].cl);
+			cpdlc_client_free(atc[i].cl);
+		}
+	}
+	free(slots);
+	free(atc);
+	free(samples);
+	freeaddrinfo(srv_ai);
+	if (csv != NULL)
+		fclose(csv);
+	cv_destroy(&wakeup_cv);
+	mutex_destroy(&wakeup_lock);
+
+	return (ok ? 0 : 1);
+}
@@ -0,0 +1,102 @@
+#!/bin/bash
+#
+# Copyright 2019 Saso Kiselkov
+#
+# Permission is hereby granted, free of charge, to any person
+# obtaining a copy of this software and associated documentation
+# files (the "Software"), to deal in the Software without
+# restriction, including without limitation the rights to use,
+# copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following
+# conditions:
+#
+# The above copyright notice and this permission notice shall be
+# included in all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+# OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+# WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+
+# Runs the cpdlcd soak test on loopback. Like e2e_bench.sh, this starts
+# the mock authenticator and a private cpdlcd instance, this time with
+# the admin socket enabled (so soak can sample heap statistics) and a
+# short message queue timeout (so queued messages expire many times
+# over during the run). The JSON summary goes to stdout, the exit code
+# is non-zero if any resource didn't settle into a steady state.
+
+source "$(dirname "$0")/srv_env.sh"
+
+SOAK="${SOAK:-$TESTDIR/soak}"
+
+PORT=17692
+AUTH_PORT=17693
+DURATION=3600
+QUEUE_TIMEOUT=5
+CSVFILE=""
+SOAK_ARGS=()
+
+function usage() {
+	echo "Usage: $0 [-h] [-p <port>] [-d <duration>] [-t <timeout>]" \
+	    "[-o <samples.csv>]"
+	echo "    [-- <soak args>]"
+	echo "  -p <port>      cpdlcd port (default: $PORT, auth uses" \
+	    "port + 1)"
+	echo "  -d <duration>  test duration in seconds (default: $DURATION)"
+	echo "  -t <timeout>   cpdlcd msgqueue/timeout in seconds" \
+	    "(default: $QUEUE_TIMEOUT)"
+	echo "  -o <file>      write the resource samples into <file> as CSV"
+	echo "Arguments after -- are passed to soak, e.g. -n 200 -x 50."
+}
+
+while getopts "hp:d:t:o:" opt; do
+	case "$opt" in
+	h)
+		usage
+		exit 0
+		;;
+	p)
+		PORT="$OPTARG"
+		AUTH_PORT=$(( PORT + 1 ))
+		;;
+	d)
+		DURATION="$OPTARG"
+		;;
+	t)
+		QUEUE_TIMEOUT="$OPTARG"
+		;;
+	o)
+		CSVFILE="$OPTARG"
+		;;
+	*)
+		usage >&2
+		exit 1
+		;;
+	esac
+done
+shift $(( OPTIND - 1 ))
+SOAK_ARGS=("$@")
+if [ -n "$CSVFILE" ]; then
+	SOAK_ARGS+=(-o "$CSVFILE")
+fi
+
+srv_env_check_progs "$SOAK" || exit 1
+srv_env_init || exit 1
+srv_start_auth "$AUTH_PORT" || exit 1
+srv_start_cpdlcd "$PORT" "$AUTH_PORT" \
+    "admin/socket = $WORKDIR/admin.sock" \
+    "msgqueue/timeout = $QUEUE_TIMEOUT" || exit 1
+
+"$SOAK" -s localhost -p "$PORT" -c "$WORKDIR/ca_cert.pem" -d "$DURATION" \
+    -P "$SRV_PID" -A "$WORKDIR/admin.sock" "${SOAK_ARGS[@]}"
+RESULT=$?
+if [ $RESULT -ne 0 ]; then
+	echo "soak failed, last lines of the cpdlcd log follow:" >&2
+	tail -n 50 "$SRV_LOG" >&2
+fi
+exit $RESULT
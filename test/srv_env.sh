@@ -0,0 +1,131 @@
+#!/bin/bash
+#
+# Copyright 2019 Saso Kiselkov
+#
+# Permission is hereby granted, free of charge, to any person
+# obtaining a copy of this software and associated documentation
+# files (the "Software"), to deal in the Software without
+# restriction, including without limitation the rights to use,
+# copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following
+# conditions:
+#
+# The above copyright notice and this permission notice shall be
+# included in all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+# OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+# WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+
+# Common setup for the scripts which run test programs against a live
+# cpdlcd instance on loopback. Source it and then call:
+#
+#	srv_env_init
+#		Creates a scratch directory ($WORKDIR) with a throwaway CA
+#		($WORKDIR/ca_cert.pem) and server certificate. Everything
+#		started from here on is torn down when the script exits.
+#	srv_start_auth <port> [mock_auth args...]
+#		Starts mock_auth on 127.0.0.1:<port>.
+#	srv_start_cpdlcd <port> <auth_port> [config lines...]
+#		Starts cpdlcd on localhost:<port>, using the mock
+#		authenticator on <auth_port>. Extra lines are appended to
+#		the config file. Sets SRV_PID, the log is in $SRV_LOG.
+#
+# Build cpdlcd (in ../cpdlcd) and the test programs (`make' in this
+# directory) first.
+
+TESTDIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+TOPDIR="$(dirname "$TESTDIR")"
+CPDLCD="${CPDLCD:-$TOPDIR/cpdlcd/cpdlcd}"
+MOCK_AUTH="${MOCK_AUTH:-$TESTDIR/mock_auth}"
+
+PIDS=()
+
+function srv_env_cleanup() {
+	for pid in "${PIDS[@]}"; do
+		kill "$pid" 2> /dev/null
+		wait "$pid" 2> /dev/null
+	done
+	rm -rf "$WORKDIR"
+}
+
+# Checks that all the given programs have been built
+function srv_env_check_progs() {
+	for prog in "$@"; do
+		if ! [ -x "$prog" ]; then
+			echo "$prog not found, build it first" >&2
+			return 1
+		fi
+	done
+}
+
+# Waits for something to start listening on a local TCP port
+function wait_port() {
+	for (( i = 0; i < 100; i++ )); do
+		if (exec 3<> "/dev/tcp/127.0.0.1/$1") 2> /dev/null; then
+			return 0
+		fi
+		sleep 0.1
+	done
+	echo "Nothing listening on port $1" >&2
+	return 1
+}
+
+function srv_env_init() {
+	srv_env_check_progs "$CPDLCD" "$MOCK_AUTH" || return 1
+	WORKDIR="$(mktemp -d)"
+	trap srv_env_cleanup EXIT
+
+	# Same as gencerts.sh, but with unencrypted keys and no prompts
+	openssl req -x509 -newkey rsa:2048 -nodes -sha256 -days 1 -batch \
+	    -subj "/CN=cpdlc test CA" -keyout "$WORKDIR/ca_key.pem" \
+	    -out "$WORKDIR/ca_cert.pem" 2> /dev/null || return 1
+	openssl req -newkey rsa:2048 -nodes -sha256 -batch \
+	    -subj "/CN=localhost" -config "$TOPDIR/openssl.cnf" \
+	    -keyout "$WORKDIR/cpdlcd_key.pem" -out "$WORKDIR/csr.pem" \
+	    2> /dev/null || return 1
+	openssl x509 -sha256 -req -in "$WORKDIR/csr.pem" \
+	    -CA "$WORKDIR/ca_cert.pem" -CAkey "$WORKDIR/ca_key.pem" \
+	    -CAcreateserial -days 1 -out "$WORKDIR/cpdlcd_cert.pem" \
+	    -extfile "$TOPDIR/openssl.cnf" -extensions v3_req \
+	    2> /dev/null || return 1
+}
+
+function srv_start_auth() {
+	local port="$1"
+	shift
+	"$MOCK_AUTH" -l 127.0.0.1 -p "$port" "$@" &
+	PIDS+=($!)
+	wait_port "$port"
+}
+
+function srv_start_cpdlcd() {
+	local port="$1" auth_port="$2" line
+	shift 2
+
+	cat > "$WORKDIR/cpdlcd.conf" << EOF2
+listen/tcp/test = localhost:$port
+tls/keyfile = $WORKDIR/cpdlcd_key.pem
+tls/certfile = $WORKDIR/cpdlcd_cert.pem
+auth/url = http://127.0.0.1:$auth_port/
+EOF2
+	for line in "$@"; do
+		echo "$line" >> "$WORKDIR/cpdlcd.conf"
+	done
+
+	SRV_LOG="$WORKDIR/cpdlcd.log"
+	"$CPDLCD" -d -c "$WORKDIR/cpdlcd.conf" 2> "$SRV_LOG" &
+	SRV_PID=$!
+	PIDS+=($SRV_PID)
+	if ! wait_port "$port"; then
+		cat "$SRV_LOG" >&2
+		return 1
+	fi
+	ulimit -n 65536 2> /dev/null || ulimit -n "$(ulimit -Hn)"
+}
@@ -0,0 +1,1083 @@
+/*
+ * Copyright 2019 Saso Kiselkov
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Adversarial client stress test for cpdlcd. Runs the same closed-loop
+ * clearance traffic as e2e_bench between a set of well-behaved aircraft
+ * and ATC stations, first on its own to establish a baseline, and then
+ * alongside a mix of misbehaving clients:
+ *
+ *	slowread  Logs on and floods the server with PINGs, but never
+ *		  reads the PONGs, so the server's output buffer for the
+ *		  connection backs up until MAX_OUTBUF_SZ is hit.
+ *	trickle   Logs on and then sends PINGs one byte per TLS record,
+ *		  with a pause after every byte.
+ *	oversize  Logs on and sends a line longer than MAX_BUF_SZ.
+ *	preflood  Sends a line longer than MAX_BUF_SZ_NO_LOGON before
+ *		  logging on.
+ *	halfopen  Opens TCP connections which never complete the TLS
+ *		  handshake, so they sit around until the LOGON_GRACE_TIME
+ *		  expires. Unlike the others, the count for this one is the
+ *		  number of such connections held open at any one time.
+ *	storm     Connects, logs on and disconnects in a tight loop.
+ *
+ * For every kind of attack, we count the connections made and how many
+ * of them the server closed on its own, and measure how long it took it
+ * to do so. The well-behaved clients' transaction latency and throughput
+ * during the attack phase are then checked against the baseline: the
+ * 99th percentile latency must stay within the given ratio of the
+ * baseline (or within the given absolute slack, whichever is larger),
+ * and the throughput must not drop below the given fraction of the
+ * baseline. None of the well-behaved clients may lose its logon.
+ *
+ * As with e2e_bench, the server must use an authenticator which makes
+ * "ATC" logons ATC stations (stress.sh sets that up). The results are
+ * printed as a JSON object on stdout, and the exit code is non-zero if
+ * any of the targets was missed.
+ */
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <gnutls/gnutls.h>
+
+#include "../src/cpdlc_alloc.h"
+#include "../src/cpdlc_assert.h"
+#include "../src/cpdlc_client.h"
+#include "../src/cpdlc_thread.h"
+#include "../cpdlcd/framing.h"
+
+#include "bench.h"
+
+#define	ACFT_PREFIX	"ST"
+#define	ATC_PREFIX	"ATC"
+#define	WAKEUP_INTVAL	10000		/* us */
+#define	LOGON_TIMEOUT	30000000llu	/* us */
+#define	DFL_PORT	17622
+#define	SOCK_TIMEOUT	200000		/* us, per blocking socket op */
+#define	CLOSE_TIMEOUT	60000000llu	/* us, give up waiting for close */
+#define	SLOWREAD_RCVBUF	4096		/* bytes */
+#define	SLOWREAD_PAUSE	1000		/* us, between bursts of PINGs */
+#define	TRICKLE_LEN	20000000llu	/* us, length of a trickle session */
+
+typedef enum {
+	ADV_SLOWREAD,
+	ADV_TRICKLE,
+	ADV_OVERSIZE,
+	ADV_PREFLOOD,
+	ADV_HALFOPEN,
+	ADV_STORM,
+	NUM_ADV_KINDS
+} adv_kind_t;
+
+static const char *adv_names[NUM_ADV_KINDS] = {
+	"slowread", "trickle", "oversize", "preflood", "halfopen", "storm"
+};
+
+typedef struct {
+	uint64_t	conns;
+	uint64_t	conn_fails;	/* couldn't connect or log on */
+	uint64_t	srv_closes;	/* server hung up on us */
+	uint64_t	not_closed;	/* server didn't hang up in time */
+	uint64_t	bytes_sent;
+	samples_t	close_lat;	/* attack start to server hangup */
+} adv_stats_t;
+
+typedef struct {
+	adv_kind_t	kind;
+	unsigned	idx;
+	thread_t	thr;
+} adv_thr_t;
+
+typedef struct {
+	int			fd;
+	gnutls_session_t	sess;
+	bool			have_sess;
+} tls_conn_t;
+
+typedef enum {
+	TXN_IDLE,
+	TXN_REQ_SENT,
+	TXN_CLR_SENT,
+	TXN_WILCO_SENT
+} txn_state_t;
+
+typedef struct {
+	cpdlc_client_t	*cl;
+	char		callsign[16];
+	bool		is_atc;
+	unsigned	atc_idx;	/* aircraft only */
+	unsigned	next_min;
+	bool		logged_on;
+	txn_state_t	txn_state;
+	unsigned	txns_done;
+	uint64_t	txn_start;
+	unsigned	sent_min;
+} station_t;
+
+static const char	*host = "localhost";
+static unsigned		port = DFL_PORT;
+static const char	*ca_file = NULL;
+static struct addrinfo	*srv_ai = NULL;
+static gnutls_certificate_credentials_t xcred;
+
+static mutex_t		wakeup_lock;
+static condvar_t	wakeup_cv;
+static bool		wakeup_pending = false;
+
+static station_t	*acft = NULL;
+static unsigned		num_acft = 20;
+static station_t	*atc = NULL;
+static unsigned		num_atc = 2;
+
+/* Good client results, index 0 is the baseline, 1 the attack phase */
+static int		phase = 0;
+static samples_t	txn_lat[2] = {};
+static uint64_t		txns[2] = {0, 0};
+static uint64_t		errors = 0, good_drops = 0;
+
+static unsigned		adv_count[NUM_ADV_KINDS] = {
+	2, 4, 2, 2, 100, 2
+};
+static uint64_t		trickle_delay = 10000;	/* us */
+static volatile bool	adv_stop = false;
+static mutex_t		adv_lock;
+static adv_stats_t	adv_stats[NUM_ADV_KINDS] = {};
+
+static uint64_t
+now_us(void)
+{
+	return (cpdlc_thread_microclock());
+}
+
+static void
+adv_stat_add(uint64_t *field, uint64_t n)
+{
+	mutex_enter(&adv_lock);
+	*field += n;
+	mutex_exit(&adv_lock);
+}
+
+static void
+adv_closed(adv_kind_t kind, uint64_t attack_start)
+{
+	mutex_enter(&adv_lock);
+	adv_stats[kind].srv_closes++;
+	samples_add(&adv_stats[kind].close_lat, now_us() - attack_start);
+	mutex_exit(&adv_lock);
+}
+
+static int
+tcp_connect(int rcvbuf)
+{
+	struct timeval tv = { .tv_sec = 0, .tv_usec = SOCK_TIMEOUT };
+	int fd = socket(srv_ai->ai_family, SOCK_STREAM, 0);
+
+	if (fd == -1)
+		return (-1);
+	/* Must be set before connecting for the TCP window to shrink */
+	if (rcvbuf != 0) {
+		(void) setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+		    sizeof (rcvbuf));
+	}
+	(void) setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+	(void) setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+	if (connect(fd, srv_ai->ai_addr, srv_ai->ai_addrlen) != 0) {
+		close(fd);
+		return (-1);
+	}
+	return (fd);
+}
+
+static bool
+tls_open(tls_conn_t *tc, int rcvbuf)
+{
+	int err;
+
+	memset(tc, 0, sizeof (*tc));
+	tc->fd = tcp_connect(rcvbuf);
+	if (tc->fd == -1)
+		return (false);
+	VERIFY0(gnutls_init(&tc->sess, GNUTLS_CLIENT));
+	tc->have_sess = true;
+	VERIFY0(gnutls_set_default_priority(tc->sess));
+	VERIFY0(gnutls_credentials_set(tc->sess, GNUTLS_CRD_CERTIFICATE,
+	    xcred));
+	VERIFY0(gnutls_server_name_set(tc->sess, GNUTLS_NAME_DNS, host,
+	    strlen(host)));
+	gnutls_session_set_verify_cert(tc->sess, host, 0);
+	gnutls_transport_set_int(tc->sess, tc->fd);
+	do {
+		err = gnutls_handshake(tc->sess);
+	} while (err < 0 && !gnutls_error_is_fatal(err) && !adv_stop);
+
+	return (err == GNUTLS_E_SUCCESS);
+}
+
+static void
+tls_close(tls_conn_t *tc)
+{
+	if (tc->have_sess)
+		gnutls_deinit(tc->sess);
+	if (tc->fd != -1)
+		close(tc->fd);
+	tc->have_sess = false;
+	tc->fd = -1;
+}
+
+/*
+ * Sends the whole buffer, in records of at most `rec_sz' bytes. Returns
+ * false if the connection is gone.
+ */
+static bool
+tls_send(tls_conn_t *tc, adv_kind_t kind, const void *buf, size_t len,
+    size_t rec_sz)
+{
+	const uint8_t *p = buf;
+
+	while (len != 0 && !adv_stop) {
+		ssize_t n = gnutls_record_send(tc->sess, p, MIN(len, rec_sz));
+
+		if (n == GNUTLS_E_AGAIN || n == GNUTLS_E_INTERRUPTED)
+			continue;
+		if (n < 0)
+			return (false);
+		adv_stat_add(&adv_stats[kind].bytes_sent, n);
+		p += n;
+		len -= n;
+	}
+	return (true);
+}
+
+/*
+ * Reads and discards input until the server closes the connection.
+ * Returns false if it didn't do so by the deadline.
+ */
+static bool
+tls_wait_close(tls_conn_t *tc, uint64_t deadline)
+{
+	while (now_us() < deadline && !adv_stop) {
+		uint8_t buf[4096];
+		ssize_t n = gnutls_record_recv(tc->sess, buf, sizeof (buf));
+
+		if (n == 0 || (n < 0 && gnutls_error_is_fatal(n)))
+			return (true);
+	}
+	return (false);
+}
+
+/*
+ * Logs on and waits for the server to accept it.
+ */
+static bool
+tls_logon(tls_conn_t *tc, adv_kind_t kind, const char *from, size_t rec_sz)
+{
+	cpdlc_msg_t *msg = cpdlc_msg_alloc(CPDLC_PKT_CPDLC);
+	uint64_t deadline = now_us() + LOGON_TIMEOUT;
+	char buf[256], line[512] = "";
+	size_t line_len = 0;
+	bool ok;
+
+	cpdlc_msg_set_logon_data(msg, "ACFT");
+	cpdlc_msg_set_from(msg, from);
+	cpdlc_msg_set_to(msg, ATC_PREFIX "0000");
+	cpdlc_msg_set_min(msg, 0);
+	cpdlc_msg_encode(msg, buf, sizeof (buf));
+	cpdlc_msg_free(msg);
+	ok = tls_send(tc, kind, buf, strlen(buf), rec_sz);
+
+	while (ok && now_us() < deadline && !adv_stop) {
+		ssize_t n = gnutls_record_recv(tc->sess, &line[line_len],
+		    sizeof (line) - line_len - 1);
+
+		if (n == GNUTLS_E_AGAIN || n == GNUTLS_E_INTERRUPTED)
+			continue;
+		if (n <= 0)
+			return (false);
+		line_len += n;
+		line[line_len] = '\0';
+		if (strstr(line, "LOGON=SUCCESS") != NULL)
+			return (true);
+		if (strchr(line, '\n') != NULL)
+			return (false);
+		if (line_len + 1 >= sizeof (line))
+			return (false);
+	}
+	return (false);
+}
+
+static bool
+adv_connect(tls_conn_t *tc, adv_kind_t kind, int rcvbuf)
+{
+	adv_stat_add(&adv_stats[kind].conns, 1);
+	if (!tls_open(tc, rcvbuf)) {
+		tls_close(tc);
+		if (!adv_stop)
+			adv_stat_add(&adv_stats[kind].conn_fails, 1);
+		return (false);
+	}
+	return (true);
+}
+
+static bool
+adv_logon(tls_conn_t *tc, adv_kind_t kind, unsigned idx, size_t rec_sz)
+{
+	char from[16];
+
+	snprintf(from, sizeof (from), "X%c%04u", 'A' + kind, idx);
+	if (!tls_logon(tc, kind, from, rec_sz)) {
+		tls_close(tc);
+		if (!adv_stop)
+			adv_stat_add(&adv_stats[kind].conn_fails, 1);
+		return (false);
+	}
+	return (true);
+}
+
+/*
+ * Fires PINGs at the server without ever reading the replies. Our tiny
+ * receive buffer stops absorbing PONGs almost immediately, so they pile
+ * up on the server.
+ */
+static void
+slowread_run(unsigned idx)
+{
+	tls_conn_t tc;
+	char burst[64 * 24] = "";
+	size_t len = 0;
+	uint64_t start;
+
+	if (!adv_connect(&tc, ADV_SLOWREAD, SLOWREAD_RCVBUF))
+		return;
+	if (!adv_logon(&tc, ADV_SLOWREAD, idx, SIZE_MAX))
+		return;
+	for (unsigned min = 1; len + 24 < sizeof (burst); min++) {
+		len += snprintf(&burst[len], sizeof (burst) - len,
+		    "PKT=PING/MIN=%u\n", min);
+	}
+	start = now_us();
+	while (!adv_stop) {
+		if (!tls_send(&tc, ADV_SLOWREAD, burst, len, SIZE_MAX)) {
+			adv_closed(ADV_SLOWREAD, start);
+			break;
+		}
+		if (now_us() - start > CLOSE_TIMEOUT) {
+			adv_stat_add(&adv_stats[ADV_SLOWREAD].not_closed, 1);
+			break;
+		}
+		/* We're after the output backlog, not an input flood */
+		usleep(SLOWREAD_PAUSE);
+	}
+	tls_close(&tc);
+}
+
+/*
+ * Logs on and sends PINGs one byte at a time. The server should keep
+ * serving this client (it's slow, not broken), so this only measures
+ * what it costs everybody else.
+ */
+static void
+trickle_run(unsigned idx)
+{
+	tls_conn_t tc;
+	uint64_t end;
+
+	if (!adv_connect(&tc, ADV_TRICKLE, 0))
+		return;
+	if (!adv_logon(&tc, ADV_TRICKLE, idx, 1))
+		return;
+	end = now_us() + TRICKLE_LEN;
+	for (unsigned min = 1; !adv_stop && now_us() < end; min++) {
+		char line[32];
+		int l = snprintf(line, sizeof (line), "PKT=PING/MIN=%u\n",
+		    min);
+
+		for (int i = 0; i < l && !adv_stop; i++) {
+			if (!tls_send(&tc, ADV_TRICKLE, &line[i], 1, 1)) {
+				adv_stat_add(
+				    &adv_stats[ADV_TRICKLE].srv_closes, 1);
+				tls_close(&tc);
+				return;
+			}
+			usleep(trickle_delay);
+		}
+		/* Drain the PONGs, or else we become a slow reader */
+		while (gnutls_record_check_pending(tc.sess) != 0 ||
+		    poll(&(struct pollfd){ .fd = tc.fd, .events = POLLIN },
+		    1, 0) > 0) {
+			uint8_t buf[1024];
+
+			if (gnutls_record_recv(tc.sess, buf, sizeof (buf)) <= 0)
+				break;
+		}
+	}
+	tls_close(&tc);
+}
+
+/*
+ * Sends a line which can never fit, either before or after logging on,
+ * and times how long it takes the server to hang up.
+ */
+static void
+overflow_run(adv_kind_t kind, unsigned idx)
+{
+	tls_conn_t tc;
+	size_t len = (kind == ADV_OVERSIZE ? 2 * MAX_BUF_SZ :
+	    2 * MAX_BUF_SZ_NO_LOGON);
+	char *buf;
+	uint64_t start;
+
+	if (!adv_connect(&tc, kind, 0))
+		return;
+	if (kind == ADV_OVERSIZE && !adv_logon(&tc, kind, idx, SIZE_MAX))
+		return;
+	buf = safe_malloc(len);
+	memset(buf, 'A', len);
+	start = now_us();
+	/* The send can fail half-way, if the server is quick about it */
+	if (!tls_send(&tc, kind, buf, len, 1024) ||
+	    tls_wait_close(&tc, start + CLOSE_TIMEOUT)) {
+		adv_closed(kind, start);
+	} else if (!adv_stop) {
+		adv_stat_add(&adv_stats[kind].not_closed, 1);
+	}
+	free(buf);
+	tls_close(&tc);
+}
+
+static void
+storm_run(unsigned idx)
+{
+	tls_conn_t tc;
+
+	if (!adv_connect(&tc, ADV_STORM, 0))
+		return;
+	if (!adv_logon(&tc, ADV_STORM, idx, SIZE_MAX))
+		return;
+	tls_close(&tc);
+}
+
+/*
+ * Keeps adv_count[ADV_HALFOPEN] connections open at all times, none of
+ * which ever send more than the first few bytes of a TLS ClientHello.
+ */
+static void
+halfopen_run(void)
+{
+	static const uint8_t partial_hello[] = {
+	    0x16, 0x03, 0x01, 0x00, 0x40, 0x01, 0x00, 0x00, 0x3c
+	};
+	unsigned n = adv_count[ADV_HALFOPEN];
+	struct pollfd *pfds = safe_calloc(n, sizeof (*pfds));
+	uint64_t *opened = safe_calloc(n, sizeof (*opened));
+
+	for (unsigned i = 0; i < n; i++)
+		pfds[i].fd = -1;
+	while (!adv_stop) {
+		for (unsigned i = 0; i < n; i++) {
+			if (pfds[i].fd != -1)
+				continue;
+			adv_stat_add(&adv_stats[ADV_HALFOPEN].conns, 1);
+			pfds[i].fd = tcp_connect(0);
+			pfds[i].events = POLLIN;
+			opened[i] = now_us();
+			if (pfds[i].fd == -1) {
+				adv_stat_add(
+				    &adv_stats[ADV_HALFOPEN].conn_fails, 1);
+				break;
+			}
+			if (i % 2 == 0) {
+				(void) write(pfds[i].fd, partial_hello,
+				    sizeof (partial_hello));
+			}
+		}
+		if (poll(pfds, n, 100) <= 0)
+			continue;
+		for (unsigned i = 0; i < n; i++) {
+			uint8_t buf[256];
+
+			if (pfds[i].fd == -1 || pfds[i].revents == 0 ||
+			    read(pfds[i].fd, buf, sizeof (buf)) > 0)
+				continue;
+			adv_closed(ADV_HALFOPEN, opened[i]);
+			close(pfds[i].fd);
+			pfds[i].fd = -1;
+		}
+	}
+	for (unsigned i = 0; i < n; i++) {
+		if (pfds[i].fd != -1)
+			close(pfds[i].fd);
+	}
+	free(pfds);
+	free(opened);
+}
+
+static void
+adv_worker(void *userinfo)
+{
+	adv_thr_t *at = userinfo;
+
+	if (at->kind == ADV_HALFOPEN) {
+		halfopen_run();
+		return;
+	}
+	while (!adv_stop) {
+		switch (at->kind) {
+		case ADV_SLOWREAD:
+			slowread_run(at->idx);
+			break;
+		case ADV_TRICKLE:
+			trickle_run(at->idx);
+			break;
+		case ADV_OVERSIZE:
+		case ADV_PREFLOOD:
+			overflow_run(at->kind, at->idx);
+			break;
+		case ADV_STORM:
+			storm_run(at->idx);
+			break;
+		default:
+			VERIFY_MSG(0, "invalid adversary kind %d", at->kind);
+		}
+		/* Don't spin if the server is refusing us outright */
+		if (at->kind != ADV_STORM)
+			usleep(10000);
+	}
+}
+
+/*
+ * Parses an attack mix, such as "slowread=4,halfopen=200".
+ */
+static bool
+parse_mix(char *spec)
+{
+	memset(adv_count, 0, sizeof (adv_count));
+	for (char *tok = strtok(spec, ","); tok != NULL;
+	    tok = strtok(NULL, ",")) {
+		char *eq = strchr(tok, '=');
+		int kind;
+
+		if (eq == NULL)
+			return (false);
+		*eq = '\0';
+		for (kind = 0; kind < NUM_ADV_KINDS; kind++) {
+			if (strcmp(tok, adv_names[kind]) == 0)
+				break;
+		}
+		if (kind == NUM_ADV_KINDS)
+			return (false);
+		adv_count[kind] = atoi(eq + 1);
+	}
+	return (true);
+}
+
+static void
+msg_recv_cb(cpdlc_client_t *cl)
+{
+	UNUSED(cl);
+	mutex_enter(&wakeup_lock);
+	wakeup_pending = true;
+	cv_broadcast(&wakeup_cv);
+	mutex_exit(&wakeup_lock);
+}
+
+static void
+wait_wakeup(void)
+{
+	uint64_t deadline = now_us() + WAKEUP_INTVAL;
+
+	mutex_enter(&wakeup_lock);
+	while (!wakeup_pending) {
+		if (cv_timedwait(&wakeup_cv, &wakeup_lock, deadline) != 0)
+			break;
+	}
+	wakeup_pending = false;
+	mutex_exit(&wakeup_lock);
+}
+
+static void
+station_init(station_t *st, bool is_atc, unsigned idx)
+{
+	st->is_atc = is_atc;
+	snprintf(st->callsign, sizeof (st->callsign), "%s%04u",
+	    is_atc ? ATC_PREFIX : ACFT_PREFIX, idx);
+	st->cl = cpdlc_client_alloc(is_atc);
+	cpdlc_client_set_host(st->cl, host);
+	cpdlc_client_set_port(st->cl, port);
+	if (ca_file != NULL)
+		cpdlc_client_set_ca_file(st->cl, ca_file);
+	cpdlc_client_set_msg_recv_cb(st->cl, msg_recv_cb);
+	if (!is_atc)
+		st->atc_idx = idx % num_atc;
+	if (is_atc) {
+		cpdlc_client_logon(st->cl, ATC_PREFIX, st->callsign,
+		    st->callsign);
+	} else {
+		cpdlc_client_logon(st->cl, "ACFT", st->callsign,
+		    atc[st->atc_idx].callsign);
+	}
+}
+
+static void
+station_fini(station_t *st)
+{
+	cpdlc_client_logoff(st->cl);
+	cpdlc_client_free(st->cl);
+}
+
+/*
+ * Checks that a station is still logged on. Losing the logon once
+ * traffic is flowing is a failure, we don't try to recover from it.
+ */
+static bool
+station_check(station_t *st)
+{
+	bool logged_on = (cpdlc_client_get_logon_status(st->cl, NULL) ==
+	    CPDLC_LOGON_COMPLETE);
+
+	if (st->logged_on && !logged_on)
+		good_drops++;
+	st->logged_on = logged_on;
+	return (logged_on);
+}
+
+static void
+send_msg(station_t *from, const char *to, int msg_type, unsigned mrn,
+    bool has_mrn, int alt)
+{
+	cpdlc_msg_t *msg = cpdlc_msg_alloc(CPDLC_PKT_CPDLC);
+	int seg = cpdlc_msg_add_seg(msg, !from->is_atc, msg_type, 0);
+
+	if (msg_type != CPDLC_DM0_WILCO) {
+		bool fl = true;
+		cpdlc_msg_seg_set_arg(msg, seg, 0, &fl, &alt);
+	}
+	if (to != NULL)
+		cpdlc_msg_set_to(msg, to);
+	cpdlc_msg_set_min(msg, from->next_min);
+	if (has_mrn)
+		cpdlc_msg_set_mrn(msg, mrn);
+	if (cpdlc_client_send_msg(from->cl, msg) == CPDLC_INVALID_MSG_TOKEN)
+		errors++;
+	cpdlc_msg_free(msg);
+	from->next_min++;
+}
+
+static void
+acft_start_txn(station_t *ac)
+{
+	ac->txn_start = now_us();
+	ac->sent_min = ac->next_min;
+	ac->txn_state = TXN_REQ_SENT;
+	send_msg(ac, NULL, CPDLC_DM6_REQ_alt, 0, false,
+	    200 + (ac->txns_done % 20) * 10);
+}
+
+static station_t *
+find_acft(const char *callsign)
+{
+	unsigned idx;
+
+	if (strncmp(callsign, ACFT_PREFIX, strlen(ACFT_PREFIX)) != 0 ||
+	    sscanf(&callsign[strlen(ACFT_PREFIX)], "%u", &idx) != 1 ||
+	    idx >= num_acft) {
+		return (NULL);
+	}
+	return (&acft[idx]);
+}
+
+static int
+msg_type(const cpdlc_msg_t *msg)
+{
+	if (cpdlc_msg_get_num_segs(msg) == 0)
+		return (-1);
+	return (msg->segs[0].info->msg_type);
+}
+
+static void
+atc_handle_msg(station_t *st, const cpdlc_msg_t *msg)
+{
+	station_t *ac = find_acft(cpdlc_msg_get_from(msg));
+
+	if (ac == NULL || !cpdlc_msg_get_dl(msg) ||
+	    cpdlc_msg_get_min(msg) != ac->sent_min) {
+		errors++;
+		return;
+	}
+	if (ac->txn_state == TXN_REQ_SENT &&
+	    msg_type(msg) == CPDLC_DM6_REQ_alt) {
+		int alt = 0;
+		bool fl = false;
+
+		cpdlc_msg_seg_get_arg(msg, 0, 0, &fl, 0, &alt);
+		ac->sent_min = st->next_min;
+		ac->txn_state = TXN_CLR_SENT;
+		send_msg(st, ac->callsign, CPDLC_UM20_CLB_TO_alt,
+		    cpdlc_msg_get_min(msg), true, alt);
+	} else if (ac->txn_state == TXN_WILCO_SENT &&
+	    msg_type(msg) == CPDLC_DM0_WILCO) {
+		/* Transactions straddling the phase change count for both */
+		samples_add(&txn_lat[phase], now_us() - ac->txn_start);
+		txns[phase]++;
+		ac->txn_state = TXN_IDLE;
+		ac->txns_done++;
+		acft_start_txn(ac);
+	} else {
+		errors++;
+	}
+}
+
+static void
+acft_handle_msg(station_t *ac, const cpdlc_msg_t *msg)
+{
+	if (ac->txn_state == TXN_CLR_SENT && !cpdlc_msg_get_dl(msg) &&
+	    msg_type(msg) == CPDLC_UM20_CLB_TO_alt &&
+	    cpdlc_msg_get_min(msg) == ac->sent_min) {
+		ac->sent_min = ac->next_min;
+		ac->txn_state = TXN_WILCO_SENT;
+		send_msg(ac, NULL, CPDLC_DM0_WILCO, cpdlc_msg_get_min(msg),
+		    true, 0);
+	} else {
+		errors++;
+	}
+}
+
+static void
+drain_station(station_t *st)
+{
+	cpdlc_msg_t *msg;
+
+	while ((msg = cpdlc_client_recv_msg(st->cl)) != NULL) {
+		if (st->is_atc)
+			atc_handle_msg(st, msg);
+		else
+			acft_handle_msg(st, msg);
+		cpdlc_msg_free(msg);
+	}
+}
+
+/*
+ * Runs the well-behaved clients' traffic for the given time.
+ */
+static void
+run_traffic(uint64_t duration)
+{
+	uint64_t end = now_us() + duration;
+
+	while (now_us() < end) {
+		wait_wakeup();
+		for (unsigned i = 0; i < num_atc; i++) {
+			if (station_check(&atc[i]))
+				drain_station(&atc[i]);
+		}
+		for (unsigned i = 0; i < num_acft; i++) {
+			if (station_check(&acft[i]))
+				drain_station(&acft[i]);
+		}
+	}
+}
+
+static void
+print_phase(const char *name, int p, double secs, const proc_stats_t *ps0,
+    const proc_stats_t *ps1)
+{
+	printf(" \"%s\": {\"time_s\": %.1f, \"txns\": %llu, "
+	    "\"txns_per_s\": %.1f, ", name, secs, (unsigned long long)txns[p],
+	    txns[p] / secs);
+	samples_print_json(stdout, "txn_latency_us", &txn_lat[p]);
+	if (ps0->valid && ps1->valid) {
+		printf(",\n    \"server\": {\"cpu_pct\": %.1f, "
+		    "\"rss_kb\": %lu, \"num_fds\": %u}",
+		    100 * (ps1->cpu_s - ps0->cpu_s) / secs,
+		    ps1->rss_kb, ps1->num_fds);
+	}
+	printf("},\n");
+}
+
+static void
+print_usage(const char *progname, FILE *fp)
+{
+	fprintf(fp, "Usage: %s [-h] [-s <host>] [-p <port>] [-c <cafile>] "
+	    "[-n <aircraft>] [-m <atc>]\n"
+	    "    [-b <baseline>] [-d <duration>] [-a <mix>] [-y <delay>] "
+	    "[-L <ratio>]\n"
+	    "    [-l <slack>] [-T <ratio>] [-P <server_pid>]\n"
+	    "\n"
+	    "  -s <host>       cpdlcd hostname (default: %s)\n"
+	    "  -p <port>       cpdlcd port (default: %u)\n"
+	    "  -c <cafile>     CA certificate file for server validation\n"
+	    "  -n <aircraft>   well-behaved aircraft (default: %u)\n"
+	    "  -m <atc>        well-behaved ATC stations (default: %u)\n"
+	    "  -b <baseline>   baseline phase length in seconds "
+	    "(default: 20)\n"
+	    "  -d <duration>   attack phase length in seconds "
+	    "(default: 60)\n"
+	    "  -a <mix>        attack mix as kind=count,... where kind is one "
+	    "of slowread,\n"
+	    "                  trickle, oversize, preflood, halfopen and "
+	    "storm\n"
+	    "                  (default: slowread=%u,trickle=%u,oversize=%u,"
+	    "preflood=%u,\n"
+	    "                  halfopen=%u,storm=%u)\n"
+	    "  -y <delay>      trickle delay between bytes in ms "
+	    "(default: %llu)\n"
+	    "  -L <ratio>      max attack/baseline p99 latency ratio "
+	    "(default: 2.0)\n"
+	    "  -l <slack>      latency increase in ms which is always "
+	    "acceptable (default: 50)\n"
+	    "  -T <ratio>      min attack/baseline throughput ratio "
+	    "(default: 0.8)\n"
+	    "  -P <pid>        cpdlcd process ID for CPU/RSS sampling\n",
+	    progname, host, port, num_acft, num_atc,
+	    adv_count[ADV_SLOWREAD], adv_count[ADV_TRICKLE],
+	    adv_count[ADV_OVERSIZE], adv_count[ADV_PREFLOOD],
+	    adv_count[ADV_HALFOPEN], adv_count[ADV_STORM],
+	    (unsigned long long)(trickle_delay / 1000));
+}
+
+int
+main(int argc, char *argv[])
+{
+	int opt, srv_pid = 0, err;
+	uint64_t baseline = 20, duration = 60, deadline;
+	double lat_ratio = 2.0, lat_slack = 50, tput_ratio = 0.8;
+	double base_s, attack_s, base_tput, attack_tput;
+	uint64_t base_p99, attack_p99, lat_limit, t0, t1, t2;
+	proc_stats_t ps0, ps1, ps2;
+	adv_thr_t *advs = NULL;
+	unsigned num_advs = 0, logged_on = 0;
+	struct addrinfo hints = {
+	    .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM
+	};
+	char portbuf[8];
+	bool lat_ok, tput_ok, ok;
+
+	while ((opt = getopt(argc, argv, "hs:p:c:n:m:b:d:a:y:L:l:T:P:")) !=
+	    -1) {
+		switch (opt) {
+		case 'h':
+			print_usage(argv[0], stdout);
+			return (0);
+		case 's':
+			host = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'c':
+			ca_file = optarg;
+			break;
+		case 'n':
+			num_acft = atoi(optarg);
+			break;
+		case 'm':
+			num_atc = atoi(optarg);
+			break;
+		case 'b':
+			baseline = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'a':
+			if (!parse_mix(optarg)) {
+				fprintf(stderr, "Invalid attack mix\n");
+				return (1);
+			}
+			break;
+		case 'y':
+			trickle_delay = atof(optarg) * 1000;
+			break;
+		case 'L':
+			lat_ratio = atof(optarg);
+			break;
+		case 'l':
+			lat_slack = atof(optarg);
+			break;
+		case 'T':
+			tput_ratio = atof(optarg);
+			break;
+		case 'P':
+			srv_pid = atoi(optarg);
+			break;
+		default:
+			print_usage(argv[0], stderr);
+			return (1);
+		}
+	}
+	if (num_acft == 0 || num_atc == 0 || baseline == 0 || duration == 0) {
+		fprintf(stderr, "Need at least one aircraft and one ATC "
+		    "station, and non-zero phase lengths\n");
+		return (1);
+	}
+	snprintf(portbuf, sizeof (portbuf), "%u", port);
+	if ((err = getaddrinfo(host, portbuf, &hints, &srv_ai)) != 0) {
+		fprintf(stderr, "Can't resolve %s: %s\n", host,
+		    gai_strerror(err));
+		return (1);
+	}
+	VERIFY0(gnutls_global_init());
+	VERIFY0(gnutls_certificate_allocate_credentials(&xcred));
+	if (ca_file != NULL) {
+		if (gnutls_certificate_set_x509_trust_file(xcred, ca_file,
+		    GNUTLS_X509_FMT_PEM) < 0) {
+			fprintf(stderr, "Can't load CA file %s\n", ca_file);
+			return (1);
+		}
+	} else {
+		VERIFY3S(gnutls_certificate_set_x509_system_trust(xcred), >=,
+		    0);
+	}
+	mutex_init(&wakeup_lock);
+	cv_init(&wakeup_cv);
+	mutex_init(&adv_lock);
+
+	atc = safe_calloc(num_atc, sizeof (*atc));
+	acft = safe_calloc(num_acft, sizeof (*acft));
+	for (unsigned i = 0; i < num_atc; i++)
+		station_init(&atc[i], true, i);
+	for (unsigned i = 0; i < num_acft; i++)
+		station_init(&acft[i], false, i);
+	deadline = now_us() + LOGON_TIMEOUT;
+	while (logged_on < num_atc + num_acft) {
+		if (now_us() > deadline) {
+			fprintf(stderr, "Only %u of %u stations logged on\n",
+			    logged_on, num_atc + num_acft);
+			return (1);
+		}
+		usleep(WAKEUP_INTVAL);
+		logged_on = 0;
+		for (unsigned i = 0; i < num_atc; i++)
+			logged_on += station_check(&atc[i]);
+		for (unsigned i = 0; i < num_acft; i++)
+			logged_on += station_check(&acft[i]);
+	}
+
+	/*
+	 * Phase 1: baseline.
+	 */
+	for (unsigned i = 0; i < num_acft; i++)
+		acft_start_txn(&acft[i]);
+	proc_stats_get(srv_pid, &ps0);
+	t0 = now_us();
+	run_traffic(baseline * 1000000llu);
+
+	/*
+	 * Phase 2: the same traffic, under attack.
+	 */
+	for (int kind = 0; kind < NUM_ADV_KINDS; kind++) {
+		unsigned n = (kind == ADV_HALFOPEN ? !!adv_count[kind] :
+		    adv_count[kind]);
+
+		for (unsigned i = 0; i < n; i++) {
+			advs = safe_realloc(advs, (num_advs + 1) *
+			    sizeof (*advs));
+			advs[num_advs].kind = kind;
+			advs[num_advs].idx = i;
+			num_advs++;
+		}
+	}
+	for (unsigned i = 0; i < num_advs; i++)
+		VERIFY(thread_create(&advs[i].thr, adv_worker, &advs[i]));
+	proc_stats_get(srv_pid, &ps1);
+	t1 = now_us();
+	phase = 1;
+	run_traffic(duration * 1000000llu);
+	proc_stats_get(srv_pid, &ps2);
+	t2 = now_us();
+	adv_stop = true;
+	for (unsigned i = 0; i < num_advs; i++)
+		thread_join(&advs[i].thr);
+
+	base_s = (t1 - t0) / 1e6;
+	attack_s = (t2 - t1) / 1e6;
+	base_tput = txns[0] / base_s;
+	attack_tput = txns[1] / attack_s;
+	base_p99 = samples_pct(&txn_lat[0], 99);
+	attack_p99 = samples_pct(&txn_lat[1], 99);
+	lat_limit = MAX(base_p99 * lat_ratio, base_p99 + lat_slack * 1000);
+	lat_ok = (txns[1] != 0 && attack_p99 <= lat_limit);
+	tput_ok = (txns[0] != 0 && attack_tput >= base_tput * tput_ratio);
+	ok = (lat_ok && tput_ok && good_drops == 0 && errors == 0);
+
+	printf("{\"aircraft\": %u, \"atc\": %u, \"pass\": %s,\n", num_acft,
+	    num_atc, ok ? "true" : "false");
+	print_phase("baseline", 0, base_s, &ps0, &ps1);
+	print_phase("attack", 1, attack_s, &ps1, &ps2);
+	printf(" \"targets\": {\"p99_limit_us\": %llu, \"latency_ok\": %s, "
+	    "\"min_txns_per_s\": %.1f, \"throughput_ok\": %s, "
+	    "\"good_drops\": %llu, \"errors\": %llu},\n",
+	    (unsigned long long)lat_limit, lat_ok ? "true" : "false",
+	    base_tput * tput_ratio, tput_ok ? "true" : "false",
+	    (unsigned long long)good_drops, (unsigned long long)errors);
+	printf(" \"adversaries\": {");
+	for (int kind = 0, first = 1; kind < NUM_ADV_KINDS; kind++) {
+		adv_stats_t *as = &adv_stats[kind];
+
+		if (adv_count[kind] == 0)
+			continue;
+		printf("%s\n  \"%s\": {\"count\": %u, \"conns\": %llu, "
+		    "\"conn_fails\": %llu, \"srv_closes\": %llu, "
+		    "\"not_closed\": %llu, \"bytes_sent\": %llu,\n    ",
+		    first ? "" : ",", adv_names[kind], adv_count[kind],
+		    (unsigned long long)as->conns,
+		    (unsigned long long)as->conn_fails,
+		    (unsigned long long)as->srv_closes,
+		    (unsigned long long)as->not_closed,
+		    (unsigned long long)as->bytes_sent);
+		samples_print_json(stdout, "close_latency_us", &as->close_lat);
+		printf("}");
+		first = 0;
+	}
+	printf("}\n}\n");
+
+	for (unsigned i = 0; i < num_acft; i++)
+		station_fini(&acft[i]);
+	for (unsigned i = 0; i < num_atc; i++)
+		station_fini(&atc[i]);
+	free(acft);
+	free(atc);
+	free(advs);
+	for (int i = 0; i < 2; i++)
+		samples_free(&txn_lat[i]);
+	for (int kind = 0; kind < NUM_ADV_KINDS; kind++)
+		samples_free(&adv_stats[kind].close_lat);
+	gnutls_certificate_free_credentials(xcred);
+	gnutls_global_deinit();
+	freeaddrinfo(srv_ai);
+	mutex_destroy(&adv_lock);
+	cv_destroy(&wakeup_cv);
+	mutex_destroy(&wakeup_lock);
+
+	return (ok ? 0 : 1);
+}
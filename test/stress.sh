@@ -0,0 +1,75 @@
+#!/bin/bash
+#
+# Copyright 2019 Saso Kiselkov
+#
+# Permission is hereby granted, free of charge, to any person
+# obtaining a copy of this software and associated documentation
+# files (the "Software"), to deal in the Software without
+# restriction, including without limitation the rights to use,
+# copy, modify, merge, publish, distribute, sublicense, and/or
+# sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following
+# conditions:
+#
+# The above copyright notice and this permission notice shall be
+# included in all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+# OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+# HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+# WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+
+# Runs the adversarial client stress test on loopback, against a private
+# cpdlcd instance and the mock authenticator (see srv_env.sh). The JSON
+# results go to stdout, the exit code is non-zero if the well-behaved
+# clients missed their latency or throughput targets while under attack.
+
+source "$(dirname "$0")/srv_env.sh"
+
+STRESS="${STRESS:-$TESTDIR/stress}"
+
+PORT=17694
+AUTH_PORT=17695
+
+function usage() {
+	echo "Usage: $0 [-h] [-p <port>] [-- <stress args>]"
+	echo "  -p <port>    cpdlcd port (default: $PORT, auth uses port + 1)"
+	echo "Arguments after -- are passed to stress, e.g." \
+	    "-d 300 -a slowread=8,halfopen=1000."
+}
+
+while getopts "hp:" opt; do
+	case "$opt" in
+	h)
+		usage
+		exit 0
+		;;
+	p)
+		PORT="$OPTARG"
+		AUTH_PORT=$(( PORT + 1 ))
+		;;
+	*)
+		usage >&2
+		exit 1
+		;;
+	esac
+done
+shift $(( OPTIND - 1 ))
+
+srv_env_check_progs "$STRESS" || exit 1
+srv_env_init || exit 1
+srv_start_auth "$AUTH_PORT" || exit 1
+srv_start_cpdlcd "$PORT" "$AUTH_PORT" || exit 1
+
+"$STRESS" -s localhost -p "$PORT" -c "$WORKDIR/ca_cert.pem" -P "$SRV_PID" \
+    "$@"
+RESULT=$?
+if [ $RESULT -ne 0 ]; then
+	echo "stress failed, last lines of the cpdlcd log follow:" >&2
+	tail -n 50 "$SRV_LOG" >&2
+fi
+exit $RESULT